@@ -0,0 +1,105 @@
+#version 410 core
+
+layout(location = 0) in vec2 in_texCoords;
+layout (location = 1) in vec3 in_vertexPos;
+layout (location = 0) out vec4 out_color;
+
+float calcAttenuation(vec3 in_lightPos, vec3 in_surfacePos, vec4 in_lightFalloff);
+float calcSpotAttenuation(vec3 in_lightPos, vec3 in_surfacePos, vec2 in_lightConeAngle, vec3 in_lightDirection);
+vec3 cookTorranceSpecular(vec3 lightDirection, vec3 viewDirection, vec3 surfaceNormal, float roughness, vec3 F0);
+
+uniform sampler2D uniform_textureA;
+uniform sampler2D uniform_textureB;
+uniform sampler2D uniform_textureC;
+uniform sampler2D uniform_textureDepth;//D
+
+layout(std140) uniform FrameBlock
+{
+  mat4 viewMatrix;
+  mat4 projMatrix;
+  mat4 invViewMatrix;
+  mat4 invProjMatrix;
+  vec4 projConst;
+  vec4 cameraPosition;
+} frame;
+
+// See kit::LightGrid for the layout of these
+uniform samplerBuffer uniform_lightData;
+uniform usamplerBuffer uniform_clusterData;
+uniform usamplerBuffer uniform_lightIndices;
+uniform vec3 uniform_gridSize;
+uniform vec2 uniform_depthSlicing;
+
+void main()
+{
+  float depth = texture(uniform_textureDepth, in_texCoords).r;//D
+
+  if(depth == 1.0)
+  {
+    discard;
+  }
+
+  // Depthextracted position
+  vec3 viewRay = in_vertexPos;//D
+  float linearDepth = frame.projConst.x / (frame.projConst.y - depth);//D
+  vec3 position = viewRay * linearDepth;//D
+
+  // Find the cluster of this fragment
+  ivec3 gridSize = ivec3(uniform_gridSize);
+  ivec3 cluster;
+  cluster.xy = clamp(ivec2(gl_FragCoord.xy / vec2(textureSize(uniform_textureA, 0)) * uniform_gridSize.xy), ivec2(0), gridSize.xy - 1);
+  cluster.z = clamp(int(log(-position.z) * uniform_depthSlicing.x + uniform_depthSlicing.y), 0, gridSize.z - 1);
+  uvec2 lightRange = texelFetch(uniform_clusterData, (cluster.z * gridSize.y + cluster.y) * gridSize.x + cluster.x).rg;
+
+  if(lightRange.y == 0u)
+  {
+    discard;
+  }
+
+  vec4 texValueA = texture(uniform_textureA, in_texCoords).rgba;
+  vec4 texValueB = texture(uniform_textureB, in_texCoords).rgba;
+  vec4 texValueC = texture(uniform_textureC, in_texCoords).rgba;
+
+  vec3 albedo = texValueA.xyz;
+  float roughness = clamp(texValueA.a, 0.0001, 1.0);
+  float metalness = texValueB.a;
+  vec3 normal = normalize(texValueC.xyz);
+
+  vec3 viewDir = normalize( -position );
+
+  float ior = 1.3;
+  vec3 F0 = vec3(abs ((1.0 - ior) / (1.0 + ior)));
+  F0 = F0 * F0;
+  F0 = mix(F0, albedo, metalness);
+
+  vec3 result = vec3(0.0);
+  for(uint i = 0u; i < lightRange.y; i++)
+  {
+    int lightOffset = int(texelFetch(uniform_lightIndices, int(lightRange.x + i)).r) * 4;
+    vec4 lightPosition = texelFetch(uniform_lightData, lightOffset);
+    vec4 lightColor = texelFetch(uniform_lightData, lightOffset + 1);
+    vec4 lightFalloff = texelFetch(uniform_lightData, lightOffset + 2);
+    vec4 lightDirection = texelFetch(uniform_lightData, lightOffset + 3);
+
+    float atten = calcAttenuation(lightPosition.xyz, position, lightFalloff);
+    if(lightPosition.w > 0.5)
+    {
+      atten *= calcSpotAttenuation(lightPosition.xyz, position, vec2(lightDirection.w, lightColor.w), lightDirection.xyz);
+    }
+
+    if(atten <= 0.0)
+    {
+      continue;
+    }
+
+    vec3 lightDir = normalize(lightPosition.xyz - position);
+    float diffuse = max(0.0, dot(normal, lightDir));
+    vec3 lightDiffuse = lightColor.rgb * albedo * diffuse * (1.0 - metalness);
+    vec3 specular = cookTorranceSpecular(lightDir, viewDir, normal, roughness, F0);
+    vec3 lightSpecular = lightColor.rgb * specular;
+
+    result += (lightDiffuse + lightSpecular) * atten;
+  }
+
+  out_color = vec4(result, 1.0);
+}
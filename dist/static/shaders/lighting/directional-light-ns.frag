@@ -12,7 +12,15 @@ uniform sampler2D uniform_textureB;
 uniform sampler2D uniform_textureC;
 uniform sampler2D uniform_textureDepth;//D
 
-uniform vec2 uniform_projConst; //D
+layout(std140) uniform FrameBlock
+{
+  mat4 viewMatrix;
+  mat4 projMatrix;
+  mat4 invViewMatrix;
+  mat4 invProjMatrix;
+  vec4 projConst;
+  vec4 cameraPosition;
+} frame;
 
 uniform vec3 uniform_lightDir;
 uniform vec3 uniform_lightColor;
@@ -40,7 +48,7 @@ void main()
 
   // Depthextracted position
   vec3 viewRay = in_vertexPos;//D
-  float linearDepth = uniform_projConst.x / (uniform_projConst.y - depth);//D
+  float linearDepth = frame.projConst.x / (frame.projConst.y - depth);//D
   vec3 position = viewRay * linearDepth;//D
 
   vec3 viewDir = normalize( -position );
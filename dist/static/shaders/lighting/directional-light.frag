@@ -12,7 +12,15 @@ uniform sampler2D uniform_textureB;
 uniform sampler2D uniform_textureC;
 uniform sampler2D uniform_textureDepth;//D
 
-uniform vec2 uniform_projConst; //D
+layout(std140) uniform FrameBlock
+{
+  mat4 viewMatrix;
+  mat4 projMatrix;
+  mat4 invViewMatrix;
+  mat4 invProjMatrix;
+  vec4 projConst;
+  vec4 cameraPosition;
+} frame;
 
 uniform vec3 uniform_lightDir;
 uniform vec3 uniform_lightColor;
@@ -20,8 +28,9 @@ uniform vec3 uniform_lightColor;
 // shadowsampler
 uniform sampler2DShadow uniform_shadowmap;
 
-uniform mat4 uniform_lightViewProjMatrix;
-uniform mat4 uniform_invViewMatrix;
+// Cascades are laid out side by side in the shadowmap
+uniform mat4 uniform_cascadeMatrices[4];
+uniform int uniform_cascadeCount;
 
 const int SHADOWSAMPLES = 9;
 vec2 sampleOffsets[SHADOWSAMPLES] = vec2[]
@@ -36,39 +45,50 @@ float calcShadow(vec3 viewPosition)
   float returner = 0.0;
   
   // Get the current fragment position in world-space
-  vec4 worldPosition = uniform_invViewMatrix * vec4(viewPosition, 1); 
-  
-  // Multiply this position by the VPMatrix used by the shadow-map-rendering. Also, normalize the perspective by dividing by w
-  vec4 lightPosition = uniform_lightViewProjMatrix * worldPosition; 
-  lightPosition /= lightPosition.w;
+  vec4 worldPosition = frame.invViewMatrix * vec4(viewPosition, 1); 
   
-  // Convert these coordinates from (-1 to 1) range to  (0 to 1) range
-  vec2 shadowUV = lightPosition.xy * vec2(0.5) + vec2(0.5);
-
-  // Use the (biased) z coordinate as the comparative depth to pass to the texture sampling function.
-  const float bias = 0.005;
-  float depthComp = (lightPosition.z * 0.5 + 0.5) - bias;
-  
-  // If the shadow UV is out of bounds, return 1.0. Needed for directional lights
-  if(shadowUV.x < 0 || shadowUV.y < 0 ||shadowUV.x > 1 ||shadowUV.y > 1)
-  {
-    return 1.0;
-  }
-
   // Prepare sampling
   ivec2 shadowSize = textureSize(uniform_shadowmap, 0);
   vec2 shadowFragSize = vec2(1.0) / vec2(shadowSize.x, shadowSize.y);
-
-  // 9-tap shadow sampling
-  for(int i = 0; i < SHADOWSAMPLES; i++)
+  vec2 cascadeMargin = shadowFragSize * vec2(uniform_cascadeCount, 1.0) * 1.5;
+  
+  // Use the first cascade that contains the fragment, with room for the filter taps. Cascades that were
+  // updated in an earlier frame may not line up with the view, so this is tested rather than derived from the depth
+  for(int c = 0; c < uniform_cascadeCount; c++)
   {
-    vec2 offsetUV = shadowUV + (sampleOffsets[i] * shadowFragSize);
-    float shadowDepth = texture(uniform_shadowmap, vec3(offsetUV.x, offsetUV.y, depthComp));
-    returner += shadowDepth;
+    // Multiply this position by the VPMatrix used by the shadow-map-rendering. Also, normalize the perspective by dividing by w
+    vec4 lightPosition = uniform_cascadeMatrices[c] * worldPosition; 
+    lightPosition /= lightPosition.w;
+    
+    // Convert these coordinates from (-1 to 1) range to  (0 to 1) range
+    vec2 shadowUV = lightPosition.xy * vec2(0.5) + vec2(0.5);
+    
+    if(any(lessThan(shadowUV, cascadeMargin)) || any(greaterThan(shadowUV, vec2(1.0) - cascadeMargin)) || abs(lightPosition.z) > 1.0)
+    {
+      continue;
+    }
+    
+    // Use the (biased) z coordinate as the comparative depth to pass to the texture sampling function.
+    const float bias = 0.005;
+    float depthComp = (lightPosition.z * 0.5 + 0.5) - bias;
+    
+    // Move into the cascade's part of the shadowmap
+    shadowUV.x = (shadowUV.x + float(c)) / float(uniform_cascadeCount);
+    
+    // 9-tap shadow sampling
+    for(int i = 0; i < SHADOWSAMPLES; i++)
+    {
+      vec2 offsetUV = shadowUV + (sampleOffsets[i] * shadowFragSize);
+      float shadowDepth = texture(uniform_shadowmap, vec3(offsetUV.x, offsetUV.y, depthComp));
+      returner += shadowDepth;
+    }
+    returner /= float(SHADOWSAMPLES);
+    
+    return returner;
   }
-  returner /= float(SHADOWSAMPLES);
   
-  return returner;
+  // Outside the shadow distance
+  return 1.0;
 }
 
 
@@ -94,7 +114,7 @@ void main()
   
   // Depthextracted position
   vec3 viewRay = in_vertexPos;//D
-  float linearDepth = uniform_projConst.x / (uniform_projConst.y - depth);//D
+  float linearDepth = frame.projConst.x / (frame.projConst.y - depth);//D
   vec3 position = viewRay * linearDepth;//D
   
   vec3 viewDir = normalize( -position );
@@ -8,7 +8,15 @@ layout (location = 1) out vec3 out_viewRay; //D
 uniform vec2 uniform_position;
 uniform vec2 uniform_size;
 
-uniform mat4 uniform_invProjMatrix;
+layout(std140) uniform FrameBlock
+{
+  mat4 viewMatrix;
+  mat4 projMatrix;
+  mat4 invViewMatrix;
+  mat4 invProjMatrix;
+  vec4 projConst;
+  vec4 cameraPosition;
+} frame;
 
 void main()
 {
@@ -19,6 +27,6 @@ void main()
   gl_Position.x -= 1.0;
   out_uv = in_uv;
   
-  vec3 viewPosition = (uniform_invProjMatrix * vec4(gl_Position.xy, 1.0, 1.0)).xyz;//D
+  vec3 viewPosition = (frame.invProjMatrix * vec4(gl_Position.xy, 1.0, 1.0)).xyz;//D
   out_viewRay = vec3(viewPosition.xy / viewPosition.z, 1.0);//D
 }
\ No newline at end of file
@@ -9,14 +9,21 @@ uniform sampler2D uniform_textureB;
 uniform sampler2D uniform_textureC;
 
 uniform sampler2D uniform_textureDepth;//D
-uniform vec2 uniform_projConst; //D
+layout(std140) uniform FrameBlock
+{
+  mat4 viewMatrix;
+  mat4 projMatrix;
+  mat4 invViewMatrix;
+  mat4 invProjMatrix;
+  vec4 projConst;
+  vec4 cameraPosition;
+} frame;
 
 uniform vec3 uniform_lightColor;
 uniform samplerCube uniform_lightIrradiance;
 uniform samplerCube uniform_lightRadiance;
 
 uniform sampler2D uniform_brdf;
-uniform mat4 uniform_invViewMatrix;
 
 vec3 decodeNormal (vec2 enc);
 
@@ -45,13 +52,13 @@ void main()
 
   // Depthextracted position
   vec3 viewRay = in_vertexPos;//D
-  float linearDepth = uniform_projConst.x / (uniform_projConst.y - depth);//D
+  float linearDepth = frame.projConst.x / (frame.projConst.y - depth);//D
   vec3 position = viewRay * linearDepth;//D
   
   vec3 viewDir = normalize( - position );
 
-  vec4 rotatedNormal = uniform_invViewMatrix * vec4(normal.xyz, 0.0);
-  vec4 rotatedViewDir = uniform_invViewMatrix * vec4(viewDir, 0.0);
+  vec4 rotatedNormal = frame.invViewMatrix * vec4(normal.xyz, 0.0);
+  vec4 rotatedViewDir = frame.invViewMatrix * vec4(viewDir, 0.0);
   vec3 refVec = normalize(reflect(-rotatedViewDir.xyz, rotatedNormal.xyz));
   float ndotv =  clamp(dot(rotatedNormal.xyz, rotatedViewDir.xyz), 0.0, 1.0);
   float ior = 1.333; // Water
@@ -3,7 +3,6 @@
 layout (location = 0) in vec3 in_vertexPos;
 layout (location = 0) out vec4 out_color;
 
-vec3 decodeNormal (vec2 enc);
 float calcAttenuation(vec3 in_lightPos, vec3 in_surfacePos, vec4 in_lightFalloff);
 vec3 cookTorranceSpecular(vec3 lightDirection, vec3 viewDirection, vec3 surfaceNormal, float roughness, vec3 F0);
 
@@ -15,59 +14,120 @@ uniform sampler2D uniform_textureDepth;//D
 uniform vec3 uniform_lightPosition;
 uniform vec3 uniform_lightColor;
 uniform vec4 uniform_lightFalloff;
-uniform float uniform_lightRadius;
-uniform samplerCube uniform_shadowmap;
-uniform mat4 uniform_invViewMatrix;
 
-uniform vec2 uniform_projConst; //D
+layout(std140) uniform FrameBlock
+{
+  mat4 viewMatrix;
+  mat4 projMatrix;
+  mat4 invViewMatrix;
+  mat4 invProjMatrix;
+  vec4 projConst;
+  vec4 cameraPosition;
+} frame;
+
+// The shadow atlas, and one tile per cube face (offset in xy, size in zw), in kit::Cubemap::Side order
+uniform sampler2DShadow uniform_shadowmap;
+uniform mat4 uniform_faceMatrices[6];
+uniform vec4 uniform_faceRects[6];
+uniform vec3 uniform_lightPositionWorld;
+
+const int SHADOWSAMPLES = 9;
+vec2 sampleOffsets[SHADOWSAMPLES] = vec2[]
+(
+   vec2(-1.0, -1.0), vec2(0.0, -1.0), vec2(1.0, -1.0),
+   vec2(-1.0, 0.0), vec2(0.0, 0.0), vec2(1.0, 0.0),
+   vec2(-1.0, 1.0), vec2(0.0, 1.0), vec2(1.0, 1.0)
+);
 
-float calcShadow(vec3 fragPos)
+float calcShadow(vec3 viewPosition)
 {
-    vec4 lp = uniform_invViewMatrix * vec4(uniform_lightPosition, 1.0);
-    vec4 p = uniform_invViewMatrix * vec4(fragPos, 1.0);
-    vec3 fragToLight = p.xyz - lp.xyz;
-    float closestDepth = texture(uniform_shadowmap, fragToLight).r;
-    closestDepth *= uniform_lightRadius;
-    float currentDepth = length(fragToLight);
-    float bias = 0.0001;
-    float shadow = currentDepth -  bias > closestDepth ? 0.0 : 1.0;
-
-    return shadow;
+  float returner = 0.0;
+
+  // Get the current fragment position in world-space
+  vec4 worldPosition = frame.invViewMatrix * vec4(viewPosition, 1);
+
+  // The face is picked by the major axis of the direction from the light
+  vec3 lightToFragment = worldPosition.xyz - uniform_lightPositionWorld;
+  vec3 absolute = abs(lightToFragment);
+  int face;
+  if(absolute.x >= absolute.y && absolute.x >= absolute.z)
+  {
+    face = lightToFragment.x > 0.0 ? 0 : 1;
+  }
+  else if(absolute.y >= absolute.z)
+  {
+    face = lightToFragment.y > 0.0 ? 2 : 3;
+  }
+  else
+  {
+    face = lightToFragment.z > 0.0 ? 4 : 5;
+  }
+
+  // Multiply this position by the VPMatrix of the face. Also, normalize the perspective by dividing by w
+  vec4 lightPosition = uniform_faceMatrices[face] * worldPosition;
+  lightPosition /= lightPosition.w;
+
+  // Convert these coordinates from (-1 to 1) range to  (0 to 1) range
+  vec2 shadowUV = lightPosition.xy * vec2(0.5) + vec2(0.5);
+
+  // Use the (biased) z coordinate as the comparative depth to pass to the texture sampling function.
+  const float bias = 0.0001;
+  float depthComp = (lightPosition.z * 0.5 + 0.5) - bias;
+
+  // Prepare sampling
+  ivec2 shadowSize = textureSize(uniform_shadowmap, 0);
+  vec2 shadowFragSize = vec2(1.0) / vec2(shadowSize.x, shadowSize.y);
+  vec4 shadowRect = uniform_faceRects[face];
+
+  // Keep the filter taps inside the tile, and move into the atlas
+  vec2 tileMargin = (shadowFragSize * 1.5) / shadowRect.zw;
+  shadowUV = shadowRect.xy + clamp(shadowUV, tileMargin, vec2(1.0) - tileMargin) * shadowRect.zw;
+
+  // 9-tap shadow sampling
+  for(int i = 0; i < SHADOWSAMPLES; i++)
+  {
+    vec2 offsetUV = shadowUV + (sampleOffsets[i] * shadowFragSize);
+    float shadowDepth = texture(uniform_shadowmap, vec3(offsetUV.x, offsetUV.y, depthComp));
+    returner += shadowDepth;
+  }
+  returner /= float(SHADOWSAMPLES);
+
+  return returner;
 }
 
 void main()
 {
   vec2 texCoord = gl_FragCoord.xy / textureSize(uniform_textureA, 0);
-  
+
   float depth = texture(uniform_textureDepth, texCoord).r;//D
-  
+
   if(depth == 1.0)
   {
     discard;
   }
-  
+
+  // Depthextracted position
+  vec3 viewRay = vec3(in_vertexPos.xy / in_vertexPos.z, 1.0);//D
+  float linearDepth = frame.projConst.x / (frame.projConst.y - depth);//D
+  vec3 position = viewRay * linearDepth;//D
+
+  float atten = calcAttenuation(uniform_lightPosition, position, uniform_lightFalloff);
+  if(atten <= 0.0)
+  {
+    discard;
+  }
+
   vec4 texValueA = texture(uniform_textureA, texCoord).rgba;
   vec4 texValueB = texture(uniform_textureB, texCoord).rgba;
   vec4 texValueC = texture(uniform_textureC, texCoord).rgba;
 
   vec3 albedo = texValueA.xyz;
   float roughness = clamp(texValueA.a, 0.0001, 1.0);
-  vec3 emissive = texValueB.rgb;
   float metalness = texValueB.a;
   vec3 normal = normalize(texValueC.xyz);
-  float occlusion = texValueC.a;
-  
-  // Hardcoded position
-  //vec3 position = texValueD.xyz;
-  
-  // Depthextracted position
-  vec3 viewRay = vec3(in_vertexPos.xy / in_vertexPos.z, 1.0);//D
-  float linearDepth = uniform_projConst.x / (uniform_projConst.y - depth);//D
-  vec3 position = viewRay * linearDepth;//D
 
   vec3 viewDir = normalize( -position );
   vec3 lightDir = normalize(uniform_lightPosition - position);
-  float atten =  calcAttenuation(uniform_lightPosition, position, uniform_lightFalloff);
 
   float diffuse = max(0.0, dot(normal, lightDir));
   vec3 lightDiffuse = (uniform_lightColor) * albedo * diffuse * (1.0 - metalness);
@@ -80,4 +140,4 @@ void main()
   vec3 lightSpecular =  (uniform_lightColor) * specular;
 
   out_color = vec4(lightDiffuse + lightSpecular, 1.0) * atten * calcShadow(position);
-}
\ No newline at end of file
+}
@@ -19,11 +19,20 @@ uniform vec3 uniform_lightDirection;
 uniform vec4 uniform_lightFalloff;
 uniform vec2 uniform_coneAngle;
 
-uniform vec2 uniform_projConst; //D
+layout(std140) uniform FrameBlock
+{
+  mat4 viewMatrix;
+  mat4 projMatrix;
+  mat4 invViewMatrix;
+  mat4 invProjMatrix;
+  vec4 projConst;
+  vec4 cameraPosition;
+} frame;
 
+// The shadow atlas, and where this lights tile is in it (offset in xy, size in zw)
 uniform sampler2DShadow uniform_shadowmap;
+uniform vec4 uniform_shadowRect;
 uniform mat4 uniform_lightViewProjMatrix;
-uniform mat4 uniform_invViewMatrix;
 
 
 const int SHADOWSAMPLES = 9;
@@ -39,7 +48,7 @@ float calcShadow(vec3 viewPosition)
   float returner = 0.0;
   
   // Get the current fragment position in world-space
-  vec4 worldPosition = uniform_invViewMatrix * vec4(viewPosition, 1);
+  vec4 worldPosition = frame.invViewMatrix * vec4(viewPosition, 1);
   
   // Multiply this position by the VPMatrix used by the shadow-map-rendering. Also, normalize the perspective by dividing by w
   vec4 lightPosition = uniform_lightViewProjMatrix * worldPosition; 
@@ -57,6 +66,10 @@ float calcShadow(vec3 viewPosition)
   float shadowscale = 2.2;
   vec2 shadowFragSize = vec2(shadowscale) / vec2(shadowSize.x, shadowSize.y);
   
+  // Keep the filter taps inside the tile, and move into the atlas
+  vec2 tileMargin = (shadowFragSize + vec2(0.5) / vec2(shadowSize)) / uniform_shadowRect.zw;
+  shadowUV = uniform_shadowRect.xy + clamp(shadowUV, tileMargin, vec2(1.0) - tileMargin) * uniform_shadowRect.zw;
+  
   // 9-tap shadow sampling
   for(int i = 0; i < SHADOWSAMPLES; i++)
   {
@@ -96,7 +109,7 @@ void main()
   
   // Depthextracted position
   vec3 viewRay = vec3(in_vertexPos.xy / in_vertexPos.z, 1.0);//D
-  float linearDepth = uniform_projConst.x / (uniform_projConst.y - depth);//D
+  float linearDepth = frame.projConst.x / (frame.projConst.y - depth);//D
   vec3 position = viewRay * linearDepth;//D
   
   vec3 viewDir = normalize( -position );
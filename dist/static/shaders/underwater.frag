@@ -14,6 +14,20 @@ uniform float uniform_time = 0.0;
 
 uniform sampler2D uniform_normalmapA;
 uniform sampler2D uniform_normalmapB;
+
+// Set for BC5 normal maps, which only store X and Y
+uniform int uniform_reconstructA = 0;
+uniform int uniform_reconstructB = 0;
+
+vec3 sampleNormal(sampler2D map, vec2 uv, int reconstruct)
+{
+  vec3 n = (texture(map, uv).rgb * 2.0) - 1.0;
+  if(reconstruct == 1)
+  {
+    n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
+  }
+  return n;
+}
 uniform sampler2D uniform_vignette;
 
 // Layer one - Clear surface
@@ -48,8 +62,8 @@ void main()
   vec2 waveUvA = (in_texCoords * 6.0)  + (vec2(0.0, 0.25) * waveTimeA);
   vec2 waveUvB = (in_texCoords * 12.0) + (vec2(0.0, 0.42) * waveTimeB);
 
-  vec3 normalTex = ((texture(uniform_normalmapA, waveUvA / 10.0).rgb * 2.0) - 1.0);
-  normalTex += ((texture(uniform_normalmapB, waveUvB / 10.0).rgb * 2.0) - 1.0);
+  vec3 normalTex = sampleNormal(uniform_normalmapA, waveUvA / 10.0, uniform_reconstructA);
+  normalTex += sampleNormal(uniform_normalmapB, waveUvB / 10.0, uniform_reconstructB);
   normalTex = normalize(normalTex);
 
   vec2 texStep = vec2(1.0) / textureSize(uniform_colormap, 0);
@@ -16,6 +16,20 @@ uniform vec3 uniform_camerawp;
 uniform sampler2D uniform_normalmapA;
 uniform sampler2D uniform_normalmapB;
 
+// Set for BC5 normal maps, which only store X and Y
+uniform int uniform_reconstructA = 0;
+uniform int uniform_reconstructB = 0;
+
+vec3 sampleNormal(sampler2D map, vec2 uv, int reconstruct)
+{
+  vec3 n = (texture(map, uv).rgb * 2.0) - 1.0;
+  if(reconstruct == 1)
+  {
+    n.z = sqrt(max(1.0 - dot(n.xy, n.xy), 0.0));
+  }
+  return n;
+}
+
 //uniform sampler2D uniform_heightmapA;
 //uniform sampler2D uniform_heightmapB;
 
@@ -53,8 +67,8 @@ void main()
   //float height = mix(heightA, heightB, 0.5);
  
  // World-space normal
-  vec3 normalA = ((texture(uniform_normalmapA, waveUvA).rbg * 2.0) - 1.0);
-  vec3 normalB = ((texture(uniform_normalmapB, waveUvB).rbg * 2.0) - 1.0);
+  vec3 normalA = sampleNormal(uniform_normalmapA, waveUvA, uniform_reconstructA).xzy;
+  vec3 normalB = sampleNormal(uniform_normalmapB, waveUvB, uniform_reconstructB).xzy;
   //vec3 worldNormal = normalize(mix(normalA, normalB, sin(uniform_time * 0.001)));
   vec3 worldNormal =normalA + normalB;
   worldNormal.xz *= 2.0;
@@ -0,0 +1,127 @@
+/*
+ * This example checks that the renderer does not allocate on the heap once a scene has settled.
+ *
+ * It renders a few spinning spheres with batching, CPU occlusion culling and spot light shadows enabled. After some
+ * warm-up frames, where programs finish compiling and containers reach their final sizes, every frame has to get by
+ * without a single heap allocation. It exits with 1 if any frame allocates, listing the frames that did.
+ *
+ * Counting allocations needs Kit built with make COUNT_ALLOCATIONS=1, and this example fails without it.
+ *
+ */
+
+#include <Kit/Window.hpp>
+#include <Kit/Renderer.hpp>
+#include <Kit/AllocationCounter.hpp>
+#include <Kit/Material.hpp>
+
+#include <Kit/Light.hpp>
+#include <Kit/Camera.hpp>
+#include <Kit/Model.hpp>
+
+#include <iostream>
+#include <vector>
+
+int main(int argc, char **argv)
+{
+  const uint32_t warmupFrames = 120;
+  const uint32_t checkedFrames = 300;
+
+  if(!kit::AllocationCounter::isEnabled())
+  {
+    std::cout << "Kit was built without allocation counting, rebuild it with make COUNT_ALLOCATIONS=1" << std::endl;
+    return 1;
+  }
+
+  kit::Window::Args winArgs;
+  winArgs.mode = kit::Window::Windowed;
+  winArgs.title = std::string("Allocation check");
+  winArgs.resolution = glm::uvec2(1280, 720);
+
+  auto win = new kit::Window(winArgs);
+  auto renderer = new kit::Renderer(glm::uvec2(1280, 720));
+  auto payload = new kit::RenderPayload();
+  renderer->registerPayload(payload);
+
+  auto camera = new kit::Camera(72.0f, 1280.0f / 720.0f, glm::vec2(0.1f, 100.0f));
+  camera->setPosition(glm::vec3(0.0f, 0.0f, 6.0f));
+
+  auto environment = new kit::Light(kit::Light::IBL);
+  environment->setEnvironment("fortpoint");
+  payload->addLight(environment);
+
+  // A shadowed spot light, so the shadow atlas and its caches are exercised
+  auto spot = new kit::Light(kit::Light::Spot, glm::uvec2(1024, 1024));
+  spot->setColor(glm::vec3(1.0f, 0.9f, 0.8f) * 10.0f);
+  spot->setRadius(20.0f);
+  spot->setConeAngle(30.0f, 40.0f);
+  spot->setPosition(glm::vec3(0.0f, 5.0f, 5.0f));
+  spot->rotateX(-45.0f);
+  payload->addLight(spot);
+
+  std::vector<kit::Model*> spheres;
+  for(int i = 0; i < 5; i++)
+  {
+    auto sphere = new kit::Model("Sphere.mesh");
+    sphere->setPosition(glm::vec3(float(i - 2) * 1.5f, 0.0f, 0.0f));
+    payload->addRenderable(sphere);
+    spheres.push_back(sphere);
+  }
+
+  renderer->setActiveCamera(camera);
+  renderer->setShadows(true);
+  renderer->setBatching(true);
+  renderer->setSoftwareOcclusion(true);
+
+  // Metrics build their text every frame, so they stay off
+  kit::Material::waitForPrograms();
+
+  uint32_t failedFrames = 0;
+  for(uint32_t frame = 0; frame < warmupFrames + checkedFrames && win->isOpen(); frame++)
+  {
+    kit::WindowEvent evt;
+    while(win->fetchEvent(evt))
+    {
+      if(evt.type == kit::WindowEvent::KeyPressed && evt.keyboard.key == kit::Escape)
+      {
+        win->close();
+      }
+    }
+
+    for(auto currSphere : spheres)
+    {
+      currSphere->rotateY(1.0f);
+    }
+
+    renderer->renderFrame();
+
+    // The renderer resets the count when a frame starts, so this is what the frame allocated
+    uint64_t allocations = kit::AllocationCounter::getCount();
+    if(frame >= warmupFrames && allocations > 0)
+    {
+      std::cout << "Frame " << frame << " allocated " << allocations << " times" << std::endl;
+      failedFrames++;
+    }
+
+    win->display();
+  }
+
+  for(auto currSphere : spheres)
+  {
+    delete currSphere;
+  }
+  delete spot;
+  delete environment;
+  delete camera;
+  delete payload;
+  delete renderer;
+  delete win;
+
+  if(failedFrames > 0)
+  {
+    std::cout << failedFrames << " of " << checkedFrames << " frames allocated after warm-up" << std::endl;
+    return 1;
+  }
+
+  std::cout << "No allocations in " << checkedFrames << " frames after warm-up" << std::endl;
+  return 0;
+}
@@ -0,0 +1,53 @@
+/*
+ * This example builds level-of-detail chains offline.
+ *
+ * For every geometry file given, it saves coarser versions next to it as "<file>.lod1", "<file>.lod2" and so on.
+ * Meshes pick these up on their own when they load the geometry.
+ *
+ * Usage: lod-generator-example [--levels N] [--ratio R] [--error E] <geometry file> [<geometry file> ...]
+ *
+ */
+
+#include <Kit/GeometrySimplifier.hpp>
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[])
+{
+  uint32_t levels = 3;
+  float ratio = 0.5f;
+  float maxError = 0.02f;
+  uint32_t files = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "--levels" && i + 1 < argc)
+    {
+      levels = (uint32_t)std::stoul(argv[++i]);
+    }
+    else if (arg == "--ratio" && i + 1 < argc)
+    {
+      ratio = std::stof(argv[++i]);
+    }
+    else if (arg == "--error" && i + 1 < argc)
+    {
+      maxError = std::stof(argv[++i]);
+    }
+    else
+    {
+      // Build the chain with the options given so far
+      kit::GeometrySimplifier::buildChain(arg, levels, ratio, maxError);
+      files++;
+    }
+  }
+
+  if (files == 0)
+  {
+    std::cout << "Usage: " << argv[0] << " [--levels N] [--ratio R] [--error E] <geometry file> [<geometry file> ...]" << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
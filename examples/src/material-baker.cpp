@@ -0,0 +1,44 @@
+/*
+ * This example bakes material caches ahead of time, for example as a build step before shipping.
+ *
+ * It opens a hidden window for the OpenGL context, loads every material given and bakes all of its caches. The caches
+ * end up in the material disk cache (./data/cache/materials/ by default), where later runs load them instead of baking.
+ *
+ * Usage: material-baker-example <material> [<material> ...]
+ *
+ */
+
+#include <Kit/Window.hpp>
+#include <Kit/Material.hpp>
+#include <Kit/MaterialCache.hpp>
+
+#include <iostream>
+
+int main(int argc, char *argv[])
+{
+  if (argc < 2)
+  {
+    std::cout << "Usage: " << argv[0] << " <material> [<material> ...]" << std::endl;
+    return 1;
+  }
+
+  kit::Window::Args args("Material baker", kit::Window::Windowed, glm::uvec2(64, 64));
+  args.visible = false;
+  auto win = new kit::Window(args);
+  win->activateContext();
+
+  for (int i = 1; i < argc; i++)
+  {
+    auto material = kit::Material::load(argv[i]);
+
+    // Loading bakes the caches used for rendering, the terrain one is baked on demand
+    material->getNDCache();
+
+    std::cout << argv[i] << ": " << material->getCacheMemory() / 1024 << " KiB of caches" << std::endl;
+  }
+
+  std::cout << kit::MaterialCache::getCacheCount() << " caches in " << kit::MaterialCache::getDiskCacheDirectory() << std::endl;
+
+  delete win;
+  return 0;
+}
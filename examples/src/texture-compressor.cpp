@@ -0,0 +1,67 @@
+/*
+ * This example compresses textures offline.
+ *
+ * For every image given, it saves a block-compressed version with mipmaps next to it as "<file>.dds".
+ * kit::Texture::load picks these up on its own, so materials need no changes.
+ *
+ * The usage decides the format: color maps go to BC1, color maps with alpha to BC3, normal maps to BC5 and
+ * single-channel masks (roughness, metalness, occlusion and so on) to BC4. It applies to the files that follow it.
+ *
+ * Usage: texture-compressor-example [--color | --alpha | --normal | --mask] [--linear] <image> [<image> ...]
+ *
+ */
+
+#include <Kit/TextureCompressor.hpp>
+
+#include <iostream>
+#include <string>
+
+int main(int argc, char *argv[])
+{
+  kit::TextureCompressor::Usage usage = kit::TextureCompressor::Color;
+  bool srgb = true;
+  uint32_t files = 0;
+  uint32_t failed = 0;
+
+  for (int i = 1; i < argc; i++)
+  {
+    std::string arg = argv[i];
+    if (arg == "--color")
+    {
+      usage = kit::TextureCompressor::Color;
+    }
+    else if (arg == "--alpha")
+    {
+      usage = kit::TextureCompressor::ColorAlpha;
+    }
+    else if (arg == "--normal")
+    {
+      usage = kit::TextureCompressor::NormalMap;
+    }
+    else if (arg == "--mask")
+    {
+      usage = kit::TextureCompressor::Mask;
+    }
+    else if (arg == "--linear")
+    {
+      srgb = false;
+    }
+    else
+    {
+      // Compress with the options given so far
+      if (!kit::TextureCompressor::compressFile(arg, arg + ".dds", usage, srgb))
+      {
+        failed++;
+      }
+      files++;
+    }
+  }
+
+  if (files == 0)
+  {
+    std::cout << "Usage: " << argv[0] << " [--color | --alpha | --normal | --mask] [--linear] <image> [<image> ...]" << std::endl;
+    return 1;
+  }
+
+  return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+namespace kit
+{
+  ///
+  /// \brief Counts heap allocations, to check that rendering a frame allocates nothing once the scene has settled
+  ///
+  /// Counting replaces the global operator new, so it is only compiled in when Kit is built with KIT_COUNT_ALLOCATIONS defined
+  /// (make COUNT_ALLOCATIONS=1). Otherwise isEnabled() returns false and the count stays at zero. kit::Renderer resets the count at
+  /// the start of every frame, and lists it among its metrics.
+  ///
+  class KITAPI AllocationCounter
+  {
+    public:
+      static bool isEnabled();
+
+      static uint64_t getCount(); ///< Allocations since the last reset, from any thread
+      static void reset();
+  };
+}
@@ -5,6 +5,8 @@
 
 #include "Kit/Renderable.hpp"
 
+#include <map>
+#include <tuple>
 
 namespace kit 
 {
@@ -42,15 +44,60 @@ namespace kit
         float            uvScale = 1.0f;
       };
 
-      
+
+      ///
+      /// \brief RGBA8 image data, bottom row first
+      ///
+      struct ImageData
+      {
+        glm::uvec2            size = glm::uvec2(0, 0);
+        std::vector<uint8_t>  pixels;
+      };
+
+      ///
+      /// \brief Everything a baked terrain needs from disk. Loading it does not touch OpenGL, so it can happen on any thread
+      ///
+      struct Data
+      {
+        std::string           name;
+        float                 xzScale = 1.0f;
+        float                 yScale = 1.0f;
+        uint8_t               numLayers = 0;
+        glm::uvec2            size = glm::uvec2(0, 0);
+        float                 uvScale[8] = {1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f};
+
+        std::vector<uint32_t> indices;
+        std::vector<float>    vertices;
+        std::vector<Vertex>   heightData;
+
+        ImageData             arCache;
+        ImageData             nxCache;
+        ImageData             materialMask[2];
+        ImageData             arLayer[8];
+        ImageData             ndLayer[8];
+
+        uint32_t              tileSize = 0;     ///< Size of a layer usage tile, in vertices
+        glm::uvec2            tileCount = glm::uvec2(0, 0);
+        std::vector<uint8_t>  layerUsage;       ///< Bitmask of used layers per tile, empty if the terrain was baked without it
+      };
+
+      ///
+      /// \brief Loads the baked data of a terrain from disk, without touching OpenGL
+      /// \param name Name of the terrain, relative to ./data/terrains/
+      /// \returns The loaded data, owned by the caller
+      /// \throws kit::Exception If any of the baked files could not be loaded
+      ///
+      static Data * loadData(const std::string& name);
 
       BakedTerrain(const std::string& name);
+      BakedTerrain(Data * data); ///< Creates the GPU resources from previously loaded data, and takes ownership of it
       ~BakedTerrain();
 
       void renderDeferred(kit::Renderer * camera) override;
       void renderGeometry() override;
 
       void renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix) override;
+      bool isShadowComplete() override;
       
       kit::Texture *  getArCache();
       kit::Texture *  getNxCache();
@@ -66,13 +113,44 @@ namespace kit
       glm::vec3 sampleNormal(float x, float z);
 
       bool checkCollision(glm::vec3 point);
+
+      ///
+      /// \brief Makes the shared edge with an adjacent terrain tile identical in both, on the CPU and the GPU
+      /// \param neighbour The adjacent terrain, which has to have the same size
+      /// \param direction Direction of the neighbour in tile space, (1,0), (-1,0), (0,1) or (0,-1)
+      ///
+      void stitchEdge(kit::BakedTerrain * neighbour, glm::ivec2 direction);
+
+      size_t getCpuMemoryUsage(); ///< Bytes of CPU memory held by this terrain
+      size_t getGpuMemoryUsage(); ///< Bytes of GPU memory held by this terrain, approximate
       
       void setDetailDistance(float const & meters);
       
       virtual int32_t getRenderPriority() override;
+      virtual bool getWorldBounds(kit::AABB & bounds) override;
 
     private:
-      void                  updateGpuProgram();   //< Compiles a new program for the GPU
+
+      // What the generated program depends on. Terrains with the same flags share a program
+      struct ProgramFlags
+      {
+        uint8_t numLayers = 0;
+        uint8_t usedLayers = 0;   //< Bitmask of the layers sampled
+        bool layerUsage = false;  //< Whether layers are skipped per tile
+
+        bool operator<(const ProgramFlags& b) const {
+          return std::tie(this->numLayers, this->usedLayers, this->layerUsage) < std::tie(b.numLayers, b.usedLayers, b.layerUsage);
+        }
+      };
+
+      static kit::Program * getProgram(ProgramFlags const & flags); //< Gets the shared program for the flags, linking it in the background the first time
+      static void allocateShared();
+      static void releaseShared();
+
+      void                  updateGpuProgram();   //< Picks the shared program for the layers of this terrain
+      void                  applyUniforms(kit::Program * program, ProgramFlags const & flags); //< Sets the textures and values of this terrain on a shared program
+      kit::Texture *        createTexture(ImageData const & image, bool repeat); //< Creates a mipmapped, anisotropic texture from image data
+      void                  writeVertex(uint32_t x, uint32_t y); //< Uploads the height and tangent frame of a single vertex to the GPU
 
       bool                  m_valid = false;              //< True if loaded
       uint32_t           m_indexCount = 0;         //< Index count
@@ -80,10 +158,16 @@ namespace kit
       uint32_t                m_glVertexIndices = 0;    //< VBO for elements/indices
       uint32_t                m_glVertexBuffer = 0;     //< VBO for vertex data
 
-      kit::Program *        m_program = nullptr;            //< GPU program
+      kit::Program *        m_program = nullptr;            //< GPU program, shared with other terrains
+      ProgramFlags          m_programFlags;
+      float                 m_detailDistance = 500.0f;      //< TODO: Replace with configuration parameter
+      bool                  m_shadowComplete = true;        //< See isShadowComplete
 
       kit::Texture *        m_arCache = nullptr;            //< Cached albedo+roughness values for the whole terrain, low-LOD
       kit::Texture *        m_nxCache = nullptr;            //< Cached normal values for the whole terrain, low-LOD (Empty value!)
+      kit::Texture *        m_layerUsage = nullptr;         //< Bitmask of used layers per tile, in the red channel
+      uint32_t              m_tileSize = 0;                 //< Size of a layer usage tile, in vertices
+      uint8_t               m_usedLayers = 0;               //< Bitmask of the layers used anywhere on the terrain
       kit::Texture *        m_materialMask[2] = {nullptr, nullptr};    //< Cached material contribution values for the whole terrain. One component per layer: 0.r, 0.g, 0.b, 0.a, 1.r, 1.g, 1.b, 1.a
 
       LayerInfo             m_layerInfo[8];       //< Layer info
@@ -93,6 +177,11 @@ namespace kit
       float                 m_yScale = 1.0f;
 
       std::vector<Vertex>     m_heightData;
+      kit::AABB               m_localBounds;        //< Bounds of the heightfield in model space
+      size_t                  m_gpuMemoryUsage = 0;
+
+      static uint32_t                                 m_instanceCount;
+      static std::map<ProgramFlags, kit::Program*>    m_programs;
   };
 
 }
@@ -18,8 +18,10 @@ namespace kit {
 
       void flip();
       
-      void clear(std::vector<glm::vec4> colorattachments, float depthattachment);
-      void clear(std::vector<glm::vec4> colorattachments);
+      void clear(std::vector<glm::vec4> const & colorattachments, float depthattachment);
+      void clear(std::vector<glm::vec4> const & colorattachments);
+      void clear(std::initializer_list<glm::vec4> colorattachments, float depthattachment);
+      void clear(std::initializer_list<glm::vec4> colorattachments);
       
       kit::PixelBuffer * getFrontBuffer();
       kit::PixelBuffer * getBackBuffer();
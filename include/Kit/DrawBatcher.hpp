@@ -0,0 +1,141 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <vector>
+
+namespace kit
+{
+  class HiZBuffer;
+
+  class Material;
+
+  class Program;
+
+  class Submesh;
+
+  class Texture;
+
+  ///
+  /// \brief Collects draws of unskinned submeshes, and renders them with a few glMultiDrawElementsIndirect calls
+  ///
+  /// Draws are grouped by material and vertex array, and every group becomes one multi-draw in which consecutive draws
+  /// of the same submesh collapse into one instanced command. The model matrices of all draws go into one buffer that
+  /// feeds an instanced vertex attribute, and each command finds its matrices through its base instance.
+  ///
+  /// With GPU culling enabled, the caller submits draws without culling them, and a compute pass tests the bounds of every
+  /// draw against the view frustum. The visible draws are appended to the command list of their group, which is rendered with
+  /// glMultiDrawElementsIndirectCountARB. Without GL_ARB_indirect_parameters (as on older Mesa llvmpipe), the unused commands
+  /// are left zeroed and the whole list is rendered with glMultiDrawElementsIndirect instead.
+  ///
+  /// Occlusion culling adds a kit::HiZBuffer to the GPU culling. Draws are first tested against the pyramid of the previous
+  /// frame's depth. After the visible ones are rendered, the pyramid is rebuilt from the current depth, and the rejected
+  /// draws are tested again so nothing pops in a frame late when the view changes.
+  ///
+  class KITAPI DrawBatcher
+  {
+    public:
+
+      DrawBatcher();
+      ~DrawBatcher();
+
+      void submit(kit::Submesh * submesh, kit::Material * material, glm::mat4 const & modelMatrix);
+
+      ///
+      /// \brief Sets the view the coming submissions are rendered from, so they can pick their level of detail
+      ///
+      void setViewProjection(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix);
+      glm::mat4 const & getViewMatrix();
+      glm::mat4 const & getProjectionMatrix();
+
+      ///
+      /// \brief Renders and forgets everything submitted since the last flush
+      /// \param depthTexture The depth attachment being rendered to, needed for occlusion culling
+      ///
+      void flush(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, kit::Texture * depthTexture = nullptr);
+
+      uint32_t getDrawCount(); ///< Draws submitted to the last flush, before GPU culling
+      uint32_t getCallCount(); ///< Multi-draw calls issued by the last flush
+
+      ///
+      /// \brief Enables or disables frustum culling of the submitted draws in a compute pass
+      ///
+      void setGpuCulling(bool enabled);
+      bool getGpuCulling();
+
+      ///
+      /// \brief Enables or disables occlusion culling against a depth pyramid, on top of GPU culling
+      ///
+      void setOcclusionCulling(bool enabled);
+      bool getOcclusionCulling();
+
+      kit::HiZBuffer * getHiZBuffer(); ///< Null until occlusion culling is first enabled
+
+      bool hasIndirectCount(); ///< True if the GPU culled draws are rendered with glMultiDrawElementsIndirectCountARB
+
+    private:
+
+      struct Draw
+      {
+        kit::Material * material;
+        kit::Submesh *  submesh;
+        uint32_t        vertexArray;
+        uint32_t        transform;    ///< Index in m_submitted
+      };
+
+      // Layout mandated by glMultiDrawElementsIndirect
+      struct DrawCommand
+      {
+        uint32_t count;
+        uint32_t instanceCount;
+        uint32_t firstIndex;
+        int32_t  baseVertex;
+        uint32_t baseInstance;
+      };
+
+      // Input of the culling pass, layout matches draw-cull.comp
+      struct CullDraw
+      {
+        glm::mat4  transform;
+        glm::vec4  boundsMin;
+        glm::vec4  boundsMax;
+        glm::uvec4 command;     ///< Index count, first index, base vertex, group
+        glm::uvec4 group;       ///< First command of the group, in x
+      };
+
+      void upload(uint32_t buffer, size_t bytes, const void * data);
+      void clear(uint32_t buffer, size_t bytes);
+
+      void flushCulled(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, kit::Texture * depthTexture);
+      void dispatchCulled(uint32_t pass, uint32_t drawCount, uint32_t groupCount);
+      void drawCulled(uint32_t pass, uint32_t drawCount, uint32_t groupCount, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix);
+
+      uint32_t                  m_glTransformBuffer = 0;
+      uint32_t                  m_glCommandBuffer = 0;
+      uint32_t                  m_glCullBuffer = 0;
+      uint32_t                  m_glCountBuffer = 0;
+      uint32_t                  m_glRejectBuffer = 0;
+
+      bool                      m_gpuCulling = false;
+      bool                      m_indirectCount = false;
+      kit::Program *            m_cullProgram = nullptr;
+      bool                      m_occlusionCulling = false;
+      kit::HiZBuffer *          m_hiZBuffer = nullptr;
+
+      glm::mat4                 m_viewMatrix;
+      glm::mat4                 m_projectionMatrix;
+
+      std::vector<Draw>         m_draws;
+      std::vector<glm::mat4>    m_submitted;    ///< Model matrices in submission order
+      std::vector<glm::mat4>    m_transforms;   ///< Model matrices in command order
+      std::vector<DrawCommand>  m_commands;
+      std::vector<uint32_t>     m_commandDraws; ///< First draw of every command
+      std::vector<CullDraw>     m_cullDraws;
+      std::vector<uint32_t>     m_groupDraws;   ///< First draw of every group
+
+      uint32_t                  m_drawCount = 0;
+      uint32_t                  m_callCount = 0;
+  };
+
+}
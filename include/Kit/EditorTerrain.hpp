@@ -6,6 +6,7 @@
 #include "Kit/Renderable.hpp"
 
 #include <memory>
+#include <list>
 
 
 namespace kit 
@@ -34,32 +35,16 @@ namespace kit
   class KITAPI EditorTerrain : public kit::Renderable
   {
     public:
-      struct Triangle;
-
+      ///
+      /// \brief A terrain vertex, assembled on demand from the flat grid arrays
+      ///
       struct Vertex
       {
-        uint32_t m_id;
-
         glm::vec3 m_position;
         glm::vec2 m_uv;
         glm::vec3 m_normal;
         glm::vec3 m_tangent;
         glm::vec3 m_bitangent;
-
-        std::vector<Triangle*> m_triangles;
-      };
-
-      struct Triangle
-      {
-        Triangle(Vertex* a, Vertex* b, Vertex* c);
-
-        glm::vec3 m_normal;
-        glm::vec3 m_tangent;
-        glm::vec3 m_bitangent;
-
-        Vertex* m_a = nullptr;
-        Vertex* m_b = nullptr;
-        Vertex* m_c = nullptr;
       };
 
       struct LayerInfo
@@ -81,7 +66,9 @@ namespace kit
       
       ~EditorTerrain();
 
-      void bake();
+      static const uint32_t BakeTileSize = 64;             ///< Size of a bake tile, in heightmap texels
+
+      void bake(bool forceFull = false);                   ///< Bakes the terrain, only rewriting tiles painted since the last bake unless forceFull is set
 
       void save();
       void saveAs(const std::string& name);
@@ -102,10 +89,11 @@ namespace kit
       uint8_t getNumLayers();
       LayerInfo & getLayerInfo(int layer);
       
-      Vertex * getVertexAt(int32_t x, int32_t y);
+      Vertex getVertexAt(int32_t x, int32_t y);          ///< Returns the vertex at the given grid position, clamped to the edges
       
       glm::vec3 sampleHeightmap(int32_t x, int32_t y); ///< Samples heightmap by pixel
       glm::vec3 sampleBilinear(float x, float z);      ///< Bilinearly samples heightmap. Input world (x,z). Output (world height, rotationx, rotationy)
+      glm::vec4 sampleMaterialMask(uint8_t mask, glm::vec2 positionUv); ///< Samples a material mask (0 or 1) by uv, served from the CPU mirror
       
       void setDecalBrush(kit::Texture * brush = nullptr, glm::vec2 positionUv = glm::vec2(0.f,0.f), glm::vec2 sizeUv= glm::vec2(0.f,0.f));
       
@@ -121,7 +109,8 @@ namespace kit
       void setName(const std::string&);
       
       void                            bakeCPUHeight();      ///< Bakes CPU height-data from GPU heightmap
-      void                            bakeCPUNormals();     ///< Bakes CPU normals and tangents from CPU vertex data
+      void                            updateCPUMirror(bool wait = false); ///< Copies finished GPU readbacks into the CPU mirror, optionally blocking until all are done
+      void                            bakeCPUNormals();     ///< Bakes CPU normals and tangents from the CPU heightmap, in parallel
 
       void                            updateGpuProgram();   ///< Compiles a new program for the GPU
       void                            bakeARNXCache();      ///< Renders deferred ARNX cache into m_arnxCache
@@ -129,7 +118,39 @@ namespace kit
       void invalidateMaterials();
       
     private:
+      
+      ///
+      /// \brief An asynchronous readback of a rectangle from a GPU buffer into a PBO
+      ///
+      struct PendingReadback
+      {
+        uint32_t    glBuffer = 0;        ///< Pixel pack buffer
+        void *      glFence = nullptr;   ///< Sync object, signaled when the copy has finished
+        uint8_t     target = 0;          ///< 0 = heightmap, 1 = material mask 0, 2 = material mask 1
+        glm::uvec4  rect;                ///< x, y, width, height in GL pixel coordinates
+      };
+      
+      enum DirtyFlags : uint8_t
+      {
+        DirtyHeight = 1,
+        DirtyMaterial = 2
+      };
+
       void generateCache();
+      void markDirty(uint8_t flags, glm::vec2 positionUv, glm::vec2 sizeUv);
+      void markAllDirty(uint8_t flags);
+      glm::uvec4 getTileRect(uint32_t tile);    ///< Tile rectangle in heightmap texels, rows top to bottom
+      glm::uvec4 getTileMapRect(uint32_t tile); ///< Tile rectangle in material map pixels, GL rows bottom to top
+      void bakeCPUNormals(glm::uvec4 rect);
+      void bakeARNXCache(glm::uvec4 rect);
+      std::vector<uint8_t> getCPUMaskRect(uint8_t mask, glm::uvec4 rect);
+      uint8_t calculateLayerUsage(uint32_t tile); ///< Bitmask of the layers with any weight in a tile, from the CPU mirror
+      bool writeBakedHeader(std::string const & bakedPath);
+      bool writeBakedLayers(std::string const & bakedPath);
+      void getCellIndices(uint32_t x, uint32_t y, uint32_t * indices); ///< Writes the 6 indices of the two triangles in the grid cell at (x, y)
+      void requestReadback(uint8_t target, glm::vec2 positionUv, glm::vec2 sizeUv);
+      void requestReadback(uint8_t target, glm::uvec4 rect);
+      void releaseReadbacks();
       
       std::string                     m_name;
       bool                            m_valid;              ///< False if terrain has been invalidated
@@ -141,10 +162,22 @@ namespace kit
       float                           m_xzScale;
       glm::uvec2                      m_resolution;
 
-      // CPU 
-      std::vector<Vertex*>            m_vertices;
-      std::vector<Triangle*>          m_triangles;
-      std::map<Vertex*, uint32_t>  m_indexCache;
+      // CPU, flat grid arrays indexed by (y * m_resolution.x) + x. Positions and uvs are implicit from the grid
+      std::vector<glm::vec3>          m_cpuNormals;
+      std::vector<glm::vec3>          m_cpuTangents;
+
+      // CPU mirror of the GPU buffers, rows stored top to bottom
+      std::vector<float>              m_cpuHeight;          ///< Heightmap, normalized [-1, 1]
+      std::vector<uint8_t>            m_cpuMask[2];         ///< Material masks, RGBA8
+      glm::uvec2                      m_maskResolution;
+      std::list<PendingReadback>      m_readbacks;          ///< In-flight readbacks, oldest first
+
+      // Incremental baking
+      glm::uvec2                      m_tileCount;
+      std::vector<uint8_t>            m_dirtyTiles;         ///< DirtyFlags per bake tile, changed since the last bake
+      std::vector<uint8_t>            m_layerUsage;         ///< Bitmask of used layers per bake tile, as of the last bake
+      bool                            m_fullBakeRequired = true; ///< True if the baked files on disk can not be patched
+      bool                            m_layersDirty = true; ///< True if the layer caches need to be rewritten
 
       // GPU data
       uint32_t                     m_indexCount;              ///< Index count
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <cstddef>
+#include <vector>
+
+namespace kit
+{
+  ///
+  /// \brief A linear allocator for memory that only lives until the end of a frame
+  ///
+  /// Allocations bump an offset into one block, and reset() releases all of them at once. When a frame needs more than the block
+  /// holds, the rest comes from the heap, and the next reset() grows the block to fit. After a few frames the block covers the
+  /// steady state, and the frame allocates nothing from the heap.
+  ///
+  class KITAPI FrameArena
+  {
+    public:
+
+      FrameArena(size_t capacity = 256 * 1024);
+      ~FrameArena();
+
+      ///
+      /// \returns Memory that stays valid until the next reset()
+      ///
+      void * allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+      ///
+      /// \brief Releases everything allocated since the last reset, and grows the block if it overflowed
+      ///
+      void reset();
+
+      size_t getUsed();     ///< Bytes allocated since the last reset, including overflow
+      size_t getCapacity(); ///< Size of the block
+
+    private:
+      uint8_t *               m_block = nullptr;
+      size_t                  m_capacity = 0;
+      size_t                  m_offset = 0;
+      size_t                  m_overflowBytes = 0;
+      std::vector<uint8_t*>   m_overflow;          ///< Heap allocations made after the block filled up
+  };
+
+  ///
+  /// \brief Lets standard containers allocate from a kit::FrameArena, see kit::FrameVector
+  ///
+  /// Deallocation does nothing, the memory is returned when the arena is reset. A container using it must not outlive the frame.
+  ///
+  template <typename T>
+  class FrameAllocator
+  {
+    public:
+      typedef T value_type;
+
+      FrameAllocator(kit::FrameArena * arena) : m_arena(arena) {}
+
+      template <typename U>
+      FrameAllocator(FrameAllocator<U> const & other) : m_arena(other.getArena()) {}
+
+      T * allocate(size_t count)
+      {
+        return static_cast<T*>(m_arena->allocate(count * sizeof(T), alignof(T)));
+      }
+
+      void deallocate(T *, size_t) {}
+
+      kit::FrameArena * getArena() const
+      {
+        return m_arena;
+      }
+
+    private:
+      kit::FrameArena * m_arena;
+  };
+
+  template <typename T, typename U>
+  bool operator==(FrameAllocator<T> const & lhs, FrameAllocator<U> const & rhs)
+  {
+    return lhs.getArena() == rhs.getArena();
+  }
+
+  template <typename T, typename U>
+  bool operator!=(FrameAllocator<T> const & lhs, FrameAllocator<U> const & rhs)
+  {
+    return lhs.getArena() != rhs.getArena();
+  }
+
+  template <typename T>
+  using FrameVector = std::vector<T, kit::FrameAllocator<T>>;
+
+}
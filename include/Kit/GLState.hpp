@@ -0,0 +1,75 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+namespace kit
+{
+  ///
+  /// \brief Tracks the GL state Kit changes most often, and drops calls that would not change it
+  ///
+  /// Covers the current program, the textures bound to the first texture units and the blend, depth and cull state. All of Kit
+  /// goes through here, so the tracked state matches the context as long as nothing else touches it. Code that calls GL directly
+  /// has to call invalidate() afterwards, which makes the next call of every setter reach the driver again.
+  ///
+  class KITAPI GLState
+  {
+    public:
+
+      static const uint32_t TrackedTextureUnits = 32; ///< Bindings to higher units are always issued
+
+      static void useProgram(uint32_t handle);
+
+      ///
+      /// \brief Binds a texture to a texture unit
+      /// \param unit The texture unit
+      /// \param target The texture target, only used where DSA is not available
+      /// \param handle The texture
+      ///
+      static void bindTexture(uint32_t unit, uint32_t target, uint32_t handle);
+
+      ///
+      /// \brief Forgets a texture that is about to be deleted, since GL reuses the names of deleted textures
+      ///
+      static void forgetTexture(uint32_t handle);
+
+      ///
+      /// \brief Forgets a program that is about to be deleted
+      ///
+      static void forgetProgram(uint32_t handle);
+
+      static void setBlend(bool enabled);
+      static void setBlendFunc(uint32_t source, uint32_t destination);
+      static void setDepthTest(bool enabled);
+      static void setDepthWrite(bool enabled);
+      static void setCulling(bool enabled);
+      static void setCullFace(uint32_t face);
+
+      ///
+      /// \brief Marks every tracked state as unknown
+      ///
+      static void invalidate();
+
+      static uint64_t getIssuedCount();  ///< Calls that reached the driver since the last resetCounters()
+      static uint64_t getSkippedCount(); ///< Calls that were dropped since the last resetCounters()
+      static void resetCounters();
+
+    private:
+
+      static void setCapability(int8_t & state, uint32_t capability, bool enabled);
+
+      static uint32_t m_program;
+      static uint32_t m_textures[TrackedTextureUnits];
+      static int8_t   m_blend;       ///< -1 if unknown
+      static uint32_t m_blendSource;
+      static uint32_t m_blendDestination;
+      static int8_t   m_depthTest;   ///< -1 if unknown
+      static int8_t   m_depthWrite;  ///< -1 if unknown
+      static int8_t   m_culling;     ///< -1 if unknown
+      static uint32_t m_cullFace;
+
+      static uint64_t m_issued;
+      static uint64_t m_skipped;
+  };
+
+}
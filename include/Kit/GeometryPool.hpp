@@ -0,0 +1,118 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <vector>
+#include <map>
+
+namespace kit
+{
+  ///
+  /// \brief Suballocates the vertices and indices of many meshes of the same vertex format out of one vertex and one index buffer
+  ///
+  /// All meshes in a pool share a single vertex array, so switching between them costs no rebinding, and draws only differ
+  /// by their first index and base vertex. Free space is kept in a first-fit free-list per buffer, where neighbouring blocks
+  /// are merged on release. When an allocation does not fit anywhere, the live allocations are compacted to the front of
+  /// fresh buffers, which are doubled in size first if the pool is short on space in total.
+  ///
+  class KITAPI GeometryPool
+  {
+    public:
+
+      ///
+      /// \brief A vertex attribute, all attributes are read from the same interleaved buffer
+      ///
+      struct Attribute
+      {
+        uint32_t location;
+        int32_t  components;
+        uint32_t type;       ///< GL_FLOAT, or GL_INT for integer attributes
+        uint32_t offset;     ///< Bytes from the start of the vertex
+      };
+
+      static const uint32_t DrawTransformLocation = 6; ///< Locations 6 to 9 are fed with one mat4 per instance by bindDrawTransforms, see kit::DrawBatcher
+      static const uint32_t DrawTransformBinding = 1;
+
+      ///
+      /// \param vertexSize Size of a vertex in bytes
+      /// \param vertexCapacity Initial number of vertices the pool has room for
+      /// \param indexCapacity Initial number of indices the pool has room for
+      ///
+      GeometryPool(uint32_t vertexSize, std::vector<Attribute> const & attributes, uint32_t vertexCapacity = 65536, uint32_t indexCapacity = 196608);
+      ~GeometryPool();
+
+      ///
+      /// \brief Uploads geometry into the pool
+      /// \param indices 32-bit indices, relative to the first of the given vertices
+      /// \returns A handle to the allocation
+      ///
+      uint32_t allocate(const void * vertices, uint32_t vertexCount, const uint32_t * indices, uint32_t indexCount);
+
+      ///
+      /// \brief Returns the space of an allocation to the pool. The handle may be reused by later allocations
+      ///
+      void release(uint32_t handle);
+
+      uint32_t getFirstIndex(uint32_t handle); ///< Draw parameter, may change when the pool is compacted
+      int32_t  getBaseVertex(uint32_t handle); ///< Draw parameter, may change when the pool is compacted
+
+      ///
+      /// \brief Moves all allocations to the front of the buffers, so the free space becomes one block at the end
+      ///
+      void defragment();
+
+      void bind();
+      uint32_t getVertexArray();
+
+      ///
+      /// \brief Feeds the draw transform attributes from the given buffer, until unbindDrawTransforms is called
+      ///
+      void bindDrawTransforms(uint32_t glBuffer);
+      void unbindDrawTransforms();
+
+      uint32_t getUsedVertices();
+      uint32_t getVertexCapacity();
+      uint32_t getUsedIndices();
+      uint32_t getIndexCapacity();
+
+    private:
+
+      struct Allocation
+      {
+        uint32_t firstVertex = 0;
+        uint32_t vertexCount = 0;
+        uint32_t firstIndex = 0;
+        uint32_t indexCount = 0;
+        bool     live = false;
+      };
+
+      typedef std::map<uint32_t, uint32_t> FreeList; ///< Offset to size of each free block
+
+      static bool allocateRange(FreeList & freeList, uint32_t size, uint32_t & offset);
+      static void releaseRange(FreeList & freeList, uint32_t offset, uint32_t size);
+      static bool fitsRange(FreeList & freeList, uint32_t size);
+
+      uint32_t createBuffer(size_t bytes);
+      void copyBuffer(uint32_t source, uint32_t destination, size_t sourceOffset, size_t destinationOffset, size_t bytes);
+      void uploadBuffer(uint32_t buffer, size_t offset, size_t bytes, const void * data);
+      void relocate(uint32_t vertexCapacity, uint32_t indexCapacity);
+      void attachBuffers();
+
+      uint32_t                  m_vertexSize;
+      uint32_t                  m_glVertexArray = 0;
+      uint32_t                  m_glVertexBuffer = 0;
+      uint32_t                  m_glIndexBuffer = 0;
+
+      uint32_t                  m_vertexCapacity;
+      uint32_t                  m_indexCapacity;
+      uint32_t                  m_usedVertices = 0;
+      uint32_t                  m_usedIndices = 0;
+      FreeList                  m_freeVertices;
+      FreeList                  m_freeIndices;
+
+      std::vector<Allocation>   m_allocations;
+      std::vector<uint32_t>     m_freeHandles;
+  };
+
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <string>
+
+namespace kit
+{
+  ///
+  /// \brief Reduces the triangle count of geometry, to build level-of-detail chains offline
+  ///
+  /// Edges are collapsed in order of least quadric error (Garland and Heckbert). A collapse moves one endpoint onto the
+  /// other, so every remaining vertex keeps its original attributes. Vertices on open borders and on attribute seams
+  /// (several vertices sharing a position) are never moved, which keeps outlines and UV islands intact, and collapses
+  /// that would flip a triangle are skipped.
+  ///
+  class KITAPI GeometrySimplifier
+  {
+    public:
+
+      ///
+      /// \brief Simplifies geometry until it has at most the given fraction of its triangles, or no collapse is cheap enough
+      /// \param targetRatio Fraction of the triangles to keep
+      /// \param maxError Largest distance a surface may move, relative to the diagonal of the bounding box
+      ///
+      static kit::Geometry simplify(kit::Geometry const & source, float targetRatio, float maxError = 0.02f);
+
+      ///
+      /// \brief Builds a LOD chain from a geometry file, and saves each level next to it as "<filename>.lod<level>"
+      /// \param levels Number of levels to build besides the source
+      /// \param ratio Fraction of the triangles each level keeps from the level before it
+      /// \returns The number of levels saved, which is lower if the geometry could not be simplified any further
+      ///
+      static uint32_t buildChain(const std::string& filename, uint32_t levels = 3, float ratio = 0.5f, float maxError = 0.02f);
+  };
+
+}
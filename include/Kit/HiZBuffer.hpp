@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+namespace kit
+{
+  class Program;
+
+  class Texture;
+
+  ///
+  /// \brief A hierarchical depth pyramid, used to reject draws hidden behind what was already rendered
+  ///
+  /// Level 0 is a copy of a depth texture, and every texel of the levels above holds the farthest depth of the texels
+  /// below it. A box whose nearest point is farther than every texel it covers is hidden. Levels are built by a compute
+  /// pass, and an odd sized level folds its last row and column into the level above, so every texel covers its whole
+  /// footprint.
+  ///
+  class KITAPI HiZBuffer
+  {
+    public:
+
+      static const uint32_t TextureUnit = 12; ///< The pyramid is bound to this unit, below the units of kit::LightGrid
+
+      HiZBuffer();
+      ~HiZBuffer();
+
+      ///
+      /// \brief Rebuilds the pyramid from a depth texture
+      /// \param depthTexture The depth texture, its resolution decides the resolution of the pyramid
+      /// \param viewProjectionMatrix The matrix the depth texture was rendered with
+      ///
+      void update(kit::Texture * depthTexture, glm::mat4 const & viewProjectionMatrix);
+
+      ///
+      /// \brief Sets the pyramid uniforms on a program and binds the pyramid. Call before dispatching with the program
+      ///
+      void bind(kit::Program * program);
+
+      bool isValid(); ///< False until the first update
+
+      glm::uvec2 getResolution();
+      uint32_t getLevelCount();
+      glm::mat4 const & getViewProjectionMatrix();
+
+    private:
+
+      void allocate(glm::uvec2 resolution);
+
+      kit::Program *  m_program = nullptr;
+      uint32_t        m_glTexture = 0;
+      glm::uvec2      m_resolution;
+      uint32_t        m_levelCount = 0;
+      glm::mat4       m_viewProjectionMatrix;
+      bool            m_valid = false;
+  };
+
+}
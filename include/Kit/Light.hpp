@@ -4,6 +4,7 @@
 #include "Kit/Types.hpp"
 #include "Kit/Transformable.hpp"
 #include "Kit/Cubemap.hpp"
+#include "Kit/ShadowAtlas.hpp"
 
 namespace kit 
 {
@@ -11,6 +12,10 @@ namespace kit
   
   class PixelBuffer;
   
+  class Renderable;
+  
+  class Camera;
+  
   class KITAPI Light : public kit::Transformable
   {
     public:
@@ -23,6 +28,44 @@ namespace kit
         IBL
       };
       
+      ///
+      /// \brief The shadow atlas tiles of a spot or point light, and the casters drawn into them. Maintained by kit::Renderer
+      ///
+      struct ShadowCache
+      {
+        glm::mat4 viewProjection;                                           ///< Light matrix the tiles were drawn with. Pointlights leave out the face rotation
+        std::vector<std::pair<kit::Renderable*, glm::mat4>> staticCasters; ///< Static casters inside the light volume, with the transforms they were drawn with
+        kit::ShadowAtlas::Tile tiles[6];                                    ///< One tile per face, in kit::Cubemap::Side order for pointlights
+        uint32_t tileCount = 0;                                             ///< 0 if the light got no room in the atlas this frame
+        bool tilesStaticOnly = false;                                       ///< The tiles hold exactly the static casters, and nothing else
+        uint64_t frame = 0;                                                 ///< Renderer frame the tiles were last drawn in. Other lights may have drawn over older tiles
+      };
+      
+      ///
+      /// \brief How the view distance covered by directional shadows is split into cascades
+      ///
+      enum class CascadeSplit : uint8_t
+      {
+        Uniform,      ///< Equally deep cascades
+        Logarithmic,  ///< Each cascade is a constant factor deeper than the previous one
+        Practical,    ///< A blend of the two, weighted by the split lambda
+        Manual        ///< Distances set by setCascadeSplitDistances
+      };
+      
+      ///
+      /// \brief One cascade of a directional shadow map. The cascades are laid out side by side in the shadow buffer
+      ///
+      struct Cascade
+      {
+        float     splitFar = 0.0f;                  ///< Distance from the camera where the cascade ends
+        glm::mat4 viewMatrix;                       ///< Light view for the current camera, see updateCascades
+        glm::mat4 projectionMatrix;                 ///< Texel-snapped light projection for the current camera
+        glm::mat4 shadowViewProjection;             ///< Light matrix the cascade was last rendered with, used when shading
+        glm::vec3 shadowDirection;                  ///< Light direction the cascade was last rendered with
+        uint32_t  updateInterval = 1;               ///< The cascade is rendered every this many frames
+        bool      rendered = false;                 ///< False until the cascade has been rendered once
+      };
+      
       Light(kit::Light::Type t, glm::uvec2 shadowmapsize = glm::uvec2(0, 0));
       ~Light();
       
@@ -44,13 +87,55 @@ namespace kit
 
       bool isShadowMapped();
       
-      kit::PixelBuffer* getShadowBuffer();
-      glm::mat4 getDirectionalProjectionMatrix();
-      glm::mat4 getDirectionalViewMatrix();
-      glm::mat4 getDirectionalModelMatrix(glm::vec3 pos, glm::vec3 forward);
-      void      setMaxShadowDistance(float);
+      kit::PixelBuffer* getShadowBuffer(); ///< Directional lights only, spot and point lights render to the renderers kit::ShadowAtlas
+      kit::Light::ShadowCache & getShadowCache();
+      void invalidateShadowCache(); ///< Forces the static shadow casters to be redrawn on the next frame
+      
+      glm::uvec2 getShadowmapSize(); ///< For spot and point lights, the largest atlas tile the light asks for
+      
+      ///
+      /// \brief Scales how important the shadows of this light are, compared to other lights competing for room in the shadow atlas. Defaults to 1
+      ///
+      void      setShadowPriority(float priority);
+      float     getShadowPriority();
+      
+      void      setMaxShadowDistance(float); ///< Distance from the camera covered by directional shadows
       float     getMaxShadowDistance();
       
+      ///
+      /// \brief Sets the number of directional shadow cascades, between 1 and 4. Recreates the shadow buffer
+      ///
+      void      setCascadeCount(uint32_t count);
+      uint32_t  getCascadeCount();
+      
+      ///
+      /// \brief Sets how the shadow distance is split into cascades
+      /// \param lambda Only used by CascadeSplit::Practical, 0 is uniform and 1 is logarithmic
+      ///
+      void      setCascadeSplit(kit::Light::CascadeSplit scheme, float lambda = 0.75f);
+      
+      ///
+      /// \brief Sets the far distance of each cascade, and switches to CascadeSplit::Manual
+      ///
+      void      setCascadeSplitDistances(std::vector<float> const & distances);
+      
+      ///
+      /// \brief Renders a cascade only every given number of frames. Distant cascades change little from frame to frame
+      ///
+      void      setCascadeUpdateInterval(uint32_t cascade, uint32_t frames);
+      
+      ///
+      /// \brief Recalculates the cascade splits and light matrices for a camera
+      ///
+      void      updateCascades(kit::Camera * camera);
+      
+      std::vector<kit::Light::Cascade> & getCascades();
+      glm::uvec2 getCascadeResolution(); ///< Resolution of a single cascade
+      
+      glm::mat4 getDirectionalProjectionMatrix(); ///< Projection of the first cascade, as of the last updateCascades
+      glm::mat4 getDirectionalViewMatrix(); ///< View of the first cascade, as of the last updateCascades
+      glm::mat4 getDirectionalModelMatrix(glm::vec3 pos, glm::vec3 forward); ///< Identity, the cascade matrices are in world space
+      
       glm::mat4 getSpotProjectionMatrix();
       glm::mat4 getSpotViewMatrix();
       kit::Cone* getSpotGeometry();
@@ -68,7 +153,14 @@ namespace kit
       bool                      m_shadowMapped;
       
       float                     m_maxShadowDistance;
+      glm::uvec2                m_shadowmapSize;
+      float                     m_shadowPriority = 1.0f;
+      std::vector<Cascade>      m_cascades;
+      CascadeSplit              m_cascadeSplit = CascadeSplit::Practical;
+      float                     m_cascadeLambda = 0.75f;
+      std::vector<float>        m_cascadeDistances; // Used by CascadeSplit::Manual
       kit::PixelBuffer*       m_shadowBuffer = nullptr;
+      ShadowCache               m_shadowCache;
       
       //kit::CubemapBuffer::Ptr    m_pointShadowMap;
       kit::Cone*              m_spotGeometry = nullptr;
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <vector>
+
+namespace kit
+{
+  class Camera;
+
+  class Light;
+
+  class Program;
+
+  ///
+  /// \brief Bins point and spot lights into view-space clusters, so they can all be shaded in a single full-screen pass
+  ///
+  /// The view frustum is split into GridWidth x GridHeight screen tiles and GridDepth exponentially spaced depth slices.
+  /// Every frame, each light is culled against the frustum and appended to the list of every cluster its bounding sphere touches.
+  /// The lights, the per-cluster ranges and the light index lists are uploaded as buffer textures.
+  ///
+  class KITAPI LightGrid
+  {
+    public:
+
+      static const uint32_t GridWidth = 16;
+      static const uint32_t GridHeight = 8;
+      static const uint32_t GridDepth = 24;
+      static const uint32_t MaxLightsPerCluster = 128; ///< Lights beyond this in a single cluster are dropped
+      static const uint32_t FirstTextureUnit = 13;     ///< The buffer textures are bound to this unit and the two after it, above the units kit::Program hands out
+
+      LightGrid();
+      ~LightGrid();
+
+      ///
+      /// \brief Culls and bins the given lights for the camera, and uploads the result
+      /// \param camera The camera the frame is rendered from
+      /// \param lights Point and spot lights, other light types are ignored
+      ///
+      void update(kit::Camera * camera, std::vector<kit::Light*> const & lights);
+
+      ///
+      /// \brief Sets the grid uniforms on a program and binds the buffer textures. Call before rendering with the program
+      ///
+      void bind(kit::Program * program);
+
+      uint32_t getLightCount(); ///< Number of lights that survived culling in the last update
+      uint32_t getIndexCount(); ///< Total number of light references over all clusters in the last update
+
+    private:
+
+      struct ClusterRange
+      {
+        glm::uvec3 min;
+        glm::uvec3 max;
+      };
+
+      void upload(uint32_t buffer, size_t bytes, const void * data);
+
+      uint32_t                m_glLightBuffer = 0;
+      uint32_t                m_glLightTexture = 0;
+      uint32_t                m_glClusterBuffer = 0;
+      uint32_t                m_glClusterTexture = 0;
+      uint32_t                m_glIndexBuffer = 0;
+      uint32_t                m_glIndexTexture = 0;
+      int32_t                 m_maxBufferTexels = 0;
+
+      glm::vec2               m_depthSlicing;            ///< slice = log(depth) * x + y
+      std::vector<glm::vec4>  m_lightData;               ///< 4 texels per light, see LightGrid.cpp
+      std::vector<ClusterRange> m_lightClusters;         ///< Clusters touched by each light
+      std::vector<uint32_t>   m_clusterData;             ///< Offset and count per cluster
+      std::vector<uint32_t>   m_indices;
+  };
+
+}
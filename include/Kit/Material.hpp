@@ -2,6 +2,7 @@
 
 #include "Kit/Export.hpp"
 #include "Kit/Types.hpp"
+#include "Kit/MaterialCache.hpp"
 
 #include <glm/gtx/transform.hpp>
 
@@ -14,6 +15,8 @@ namespace kit
   class PixelBuffer;
   class Camera;
   class Renderer;
+  class UniformBuffer;
+  class UniformRing;
   
   class KITAPI Material
   {
@@ -35,6 +38,8 @@ namespace kit
             std::tie(
               this->m_skinned,
               this->m_instanced,
+              this->m_batched,
+              this->m_lodFade,
               this->m_forward,
               this->m_opacityMask,
               this->m_dynamicAR,
@@ -50,6 +55,8 @@ namespace kit
             < std::tie(
               b.m_skinned,
               b.m_instanced,
+              b.m_batched,
+              b.m_lodFade,
               b.m_forward,
               b.m_opacityMask,
               b.m_dynamicAR,
@@ -66,6 +73,8 @@ namespace kit
         
         bool m_skinned;
         bool m_instanced;
+        bool m_batched;     ///< Per-draw transforms come from an instanced vertex attribute, see kit::DrawBatcher
+        bool m_lodFade;     ///< Dithers fragments away during a level-of-detail cross-fade, see kit::Model::setLodCrossFade
 
         bool m_forward;
         bool m_opacityMask;
@@ -95,7 +104,19 @@ namespace kit
 
       std::string getName();
       
-      void use(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform);
+      struct DrawCache;
+
+      ///
+      /// \param lodFade Below 1, keeps that fraction of the fragments in a dither pattern. Negative values keep the complement of the pattern of their absolute value
+      /// \param cache Kept by the caller for one draw, so that repeated draws skip looking up their program. May be nullptr
+      /// \returns The program that was bound, see kit::MaterialInstance
+      ///
+      kit::Program * use(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform, float lodFade = 1.0f, DrawCache * cache = nullptr);
+      
+      ///
+      /// \brief Binds the program used by kit::DrawBatcher, which reads each draws model matrix from vertex attribute 6
+      ///
+      void useBatched(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix);
       void useReflective(kit::Renderer * renderer, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform);
       
       const glm::vec3 & getAlbedo();
@@ -157,22 +178,81 @@ namespace kit
       kit::Texture * getEOCache();
       kit::Texture * getNDCache();
       
+      ///
+      /// \brief Bytes used by the baked caches of this material, counting caches shared with other materials in full
+      ///
+      uint64_t getCacheMemory();
+      
       void setUvScale(float v);
       void setDepthMask(std::shared_ptr<kit::Texture>);
       std::shared_ptr<kit::Texture> getDepthMask();
       float getUvScale();
 
       void assertCache();
-      ProgramFlags  getFlags(bool skinned, bool instanced);
+      ProgramFlags  getFlags(bool skinned, bool instanced, bool batched = false);
+
+      ///
+      /// \brief Requests every program this material may use, including the level-of-detail fade variants, so they compile in the background
+      ///
+      /// Programs that are not ready when a material is drawn are stood in for by a program that ignores the maps. Prewarm the
+      /// materials of a level while loading it, and call waitForPrograms() before the first frame to avoid the stand-ins entirely.
+      ///
+      void prewarm();
+
+      ///
+      /// \brief Blocks until every requested material program has finished compiling
+      ///
+      static void waitForPrograms();
+
+      ///
+      /// \brief The std140 layout of the MaterialBlock uniform block of material programs
+      ///
+      struct UniformBlock
+      {
+        glm::vec4 albedo;   ///< Albedo in rgb, roughness in w
+        glm::vec4 tint;     ///< Multiplied with the albedo, only differs from white for kit::MaterialInstance
+        glm::vec4 emissive; ///< Emissive color in rgb, emissive strength in w
+        glm::vec4 params;   ///< Metalness in x, opacity in y
+      };
+
+      ///
+      /// \returns The parameters as they are uploaded to the material uniform buffer
+      ///
+      UniformBlock const & getUniformBlock();
+
+      ///
+      /// \returns A counter that increases every time the parameters in the uniform block change
+      ///
+      uint32_t getUniformRevision();
+
+      ///
+      /// \returns A counter that increases every time a change calls for different programs, see kit::Mesh
+      ///
+      uint32_t getProgramRevision();
+
     private:
 
+      ///
+      /// \brief The std140 layout of the DrawBlock uniform block, pushed through a kit::UniformRing for every draw
+      ///
+      struct DrawBlock
+      {
+        glm::mat4 mvpMatrix;
+        glm::vec4 normalMatrix[3]; ///< A std140 mat3 takes three vec4 columns
+        glm::vec4 params;          ///< LOD fade in x
+      };
+
       void renderARCache();
       void renderNMCache();
       void renderEOCache();
       void renderNDCache();
+      void bakeCache(std::shared_ptr<kit::PixelBuffer> & cache, kit::MaterialCache::Key const & key);
 
       void updateUniforms();
+      struct ProgramUniforms;
+      kit::Program * bindProgram(kit::Program * currProgram, ProgramFlags flags, ProgramUniforms const * preparedUniforms, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform, float lodFade);
       static kit::Program * getProgram(ProgramFlags);
+      static ProgramFlags getFallbackFlags(ProgramFlags flags);
       
       static std::map<std::string, std::weak_ptr<kit::Material>> m_cache;
       static void allocateShared();
@@ -180,21 +260,56 @@ namespace kit
       static kit::Program * m_cacheProgram; // Program to re-render our caches for NM and AR and EO
       static uint32_t       m_instanceCount;
       static std::map<ProgramFlags, kit::Program *> m_programCache;
+
+      ///
+      /// \brief Handles of the per-draw uniforms of a material program, kit::Program::InvalidUniform where the program has none
+      ///
+      struct ProgramUniforms
+      {
+        uint32_t albedoMap, roughnessMap, ARMap;
+        uint32_t normalMap, metalnessMap, NMMap;
+        uint32_t reconstructNormal;
+        uint32_t emissiveMap, occlusionMap, EOMap;
+        uint32_t opacityMask;
+        uint32_t bones, instanceTransform;
+      };
+      static std::map<kit::Program *, ProgramUniforms> m_programUniforms; ///< Only holds programs that have finished compiling
+
+      static ProgramUniforms const * prepareProgram(kit::Program * program, ProgramFlags const & flags, bool wait); // Returns nullptr while the program is compiling
+
+    public:
+
+      ///
+      /// \brief The compiled program a draw resolved last, with its flags and uniform handles. Only valid for the program revision it was resolved at
+      ///
+      struct DrawCache
+      {
+        kit::Program *          program = nullptr;
+        ProgramUniforms const * uniforms = nullptr;
+        ProgramFlags            flags;
+        uint32_t                programRevision = 0;
+      };
+
+    private:
+
       static kit::Program *   m_reflectiveProgram;
+      static kit::UniformRing * m_drawRing;
       
       std::string m_filename;
 
-      kit::PixelBuffer * m_arCache = nullptr; // Baked cache of Albedo+Roughness
+      std::shared_ptr<kit::PixelBuffer> m_arCache; // Baked cache of Albedo+Roughness, see kit::MaterialCache
       bool                m_arDirty = true;
       
-      kit::PixelBuffer * m_nmCache = nullptr; // Baked cache of Normal+Metalness
+      std::shared_ptr<kit::PixelBuffer> m_nmCache; // Baked cache of Normal+Metalness
       bool                m_nmDirty = true;
 
-      kit::PixelBuffer * m_ndCache = nullptr; // Baked cache of Normal+Depth (Used for terrains)
+      std::shared_ptr<kit::PixelBuffer> m_ndCache; // Baked cache of Normal+Depth (Used for terrains)
       bool                m_ndDirty = true;
 
-      kit::PixelBuffer * m_eoCache = nullptr; // Baked cache of Emissive+Occlusion
+      std::shared_ptr<kit::PixelBuffer> m_eoCache; // Baked cache of Emissive+Occlusion
       bool                m_eoDirty = true;
+
+      bool                m_persistCaches = false; // Store baked caches on disk. Only while the inputs are still those of the material file
       
       bool              m_dynamicAR = false;
       bool              m_dynamicNM = false;
@@ -231,7 +346,15 @@ namespace kit
       kit::Program *   m_sProgram = nullptr;
       kit::Program *   m_iProgram = nullptr;
       kit::Program *   m_siProgram = nullptr;
+      kit::Program *   m_bProgram = nullptr;
+      kit::Program *   m_fadePrograms[4] = { nullptr, nullptr, nullptr, nullptr }; ///< LOD fade variants by skinned + 2 * instanced, looked up on first use
       bool             m_dirty = true;
+      uint32_t         m_programRevision = 0;
+
+      kit::UniformBuffer * m_uniformBuffer = nullptr;
+      UniformBlock     m_uniformBlock;
+      bool             m_uniformsDirty = true;
+      uint32_t         m_uniformRevision = 0;
 
       // SPECIFICS
       float            m_spec_uvScale = 1.0f;
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <map>
+#include <memory>
+#include <string>
+
+namespace kit
+{
+  class PixelBuffer;
+  class Texture;
+
+  ///
+  /// \brief Keeps the baked caches of kit::Material, shared between every material that bakes the same inputs
+  ///
+  /// A cache packs an RGB source and a single channel source into one RGBA8 texture with mipmaps. Caches are sized to their
+  /// largest source texture (up to the maximum resolution), and caches without source textures are a single texel, since the
+  /// material shaders read such constants from uniforms anyway. Identical inputs map to the same cache, which in particular
+  /// folds the constant caches of most materials into a handful of texels.
+  ///
+  /// Caches baked from material files are also stored on disk, mipmaps included, named by a hash of the contents of their source
+  /// texture files and their constants. Later runs load them from there instead of baking, and changed inputs simply hash to a
+  /// different file. Rebakes after a material is edited through its setters are only kept in memory.
+  ///
+  class KITAPI MaterialCache
+  {
+    public:
+
+      ///
+      /// \brief The inputs of a cache. Constants are ignored where a map replaces them
+      ///
+      struct Key
+      {
+        kit::Texture *  mapA = nullptr;
+        kit::Texture *  mapB = nullptr;
+        glm::vec3       defaultA;
+        float           defaultB = 0.0f;
+
+        bool operator<(Key const & b) const;
+      };
+
+      ///
+      /// \brief Returns the cache for the given inputs
+      /// \param created Set to true if the cache is new, and has to be baked by the caller before anything else acquires it
+      ///
+      static std::shared_ptr<kit::PixelBuffer> acquire(Key const & key, bool & created);
+
+      ///
+      /// \brief Writes a freshly baked cache to the disk cache, unless it is disabled or a source texture has no file
+      ///
+      static void store(Key const & key, kit::PixelBuffer * cache);
+
+      ///
+      /// \brief Sets the directory caches are stored in, which has to exist. An empty string disables the disk cache
+      ///
+      static void setDiskCacheDirectory(const std::string& directory);
+      static std::string const & getDiskCacheDirectory();
+
+      static glm::uvec2 getResolution(Key const & key); ///< The size a cache for the given inputs is created with
+
+      static uint64_t getMemory(kit::PixelBuffer * cache); ///< Bytes used by a cache, including its mipmaps
+      static uint64_t getTotalMemory(); ///< Bytes used by all live caches, each counted once
+      static uint32_t getCacheCount(); ///< Number of live caches
+
+      ///
+      /// \brief Caps the resolution of caches created from now on
+      ///
+      static void setMaxResolution(uint32_t resolution);
+      static uint32_t getMaxResolution();
+
+    private:
+      static Key normalize(Key const & key);
+      static bool getDiskPath(Key const & key, std::string & path);
+      static bool loadFromDisk(Key const & key, kit::PixelBuffer * cache);
+      static uint64_t hashFile(const std::string& filename);
+
+      static std::map<Key, std::weak_ptr<kit::PixelBuffer>> m_caches;
+      static uint32_t m_maxResolution;
+      static std::string m_diskCacheDirectory;
+      static std::map<std::string, uint64_t> m_fileHashes; ///< Source texture hashes, computed once per run
+  };
+
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+#include "Kit/Material.hpp"
+
+#include <memory>
+
+namespace kit
+{
+  class UniformBuffer;
+
+  ///
+  /// \brief Renders with the programs and caches of a parent material, overriding a few of its parameters
+  ///
+  /// An instance owns nothing but a copy of its parent's material uniform block with the overrides applied, which it binds in
+  /// place of the parent's after the parent has bound its program. That makes it cheap enough for per-object variation such as
+  /// tinting thousands of props that share a material. Overridden constants only apply where the parent does not read the
+  /// value from a map, while the tint multiplies the albedo either way.
+  /// Draws with an instance are not batched, since the batched program has no per-draw parameters.
+  ///
+  class KITAPI MaterialInstance
+  {
+    public:
+
+      MaterialInstance(std::shared_ptr<kit::Material> parent);
+      ~MaterialInstance();
+
+      std::shared_ptr<kit::Material> getParent();
+
+      ///
+      /// \brief Binds the program of the parent material with the overrides applied, see kit::Material::use
+      ///
+      void use(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform, float lodFade = 1.0f, kit::Material::DrawCache * cache = nullptr);
+
+      void setTint(glm::vec3 const & tint);
+      glm::vec3 const & getTint();
+
+      // Getters return the parent value unless overridden
+      void setAlbedo(glm::vec3 const & albedo);
+      glm::vec3 getAlbedo();
+
+      void setRoughness(float roughness);
+      float getRoughness();
+
+      void setMetalness(float metalness);
+      float getMetalness();
+
+      void setEmissiveColor(glm::vec3 const & color);
+      glm::vec3 getEmissiveColor();
+
+      void setEmissiveStrength(float strength);
+      float getEmissiveStrength();
+
+      ///
+      /// \brief Drops every override, and resets the tint to white
+      ///
+      void clearOverrides();
+
+    private:
+
+      enum Override : uint32_t
+      {
+        Albedo = 1 << 0,
+        Roughness = 1 << 1,
+        Metalness = 1 << 2,
+        EmissiveColor = 1 << 3,
+        EmissiveStrength = 1 << 4
+      };
+
+      void updateUniforms();
+
+      std::shared_ptr<kit::Material> m_parent;
+      uint32_t        m_overrides = 0;     ///< Override bits
+
+      kit::UniformBuffer * m_uniformBuffer = nullptr;
+      bool            m_uniformsDirty = true;
+      uint32_t        m_parentRevision = 0; ///< Uniform revision of the parent the buffer was built from
+
+      glm::vec3       m_tint = glm::vec3(1.0f, 1.0f, 1.0f);
+      glm::vec3       m_albedo;
+      float           m_roughness = 0.0f;
+      float           m_metalness = 0.0f;
+      glm::vec3       m_emissiveColor;
+      float           m_emissiveStrength = 0.0f;
+  };
+
+}
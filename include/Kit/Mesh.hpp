@@ -1,6 +1,8 @@
 #pragma once
 
 #include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+#include "Kit/Material.hpp"
 
 #include <glm/glm.hpp>
 
@@ -14,11 +16,22 @@ namespace kit
   class Submesh;
 
   class Material;
+
+  class MaterialInstance;
   
   class Camera;
 
   class Renderer;
   
+  class DrawBatcher;
+  
+  ///
+  /// \brief A set of named submeshes, each with its own material and levels of detail
+  ///
+  /// The entries are kept by name, but drawing walks a flat list of draw records compiled from them. The list is rebuilt when
+  /// entries are added or enabled, and single records are refreshed when an entry gets another material or the programs of its
+  /// material change.
+  ///
   class KITAPI Mesh 
   {
     public:
@@ -27,6 +40,9 @@ namespace kit
       {
         std::shared_ptr<kit::Submesh>  m_submesh;
         std::shared_ptr<kit::Material> m_material;
+        std::vector<std::shared_ptr<kit::Submesh>> m_lods; ///< Coarser levels of detail, level 1 first
+        
+        kit::Submesh * getLod(uint32_t level); ///< The given level of detail, or the coarsest one there is
       };
 
       enum class RenderPass : uint8_t
@@ -36,6 +52,22 @@ namespace kit
         Reflection
       };
       
+      ///
+      /// \brief Passes that select their level of detail separately. The geometry and reflection passes select from their own point of view,
+      /// while shadows select once per frame from the camera, since a caster renders into many shadow views of very different sizes
+      ///
+      enum class LodPass : uint8_t
+      {
+        Geometry,
+        Shadow,
+        Reflection
+      };
+      
+      static const std::vector<glm::mat4> NoTransforms; ///< The skin and instance transforms of render configs that have none
+
+      ///
+      /// \brief The state of a single render call. Transforms are viewed rather than copied, so they must outlive the call
+      ///
       struct RenderConfig
       {
         glm::mat4 viewMatrix;
@@ -45,8 +77,13 @@ namespace kit
         RenderPass renderPass;
         Renderer * renderer;
 
-        std::vector<glm::mat4> skinTransform;
-        std::vector<glm::mat4> instanceTransform;
+        std::vector<glm::mat4> const * skinTransform = &kit::Mesh::NoTransforms;
+        std::vector<glm::mat4> const * instanceTransform = &kit::Mesh::NoTransforms;
+        
+        uint32_t lod = 0;
+        float lodFade = 1.0f; ///< See kit::Material::use
+        
+        std::map<std::string, std::shared_ptr<kit::MaterialInstance>> const * materialInstances = nullptr; ///< Instances replacing the material of submeshes, by submesh name
       };
       
       ~Mesh();
@@ -55,18 +92,87 @@ namespace kit
       
       void render(RenderConfig const & config);
       
-      void renderGeometry();
+      void renderGeometry(uint32_t lod = 0);
+      
+      ///
+      /// \brief Submits the enabled, deferred submeshes to a batcher
+      ///
+      void submitBatched(kit::DrawBatcher * batcher, glm::mat4 const & modelMatrix, uint32_t lod = 0);
+
+      kit::AABB getBounds(); ///< Bounding box of the enabled submeshes, in model space
 
       void addSubmeshEntry(const std::string& name, std::shared_ptr<kit::Submesh> geometry, std::shared_ptr<kit::Material> material);
       
+      ///
+      /// \brief Appends the next coarser level of detail to a submesh. Mesh files pick up "<geometry>.lod<level>" files on their own
+      ///
+      void addSubmeshLod(const std::string& name, std::shared_ptr<kit::Submesh> geometry);
+      
+      ///
+      /// \brief Sets the screen sizes below which each level of detail takes over, level 1 first
+      ///
+      /// Screen sizes are the diameter of the bounding sphere over the height of the view. Levels without a size take over at half the size of the level before.
+      ///
+      void setLodScreenSizes(std::vector<float> const & sizes);
+      float getLodScreenSize(uint32_t level);
+      
+      ///
+      /// \brief Sets how far past a screen size a model must go before it changes level, as a fraction of the size
+      ///
+      void setLodHysteresis(float hysteresis);
+      float getLodHysteresis();
+      
+      uint32_t getLodCount(); ///< Levels of detail of the submesh with the most of them, including the full detail level
+      
+      ///
+      /// \brief Selects the level of detail for a screen size, moving away from the current level only once clear of the hysteresis band
+      ///
+      uint32_t selectLod(float screenSize, uint32_t current);
+      
+      ///
+      /// \returns The screen size of a world space box, as used by selectLod
+      ///
+      static float getScreenSize(kit::AABB const & bounds, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix);
+      
       void setSubmeshEnabled(const std::string& name, bool s);
       
       kit::Mesh::SubmeshEntry * getSubmeshEntry(const std::string& name);
+
       std::map<std::string, kit::Mesh::SubmeshEntry> & getSubmeshEntries();
 
+      ///
+      /// \returns A counter that increases every time a submesh is added, enabled or disabled, see kit::Model
+      ///
+      uint32_t getSubmeshRevision();
+
     private:
+
+      ///
+      /// \brief Everything the draw loops need about an enabled submesh, resolved ahead of time
+      ///
+      struct DrawRecord
+      {
+        kit::Mesh::SubmeshEntry * entry;
+        std::string const *       name;             ///< Key of the entry, for material instance lookups
+        kit::Material *           material;
+        uint32_t                  programRevision;  ///< See kit::Material::getProgramRevision
+        bool                      forward;
+        kit::Material::DrawCache  drawCache;        ///< Program the last draw resolved, see kit::Material::use
+      };
+
+      void assertDrawRecords();
+      void refreshDrawRecord(DrawRecord & record);
+
       std::map<std::string, kit::Mesh::SubmeshEntry> m_submeshEntries;
       std::map<std::string, bool> m_submeshesEnabled;
+
+      std::vector<DrawRecord> m_drawRecords;
+      bool m_drawRecordsDirty = true;
+      uint32_t m_submeshRevision = 0;
+      
+      std::vector<float> m_lodScreenSizes;
+      float m_lodHysteresis = 0.1f;
+      uint32_t m_lodCount = 1;
   };
 
 }
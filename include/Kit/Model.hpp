@@ -2,6 +2,7 @@
 
 #include "Kit/Export.hpp"
 #include "Kit/Renderable.hpp"
+#include "Kit/Mesh.hpp"
 
 namespace kit 
 {
@@ -11,6 +12,8 @@ namespace kit
   class Mesh;
   class Texture;
   class Skeleton;
+  class Occluder;
+  class MaterialInstance;
 
   class KITAPI Model : public kit::Renderable
   {
@@ -28,15 +31,49 @@ namespace kit
       
       void setInstancing(bool enabled, std::vector<glm::mat4> transforms);
       
+      ///
+      /// \brief Sets the stand-in that hides what is behind this model from the CPU occlusion culling, or null to hide nothing
+      ///
+      void setOccluder(std::shared_ptr<kit::Occluder> occluder);
+      void setOccluder(const std::string& geometry);
+      
+      ///
+      /// \brief Returns the material instance this model renders a submesh with, creating one from the submesh material if needed
+      ///
+      kit::MaterialInstance * getMaterialInstance(const std::string& submesh);
+      
+      ///
+      /// \brief Renders a submesh with the given material instance, which may be shared with other models, or with its own material if null
+      ///
+      void setMaterialInstance(const std::string& submesh, std::shared_ptr<kit::MaterialInstance> instance);
+      
+      ///
+      /// \brief Scales the screen size this model selects its level of detail by in a pass. Below 1 switches to coarser levels sooner
+      ///
+      void setLodBias(kit::Mesh::LodPass pass, float bias);
+      float getLodBias(kit::Mesh::LodPass pass);
+      uint32_t getLod(kit::Mesh::LodPass pass); ///< The level of detail last selected for a pass
+      
+      ///
+      /// \brief Dithers between the old and new level of detail in the geometry pass for the given number of frames, or switches at once if 0
+      ///
+      void setLodCrossFade(uint32_t frames);
+      uint32_t getLodCrossFade();
+      
       void update(double const & ms);
       void renderDeferred(kit::Renderer * renderer) override;
       void renderForward(kit::Renderer * renderer) override;
       void renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix) override;
+      bool isShadowComplete() override;
+      void prepareShadows(kit::Camera * camera) override;
       void renderGeometry() override;
       void renderReflection(Renderer *, const glm::mat4 & viewMatrix, const glm::mat4 & projectionMatrix) override;
       
-      virtual std::vector<glm::mat4> getSkin() override;
+      virtual std::vector<glm::mat4> const & getSkin() override;
       virtual bool isSkinned() override;
+      virtual bool getWorldBounds(kit::AABB & bounds) override;
+      virtual bool submitBatched(kit::DrawBatcher * batcher) override;
+      virtual kit::Occluder * getOccluder() override;
 
       glm::vec3 getBoneWorldPosition(const std::string& bone);
       glm::quat getBoneWorldRotation(const std::string& bone);
@@ -44,6 +81,9 @@ namespace kit
       static kit::Program* getShadowProgram(bool skinned, bool opacityMapped, bool instanced);
     private:
       
+      uint32_t selectLod(kit::Mesh::LodPass pass, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix);
+      bool isLodFading();
+      
       struct ShadowProgramFlags
       {
         bool skinned;
@@ -55,11 +95,34 @@ namespace kit
         }
       };
       
+      ///
+      /// \brief A submesh as drawn into shadow maps, with the shadow program resolved for its material
+      ///
+      struct ShadowDraw
+      {
+        kit::Mesh::SubmeshEntry * entry;
+        kit::Material *           material = nullptr; ///< Material the program was resolved for
+        kit::Program *            program = nullptr;
+        ShadowProgramFlags        flags;
+      };
+      
       bool m_ownMesh = false;
       kit::Mesh* m_mesh = nullptr;
       kit::Skeleton* m_skeleton = nullptr;
       bool m_instanced = false;
       std::vector<glm::mat4> m_instanceTransform;
+      std::shared_ptr<kit::Occluder> m_occluder;
+      std::map<std::string, std::shared_ptr<kit::MaterialInstance>> m_materialInstances;
+      
+      uint32_t m_lods[3] = { 0, 0, 0 };               ///< Selected level per kit::Mesh::LodPass
+      bool m_shadowComplete = true;                   ///< See isShadowComplete
+      std::vector<ShadowDraw> m_shadowDraws;          ///< Every submesh of m_shadowDrawsMesh, at m_shadowDrawsRevision
+      kit::Mesh * m_shadowDrawsMesh = nullptr;
+      uint32_t m_shadowDrawsRevision = 0;
+      float m_lodBias[3] = { 1.0f, 1.0f, 1.0f };
+      uint32_t m_lodFadeFrames = 0;
+      uint32_t m_lodFadeFrame = 0;
+      uint32_t m_lodFadeFrom = 0;                     ///< The level being faded out in the geometry pass
       
 
       static uint32_t               m_instanceCount;
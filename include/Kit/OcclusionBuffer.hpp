@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace kit
+{
+  ///
+  /// \brief A low-poly stand-in for the geometry of a renderable, rasterized into a kit::OcclusionBuffer
+  ///
+  /// It has to stay inside the geometry it stands in for, or it would hide things that are actually visible.
+  ///
+  class KITAPI Occluder
+  {
+    public:
+
+      Occluder(std::vector<glm::vec3> const & positions, std::vector<uint32_t> const & indices);
+
+      ///
+      /// \brief Loads the positions and indices of a geometry file, relative to ./data/geometry/
+      ///
+      static std::shared_ptr<kit::Occluder> load(const std::string& name);
+
+      std::vector<glm::vec3> const & getPositions();
+      std::vector<uint32_t> const & getIndices();
+
+    private:
+
+      static std::map<std::string, std::weak_ptr<kit::Occluder>> m_cache;
+
+      std::vector<glm::vec3>  m_positions;
+      std::vector<uint32_t>   m_indices;
+  };
+
+  ///
+  /// \brief A small depth buffer rasterized on the CPU, used to cull what is hidden behind occluders without asking the GPU
+  ///
+  /// Every frame, the occluders are clipped against the near plane, projected and binned into TileSize x TileSize tiles.
+  /// rasterize() then fills the tiles on a pool of threads started with the buffer, each thread taking whole tiles, and each
+  /// tile is filled 4 texels at a time where SSE2 is available. Depths are in the 0 to 1 range of
+  /// the default OpenGL depth range, and each texel keeps the nearest depth of the occluders covering its center.
+  /// A box is hidden if its nearest point is behind every texel its screen rectangle touches.
+  ///
+  class KITAPI OcclusionBuffer
+  {
+    public:
+
+      static const uint32_t TileSize = 32;
+
+      ///
+      /// \param resolution Width and height, rounded up to whole tiles
+      /// \param threadCount Threads used by rasterize(), 0 uses one per hardware thread
+      ///
+      OcclusionBuffer(glm::uvec2 resolution = glm::uvec2(256, 128), uint32_t threadCount = 0);
+      ~OcclusionBuffer();
+
+      ///
+      /// \brief Forgets the occluders of the last frame, and clears to the far plane
+      ///
+      void clear(glm::mat4 const & viewProjectionMatrix);
+
+      ///
+      /// \brief Projects and bins the triangles of an occluder
+      ///
+      void addOccluder(kit::Occluder & occluder, glm::mat4 const & modelMatrix);
+
+      ///
+      /// \brief Rasterizes every occluder added since clear()
+      ///
+      void rasterize();
+
+      ///
+      /// \returns false if the box is hidden behind the occluders. Boxes crossing the near plane are always visible
+      ///
+      bool isVisible(kit::AABB const & box) const;
+
+      float getDepth(uint32_t x, uint32_t y) const;
+      glm::uvec2 getResolution() const;
+      uint32_t getTriangleCount() const; ///< Triangles binned since clear(), after clipping
+
+    private:
+
+      // Vertices in texels, with the depth in z
+      struct Triangle
+      {
+        glm::vec3 v0;
+        glm::vec3 v1;
+        glm::vec3 v2;
+      };
+
+      void addTriangle(glm::vec4 const & c0, glm::vec4 const & c1, glm::vec4 const & c2);
+      glm::vec3 toScreen(glm::vec4 const & clip) const;
+      void rasterizeTile(uint32_t tile);
+      void rasterizeTiles();
+      void workerMain();
+
+      glm::uvec2              m_resolution;
+      glm::uvec2              m_tiles;
+      uint32_t                m_threadCount;
+      glm::mat4               m_viewProjectionMatrix;
+
+      std::vector<float>      m_depth;
+      std::vector<Triangle>   m_triangles;
+      std::vector<std::vector<uint32_t>> m_bins; ///< Triangles touching each tile
+
+      // Shared with the workers, guarded by m_mutex
+      std::vector<std::thread>  m_workers;
+      std::mutex                m_mutex;
+      std::condition_variable   m_condition;
+      std::condition_variable   m_finished;
+      uint64_t                  m_generation = 0; ///< Bumped by rasterize() to wake the workers
+      uint32_t                  m_busyWorkers = 0;
+      bool                      m_stopping = false;
+      std::atomic<uint32_t>     m_nextTile;
+  };
+
+}
@@ -6,6 +6,7 @@
 
 #include <vector>
 #include <array>
+#include <initializer_list>
 
 namespace kit {
 
@@ -116,7 +117,12 @@ namespace kit {
       /// \throws kit::Exception If colorattachments contain the wrong number of colors (1 per attachment required)
       /// \throws kit::Exception If called without a depth attachment (Use the other clear method)
       ///
-      void clear(std::vector<glm::vec4> colorattachments, float depthattachment);
+      void clear(std::vector<glm::vec4> const & colorattachments, float depthattachment);
+
+      ///
+      /// \brief Same as above, but takes braced lists of colors without building a vector
+      ///
+      void clear(std::initializer_list<glm::vec4> colorattachments, float depthattachment);
 
       ///
       /// \brief Clear the attachments
@@ -124,7 +130,8 @@ namespace kit {
       ///
       /// \throws kit::Exception If colorattachments contain the wrong number of colors (1 per attachment required)
       ///
-      void clear(std::vector<glm::vec4> colorattachments);
+      void clear(std::vector<glm::vec4> const & colorattachments);
+      void clear(std::initializer_list<glm::vec4> colorattachments);
 
       ///
       /// \brief Clear the depthattachment
@@ -208,6 +215,8 @@ namespace kit {
       void blitFrom(kit::PixelBuffer * source, bool colorMask, std::vector<std::array<bool, 4>> componentMask, bool depthMask, bool stencilMask);
 
     private:
+
+      void clearColors(glm::vec4 const * colors, size_t count);
       
       struct AttachmentEntry
       {
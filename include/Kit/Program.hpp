@@ -18,8 +18,19 @@ namespace kit {
   ///
   /// \brief An OpenGL Program
   ///
+  /// Uniforms can be set by name, or through handles resolved once with getUniformHandle(). Either way the program keeps a copy
+  /// of the last value it uploaded to each uniform, and skips uploads that would not change it. Uniforms are uploaded with
+  /// glProgramUniform, so setting them does not make the program current.
+  ///
+  /// Programs generated at runtime can be linked with linkAsync(), which returns without waiting for the driver. On drivers with
+  /// GL_KHR_parallel_shader_compile the work happens on the driver's compiler threads, and isReady() polls for completion.
+  /// Elsewhere linkAsync() only keeps the shaders, and isReady() compiles and links at most one pending program per frame, so a
+  /// burst of new programs is spread over several frames.
+  ///
   class KITAPI Program {
     public:
+
+      static const uint32_t InvalidUniform = 0xFFFFFFFF; ///< The handle of uniforms the program does not have, setting it does nothing
       
 
       typedef std::vector<std::string > const & SourceList;
@@ -98,6 +109,36 @@ namespace kit {
       ///
       bool link();
 
+      ///
+      /// \brief Compiles the given shaders and links them into this program, without waiting for either to finish
+      ///
+      /// Without parallel compilation nothing is handed to the driver yet, isReady() compiles and links once its budget allows.
+      /// \param shaders Sourced shaders. The program takes ownership of them, and deletes them once it is ready
+      ///
+      void linkAsync(std::vector<kit::Shader*> const & shaders);
+
+      ///
+      /// \brief Checks whether a program linked with linkAsync() has finished. Programs linked any other way are always ready
+      /// \param wait Blocks until the program is ready instead of polling
+      /// \returns True if the program can be used, see isLinked() for whether it linked successfully
+      ///
+      bool isReady(bool wait = false);
+
+      ///
+      /// \returns True if the program is ready and linked successfully
+      ///
+      bool isLinked();
+
+      ///
+      /// \returns True if the driver compiles and links programs in the background, see linkAsync()
+      ///
+      static bool hasParallelCompile();
+
+      ///
+      /// \brief Lets isReady() finish another pending program on drivers without parallel compilation. Called once per frame by kit::Renderer
+      ///
+      static void resetLinkBudget();
+
       ///
       /// \brief Tells OpenGL to use this program
       ///
@@ -184,6 +225,19 @@ namespace kit {
       ///
       void setUniform4f(const std::string& name, const glm::vec4 & value);
 
+      /// \brief Sets a vector of vec4s as a uniform
+      /// \param name The name of the uniform to set 
+      /// \param value The value to set as uniform
+      ///
+      void setUniform4fv(const std::string& name, const std::vector<glm::vec4> & value);
+
+      /// \brief Sets an array of vec4s as a uniform, without needing them in a vector
+      /// \param name The name of the uniform to set 
+      /// \param values The first value to set
+      /// \param count The number of values
+      ///
+      void setUniform4fv(const std::string& name, const glm::vec4 * values, size_t count);
+
       /// \brief Sets a mat3 as a uniform
       /// \param name The name of the uniform to set 
       /// \param value The value to set as uniform
@@ -208,17 +262,83 @@ namespace kit {
       ///
       uint32_t getUniformLocation(const std::string& name);
 
+      ///
+      /// \brief Resolves a uniform for the handle-based setters below, which skip the name lookup
+      /// \param name The name of the uniform
+      /// \returns The handle of the uniform, or InvalidUniform if the program has no such uniform
+      ///
+      uint32_t getUniformHandle(const std::string& name);
+      uint32_t getUniformHandle(const char * name);
+
+      // Overloads for string literals, which would otherwise build a std::string for every call
+      void setUniformTexture(const char * name, kit::Texture * texture);
+      void setUniformCubemap(const char * name, kit::Cubemap * cubemap);
+      void setUniform1f(const char * name, float value);
+      void setUniform1d(const char * name, double value);
+      void setUniform1i(const char * name, int32_t value);
+      void setUniform1ui(const char * name, uint32_t value);
+      void setUniform2f(const char * name, const glm::vec2 & value);
+      void setUniform3f(const char * name, const glm::vec3 & value);
+      void setUniform3fv(const char * name, const std::vector<glm::vec3> & value);
+      void setUniform4f(const char * name, const glm::vec4 & value);
+      void setUniform4fv(const char * name, const std::vector<glm::vec4> & value);
+      void setUniform4fv(const char * name, const glm::vec4 * values, size_t count);
+      void setUniformMat3(const char * name, const glm::mat3 & value);
+      void setUniformMat4(const char * name, const glm::mat4 & value);
+      void setUniformMat4v(const char * name, const std::vector<glm::mat4> & value);
+
+      void setUniformTexture(uint32_t handle, kit::Texture * texture);
+      void setUniformCubemap(uint32_t handle, kit::Cubemap * cubemap);
+      void setUniform1f(uint32_t handle, float value);
+      void setUniform1i(uint32_t handle, int32_t value);
+      void setUniform1ui(uint32_t handle, uint32_t value);
+      void setUniform2f(uint32_t handle, const glm::vec2 & value);
+      void setUniform3f(uint32_t handle, const glm::vec3 & value);
+      void setUniform3fv(uint32_t handle, const std::vector<glm::vec3> & value);
+      void setUniform4f(uint32_t handle, const glm::vec4 & value);
+      void setUniform4fv(uint32_t handle, const std::vector<glm::vec4> & value);
+      void setUniform4fv(uint32_t handle, const glm::vec4 * values, size_t count);
+      void setUniformMat3(uint32_t handle, const glm::mat3 & value);
+      void setUniformMat4(uint32_t handle, const glm::mat4 & value);
+      void setUniformMat4v(uint32_t handle, const std::vector<glm::mat4> & value);
+
+      ///
+      /// \brief Sources a uniform block of this program from a uniform buffer binding point, see kit::UniformBuffer
+      /// \param name The name of the block
+      /// \param binding The binding point
+      /// \returns False if the program has no such block
+      ///
+      bool setUniformBlock(const std::string& name, uint32_t binding);
+
       /// \brief For internal use
       void prepareTextures();
 
     private:
       void addShaders(kit::Shader::Type type, std::vector<std::string> const & sources, std::vector<kit::Shader*> & outShaders, kit::DataSource source = kit::DataSource::Data);
       
+      struct Uniform
+      {
+        int32_t               location = -1;
+        std::vector<uint8_t>  shadow;            ///< The last uploaded value, empty before the first upload
+        int32_t               unit = -1;         ///< The texture unit of samplers
+        uint32_t              target = 0;        ///< The texture target of samplers
+        uint32_t              texture = 0;       ///< The texture bound to the unit of samplers
+      };
+
+      Uniform * updateShadow(uint32_t handle, const void * value, size_t size); // Returns nullptr if the upload can be skipped
+      bool      assignUnit(Uniform & uniform);
+      bool      checkLinkStatus();
+
+      static uint32_t                           m_linkBudget;     ///< Pending programs isReady() may still finish this frame without parallel compilation
+
       std::string                               m_fileIdentifier;
       uint32_t			                        m_glHandle;
-      std::map<std::string, uint32_t>           m_locationCache;
-      std::map<uint32_t, kit::Texture*>      m_textures;
-      std::map<uint32_t, kit::Cubemap*>      m_cubemaps;
+      bool                                      m_linked = false;
+      std::vector<kit::Shader*>                 m_pendingShaders; ///< Shaders of a program linked with linkAsync() that is not ready yet
+      bool                                      m_linkDeferred = false; ///< The pending shaders are not compiled or attached yet, see linkAsync()
+      std::map<std::string, uint32_t, std::less<>> m_handles;
+      std::vector<Uniform>                      m_uniforms;
+      std::vector<uint32_t>                     m_samplers;       ///< Handles of the uniforms that have a texture unit
   };
 
 }
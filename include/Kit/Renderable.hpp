@@ -10,6 +10,10 @@ namespace  kit
   
   class Renderer;
   
+  class DrawBatcher;
+  
+  class Occluder;
+  
   class KITAPI Renderable : public kit::Transformable
   {
   public:
@@ -18,15 +22,52 @@ namespace  kit
     virtual ~Renderable();
     virtual void renderDeferred(Renderer *);
     virtual void renderForward(Renderer *);
+    
     virtual void renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix);
+    
+    ///
+    /// \returns false if the last renderShadows() left anything out or drew it without all of its detail, for example while a
+    /// program is still compiling, so that shadow maps cached by the renderer are drawn again
+    ///
+    virtual bool isShadowComplete();
+    
     virtual void renderGeometry();
     virtual void renderReflection(Renderer *, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix);
     
+    ///
+    /// \brief Called once per frame before the shadow casters render into any shadow view, with the camera the frame is seen from
+    ///
+    virtual void prepareShadows(kit::Camera * camera);
+    
     virtual bool isShadowCaster();
     virtual void setShadowCaster(bool s);
     
+    ///
+    /// \brief Static renderables promise not to move, animate or otherwise change shape, which lets the renderer cache what they draw, like their contribution to shadow maps
+    ///
+    virtual bool isStatic();
+    virtual void setStatic(bool s);
+    
+    ///
+    /// \brief Gets the world space bounding box, used for culling
+    /// \returns false if the renderable has no bounds, in which case it is never culled
+    ///
+    virtual bool getWorldBounds(kit::AABB & bounds);
+    
+    ///
+    /// \brief Hands the deferred draws of this renderable to a batcher, instead of rendering them in renderDeferred
+    /// \returns false if the renderable can not be batched, in which case renderDeferred is called as usual
+    ///
+    virtual bool submitBatched(kit::DrawBatcher * batcher);
+    
+    ///
+    /// \brief Gets the low-poly stand-in rasterized for CPU occlusion culling, in the space of the world transform
+    /// \returns null if the renderable hides nothing
+    ///
+    virtual kit::Occluder * getOccluder();
+    
     virtual bool isSkinned();
-    virtual std::vector<glm::mat4> getSkin();
+    virtual std::vector<glm::mat4> const & getSkin();
     
     virtual int32_t getRenderPriority(); // Lower values are rendered first
 
@@ -35,5 +76,6 @@ namespace  kit
 
   private:
     bool m_shadowCaster;
+    bool m_static;
   };
 }
@@ -38,12 +38,29 @@ namespace kit
   class Program;
   
 
-  class Sphere;
+  class LightGrid;
+  
+
+  class UniformBuffer;
+  
+
+  class ShadowAtlas;
+  
+
+  class DrawBatcher;
+  
+
+  class OcclusionBuffer;
+
+  class FrameArena;
   
 
   class GLTimer;
   
 
+  class Sphere;
+  
+
   class Quad;
   
 
@@ -89,7 +106,7 @@ namespace kit
     /// Renders the payload and composes a fully rendered frame, the result is retreivable using getBuffer()
     void renderFrame();
     
-    // Finds the first IBL light it can find, or nullptr if none
+    // Finds the first IBL light it can find, or nullptr if none. The result is kept for the rest of the frame
     kit::Light * findIBLLight();
 
     /// Gets a pointer to a texture containing the rendered payload
@@ -107,6 +124,30 @@ namespace kit
     void setShadows(bool const & enabled);
     bool const & getShadows();
 
+    /// Enables or disables batching of models into multi-draws in the geometry pass
+    void setBatching(bool const & enabled);
+    bool const & getBatching();
+
+    /// Enables or disables frustum culling of batched models on the GPU, instead of per model on the CPU
+    void setGpuCulling(bool const & enabled);
+    bool const & getGpuCulling();
+
+    /// Enables or disables occlusion culling of batched models against the depth of the previous frame. Needs GPU culling
+    void setOcclusionCulling(bool const & enabled);
+    bool const & getOcclusionCulling();
+
+    /// Enables or disables occlusion culling against model occluders rasterized on the CPU, before the geometry and shadow passes
+    void setSoftwareOcclusion(bool const & enabled);
+    bool const & getSoftwareOcclusion();
+    kit::OcclusionBuffer * getOcclusionBuffer();
+
+    /// Transient memory for the frame being rendered, released when the next frame starts. See kit::FrameVector
+    kit::FrameArena * getFrameArena();
+
+    /// Sets the width and height of the shadow atlas shared by spot and point lights, which bounds their shadowmap memory
+    void setShadowAtlasResolution(uint32_t const & resolution);
+    kit::ShadowAtlas * getShadowAtlas();
+
     /// Sets the active cameras exposure
     void setExposure(float const & exposure);
     float const & getExposure();
@@ -206,6 +247,8 @@ namespace kit
     /// Called on every resize
     void onResize();
     
+    void occlusionPass();
+    void updateFrameBlock();
     void geometryPass();
     void shadowPass();
     void lightPass();
@@ -219,6 +262,8 @@ namespace kit
 
     void updateBuffers();
     void renderLight(kit::Light *);
+    void renderShadowTiles(kit::Light * light, uint32_t request);
+    void renderShadowCascades(kit::Light * light);
     
     static void allocateShared();
     static void releaseShared();
@@ -292,10 +337,36 @@ namespace kit
     kit::Program *           m_programDirectional = nullptr;
     kit::Program *           m_programDirectionalNS = nullptr;
     kit::Program *           m_programSpot = nullptr;
-    kit::Program *           m_programSpotNS = nullptr;
     kit::Program *           m_programPoint = nullptr;
-    kit::Program *           m_programPointNS = nullptr;
     kit::Sphere *            m_pointGeometry = nullptr;
+    kit::Program *           m_programClustered = nullptr;
+    kit::LightGrid *         m_lightGrid = nullptr;
+    std::vector<kit::Light*> m_clusteredLights;
+    kit::Light *             m_iblLight = nullptr;    // Result of findIBLLight for m_iblLightFrame
+    uint64_t                 m_iblLightFrame = 0;
+
+    // The std140 layout of the FrameBlock uniform block, see kit::UniformBuffer::FrameBinding
+    struct FrameBlock
+    {
+      glm::mat4 viewMatrix;
+      glm::mat4 projectionMatrix;
+      glm::mat4 invViewMatrix;
+      glm::mat4 invProjectionMatrix;
+      glm::vec4 projConst;       // Depth linearization constants in xy
+      glm::vec4 cameraPosition;
+    };
+    kit::UniformBuffer *     m_frameBuffer = nullptr;
+
+    // Batching
+    kit::DrawBatcher *       m_drawBatcher = nullptr;
+    bool                     m_batchingEnabled = true;
+    bool                     m_gpuCullingEnabled = false;
+    bool                     m_occlusionCullingEnabled = false;
+
+    // CPU occlusion culling
+    kit::OcclusionBuffer *   m_occlusionBuffer = nullptr;
+    bool                     m_softwareOcclusionEnabled = false;
+    uint32_t                 m_occludedCount = 0;
 
     // Render payload (renderables, lights, camera)
     kit::Camera *            m_activeCamera = nullptr;
@@ -303,7 +374,32 @@ namespace kit
     kit::Skybox *           m_skybox = nullptr;
 
     // Shadow stuff
+    struct ShadowCaster
+    {
+      kit::Renderable *         renderable = nullptr;
+      kit::AABB                 bounds;
+      bool                      bounded = false; ///< Unbounded casters are never culled
+    };
+    
+    // Draws casters into one face of a light's tile, in the atlas or in its static copy. False if a caster was not drawn completely
+    bool renderShadowTile(kit::Light * light, kit::PixelBuffer * buffer, uint32_t request, uint32_t face, std::vector<ShadowCaster*> const & casters, bool clear);
+    
+    struct AtlasRequest
+    {
+      kit::Light *              light = nullptr;
+      uint32_t                  request = 0;     ///< Index of the lights request in the shadow atlas
+    };
+    
     bool                        m_shadowsEnabled = true;
+    kit::ShadowAtlas *          m_shadowAtlas = nullptr;
+    std::vector<AtlasRequest>   m_atlasRequests;  // Spot and point lights that asked for atlas tiles this frame
+    std::vector<ShadowCaster>   m_shadowCasters;  // Shadow casters of the current frame
+    std::vector<ShadowCaster*>  m_staticCasters;  // Static casters inside the light being rendered
+    std::vector<ShadowCaster*>  m_dynamicCasters; // Dynamic casters inside the light being rendered
+    std::vector<glm::mat4>      m_shadowMatrices;   // Cascade or cube face matrices of the light being shaded
+    std::vector<glm::vec4>      m_shadowRects;      // Atlas tiles of the cube faces of the pointlight being shaded
+    uint64_t                    m_frameIndex = 0;   // Counts rendered frames, used to schedule cascade updates
+    kit::FrameArena *           m_frameArena = nullptr; // Backs the containers that only live for one frame
     
     // Bloom stuff
     bool                        m_bloomEnabled = true;
@@ -359,6 +455,7 @@ namespace kit
     uint32_t                    m_framesCount = 0;
     uint32_t                    m_metricsFPS = 0;
     uint32_t                    m_metricsFPSCalibrated = 0;
+    uint64_t                    m_metricsAllocations = 0; ///< Everything the last frame allocated, metrics included
 
   };
   
@@ -60,6 +60,17 @@ namespace kit{
       ///
       bool compile();
 
+      ///
+      /// \brief Starts compiling the source without asking for the result, which lets the driver compile in the background
+      ///
+      void compileAsync();
+
+      ///
+      /// \brief Retrieves the result of compileAsync(), waiting for the compilation to finish and dumping the source on errors
+      /// \returns true on success, false on failure
+      ///
+      bool checkCompileStatus();
+
       ///
       /// \brief Retrieve the internal OpenGL name for this shader object
       /// \returns the internal OpenGL name
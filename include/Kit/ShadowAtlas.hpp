@@ -0,0 +1,108 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <vector>
+
+namespace kit
+{
+  class PixelBuffer;
+
+  ///
+  /// \brief A single depth texture shared by the shadowmaps of all spot and point lights
+  ///
+  /// Every frame, each shadowed light requests one square tile per face (1 for spotlights, 6 for pointlights) with a desired size
+  /// and an importance. allocate() then shrinks the least important tiles until all of them fit in the atlas, dropping lights
+  /// entirely as a last resort, and packs them. Tile sizes are powers of two, so sorting them largest first and placing them
+  /// along a Z-order curve packs them without gaps.
+  ///
+  /// A second buffer with the same layout keeps only the static casters of each tile, so lights with dynamic casters in range can
+  /// restore their static depth and draw just the dynamic casters on top.
+  ///
+  class KITAPI ShadowAtlas
+  {
+    public:
+
+      ///
+      /// \brief A square region of the atlas, in texels
+      ///
+      struct Tile
+      {
+        glm::uvec2 offset;
+        uint32_t   size = 0;
+
+        bool operator==(Tile const & other) const;
+        bool operator!=(Tile const & other) const;
+      };
+
+      ///
+      /// \param resolution Width and height of the atlas, rounded down to a power of two
+      /// \param minTileSize Tiles are never shrunk below this size, rounded down to a power of two
+      /// \param maxTileSize Tiles are never larger than this size, rounded down to a power of two
+      ///
+      ShadowAtlas(uint32_t resolution = 4096, uint32_t minTileSize = 128, uint32_t maxTileSize = 1024);
+      ~ShadowAtlas();
+
+      ///
+      /// \brief Drops the requests of the previous frame
+      ///
+      void clearRequests();
+
+      ///
+      /// \brief Requests tiles for a light
+      /// \param faces Number of tiles, all of the same size
+      /// \param size Desired size of each tile, rounded up to a power of two and clamped to the tile size limits
+      /// \param importance Relative importance, less important lights are shrunk first when the atlas is full
+      /// \returns The index of the request, used with getTile()
+      ///
+      uint32_t request(uint32_t faces, uint32_t size, float importance);
+
+      ///
+      /// \brief Decides the size of every requested tile, and packs them in the atlas
+      ///
+      void allocate();
+
+      ///
+      /// \returns False if the request was dropped because the atlas was full
+      ///
+      bool isAllocated(uint32_t request);
+
+      kit::ShadowAtlas::Tile const & getTile(uint32_t request, uint32_t face);
+
+      ///
+      /// \returns The offset (xy) and scale (zw) that map a tile's 0 to 1 texture coordinates into the atlas
+      ///
+      glm::vec4 getTileRect(kit::ShadowAtlas::Tile const & tile);
+
+      ///
+      /// \brief Copies a tile from the static buffer into the same tile of the atlas
+      ///
+      void restoreStaticTile(kit::ShadowAtlas::Tile const & tile);
+
+      kit::PixelBuffer * getBuffer();
+      kit::PixelBuffer * getStaticBuffer(); ///< Same layout as getBuffer(), holding only the static casters
+      uint32_t getResolution();
+
+    private:
+
+      struct Request
+      {
+        uint32_t faces;
+        uint32_t size;
+        float    importance;
+        uint32_t firstTile;
+      };
+
+      uint32_t                m_resolution;
+      uint32_t                m_minTileSize;
+      uint32_t                m_maxTileSize;
+      kit::PixelBuffer *      m_buffer = nullptr;
+      kit::PixelBuffer *      m_staticBuffer = nullptr;
+
+      std::vector<Request>    m_requests;
+      std::vector<uint32_t>   m_order;           ///< Requests sorted by tile size
+      std::vector<Tile>       m_tiles;
+  };
+
+}
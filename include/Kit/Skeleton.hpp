@@ -80,7 +80,7 @@ namespace kit
 
       ~Skeleton();
   
-      std::vector<glm::mat4> getSkin();
+      std::vector<glm::mat4> const & getSkin(); ///< The bone palette, updated in place as the skeleton animates
 
       kit::Skeleton::Bone * getBone(const std::string& name);
       kit::Skeleton::Bone * getBone(uint32_t id);
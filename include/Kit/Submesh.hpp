@@ -7,6 +7,8 @@
 
 namespace kit 
 {
+  class GeometryPool;
+  
   class KITAPI Submesh 
   {
     public:
@@ -19,6 +21,21 @@ namespace kit
       void renderGeometry();
       void renderGeometryInstanced(uint32_t numInstances);
       
+      kit::AABB const & getBounds(); ///< Bounding box of the vertex positions, in model space
+      
+      ///
+      /// \brief Feeds vertex attributes 6 to 9 with one mat4 per instance from the given buffer, for kit::DrawBatcher
+      ///
+      void bindDrawTransforms(uint32_t glBuffer);
+      void unbindDrawTransforms();
+      
+      uint32_t getVertexArray();  ///< Shared by all submeshes
+      uint32_t getIndexCount();
+      uint32_t getFirstIndex();   ///< First index of this submesh in the shared index buffer
+      int32_t  getBaseVertex();   ///< Added to every index of this submesh
+      
+      static kit::GeometryPool * getGeometryPool(); ///< Holds the geometry of all submeshes
+      
       Submesh(const std::string& filename);
     private:
       void loadGeometry(const std::string& filename);
@@ -26,15 +43,17 @@ namespace kit
       // Cache
       static std::map<std::string, std::weak_ptr<kit::Submesh>> m_cache;
       
-      // Individual GPU data
-      void allocateBuffers();
-      void releaseBuffers();
+      // Shared GPU data
+      static kit::GeometryPool * m_geometryPool;
+      static uint32_t m_instanceCount;
+      static void allocateShared();
+      static void releaseShared();
       
-      uint32_t m_glVertexArray;   
-      uint32_t m_glVertexIndices; 
-      uint32_t m_glVertexBuffer;
+      bool     m_allocated = false;
+      uint32_t m_allocation;      ///< Handle in the geometry pool
       
       uint32_t m_indexCount;
+      kit::AABB m_bounds;
 
   };
 }
@@ -0,0 +1,142 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include "Kit/Renderable.hpp"
+#include "Kit/BakedTerrain.hpp"
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
+
+
+namespace kit
+{
+  class Renderer;
+
+
+  ///
+  /// \brief A grid of baked terrain tiles, paged in and out around the camera by background threads
+  ///
+  /// The world is described by ./data/terrains/<name>/world, with the lines "tiles <x> <y>", "tilesize <vertices>" and "xzscale <meters>".
+  /// Each tile is a regular baked terrain named <name>/<x>_<y>. Adjacent tiles share their edge row of vertices,
+  /// so tile centers are (tilesize - 1) * xzscale apart, and tile (0,0) is centered at the world origin.
+  ///
+  class KITAPI TerrainWorld : public kit::Renderable
+  {
+    public:
+
+      ///
+      /// \brief Opens a terrain world. No tiles are loaded until update() is called
+      /// \param name Name of the world, relative to ./data/terrains/
+      /// \param numWorkers Number of background threads loading tiles
+      ///
+      TerrainWorld(const std::string& name, uint32_t numWorkers = 2);
+      ~TerrainWorld();
+
+      ///
+      /// \brief Requests tiles around the camera, uploads finished loads and evicts tiles to stay within the memory budgets. Call once per frame
+      /// \param cameraPosition Camera position in world space
+      ///
+      void update(glm::vec3 const & cameraPosition);
+
+      void renderDeferred(kit::Renderer * renderer) override;
+      void renderGeometry() override;
+      void renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix) override;
+      bool isShadowComplete() override;
+      virtual int32_t getRenderPriority() override;
+
+      ///
+      /// \brief Samples the terrain height at a world position, across tile boundaries
+      /// \returns false if the tile at the position is not resident
+      ///
+      bool sampleHeight(float x, float z, float & height);
+
+      ///
+      /// \brief Samples the terrain normal at a world position, across tile boundaries
+      /// \returns false if the tile at the position is not resident
+      ///
+      bool sampleNormal(float x, float z, glm::vec3 & normal);
+
+      void setLoadDistance(float meters);     ///< Tiles with their center within this distance of the camera are paged in
+      void setCpuBudget(size_t bytes);        ///< Maximum CPU memory used by resident tiles
+      void setGpuBudget(size_t bytes);        ///< Maximum GPU memory used by resident tiles
+      void setUploadsPerUpdate(uint32_t uploads); ///< Maximum number of tiles uploaded to the GPU per update, to spread the cost over frames
+      void setDetailDistance(float meters);
+      void setRetryDelay(uint32_t updates);   ///< Updates to wait before loading a failed tile again, doubled on every further failure
+
+      ///
+      /// \brief Lets every tile that failed to load be requested again on the next update, instead of waiting out its retry delay
+      ///
+      void retryFailedTiles();
+
+      glm::uvec2 getTileCount();
+      float getTileSpacing();
+      kit::BakedTerrain * getTile(uint32_t x, uint32_t y); ///< Returns the tile at the given grid position, or nullptr if it is not resident
+
+      size_t getCpuMemoryUsage();
+      size_t getGpuMemoryUsage();
+
+    private:
+      enum class TileState : uint8_t
+      {
+        Unloaded,
+        Queued,     ///< Requested or being loaded by a worker
+        Resident,
+        Failed      ///< Not requested again until retryAt
+      };
+
+      struct Tile
+      {
+        TileState             state = TileState::Unloaded;
+        kit::BakedTerrain *   terrain = nullptr;
+        uint64_t              lastUsed = 0;   ///< Update in which the tile was last within load distance
+        size_t                cpuBytes = 0;
+        size_t                gpuBytes = 0;
+        uint32_t              failures = 0;   ///< Failed loads in a row
+        uint64_t              retryAt = 0;    ///< Update in which a failed tile may be requested again
+      };
+
+      void workerMain();
+      std::string getTileName(uint32_t tile);
+      glm::vec3 getTileCenter(uint32_t tile);
+      bool findTile(float x, float z, kit::BakedTerrain *& terrain, glm::vec2 & local);
+      void makeResident(uint32_t tile, kit::BakedTerrain::Data * data);
+      void evict(uint32_t tile);
+      void fail(uint32_t tile);
+
+      std::string                   m_name;
+      glm::uvec2                    m_tileCount;
+      uint32_t                      m_tileResolution = 0;
+      float                         m_xzScale = 1.0f;
+      std::vector<Tile>             m_tiles;
+      std::vector<std::pair<float, uint32_t>> m_wanted; ///< Tiles within load distance and their distance, kept between updates to reuse the storage
+      std::vector<bool>             m_isWanted;     ///< Tiles that fit in the budgets, one per tile
+
+      uint64_t                      m_updateCount = 0;
+      bool                          m_shadowComplete = true; ///< See isShadowComplete
+      float                         m_loadDistance = 1000.0f;
+      float                         m_detailDistance = 500.0f;
+      uint32_t                      m_uploadsPerUpdate = 1;
+      uint32_t                      m_retryDelay = 60;
+      size_t                        m_cpuBudget = 512 * 1024 * 1024;
+      size_t                        m_gpuBudget = 1024 * 1024 * 1024;
+      size_t                        m_cpuUsage = 0;
+      size_t                        m_gpuUsage = 0;
+      size_t                        m_tileCpuEstimate = 0; ///< Largest CPU cost of a single tile seen so far
+      size_t                        m_tileGpuEstimate = 0; ///< Largest GPU cost of a single tile seen so far
+
+      // Shared with the workers, guarded by m_mutex
+      std::vector<std::thread>      m_workers;
+      std::mutex                    m_mutex;
+      std::condition_variable       m_condition;
+      bool                          m_stopping = false;
+      std::deque<uint32_t>          m_requests;     ///< Tiles to load, nearest first
+      std::list<std::pair<uint32_t, kit::BakedTerrain::Data*>> m_results; ///< Loaded tiles waiting for upload, nullptr on failure
+      size_t                        m_maxResults = 0; ///< Workers stop picking up requests while this many results are waiting, to bound staging memory
+  };
+
+}
@@ -5,6 +5,7 @@
 #include "Kit/Types.hpp"
 
 #include <unordered_map>
+#include <vector>
 #include <memory>
 #include <string>
 
@@ -154,7 +155,15 @@ namespace kit{
         DepthComponent16 = GLK_DEPTH_COMPONENT16, 
         Depth32FStencil8 = GLK_DEPTH32F_STENCIL8, 
         Depth24Stencil8 = GLK_DEPTH24_STENCIL8, 
-        StencilIndex8 = GLK_STENCIL_INDEX8
+        StencilIndex8 = GLK_STENCIL_INDEX8,
+        BC1RGBA = GLK_COMPRESSED_RGBA_S3TC_DXT1_EXT,
+        BC1SRGBAlpha = GLK_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT,
+        BC3RGBA = GLK_COMPRESSED_RGBA_S3TC_DXT5_EXT,
+        BC3SRGBAlpha = GLK_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT,
+        BC4Red = GLK_COMPRESSED_RED_RGTC1,
+        BC5RG = GLK_COMPRESSED_RG_RGTC2,
+        BC7RGBA = GLK_COMPRESSED_RGBA_BPTC_UNORM,
+        BC7SRGBAlpha = GLK_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
       };
 
       ///
@@ -183,6 +192,20 @@ namespace kit{
         UnsignedInt2101010Rev = GLK_UNSIGNED_INT_2_10_10_10_REV
       };
 
+      ///
+      /// \brief How many channels a texture keeps from its image file
+      ///
+      /// Fewer channels take less memory. They are swizzled so shaders read them exactly as they read the RGBA8 texture before.
+      /// Only applies to textures loaded as RGBA8, sRGB and other formats always keep every channel.
+      ///
+      enum class Channels : uint8_t
+      {
+        Detect, ///< As many as the file has
+        One,    ///< Red only, stored as R8 and read as (r, r, r, 1). For masks, roughness, metalness and height maps
+        Two,    ///< Gray and alpha, stored as RG8 and read as (r, r, r, g)
+        All     ///< Every channel, stored in the format given
+      };
+
       /// 
       /// \brief Creates a 2D texture
       ///
@@ -194,10 +217,13 @@ namespace kit{
       /// 
       /// \brief Creates a 2D texture and loads its content from a file
       ///
+      /// DDS files are loaded in their block-compressed format with the mipmaps they carry, see kit::TextureCompressor.
+      ///
       /// \param filename Path to the source file, relative to the working directory.
-      /// \param format The internal format of the new texture
+      /// \param format The internal format of the new texture. For DDS files, only whether it is sRGB matters
+      /// \param channels The channels to keep, for 2D textures
       ///
-      Texture(const std::string& filename, InternalFormat format = RGBA8, uint8_t levels = 0, Type t = Type::Texture2D);
+      Texture(const std::string& filename, InternalFormat format = RGBA8, uint8_t levels = 0, Type t = Type::Texture2D, Channels channels = Channels::Detect);
       
       
       ///
@@ -218,21 +244,42 @@ namespace kit{
       /// 
       /// \brief Loads a texture from a file. This is probably want you want to use for regular 2D texture loading.
       ///
+      /// If a compressed "<name>.dds" exists next to the file, that is loaded instead. Throws if it can not be flipped exactly,
+      /// see kit::TextureCompressor::flipVertically.
+      ///
       /// \param name Path to the source file, relative to ./data/textures/
       /// \param srgb true if texture is sRGB-encoded
+      /// \param channels The channels to keep, for files that carry more than the texture needs
       ///
       /// \returns A shared pointer pointing to the newly created texture
       ///
-      static std::shared_ptr<kit::Texture> load(const std::string& name, bool srgb = true);
+      static std::shared_ptr<kit::Texture> load(const std::string& name, bool srgb = true, Channels channels = Channels::Detect);
 
 
       // ---- Operations
 
       ///
-      /// \brief Generates mipmaps for the current texture, based on its current contents
+      /// \brief Generates mipmaps for the current texture, based on its current contents. Does nothing on compressed textures
       ///
       void generateMipmap();
 
+      ///
+      /// \brief Uploads pixel data to a level of this 2D texture
+      /// \param data 8-bit pixel data matching the resolution of the level, bottom row first
+      /// \param format The channels in data, tightly packed
+      ///
+      void setPixelData(const uint8_t * data, uint32_t level = 0, Format format = RGBA);
+
+      ///
+      /// \brief Downloads a level of this 2D texture as RGBA8, bottom row first
+      ///
+      std::vector<uint8_t> getPixelData(uint32_t level = 0);
+
+      ///
+      /// \returns The resolution of a mip level of this texture
+      ///
+      glm::uvec2 getLevelResolution(uint32_t level);
+
       ///
       /// \brief Calculates the mip levels of this texture
       ///
@@ -262,7 +309,7 @@ namespace kit{
       bool saveToFile(const std::string& filename);
 
       ///
-      /// \brief Bind this texture
+      /// \brief Bind this texture to the first texture unit, through kit::GLState
       ///
       void bind();
 
@@ -346,12 +393,23 @@ namespace kit{
       ///
       InternalFormat getInternalFormat();
 
+      ///
+      /// \returns true if this texture has a block-compressed internal format
+      ///
+      bool isCompressed();
+
       ///
       /// \brief Get the internal handle for this texture
       /// \returns the internal handle for this texture
       ///
       uint32_t getHandle();
 
+      ///
+      /// \brief Get the type of this texture
+      /// \returns the type of this texture
+      ///
+      Type getType();
+
       ///
       /// \brief Gets the filename of this texture, if applicable
       /// \returns the filename for this texture
@@ -363,6 +421,9 @@ namespace kit{
     private:
 
       Texture(Type t);
+
+      void loadCompressed(const std::string& filename, bool srgb);
+      void setSwizzle(uint32_t r, uint32_t g, uint32_t b, uint32_t a);
       
       std::string         m_filename = "";
 
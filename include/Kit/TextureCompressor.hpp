@@ -0,0 +1,114 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+#include <string>
+#include <vector>
+
+namespace kit
+{
+  ///
+  /// \brief Encodes images to GPU block-compressed formats offline, and reads and writes the DDS files kit::Texture loads them from
+  ///
+  /// Every format stores 4x4 texel blocks in a fixed number of bytes, at 4 to 8 times less memory than RGBA8, and the GPU samples
+  /// them without decompressing first. Mipmaps cannot be generated from compressed data at runtime, so the files carry their own.
+  ///
+  /// The files are stored top row first, like DDS files from any other encoder. kit keeps textures bottom row first, so
+  /// kit::Texture flips the blocks when loading them. BC7 blocks can not be flipped that way, so kit::Texture refuses them.
+  ///
+  class KITAPI TextureCompressor
+  {
+    public:
+
+      ///
+      /// \brief Block-compressed formats, named after their Direct3D names
+      ///
+      enum Format
+      {
+        BC1, ///< RGB at 4 bits per texel, for opaque color maps
+        BC3, ///< RGBA at 8 bits per texel, for color maps with alpha
+        BC4, ///< One channel at 4 bits per texel, for masks and grayscale maps
+        BC5, ///< Two channels at 8 bits per texel, for the X and Y of normal maps
+        BC7  ///< RGBA at 8 bits per texel in higher quality. Read, but neither encoded nor loaded into textures by kit
+      };
+
+      ///
+      /// \brief What an image holds, which decides its format and how its mipmaps are filtered
+      ///
+      enum Usage
+      {
+        Color,      ///< BC1
+        ColorAlpha, ///< BC3
+        NormalMap,  ///< BC5, the shaders rebuild Z. Mipmaps are renormalized
+        Mask        ///< BC4, from the red channel
+      };
+
+      ///
+      /// \brief One mip level of compressed data
+      ///
+      struct KITAPI Level
+      {
+        glm::uvec2 resolution;
+        std::vector<uint8_t> data;
+      };
+
+      ///
+      /// \returns The format used for images with the given usage
+      ///
+      static Format getFormat(Usage usage);
+
+      ///
+      /// \returns The number of bytes in each 4x4 block of the given format
+      ///
+      static uint32_t getBlockSize(Format format);
+
+      ///
+      /// \returns The number of bytes a level of the given resolution takes
+      ///
+      static size_t getLevelSize(Format format, glm::uvec2 resolution);
+
+      ///
+      /// \brief Compresses one level
+      /// \param rgba RGBA8 pixel data, 4 bytes per texel
+      /// \throws kit::Exception if format is BC7
+      ///
+      static std::vector<uint8_t> encode(const uint8_t * rgba, glm::uvec2 resolution, Format format);
+
+      ///
+      /// \brief Halves an image with a box filter, for the next mip level
+      /// \param srgb Average in linear space, for sRGB-encoded color maps
+      /// \param normalMap Renormalize the averaged normals
+      ///
+      static std::vector<uint8_t> downsample(const uint8_t * rgba, glm::uvec2 resolution, bool srgb, bool normalMap);
+
+      ///
+      /// \brief Flips a level vertically by reordering its blocks and the texel rows inside them, without decoding it
+      /// \returns false if the level could not be flipped exactly. BC7 levels are left as they are, and levels whose height
+      /// is 4 or more but not a multiple of 4 end up shifted by the rows padding their last block
+      ///
+      static bool flipVertically(Format format, Level & level);
+
+      ///
+      /// \brief Compresses an image file, with mipmaps down to 1x1, and saves it as a DDS file
+      /// \param source Path to a PNG, TGA or any other file stb_image reads
+      /// \param destination Path to the new DDS file, usually "<source>.dds" so kit::Texture::load picks it up
+      /// \param srgb true if the image is sRGB-encoded
+      /// \returns true on success, false on failure. Fails for heights that kit::Texture could not flip exactly
+      ///
+      static bool compressFile(const std::string& source, const std::string& destination, Usage usage, bool srgb);
+
+      ///
+      /// \brief Saves compressed levels to a DDS file
+      ///
+      static bool writeDDS(const std::string& filename, Format format, bool srgb, std::vector<Level> const & levels);
+
+      ///
+      /// \brief Loads compressed levels from a DDS file, top row first as they are stored
+      /// \param srgb Set to true if the file is marked as sRGB-encoded
+      /// \throws kit::Exception if the file can not be read, or holds a format kit does not support
+      ///
+      static void readDDS(const std::string& filename, Format & format, bool & srgb, std::vector<Level> & levels);
+  };
+
+}
@@ -147,6 +147,14 @@
 #define GLK_DEPTH32F_STENCIL8 0x8CAD
 #define GLK_DEPTH24_STENCIL8 0x88F0
 #define GLK_STENCIL_INDEX8 0x8D48
+#define GLK_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GLK_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GLK_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#define GLK_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#define GLK_COMPRESSED_RED_RGTC1 0x8DBB
+#define GLK_COMPRESSED_RG_RGTC2 0x8DBD
+#define GLK_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GLK_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
 #define GLK_BYTE 0x1400
 #define GLK_UNSIGNED_BYTE 0x1401
 #define GLK_SHORT 0x1402
@@ -469,6 +477,48 @@ namespace kit{
     std::vector<kit::Vertex>            m_vertices;
     std::vector<uint32_t>            m_indices;
   };
+
+  ///
+  /// \brief An axis-aligned bounding box. A default constructed box is empty, and becomes valid once something is added to it
+  ///
+  struct KITAPI AABB
+  {
+    AABB();
+    AABB(glm::vec3 const & min, glm::vec3 const & max);
+
+    bool isValid() const;
+    void expand(glm::vec3 const & point);
+    void expand(kit::AABB const & box);
+
+    ///
+    /// \returns true if the boxes overlap
+    ///
+    bool intersects(kit::AABB const & box) const;
+
+    ///
+    /// \returns The box enclosing this box after it has been transformed by the given matrix
+    ///
+    kit::AABB transformed(glm::mat4 const & matrix) const;
+
+    glm::vec3 m_min;
+    glm::vec3 m_max;
+  };
+
+  ///
+  /// \brief The six planes of a view-projection volume, used to cull bounding boxes against cameras and lights
+  ///
+  struct KITAPI CullVolume
+  {
+    CullVolume();
+    CullVolume(glm::mat4 const & viewProjectionMatrix);
+
+    ///
+    /// \returns false if the box is completely outside the volume. Conservative, boxes just outside a corner of the volume may pass
+    ///
+    bool intersects(kit::AABB const & box) const;
+
+    glm::vec4 m_planes[6];
+  };
   
 }
 
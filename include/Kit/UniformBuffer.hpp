@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Kit/Export.hpp"
+#include "Kit/Types.hpp"
+
+namespace kit
+{
+  ///
+  /// \brief A std140 uniform block store, bound to a uniform buffer binding point
+  ///
+  /// Programs map their blocks to the binding points below with kit::Program::setUniformBlock. Data that changes once per frame
+  /// or once per material lives in its own buffer and is only re-uploaded when it changes, while data that changes with every draw
+  /// goes through a kit::UniformRing.
+  ///
+  class KITAPI UniformBuffer
+  {
+    public:
+
+      static const uint32_t FrameBinding = 0;    ///< Camera and projection data, see kit::Renderer
+      static const uint32_t MaterialBinding = 1; ///< Material parameters, see kit::Material
+      static const uint32_t DrawBinding = 2;     ///< Transforms of the current draw
+
+      UniformBuffer(size_t size);
+      ~UniformBuffer();
+
+      void update(const void * data, size_t size, size_t offset = 0);
+
+      void bind(uint32_t binding);
+
+      uint32_t getHandle();
+      size_t getSize();
+
+      static uint32_t getOffsetAlignment(); ///< Required alignment of bound ranges
+
+    private:
+      uint32_t m_glHandle = 0;
+      size_t   m_size = 0;
+  };
+
+  ///
+  /// \brief Streams small per-draw uniform blocks through one large buffer
+  ///
+  /// Every push writes behind the previous one and binds just that range, so consecutive draws never overwrite data the GPU may
+  /// still read. When the buffer is full its store is orphaned and writing starts over at the front.
+  ///
+  class KITAPI UniformRing
+  {
+    public:
+
+      UniformRing(size_t size = 1024 * 1024);
+      ~UniformRing();
+
+      ///
+      /// \brief Writes a block and binds it to the given binding point
+      ///
+      void push(uint32_t binding, const void * data, size_t size);
+
+    private:
+      uint32_t m_glHandle = 0;
+      size_t   m_size = 0;
+      size_t   m_offset = 0;
+      size_t   m_alignment = 256;
+  };
+
+}
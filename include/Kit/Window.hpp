@@ -64,6 +64,7 @@ namespace kit
         glm::uvec2         resolution; ///< The window resolution to set upon creation
         kit::Window *   sharedWindow = nullptr; ///< A window to share resources with, or nullptr
         bool               resizable = true; ///< True if window should be resizable
+        bool               visible = true; ///< False creates a hidden window, for tools that only need an OpenGL context
 
       private:
         kit::GLFWSingleton m_glfwSingleton;
@@ -0,0 +1,67 @@
+#include "Kit/AllocationCounter.hpp"
+
+#ifdef KIT_COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+  std::atomic<uint64_t> allocationCount(0);
+}
+
+void * operator new(std::size_t size)
+{
+  allocationCount++;
+
+  void * returner = std::malloc(size > 0 ? size : 1);
+  if (!returner)
+  {
+    throw std::bad_alloc();
+  }
+  return returner;
+}
+
+void operator delete(void * pointer) noexcept
+{
+  std::free(pointer);
+}
+
+void operator delete(void * pointer, std::size_t) noexcept
+{
+  std::free(pointer);
+}
+
+bool kit::AllocationCounter::isEnabled()
+{
+  return true;
+}
+
+uint64_t kit::AllocationCounter::getCount()
+{
+  return allocationCount.load();
+}
+
+void kit::AllocationCounter::reset()
+{
+  allocationCount = 0;
+}
+
+#else
+
+bool kit::AllocationCounter::isEnabled()
+{
+  return false;
+}
+
+uint64_t kit::AllocationCounter::getCount()
+{
+  return 0;
+}
+
+void kit::AllocationCounter::reset()
+{
+}
+
+#endif
@@ -1,6 +1,7 @@
 #include "Kit/BakedTerrain.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 
 #include "Kit/Program.hpp"
 #include "Kit/Material.hpp"
@@ -16,8 +17,16 @@
 #include <cstdlib>
 #include <sstream>
 
+uint32_t kit::BakedTerrain::m_instanceCount = 0;
+std::map<kit::BakedTerrain::ProgramFlags, kit::Program*> kit::BakedTerrain::m_programs;
+
 const char componentIndex[4] = {'r', 'g', 'b', 'a'};
 
+// Set on every draw, since the programs are shared between terrains
+static const char * arLayerUniforms[8] = {"uniform_arLayer0", "uniform_arLayer1", "uniform_arLayer2", "uniform_arLayer3", "uniform_arLayer4", "uniform_arLayer5", "uniform_arLayer6", "uniform_arLayer7"};
+static const char * ndLayerUniforms[8] = {"uniform_ndLayer0", "uniform_ndLayer1", "uniform_ndLayer2", "uniform_ndLayer3", "uniform_ndLayer4", "uniform_ndLayer5", "uniform_ndLayer6", "uniform_ndLayer7"};
+static const char * uvScaleUniforms[8] = {"uniform_uvScale0", "uniform_uvScale1", "uniform_uvScale2", "uniform_uvScale3", "uniform_uvScale4", "uniform_uvScale5", "uniform_uvScale6", "uniform_uvScale7"};
+
 static std::string getMaskSuffix(int layer)
 {
   std::string returner;
@@ -35,76 +44,299 @@ static std::string getMaskSuffix(int layer)
   return returner;
 }
 
-kit::BakedTerrain::BakedTerrain(std::string const & name)
+// Reads a baked TGA image, uncompressed or RLE. Done by hand rather than through stb, since stb keeps its flip setting in a global and we load from worker threads
+static void readBakedImage(std::string const & filename, kit::BakedTerrain::ImageData & image)
 {
-  glGenVertexArrays(1, &m_glVertexArray);
-  glGenBuffers(1, &m_glVertexIndices);
-  glGenBuffers(1, &m_glVertexBuffer);
-  
-  uint32_t vertexDataLen = 0;
-  float * vertexData = nullptr;
-  uint32_t * indexData = nullptr;
-  
+  std::ifstream f(filename, std::ios_base::in | std::ios_base::binary);
+  if(!f)
+  {
+    KIT_THROW("Could not open image \"" + filename + "\"");
+  }
+
+  uint8_t header[18];
+  f.read((char*)header, sizeof(header));
+
+  uint8_t imageType = header[2];
+  uint32_t width = uint32_t(header[12]) | (uint32_t(header[13]) << 8);
+  uint32_t height = uint32_t(header[14]) | (uint32_t(header[15]) << 8);
+  uint32_t bytesPerPixel = header[16] / 8;
+  bool topDown = (header[17] & 0x20) != 0;
+
+  if(!f || header[1] != 0 || (imageType != 2 && imageType != 10) || (bytesPerPixel != 3 && bytesPerPixel != 4) || width == 0 || height == 0)
+  {
+    KIT_THROW("Unsupported image format in \"" + filename + "\"");
+  }
+
+  f.seekg(header[0], std::ios_base::cur);
+
+  // Read the pixels in file order, BGR(A)
+  std::vector<uint8_t> raw(width * height * bytesPerPixel);
+  if(imageType == 2)
+  {
+    f.read((char*)&raw[0], raw.size());
+  }
+  else
+  {
+    size_t current = 0;
+    while(current < raw.size() && f)
+    {
+      uint8_t packet = kit::readUint8(f);
+      size_t count = ((packet & 0x7F) + 1) * bytesPerPixel;
+      count = (glm::min)(count, raw.size() - current);
+
+      if(packet & 0x80)
+      {
+        uint8_t pixel[4];
+        f.read((char*)pixel, bytesPerPixel);
+        for(size_t i = 0; i < count; i++)
+        {
+          raw[current + i] = pixel[i % bytesPerPixel];
+        }
+      }
+      else
+      {
+        f.read((char*)&raw[current], count);
+      }
+      current += count;
+    }
+  }
+
+  if(!f)
+  {
+    KIT_THROW("Unexpected end of image \"" + filename + "\"");
+  }
+
+  // Convert to RGBA, bottom row first
+  image.size = glm::uvec2(width, height);
+  image.pixels.resize(width * height * 4);
+  for(uint32_t y = 0; y < height; y++)
+  {
+    uint8_t const * source = &raw[(topDown ? (height - 1 - y) : y) * width * bytesPerPixel];
+    uint8_t * destination = &image.pixels[y * width * 4];
+    for(uint32_t x = 0; x < width; x++)
+    {
+      destination[x * 4 + 0] = source[x * bytesPerPixel + 2];
+      destination[x * 4 + 1] = source[x * bytesPerPixel + 1];
+      destination[x * 4 + 2] = source[x * bytesPerPixel + 0];
+      destination[x * 4 + 3] = (bytesPerPixel == 4) ? source[x * bytesPerPixel + 3] : 255;
+    }
+  }
+}
+
+kit::BakedTerrain::Data * kit::BakedTerrain::loadData(std::string const & name)
+{
+  Data * data = new Data();
+  data->name = name;
+
   std::string dataDirectory = "./data/terrains/" + name + "/baked/";
-  
-  // Load data
+
+  try
   {
-    std::cout << "Loading vertex data from disk" << std::endl;
-    std::ifstream f(dataDirectory + "vertexdata", std::ios_base::in | std::ios_base::binary);
-    if(!f)
+    // Load vertex data
     {
-      KIT_THROW("Failed to load terrain \"" + name + "\": could not load vertexdata.");
+      std::ifstream f(dataDirectory + "vertexdata", std::ios_base::in | std::ios_base::binary);
+      if(!f)
+      {
+        KIT_THROW("Failed to load terrain \"" + name + "\": could not load vertexdata.");
+      }
+
+      // Read index-data length (in ints), and index data
+      data->indices.resize(kit::readUint32(f));
+      f.read((char*)&data->indices[0], data->indices.size() * sizeof(uint32_t));
+
+      // Read vertex-data length (in floats), and vertex data
+      data->vertices.resize(kit::readUint32(f));
+      f.read((char*)&data->vertices[0], data->vertices.size() * sizeof(float));
+
+      if(!f)
+      {
+        KIT_THROW("Failed to load terrain \"" + name + "\": vertexdata is truncated.");
+      }
     }
 
-    // Read index-data length (in ints)
-    m_indexCount = kit::readUint32(f);
+    // Load maps
+    readBakedImage(dataDirectory + "arcache.tga", data->arCache);
+    readBakedImage(dataDirectory + "nxcache.tga", data->nxCache);
 
-    // Read index data
-    indexData = new uint32_t[m_indexCount];
-    for (uint32_t i = 0; i < m_indexCount; i++)
+    try
     {
-      indexData[i] = kit::readUint32(f);
+      readBakedImage(dataDirectory + "materialmask0.tga", data->materialMask[0]);
+      readBakedImage(dataDirectory + "materialmask1.tga", data->materialMask[1]);
     }
+    catch(...)
+    {
+
+    }
+
+    // Load header
+    {
+      std::string currLine;
+
+      std::ifstream f(dataDirectory + "header", std::ios_base::in);
+      if(!f)
+      {
+        KIT_THROW("Failed to load terrain \"" + name + "\": could not load header.");
+      }
+
+      while(std::getline(f, currLine))
+      {
+        if(kit::trim(currLine) == "")
+        {
+          continue;
+        }
+
+        auto args = kit::splitString(currLine);
+
+        if(args[0] == "xzscale" && args.size() == 2)
+        {
+          data->xzScale = (float)std::atof(args[1].c_str());
+        }
+
+        if (args[0] == "yscale" && args.size() == 2)
+        {
+          data->yScale = (float)std::atof(args[1].c_str());
+        }
+
+        if(args[0] == "numlayers" && args.size() == 2)
+        {
+          int numLayers = std::atoi(args[1].c_str());
+          if(numLayers > 8)
+          {
+            KIT_THROW("Too many layers in terrain");
+          }
+          data->numLayers = (uint8_t)numLayers;
+        }
+
+        if(args[0] == "size" && args.size() == 3)
+        {
+          data->size.x = std::atoi(args[1].c_str());
+          data->size.y = std::atoi(args[2].c_str());
+        }
+
+        if(args[0] == "tilesize" && args.size() == 2)
+        {
+          data->tileSize = std::atoi(args[1].c_str());
+        }
+
+        if(args[0] == "layer" && args.size() == 3)
+        {
+          int currLayer = std::atoi(args[1].c_str());
+          if(currLayer >= 0 && currLayer <= 7 && currLayer < data->numLayers)
+          {
+            data->uvScale[currLayer] = (float)std::atof(args[2].c_str());
+            readBakedImage(dataDirectory + "arlayer" + std::to_string(currLayer) + ".tga", data->arLayer[currLayer]);
+            readBakedImage(dataDirectory + "ndlayer" + std::to_string(currLayer) + ".tga", data->ndLayer[currLayer]);
+          }
+          else
+          {
+            KIT_THROW("Invalid layer id");
+          }
+        }
+      }
     
-    // Read vertex-data length (in floats)
-    vertexDataLen = kit::readUint32(f);
-    
-    // Read vertex data
-    vertexData = new float[vertexDataLen];
-    for (uint32_t i = 0; i < vertexDataLen; i++)
+      f.close();
+    }
+
+    // Load layer usage, optional
+    {
+      std::ifstream f(dataDirectory + "layerusage", std::ios_base::in | std::ios_base::binary);
+      if(f && data->tileSize > 0)
+      {
+        data->tileCount.x = kit::readUint32(f);
+        data->tileCount.y = kit::readUint32(f);
+        data->layerUsage.resize(data->tileCount.x * data->tileCount.y);
+        if(!data->layerUsage.empty())
+        {
+          f.read((char*)&data->layerUsage[0], data->layerUsage.size());
+        }
+
+        if(!f || data->tileCount != (data->size + glm::uvec2(data->tileSize - 1)) / data->tileSize)
+        {
+          KIT_ERR("Warning: Ignoring invalid layer usage for terrain \"" + name + "\"");
+          data->layerUsage.clear();
+        }
+      }
+    }
+
+    // Load height data 
     {
-      vertexData[i] = kit::readFloat(f);
+      std::ifstream f(dataDirectory + "heightdata", std::ios_base::in | std::ios_base::binary);
+      if (!f)
+      {
+        KIT_THROW("Failed to load terrain \"" + name + "\": could not load heightdata.");
+      }
+
+      data->heightData.resize(data->size.x * data->size.y);
+      for(auto & currVertex : data->heightData)
+      {
+        currVertex.m_height = kit::readFloat(f);
+        currVertex.m_normal = kit::readVec3(f);
+      }
+
+      if(!f)
+      {
+        KIT_THROW("Failed to load terrain \"" + name + "\": heightdata is truncated.");
+      }
     }
-    f.close();
+  }
+  catch(...)
+  {
+    delete data;
+    throw;
   }
 
-  // Upload data
+  return data;
+}
+
+kit::BakedTerrain::BakedTerrain(std::string const & name) : kit::BakedTerrain(loadData(name))
+{
+
+}
+
+kit::BakedTerrain::BakedTerrain(Data * data)
+{
+  kit::BakedTerrain::m_instanceCount++;
+  if (kit::BakedTerrain::m_instanceCount == 1)
   {
-    std::cout << "Uploading data to GPU" << std::endl;
+    kit::BakedTerrain::allocateShared();
+  }
 
+  glGenVertexArrays(1, &m_glVertexArray);
+  glGenBuffers(1, &m_glVertexIndices);
+  glGenBuffers(1, &m_glVertexBuffer);
+
+  m_xzScale = data->xzScale;
+  m_yScale = data->yScale;
+  m_numLayers = data->numLayers;
+  m_size = data->size;
+  m_indexCount = (uint32_t)data->indices.size();
+  m_heightData.swap(data->heightData);
+
+  glm::vec2 halfSize = glm::vec2(m_size) * m_xzScale * 0.5f;
+  m_localBounds = kit::AABB();
+  for(auto & currVertex : m_heightData)
+  {
+    m_localBounds.expand(glm::vec3(-halfSize.x, currVertex.m_height * m_yScale, -halfSize.y));
+    m_localBounds.expand(glm::vec3(halfSize.x, currVertex.m_height * m_yScale, halfSize.y));
+  }
+
+  // Upload data
+  {
     glBindVertexArray(m_glVertexArray);
 
     // Upload indices
-    std::cout << "Uploading indices (" << (m_indexCount * sizeof(uint32_t)) << " bytes)" << std::endl;
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_glVertexIndices);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, m_indexCount * sizeof(uint32_t), &indexData[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, data->indices.size() * sizeof(uint32_t), &data->indices[0], GL_STATIC_DRAW);
 
     // Upload vertices 
-    std::cout << "Uploading vertices (" << (vertexDataLen * sizeof(float)) << " bytes)" << std::endl;
     glBindBuffer(GL_ARRAY_BUFFER, m_glVertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, vertexDataLen * sizeof(float) , &vertexData[0], GL_STATIC_DRAW);
-  }
+    glBufferData(GL_ARRAY_BUFFER, data->vertices.size() * sizeof(float) , &data->vertices[0], GL_STATIC_DRAW);
 
-  // Cleanup data
-  {
-    std::cout << "Cleaning up CPU copy" << std::endl;
-    delete[] indexData;
-    delete[] vertexData;
+    m_gpuMemoryUsage += data->indices.size() * sizeof(uint32_t) + data->vertices.size() * sizeof(float);
   }
   
   // Configure attributes
   {
-    std::cout << "Setting up GPU attributes" << std::endl;
     static const uint32_t attributeSize = sizeof(float) * 14;
 
     // Positions
@@ -127,149 +359,73 @@ kit::BakedTerrain::BakedTerrain(std::string const & name)
     glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, attributeSize, (void*) (sizeof(float) * 11) );
   }
 
-  // Load maps
+  // Create maps
   {
-    std::cout << "Loading maps" << std::endl;
-    m_arCache = new kit::Texture(dataDirectory + "arcache.tga");
-    m_arCache->setEdgeSamplingMode(Texture::Repeat);
-    m_arCache->setMinFilteringMode(Texture::LinearMipmapLinear);
-    m_arCache->setMagFilteringMode(Texture::Linear);
-    m_arCache->setAnisotropicLevel(8.0f);
-    m_arCache->generateMipmap();
-    
-    m_nxCache = new kit::Texture(dataDirectory + "nxcache.tga");
-    m_nxCache->setEdgeSamplingMode(Texture::Repeat);
-    m_nxCache->setMinFilteringMode(Texture::LinearMipmapLinear);
-    m_nxCache->setMagFilteringMode(Texture::Linear);
-    m_nxCache->setAnisotropicLevel(8.0f);
-    m_nxCache->generateMipmap();
-    
-    try
-    {
-      m_materialMask[0] = new kit::Texture(dataDirectory + "materialmask0.tga");
-      m_materialMask[0]->setEdgeSamplingMode(Texture::ClampToEdge);
-      m_materialMask[0]->setMinFilteringMode(Texture::LinearMipmapLinear);
-      m_materialMask[0]->setMagFilteringMode(Texture::Linear);
-      m_materialMask[0]->setAnisotropicLevel(8.0f);
-      m_materialMask[0]->generateMipmap();
-    
-      m_materialMask[1] = new kit::Texture(dataDirectory + "materialmask1.tga");
-      m_materialMask[1]->setEdgeSamplingMode(Texture::ClampToEdge);
-      m_materialMask[1]->setMinFilteringMode(Texture::LinearMipmapLinear);
-      m_materialMask[1]->setMagFilteringMode(Texture::Linear);
-      m_materialMask[1]->setAnisotropicLevel(8.0f);
-      m_materialMask[1]->generateMipmap();
-    }
-    catch (...)
-    {
-
-    }
-  }
-  
-  // Load header
-  {
-    std::cout << "Loading header" << std::endl;
-    std::string currLine;
-
-    std::ifstream f(dataDirectory + "header", std::ios_base::in);
-    if(!f)
+    m_arCache = createTexture(data->arCache, true);
+    m_nxCache = createTexture(data->nxCache, true);
+    m_materialMask[0] = createTexture(data->materialMask[0], false);
+    m_materialMask[1] = createTexture(data->materialMask[1], false);
+
+    // Layers that no tile uses are left out of the program entirely
+    m_usedLayers = 0xFF;
+    if(!data->layerUsage.empty())
     {
-      KIT_THROW("Failed to load terrain \"" + name + "\": could not load header.");
-    }
+      ImageData usage;
+      usage.size = data->tileCount;
+      usage.pixels = data->layerUsage;
 
-    while(std::getline(f, currLine))
-    {
-      if(kit::trim(currLine) == "")
+      m_usedLayers = 1;
+      for(size_t i = 0; i < data->layerUsage.size(); i++)
       {
-        continue;
+        m_usedLayers |= data->layerUsage[i];
       }
 
-      auto args = kit::splitString(currLine);
-
-      if(args[0] == "xzscale" && args.size() == 2)
-      {
-        m_xzScale = (float)std::atof(args[1].c_str());
-      }
-
-      if (args[0] == "yscale" && args.size() == 2)
-      {
-        m_yScale = (float)std::atof(args[1].c_str());
-      }
-
-      if(args[0] == "numlayers" && args.size() == 2)
-      {
-        m_numLayers = std::atoi(args[1].c_str());
-        if(m_numLayers > 8)
-        {
-          KIT_THROW("Too many layers in terrain");
-        }
-      }
+      // One byte of layer bits per tile
+      m_tileSize = data->tileSize;
+      m_layerUsage = new kit::Texture(usage.size, kit::Texture::R8, 1);
+      m_layerUsage->setPixelData(&usage.pixels[0], 0, kit::Texture::Red);
+      m_layerUsage->setEdgeSamplingMode(Texture::ClampToEdge);
+      m_layerUsage->setMinFilteringMode(Texture::Nearest);
+      m_layerUsage->setMagFilteringMode(Texture::Nearest);
+      m_gpuMemoryUsage += usage.pixels.size();
+    }
 
-      if(args[0] == "size" && args.size() == 3)
+    for(int i = 0; i < m_numLayers; i++)
+    {
+      m_layerInfo[i].used = (m_usedLayers & (1 << i)) != 0 && !data->arLayer[i].pixels.empty();
+      m_layerInfo[i].uvScale = data->uvScale[i];
+      if(m_layerInfo[i].used)
       {
-        m_size.x = std::atoi(args[1].c_str());
-        m_size.y = std::atoi(args[2].c_str());
-      }
-
-      if(args[0] == "layer" && args.size() == 3)
-      {
-        int currLayer = std::atoi(args[1].c_str());
-        if(currLayer >= 0 && currLayer <= 7 && currLayer < m_numLayers)
-        {
-          m_layerInfo[currLayer].uvScale = (float)std::atof(args[2].c_str());
-          m_layerInfo[currLayer].used = true;
-
-          std::stringstream currAr;
-          currAr << dataDirectory << "arlayer" << currLayer << ".tga";
-          m_layerInfo[currLayer].arCache = new kit::Texture(currAr.str());
-          m_layerInfo[currLayer].arCache->setEdgeSamplingMode(Texture::Repeat);
-          m_layerInfo[currLayer].arCache->setMinFilteringMode(Texture::LinearMipmapLinear);
-          m_layerInfo[currLayer].arCache->setMagFilteringMode(Texture::Linear);
-          m_layerInfo[currLayer].arCache->setAnisotropicLevel(8.0f);
-          m_layerInfo[currLayer].arCache->generateMipmap();
-
-          std::stringstream currNm;
-          currNm << dataDirectory << "ndlayer" << currLayer << ".tga";
-          m_layerInfo[currLayer].ndCache = new kit::Texture(currNm.str());
-          m_layerInfo[currLayer].ndCache->setEdgeSamplingMode(Texture::Repeat);
-          m_layerInfo[currLayer].ndCache->setMinFilteringMode(Texture::LinearMipmapLinear);
-          m_layerInfo[currLayer].ndCache->setMagFilteringMode(Texture::Linear);
-          m_layerInfo[currLayer].ndCache->setAnisotropicLevel(8.0f);
-          m_layerInfo[currLayer].ndCache->generateMipmap();
-        }
-        else
-        {
-          KIT_THROW("Invalid layer id");
-        }
+        m_layerInfo[i].arCache = createTexture(data->arLayer[i], true);
+        m_layerInfo[i].ndCache = createTexture(data->ndLayer[i], true);
       }
     }
-  
-    f.close();
   }
 
-  // Load height data 
-  {
-    std::ifstream f(dataDirectory + "heightdata", std::ios_base::in | std::ios_base::binary);
-    if (!f)
-    {
-      KIT_THROW("Failed to load terrain \"" + name + "\": could not load heightdata.");
-    }
+  delete data;
 
-    // Reserve and load height data
-    m_heightData.reserve(m_size.x * m_size.y);
-    for (unsigned int i = 0; i < m_size.y * m_size.x; i++)
-    {
-      kit::BakedTerrain::Vertex adder;
-      adder.m_height = kit::readFloat(f);
-      adder.m_normal = kit::readVec3(f);
-      m_heightData.push_back(adder);
-    }
+  m_valid = true;
+  updateGpuProgram();
+}
 
+kit::Texture * kit::BakedTerrain::createTexture(ImageData const & image, bool repeat)
+{
+  if(image.pixels.empty())
+  {
+    return nullptr;
   }
 
-  m_valid = true;
-  std::cout << "Generating GPU program and verifying cache" << std::endl;
-  updateGpuProgram();
+  kit::Texture * returner = new kit::Texture(image.size, kit::Texture::RGBA8);
+  returner->setPixelData(&image.pixels[0]);
+  returner->setEdgeSamplingMode(repeat ? Texture::Repeat : Texture::ClampToEdge);
+  returner->setMinFilteringMode(Texture::LinearMipmapLinear);
+  returner->setMagFilteringMode(Texture::Linear);
+  returner->setAnisotropicLevel(8.0f);
+  returner->generateMipmap();
+
+  m_gpuMemoryUsage += (image.pixels.size() * 4) / 3;
+
+  return returner;
 }
 
 kit::BakedTerrain::~BakedTerrain()
@@ -278,15 +434,15 @@ kit::BakedTerrain::~BakedTerrain()
   glDeleteBuffers(1, &m_glVertexBuffer);
   glDeleteVertexArrays(1, &m_glVertexArray);
   
+  if(m_layerUsage)
+    delete m_layerUsage;
+
   if(m_materialMask[0])
     delete m_materialMask[0];
 
   if(m_materialMask[1])
     delete m_materialMask[1];
   
-  if(m_program)
-    delete m_program;
-  
   if(m_arCache)
     delete m_arCache;
   
@@ -301,6 +457,12 @@ kit::BakedTerrain::~BakedTerrain()
     if(c.ndCache)
       delete c.ndCache;
   }
+
+  kit::BakedTerrain::m_instanceCount--;
+  if (kit::BakedTerrain::m_instanceCount == 0)
+  {
+    kit::BakedTerrain::releaseShared();
+  }
 }
 
 void kit::BakedTerrain::renderDeferred(kit::Renderer * renderer)
@@ -313,27 +475,52 @@ void kit::BakedTerrain::renderDeferred(kit::Renderer * renderer)
   glm::mat4 modelViewMatrix = renderer->getActiveCamera()->getViewMatrix() * getWorldTransformMatrix();
   glm::mat4 modelViewProjectionMatrix = renderer->getActiveCamera()->getProjectionMatrix() * renderer->getActiveCamera()->getViewMatrix() * getWorldTransformMatrix();
 
-  glDisable(GL_BLEND);
-  glDisable(GL_CULL_FACE);
+  // While the program for these layers is still compiling, draw the cached maps with the fallback, or nothing until that is ready too
+  kit::Program * program = m_program;
+  ProgramFlags flags = m_programFlags;
+  if(!program->isReady())
+  {
+    flags = ProgramFlags();
+    program = kit::BakedTerrain::getProgram(flags);
+    if(!program->isReady())
+    {
+      return;
+    }
+  }
+
+  kit::GLState::setBlend(false);
+  kit::GLState::setCulling(false);
   //glCullFace(GL_BACK);
 
-  m_program->setUniformMat4("uniform_mvMatrix", modelViewMatrix);
-  m_program->setUniformMat4("uniform_mvpMatrix", modelViewProjectionMatrix);
+  applyUniforms(program, flags);
+  program->setUniformMat4("uniform_mvMatrix", modelViewMatrix);
+  program->setUniformMat4("uniform_mvpMatrix", modelViewProjectionMatrix);
 
-  m_program->use();
+  program->use();
   
   renderGeometry();
 }
 
 void kit::BakedTerrain::renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
 {
-  glDisable(GL_CULL_FACE);
   auto program = kit::Model::getShadowProgram(false, false, false);
+  m_shadowComplete = program->isReady();
+  if(!m_shadowComplete)
+  {
+    return;
+  }
+
+  kit::GLState::setCulling(false);
   program->setUniformMat4("uniform_mvpMatrix", projectionMatrix * viewMatrix * getWorldTransformMatrix());
   program->use();
   renderGeometry();
 }
 
+bool kit::BakedTerrain::isShadowComplete()
+{
+  return m_shadowComplete;
+}
+
 void kit::BakedTerrain::renderGeometry()
 {
   if(!m_valid)
@@ -345,6 +532,20 @@ void kit::BakedTerrain::renderGeometry()
   glDrawElements( GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, (void*)0);
 }
 
+void kit::BakedTerrain::allocateShared()
+{
+  // Request the fallback first, so it is the first to finish
+  kit::BakedTerrain::getProgram(ProgramFlags());
+}
+
+void kit::BakedTerrain::releaseShared()
+{
+  for(auto & t : m_programs)
+    if(t.second) delete t.second;
+
+  m_programs.clear();
+}
+
 void kit::BakedTerrain::updateGpuProgram()
 {
   if(!m_valid)
@@ -352,6 +553,71 @@ void kit::BakedTerrain::updateGpuProgram()
     return;
   }
 
+  m_programFlags.numLayers = m_numLayers;
+  m_programFlags.usedLayers = 0;
+  m_programFlags.layerUsage = (m_layerUsage != nullptr);
+  for(int i = 0; i < m_numLayers; i++)
+  {
+    if (m_layerInfo[i].used)
+    {
+      m_programFlags.usedLayers |= uint8_t(1u << i);
+    }
+  }
+
+  m_program = kit::BakedTerrain::getProgram(m_programFlags);
+}
+
+void kit::BakedTerrain::applyUniforms(kit::Program * program, ProgramFlags const & flags)
+{
+  program->setUniformTexture("uniform_arCache", m_arCache);
+  program->setUniformTexture("uniform_nxCache", m_nxCache);
+
+  if (flags.usedLayers == 0)
+  {
+    return;
+  }
+
+  program->setUniform1f("uniform_detailDistance", m_detailDistance);
+  program->setUniform2f("uniform_detailScale", glm::vec2(m_size) * m_xzScale);
+
+  if (flags.numLayers > 1)
+  {
+    program->setUniformTexture("uniform_materialMask0", m_materialMask[0]);
+  }
+
+  if (flags.numLayers > 4)
+  {
+    program->setUniformTexture("uniform_materialMask1", m_materialMask[1]);
+  }
+
+  if (flags.layerUsage)
+  {
+    program->setUniformTexture("uniform_layerUsage", m_layerUsage);
+    program->setUniform2f("uniform_usageScale", glm::vec2(m_size) / float(m_tileSize));
+  }
+
+  // Layer-specific uniforms
+  for(int i = 0; i < flags.numLayers; i++)
+  {
+    if ((flags.usedLayers & (1u << i)) == 0)
+    {
+      continue;
+    }
+
+    program->setUniformTexture(arLayerUniforms[i], m_layerInfo[i].arCache);
+    program->setUniformTexture(ndLayerUniforms[i], m_layerInfo[i].ndCache);
+    program->setUniform1f(uvScaleUniforms[i], m_layerInfo[i].uvScale);
+  }
+}
+
+kit::Program * kit::BakedTerrain::getProgram(ProgramFlags const & flags)
+{
+  auto existing = m_programs.find(flags);
+  if(existing != m_programs.end())
+  {
+    return existing->second;
+  }
+
   // Generate vertexshader sourcecode
   std::stringstream vertexSource;
   {
@@ -440,27 +706,45 @@ void kit::BakedTerrain::updateGpuProgram()
     pixelSource << "}" << std::endl;
     pixelSource << std::endl;
     
-    // Uniforms
-    if (m_numLayers > 1)
-    {
-      pixelSource << "uniform sampler2D uniform_materialMask0;" << std::endl;
-    }
+    // Uniforms. Everything that differs between terrains is a uniform, so terrains with the same layers share the program
+    bool detail = (flags.usedLayers != 0);
+    pixelSource << "uniform sampler2D uniform_arCache;" << std::endl;
+    pixelSource << "uniform sampler2D uniform_nxCache;" << std::endl;
 
-    if (m_numLayers > 4)
+    if (detail)
     {
-      pixelSource << "uniform sampler2D uniform_materialMask1;" << std::endl;
-    }
+      pixelSource << "uniform float uniform_detailDistance;" << std::endl;
+      pixelSource << "uniform vec2 uniform_detailScale;" << std::endl;
 
-    pixelSource << "uniform sampler2D uniform_arCache;" << std::endl;
-    pixelSource << "uniform sampler2D uniform_nxCache;" << std::endl;
-    pixelSource << "uniform float uniform_detailDistance;" << std::endl;
+      if (flags.numLayers > 1)
+      {
+        pixelSource << "uniform sampler2D uniform_materialMask0;" << std::endl;
+      }
+
+      if (flags.numLayers > 4)
+      {
+        pixelSource << "uniform sampler2D uniform_materialMask1;" << std::endl;
+      }
+
+      if (flags.layerUsage)
+      {
+        pixelSource << "uniform sampler2D uniform_layerUsage;" << std::endl;
+        pixelSource << "uniform vec2 uniform_usageScale;" << std::endl;
+      }
+    }
     pixelSource << std::endl;
 
     // Layerspecific uniforms
-    for(int i = 0; i < m_numLayers; i++)
+    for(int i = 0; i < flags.numLayers; i++)
     {
+      if ((flags.usedLayers & (1u << i)) == 0)
+      {
+        continue;
+      }
+
       pixelSource << "uniform sampler2D uniform_arLayer" << i << ";" << std::endl;
       pixelSource << "uniform sampler2D uniform_ndLayer" << i << ";" << std::endl;
+      pixelSource << "uniform float uniform_uvScale" << i << ";" << std::endl;
       pixelSource << std::endl;
     }
 
@@ -468,57 +752,82 @@ void kit::BakedTerrain::updateGpuProgram()
     pixelSource << "void main()" << std::endl;
     pixelSource << "{" << std::endl;
 
-    // Prepare variables
+    // Start from the cached AR and NM maps, which is all there is beyond the detail distance
     pixelSource << "  vec2 fullUv = in_texCoords;" << std::endl;
-    pixelSource << "  vec2 detailUv = in_texCoords * vec2(" << (float)m_size.x * m_xzScale << ", " << (float)m_size.y  * m_xzScale << ");" << std::endl;
-    pixelSource << "  float linearDistance = distance(vec3(0.0), in_position.xyz / in_position.w);" << std::endl;
-
-    // Prepare output variables
-    pixelSource << "  vec4 arOut; " << std::endl;
-    pixelSource << "  vec3 nOut;" << std::endl;
-
-    // If the distance to the fragment is higher than the detail distance, output the cached AR and NM maps
-    pixelSource << "  if (linearDistance > uniform_detailDistance)" << std::endl;
-    pixelSource << "  {" << std::endl;
-    pixelSource << "    arOut = texture(uniform_arCache, fullUv);" << std::endl;
-    pixelSource << "    nOut = texture(uniform_nxCache, fullUv).rgb;" << std::endl;
-    pixelSource << "  }" << std::endl;
+    pixelSource << "  vec4 arOut = texture(uniform_arCache, fullUv);" << std::endl;
+    pixelSource << "  vec3 nOut = texture(uniform_nxCache, fullUv).rgb;" << std::endl;
 
     // Otherwise, do some magic
-    pixelSource << "  else" << std::endl;
-    pixelSource << "  {" << std::endl;
-
-    // Sample the materialmasks
-    if (m_numLayers > 1)
+    if (detail)
     {
-      pixelSource << "    vec4 materialMask0 = texture(uniform_materialMask0, fullUv);" << std::endl;
-    }
+      pixelSource << "  vec2 detailUv = in_texCoords * uniform_detailScale;" << std::endl;
+      pixelSource << "  float linearDistance = distance(vec3(0.0), in_position.xyz / in_position.w);" << std::endl;
 
-    if (m_numLayers > 4)
-    {
-      pixelSource << "    vec4 materialMask1 = texture(uniform_materialMask1, fullUv);" << std::endl;
-    }
+      // Gradients are taken up front, since the layer branches below are not uniform across tile edges
+      pixelSource << "  vec2 detailDx = dFdx(detailUv);" << std::endl;
+      pixelSource << "  vec2 detailDy = dFdy(detailUv);" << std::endl;
 
-    // Sample the layer maps
-    for (int i = 0; i < m_numLayers; i++)
-    {
-      pixelSource << "    vec4 ar" << i << " = texture(uniform_arLayer" << i << ", detailUv * " << m_layerInfo[i].uvScale << ");" << std::endl;
-      pixelSource << "    vec4 nd" << i << " = texture(uniform_ndLayer" << i << ", detailUv * " << m_layerInfo[i].uvScale << ");" << std::endl;
+      pixelSource << "  if (linearDistance <= uniform_detailDistance)" << std::endl;
+      pixelSource << "  {" << std::endl;
 
-      if (i == 0)
+      // Sample the materialmasks
+      if (flags.numLayers > 1)
       {
-        pixelSource << "    arOut = ar0;" << std::endl;
-        pixelSource << "    nOut = nd0.rgb;" << std::endl;
+        pixelSource << "    vec4 materialMask0 = texture(uniform_materialMask0, fullUv);" << std::endl;
       }
-      else
+
+      if (flags.numLayers > 4)
       {
-        pixelSource << "    arOut = blend2(arOut, ar" << i << ", materialMask" << getMaskSuffix(i) << " + nd" << i << ".a);" << std::endl;
-        pixelSource << "    nOut = blend2(vec4(nOut, 0.0), vec4(nd" << i << ".rgb, 0.0), materialMask" << getMaskSuffix(i) << " + nd" << i << ".a).rgb;" << std::endl;
+        pixelSource << "    vec4 materialMask1 = texture(uniform_materialMask1, fullUv);" << std::endl;
+      }
+
+      // Look up which layers this tile uses
+      if (flags.layerUsage)
+      {
+        pixelSource << "    ivec2 tile = ivec2(vec2(fullUv.x, 1.0 - fullUv.y) * uniform_usageScale);" << std::endl;
+        pixelSource << "    tile = clamp(tile, ivec2(0), textureSize(uniform_layerUsage, 0) - ivec2(1));" << std::endl;
+        pixelSource << "    uint layerUsage = uint(texelFetch(uniform_layerUsage, tile, 0).r * 255.0 + 0.5);" << std::endl;
       }
-    }
 
-    // We're done with generating output
-    pixelSource << "  }" << std::endl;
+      // Sample the layer maps, skipping the ones this tile does not use
+      for (int i = 0; i < flags.numLayers; i++)
+      {
+        if ((flags.usedLayers & (1u << i)) == 0)
+        {
+          continue;
+        }
+
+        std::string indent = "    ";
+        if (i != 0 && flags.layerUsage)
+        {
+          pixelSource << "    if ((layerUsage & " << (1u << i) << "u) != 0u)" << std::endl;
+          pixelSource << "    {" << std::endl;
+          indent = "      ";
+        }
+
+        pixelSource << indent << "vec4 ar" << i << " = textureGrad(uniform_arLayer" << i << ", detailUv * uniform_uvScale" << i << ", detailDx * uniform_uvScale" << i << ", detailDy * uniform_uvScale" << i << ");" << std::endl;
+        pixelSource << indent << "vec4 nd" << i << " = textureGrad(uniform_ndLayer" << i << ", detailUv * uniform_uvScale" << i << ", detailDx * uniform_uvScale" << i << ", detailDy * uniform_uvScale" << i << ");" << std::endl;
+
+        if (i == 0)
+        {
+          pixelSource << indent << "arOut = ar0;" << std::endl;
+          pixelSource << indent << "nOut = nd0.rgb;" << std::endl;
+        }
+        else
+        {
+          pixelSource << indent << "arOut = blend2(arOut, ar" << i << ", materialMask" << getMaskSuffix(i) << " + nd" << i << ".a);" << std::endl;
+          pixelSource << indent << "nOut = blend2(vec4(nOut, 0.0), vec4(nd" << i << ".rgb, 0.0), materialMask" << getMaskSuffix(i) << " + nd" << i << ".a).rgb;" << std::endl;
+        }
+
+        if (i != 0 && flags.layerUsage)
+        {
+          pixelSource << "    }" << std::endl;
+        }
+      }
+
+      // We're done with generating output
+      pixelSource << "  }" << std::endl;
+    }
     pixelSource << std::endl;
 
     // Prepare normalmapping and output
@@ -536,50 +845,18 @@ void kit::BakedTerrain::updateGpuProgram()
     pixelSource << "}" << std::endl;
   }
 
-  // Compile shader objects
+  // Compile and link in the background, see renderDeferred
   auto vertexShader = new kit::Shader(Shader::Type::Vertex);
   vertexShader->sourceFromString(vertexSource.str());
-  vertexShader->compile();
 
   auto pixelShader = new kit::Shader(Shader::Type::Fragment);
   pixelShader->sourceFromString(pixelSource.str());
-  pixelShader->compile();
-
-  // Link program
-  if(m_program)
-    delete m_program;
-  
-  m_program = new kit::Program();
-  m_program->attachShader(vertexShader);
-  m_program->attachShader(pixelShader);
-  m_program->link();
-  m_program->detachShader(vertexShader);
-  m_program->detachShader(pixelShader);
-
-  delete vertexShader;
-  delete pixelShader;
-  
-  // Update uniforms
-  if (m_numLayers > 1)
-  {
-    m_program->setUniformTexture("uniform_materialMask0", m_materialMask[0]);
-  }
 
-  if (m_numLayers > 4)
-  {
-    m_program->setUniformTexture("uniform_materialMask1", m_materialMask[1]);
-  }
-  
-  m_program->setUniformTexture("uniform_arCache", m_arCache);
-  m_program->setUniformTexture("uniform_nxCache", m_nxCache);
-  m_program->setUniform1f("uniform_detailDistance", 500.0f); //< TODO: Replace with configuration parameter
+  auto newProgram = new kit::Program();
+  newProgram->linkAsync({vertexShader, pixelShader});
 
-  // Layer-specific uniforms
-  for(int i = 0; i < m_numLayers; i++)
-  {
-    m_program->setUniformTexture("uniform_arLayer" + std::to_string(i), m_layerInfo[i].arCache);
-    m_program->setUniformTexture("uniform_ndLayer" + std::to_string(i), m_layerInfo[i].ndCache);
-  }
+  m_programs[flags] = newProgram;
+  return newProgram;
 }
 
 kit::Texture * kit::BakedTerrain::getArCache()
@@ -708,6 +985,17 @@ bool kit::BakedTerrain::checkCollision(glm::vec3 point)
   return sampleHeight(point.x, point.z) >= point.y;
 }
 
+bool kit::BakedTerrain::getWorldBounds(kit::AABB & bounds)
+{
+  if(!m_localBounds.isValid())
+  {
+    return false;
+  }
+
+  bounds = m_localBounds.transformed(getWorldTransformMatrix());
+  return true;
+}
+
 int32_t kit::BakedTerrain::getRenderPriority()
 {
   // Render priority at 990. We want to render it after anything else, except water which is at 1000)
@@ -717,5 +1005,84 @@ int32_t kit::BakedTerrain::getRenderPriority()
 
 void kit::BakedTerrain::setDetailDistance(const float& meters)
 {
-  m_program->setUniform1f("uniform_detailDistance", meters);
+  m_detailDistance = meters;
+}
+
+void kit::BakedTerrain::writeVertex(uint32_t x, uint32_t y)
+{
+  // Vertex layout is position(3), uv(2), normal(3), tangent(3), bitangent(3)
+  Vertex const & vertex = m_heightData[(m_size.x * y) + x];
+  size_t offset = size_t((m_size.x * y) + x) * 14 * sizeof(float);
+  float height = vertex.m_height * m_yScale;
+
+  // Rebuild the tangent frame around the normal the same way the editor bakes it, tangent along +u (+x) and bitangent = normal x tangent
+  glm::vec3 frame[3];
+  frame[0] = vertex.m_normal;
+  frame[1] = glm::normalize(glm::vec3(vertex.m_normal.y, -vertex.m_normal.x, 0.0f));
+  frame[2] = glm::cross(frame[0], frame[1]);
+
+#ifndef KIT_SHITTY_INTEL
+  glNamedBufferSubData(m_glVertexBuffer, offset + sizeof(float), sizeof(float), &height);
+  glNamedBufferSubData(m_glVertexBuffer, offset + sizeof(float) * 5, sizeof(frame), frame);
+#else
+  glBindBuffer(GL_ARRAY_BUFFER, m_glVertexBuffer);
+  glBufferSubData(GL_ARRAY_BUFFER, offset + sizeof(float), sizeof(float), &height);
+  glBufferSubData(GL_ARRAY_BUFFER, offset + sizeof(float) * 5, sizeof(frame), frame);
+#endif
+}
+
+void kit::BakedTerrain::stitchEdge(kit::BakedTerrain * neighbour, glm::ivec2 direction)
+{
+  if(!m_valid || neighbour == nullptr || !neighbour->m_valid || neighbour->m_size != m_size)
+  {
+    return;
+  }
+
+  // Tiles overlap by one row of vertices, so the edge exists in both. Average them, since each was baked without the other
+  bool vertical = (direction.x != 0);
+  uint32_t length = vertical ? m_size.y : m_size.x;
+  for(uint32_t i = 0; i < length; i++)
+  {
+    glm::uvec2 mine;
+    glm::uvec2 theirs;
+    if(vertical)
+    {
+      mine = glm::uvec2(direction.x > 0 ? m_size.x - 1 : 0, i);
+      theirs = glm::uvec2(direction.x > 0 ? 0 : m_size.x - 1, i);
+    }
+    else
+    {
+      mine = glm::uvec2(i, direction.y > 0 ? m_size.y - 1 : 0);
+      theirs = glm::uvec2(i, direction.y > 0 ? 0 : m_size.y - 1);
+    }
+
+    Vertex & a = m_heightData[(m_size.x * mine.y) + mine.x];
+    Vertex & b = neighbour->m_heightData[(m_size.x * theirs.y) + theirs.x];
+
+    float height = ((a.m_height * m_yScale) + (b.m_height * neighbour->m_yScale)) * 0.5f;
+    glm::vec3 normal = glm::normalize(a.m_normal + b.m_normal);
+
+    a.m_height = height / m_yScale;
+    a.m_normal = normal;
+    b.m_height = height / neighbour->m_yScale;
+    b.m_normal = normal;
+
+    m_localBounds.m_min.y = glm::min(m_localBounds.m_min.y, height);
+    m_localBounds.m_max.y = glm::max(m_localBounds.m_max.y, height);
+    neighbour->m_localBounds.m_min.y = glm::min(neighbour->m_localBounds.m_min.y, height);
+    neighbour->m_localBounds.m_max.y = glm::max(neighbour->m_localBounds.m_max.y, height);
+
+    writeVertex(mine.x, mine.y);
+    neighbour->writeVertex(theirs.x, theirs.y);
+  }
+}
+
+size_t kit::BakedTerrain::getCpuMemoryUsage()
+{
+  return m_heightData.size() * sizeof(Vertex);
+}
+
+size_t kit::BakedTerrain::getGpuMemoryUsage()
+{
+  return m_gpuMemoryUsage;
 }
@@ -2,6 +2,7 @@
 
 #include "Kit/Exception.hpp"
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 
 #include "Kit/stb/stb_image.h"
 
@@ -22,6 +23,7 @@ kit::Cubemap::Cubemap(uint32_t handle){
 
 kit::Cubemap::~Cubemap()
 {
+  kit::GLState::forgetTexture(this->m_glHandle);
   glDeleteTextures(1, &this->m_glHandle);
 }
 
@@ -298,12 +300,12 @@ kit::Cubemap * kit::Cubemap::createDepthmap(glm::uvec2 resolution)
 }
 
 void kit::Cubemap::bind(){
-  glBindTexture(GL_TEXTURE_CUBE_MAP, this->m_glHandle);
+  kit::GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, this->m_glHandle);
 }
 
 void kit::Cubemap::unbind()
 {
-  glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+  kit::GLState::bindTexture(0, GL_TEXTURE_CUBE_MAP, 0);
 }
 
 uint32_t kit::Cubemap::getHandle(){
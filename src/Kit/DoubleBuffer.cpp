@@ -32,13 +32,25 @@ void kit::DoubleBuffer::flip()
   m_backBuffer = f;
 }
 
-void kit::DoubleBuffer::clear(std::vector<glm::vec4> colors, float depth)
+void kit::DoubleBuffer::clear(std::vector<glm::vec4> const & colors, float depth)
 {
   m_backBuffer->clear(colors, depth);
   m_backBuffer->bind();
 }
 
-void kit::DoubleBuffer::clear(std::vector<glm::vec4> colors)
+void kit::DoubleBuffer::clear(std::vector<glm::vec4> const & colors)
+{
+  m_backBuffer->clear(colors);
+  m_backBuffer->bind();
+}
+
+void kit::DoubleBuffer::clear(std::initializer_list<glm::vec4> colors, float depth)
+{
+  m_backBuffer->clear(colors, depth);
+  m_backBuffer->bind();
+}
+
+void kit::DoubleBuffer::clear(std::initializer_list<glm::vec4> colors)
 {
   m_backBuffer->clear(colors);
   m_backBuffer->bind();
@@ -0,0 +1,367 @@
+#include "Kit/DrawBatcher.hpp"
+
+#include "Kit/IncOpenGL.hpp"
+#include "Kit/HiZBuffer.hpp"
+#include "Kit/Material.hpp"
+#include "Kit/Program.hpp"
+#include "Kit/Submesh.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <tuple>
+
+kit::DrawBatcher::DrawBatcher()
+{
+#ifndef KIT_SHITTY_INTEL
+  glCreateBuffers(1, &m_glTransformBuffer);
+  glCreateBuffers(1, &m_glCommandBuffer);
+  glCreateBuffers(1, &m_glCullBuffer);
+  glCreateBuffers(1, &m_glCountBuffer);
+  glCreateBuffers(1, &m_glRejectBuffer);
+#else
+  glGenBuffers(1, &m_glTransformBuffer);
+  glGenBuffers(1, &m_glCommandBuffer);
+  glGenBuffers(1, &m_glCullBuffer);
+  glGenBuffers(1, &m_glCountBuffer);
+  glGenBuffers(1, &m_glRejectBuffer);
+#endif
+
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (GLint i = 0; i < extensionCount; i++)
+  {
+    const char * currExtension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+    if (currExtension && std::strcmp(currExtension, "GL_ARB_indirect_parameters") == 0)
+    {
+      m_indirectCount = (glMultiDrawElementsIndirectCountARB != nullptr);
+    }
+  }
+}
+
+kit::DrawBatcher::~DrawBatcher()
+{
+  glDeleteBuffers(1, &m_glTransformBuffer);
+  glDeleteBuffers(1, &m_glCommandBuffer);
+  glDeleteBuffers(1, &m_glCullBuffer);
+  glDeleteBuffers(1, &m_glCountBuffer);
+  glDeleteBuffers(1, &m_glRejectBuffer);
+
+  if(m_cullProgram)
+    delete m_cullProgram;
+
+  if(m_hiZBuffer)
+    delete m_hiZBuffer;
+}
+
+void kit::DrawBatcher::upload(uint32_t buffer, size_t bytes, const void * data)
+{
+  // Respecifying the whole store orphans last frame's data instead of waiting for the GPU to finish with it
+#ifndef KIT_SHITTY_INTEL
+  glNamedBufferData(buffer, bytes, data, GL_STREAM_DRAW);
+#else
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glBufferData(GL_ARRAY_BUFFER, bytes, data, GL_STREAM_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+}
+
+void kit::DrawBatcher::clear(uint32_t buffer, size_t bytes)
+{
+  // A null clear value fills the store with zeroes
+  upload(buffer, bytes, nullptr);
+#ifndef KIT_SHITTY_INTEL
+  glClearNamedBufferData(buffer, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+#else
+  glBindBuffer(GL_ARRAY_BUFFER, buffer);
+  glClearBufferData(GL_ARRAY_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+#endif
+}
+
+void kit::DrawBatcher::submit(kit::Submesh * submesh, kit::Material * material, glm::mat4 const & modelMatrix)
+{
+  Draw newDraw;
+  newDraw.material = material;
+  newDraw.submesh = submesh;
+  newDraw.vertexArray = submesh->getVertexArray();
+  newDraw.transform = (uint32_t)m_submitted.size();
+  m_draws.push_back(newDraw);
+  m_submitted.push_back(modelMatrix);
+}
+
+void kit::DrawBatcher::flush(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, kit::Texture * depthTexture)
+{
+  m_drawCount = (uint32_t)m_draws.size();
+  m_callCount = 0;
+
+  if (m_draws.empty())
+  {
+    return;
+  }
+
+  // Group by material, then vertex array, then submesh. Ties keep their submission order, so draws stay sorted front to back within a command
+  std::sort(m_draws.begin(), m_draws.end(), [](Draw const & lhs, Draw const & rhs)
+  {
+    return std::tie(lhs.material, lhs.vertexArray, lhs.submesh, lhs.transform) < std::tie(rhs.material, rhs.vertexArray, rhs.submesh, rhs.transform);
+  });
+
+  if (m_gpuCulling)
+  {
+    flushCulled(viewMatrix, projectionMatrix, depthTexture);
+    m_draws.clear();
+    m_submitted.clear();
+    return;
+  }
+
+  m_transforms.clear();
+  m_commands.clear();
+  m_commandDraws.clear();
+  for (uint32_t i = 0; i < m_draws.size(); i++)
+  {
+    Draw & currDraw = m_draws[i];
+    m_transforms.push_back(m_submitted[currDraw.transform]);
+
+    if (!m_commandDraws.empty())
+    {
+      Draw & lastDraw = m_draws[m_commandDraws.back()];
+      if (lastDraw.material == currDraw.material && lastDraw.submesh == currDraw.submesh)
+      {
+        m_commands.back().instanceCount++;
+        continue;
+      }
+    }
+
+    DrawCommand newCommand;
+    newCommand.count = currDraw.submesh->getIndexCount();
+    newCommand.instanceCount = 1;
+    newCommand.firstIndex = currDraw.submesh->getFirstIndex();
+    newCommand.baseVertex = currDraw.submesh->getBaseVertex();
+    newCommand.baseInstance = i;
+    m_commands.push_back(newCommand);
+    m_commandDraws.push_back(i);
+  }
+
+  upload(m_glTransformBuffer, m_transforms.size() * sizeof(glm::mat4), &m_transforms[0]);
+  upload(m_glCommandBuffer, m_commands.size() * sizeof(DrawCommand), &m_commands[0]);
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_glCommandBuffer);
+
+  uint32_t firstCommand = 0;
+  while (firstCommand < m_commands.size())
+  {
+    Draw & firstDraw = m_draws[m_commandDraws[firstCommand]];
+
+    uint32_t lastCommand = firstCommand + 1;
+    while (lastCommand < m_commands.size())
+    {
+      Draw & currDraw = m_draws[m_commandDraws[lastCommand]];
+      if (currDraw.material != firstDraw.material || currDraw.vertexArray != firstDraw.vertexArray)
+      {
+        break;
+      }
+      lastCommand++;
+    }
+
+    firstDraw.material->useBatched(viewMatrix, projectionMatrix);
+    firstDraw.submesh->bindDrawTransforms(m_glTransformBuffer);
+    glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)(firstCommand * sizeof(DrawCommand)), lastCommand - firstCommand, 0);
+    firstDraw.submesh->unbindDrawTransforms();
+    m_callCount++;
+
+    firstCommand = lastCommand;
+  }
+
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+  m_draws.clear();
+  m_submitted.clear();
+}
+
+void kit::DrawBatcher::flushCulled(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, kit::Texture * depthTexture)
+{
+  // Every group gets one command slot per draw and pass, the culling passes fill them from the front
+  m_cullDraws.clear();
+  m_groupDraws.clear();
+  for (uint32_t i = 0; i < m_draws.size(); i++)
+  {
+    Draw & currDraw = m_draws[i];
+    if (m_groupDraws.empty() || m_draws[m_groupDraws.back()].material != currDraw.material || m_draws[m_groupDraws.back()].vertexArray != currDraw.vertexArray)
+    {
+      m_groupDraws.push_back(i);
+    }
+
+    kit::AABB const & bounds = currDraw.submesh->getBounds();
+
+    CullDraw newDraw;
+    newDraw.transform = m_submitted[currDraw.transform];
+    newDraw.boundsMin = glm::vec4(bounds.m_min, 0.0f);
+    newDraw.boundsMax = glm::vec4(bounds.m_max, 0.0f);
+    newDraw.command = glm::uvec4(currDraw.submesh->getIndexCount(), currDraw.submesh->getFirstIndex(), (uint32_t)currDraw.submesh->getBaseVertex(), (uint32_t)m_groupDraws.size() - 1);
+    newDraw.group = glm::uvec4(m_groupDraws.back(), 0, 0, 0);
+    m_cullDraws.push_back(newDraw);
+  }
+
+  uint32_t drawCount = (uint32_t)m_cullDraws.size();
+  uint32_t groupCount = (uint32_t)m_groupDraws.size();
+  upload(m_glCullBuffer, drawCount * sizeof(CullDraw), &m_cullDraws[0]);
+  upload(m_glTransformBuffer, 2 * drawCount * sizeof(glm::mat4), nullptr);
+  clear(m_glCommandBuffer, 2 * drawCount * sizeof(DrawCommand));
+  clear(m_glCountBuffer, 2 * groupCount * sizeof(uint32_t));
+  clear(m_glRejectBuffer, (1 + drawCount) * sizeof(uint32_t));
+
+  // The first frame has no pyramid to test against, so nothing is rejected and there is nothing to test again
+  bool occlusion = m_occlusionCulling && depthTexture != nullptr;
+  bool retest = occlusion && m_hiZBuffer->isValid();
+
+  kit::CullVolume cameraVolume(projectionMatrix * viewMatrix);
+
+  m_cullProgram->use();
+  m_cullProgram->setUniform1ui("uniform_drawCount", drawCount);
+  m_cullProgram->setUniform4fv("uniform_frustumPlanes", cameraVolume.m_planes, 6);
+  m_cullProgram->setUniform1i("uniform_occlusion", retest ? 1 : 0);
+  if (retest)
+  {
+    m_hiZBuffer->bind(m_cullProgram);
+  }
+
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, m_glCullBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, m_glCommandBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, m_glCountBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, m_glTransformBuffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, m_glRejectBuffer);
+
+  dispatchCulled(0, drawCount, groupCount);
+  drawCulled(0, drawCount, groupCount, viewMatrix, projectionMatrix);
+
+  if (occlusion)
+  {
+    // Built from the draws so far. It lacks the draws of the second pass, which only makes it less effective next frame
+    m_hiZBuffer->update(depthTexture, projectionMatrix * viewMatrix);
+
+    if (retest)
+    {
+      m_cullProgram->use();
+      m_hiZBuffer->bind(m_cullProgram);
+      dispatchCulled(1, drawCount, groupCount);
+      drawCulled(1, drawCount, groupCount, viewMatrix, projectionMatrix);
+    }
+  }
+
+  for (uint32_t i = 0; i < 5; i++)
+  {
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, 0);
+  }
+}
+
+void kit::DrawBatcher::dispatchCulled(uint32_t pass, uint32_t drawCount, uint32_t groupCount)
+{
+  m_cullProgram->setUniform1ui("uniform_pass", pass);
+  m_cullProgram->setUniform1ui("uniform_slotOffset", pass * drawCount);
+  m_cullProgram->setUniform1ui("uniform_countOffset", pass * groupCount);
+  glDispatchCompute((drawCount + 63) / 64, 1, 1);
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT);
+}
+
+void kit::DrawBatcher::drawCulled(uint32_t pass, uint32_t drawCount, uint32_t groupCount, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
+{
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, m_glCommandBuffer);
+  if (m_indirectCount)
+  {
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, m_glCountBuffer);
+  }
+
+  for (uint32_t group = 0; group < groupCount; group++)
+  {
+    uint32_t firstDraw = m_groupDraws[group];
+    uint32_t lastDraw = (group + 1 < groupCount) ? m_groupDraws[group + 1] : drawCount;
+    size_t commandOffset = (pass * drawCount + firstDraw) * sizeof(DrawCommand);
+    size_t countOffset = (pass * groupCount + group) * sizeof(uint32_t);
+    Draw & currDraw = m_draws[firstDraw];
+
+    currDraw.material->useBatched(viewMatrix, projectionMatrix);
+    currDraw.submesh->bindDrawTransforms(m_glTransformBuffer);
+    if (m_indirectCount)
+    {
+      glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, (GLintptr)commandOffset, (GLintptr)countOffset, lastDraw - firstDraw, 0);
+    }
+    else
+    {
+      // Culled commands are zeroed, and draw nothing
+      glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandOffset, lastDraw - firstDraw, 0);
+    }
+    currDraw.submesh->unbindDrawTransforms();
+    m_callCount++;
+  }
+
+  if (m_indirectCount)
+  {
+    glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+  }
+  glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+}
+
+void kit::DrawBatcher::setGpuCulling(bool enabled)
+{
+  if (enabled && !m_cullProgram)
+  {
+    m_cullProgram = new kit::Program({"culling/draw-cull.comp"}, kit::DataSource::Static);
+  }
+
+  m_gpuCulling = enabled;
+}
+
+bool kit::DrawBatcher::getGpuCulling()
+{
+  return m_gpuCulling;
+}
+
+void kit::DrawBatcher::setViewProjection(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
+{
+  m_viewMatrix = viewMatrix;
+  m_projectionMatrix = projectionMatrix;
+}
+
+glm::mat4 const & kit::DrawBatcher::getViewMatrix()
+{
+  return m_viewMatrix;
+}
+
+glm::mat4 const & kit::DrawBatcher::getProjectionMatrix()
+{
+  return m_projectionMatrix;
+}
+
+void kit::DrawBatcher::setOcclusionCulling(bool enabled)
+{
+  if (enabled && !m_hiZBuffer)
+  {
+    m_hiZBuffer = new kit::HiZBuffer();
+  }
+
+  m_occlusionCulling = enabled;
+}
+
+bool kit::DrawBatcher::getOcclusionCulling()
+{
+  return m_occlusionCulling;
+}
+
+kit::HiZBuffer * kit::DrawBatcher::getHiZBuffer()
+{
+  return m_hiZBuffer;
+}
+
+bool kit::DrawBatcher::hasIndirectCount()
+{
+  return m_indirectCount;
+}
+
+uint32_t kit::DrawBatcher::getDrawCount()
+{
+  return m_drawCount;
+}
+
+uint32_t kit::DrawBatcher::getCallCount()
+{
+  return m_callCount;
+}
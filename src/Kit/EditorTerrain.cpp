@@ -1,6 +1,7 @@
 #include "Kit/EditorTerrain.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 #include "Kit/Program.hpp"
 #include "Kit/Material.hpp"
 #include "Kit/Texture.hpp"
@@ -16,6 +17,8 @@
 #include <cstdlib>
 #include <sstream>
 #include <algorithm>
+#include <cstring>
+#include <thread>
 
 
 #include <glm/glm.hpp>
@@ -39,16 +42,77 @@ static std::string getMaskSuffix(int layer)
 
   return returner;
 }
-kit::EditorTerrain::Triangle::Triangle(kit::EditorTerrain::Vertex* a, kit::EditorTerrain::Vertex* b, kit::EditorTerrain::Vertex* c)
+
+const uint32_t kit::EditorTerrain::BakeTileSize;
+
+// Baked images are written as uncompressed, bottom-up TGA so that tiles can be patched in place
+static void writeTgaRows(std::ostream & f, uint8_t const * rgba, uint32_t width)
 {
-  m_a = a;
-  m_b = b;
-  m_c = c;
-  m_bitangent = glm::vec3(0.0f, 0.0f, 0.0f);
-  m_normal = glm::vec3(0.0f, 0.0f, 0.0f);
-  m_tangent = glm::vec3(0.0f, 0.0f, 0.0f);
+  std::vector<char> row(width * 4);
+  for(uint32_t x = 0; x < width; x++)
+  {
+    row[x * 4 + 0] = (char)rgba[x * 4 + 2];
+    row[x * 4 + 1] = (char)rgba[x * 4 + 1];
+    row[x * 4 + 2] = (char)rgba[x * 4 + 0];
+    row[x * 4 + 3] = (char)rgba[x * 4 + 3];
+  }
+  f.write(&row[0], row.size());
 }
 
+static bool writeBakedImage(std::string const & filename, glm::uvec2 size, std::vector<uint8_t> const & rgba)
+{
+  std::ofstream f(filename, std::ios_base::out | std::ios_base::binary);
+  if(!f)
+  {
+    return false;
+  }
+
+  uint8_t header[18] = {0};
+  header[2] = 2;  // Uncompressed truecolor
+  header[12] = uint8_t(size.x & 0xFF);
+  header[13] = uint8_t((size.x >> 8) & 0xFF);
+  header[14] = uint8_t(size.y & 0xFF);
+  header[15] = uint8_t((size.y >> 8) & 0xFF);
+  header[16] = 32;
+  header[17] = 8; // 8 alpha bits, bottom-left origin
+  f.write((char*)header, sizeof(header));
+
+  for(uint32_t y = 0; y < size.y; y++)
+  {
+    writeTgaRows(f, &rgba[y * size.x * 4], size.x);
+  }
+
+  return bool(f);
+}
+
+static bool patchBakedImage(std::string const & filename, glm::uvec2 size, glm::uvec4 rect, std::vector<uint8_t> const & rgba)
+{
+  std::fstream f(filename, std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+  if(!f)
+  {
+    return false;
+  }
+
+  for(uint32_t y = 0; y < rect.w; y++)
+  {
+    f.seekp(18 + ((uint64_t(rect.y + y) * size.x) + rect.x) * 4);
+    writeTgaRows(f, &rgba[y * rect.z * 4], rect.z);
+  }
+
+  return bool(f);
+}
+
+static std::vector<uint8_t> readAttachmentRect(kit::PixelBuffer * buffer, uint32_t attachment, glm::uvec4 rect)
+{
+  std::vector<uint8_t> returner(rect.z * rect.w * 4);
+
+  buffer->bind(kit::PixelBuffer::Read);
+  glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+  glReadPixels(rect.x, rect.y, rect.z, rect.w, GL_RGBA, GL_UNSIGNED_BYTE, &returner[0]);
+  kit::PixelBuffer::unbind(kit::PixelBuffer::Read);
+
+  return returner;
+}
 
 kit::EditorTerrain::EditorTerrain() : kit::Renderable()
 {
@@ -110,21 +174,11 @@ kit::EditorTerrain::EditorTerrain() : kit::Renderable()
 
 kit::EditorTerrain::~EditorTerrain()
 {
+  releaseReadbacks();
+  
   glDeleteBuffers(1, &m_glVertexIndices);
   glDeleteBuffers(1, &m_glVertexBuffer);
   glDeleteVertexArrays(1, &m_glVertexArray);
-
-  for(Triangle *currTriangle : m_triangles)
-  {
-    delete currTriangle;
-  }
-  
-  for(Vertex *currVertex : m_vertices)
-  {
-    delete currVertex;
-  }
-  m_triangles.clear();
-  m_vertices.clear();
   
   if(m_materialMask)
     delete m_materialMask;
@@ -165,130 +219,42 @@ kit::EditorTerrain::~EditorTerrain()
 
 void kit::EditorTerrain::generateCache()
 {
-  // Clear old CPU data
-  for(Triangle *currTriangle : m_triangles)
-  {
-    delete currTriangle;
-  }
-  
-  for(Vertex *currVertex : m_vertices)
-  {
-    delete currVertex;
-  }
-  
-  m_triangles.clear();
-  m_vertices.clear();
-  
   // Create CPU data
   glm::vec2 fullSize;
   fullSize.x = float(m_resolution.x) * m_xzScale;
   fullSize.y = float(m_resolution.y) * m_xzScale;
 
   glm::vec2 halfSize = fullSize / 2.0f;
-  
-  // Generate vertexdata on the CPU
-  uint32_t currId = 0;
-  for(uint32_t y = 0; y < m_resolution.y; y++)
-  {
-    for(uint32_t x = 0; x < m_resolution.x; x++)
-    {
-      Vertex * newVertex = new Vertex();
-      newVertex->m_position.x = float(x) * m_xzScale - halfSize.x;
-      newVertex->m_position.y = 0.0f;
-      newVertex->m_position.z = float(y) * m_xzScale - halfSize.y;
-
-      newVertex->m_normal.x = 0.0;
-      newVertex->m_normal.y = 0.0;
-      newVertex->m_normal.z = 0.0;
-
-      newVertex->m_tangent.x = 0.0;
-      newVertex->m_tangent.y = 0.0;
-      newVertex->m_tangent.z = 0.0;
-
-      newVertex->m_uv.x = float(x) * (1.0f/float(m_resolution.x));
-      newVertex->m_uv.y = 1.0f - (float(y) * (1.0f/float(m_resolution.y)));
-      newVertex->m_id = currId;
 
-      m_vertices.push_back(newVertex);
-      m_indexCache[newVertex] = currId++;
-
-    }
-  }
-
-  // Generate triangles on the CPU
-  bool xflip = false;
-  bool yflip = false;
-  for(unsigned int y = 0; y < m_resolution.y-1; y++)
-  {
-    xflip = false;
-    for(unsigned int x = 0; x < m_resolution.x-1; x++)
-    {
-      Triangle* newTriangleA;
-      Triangle* newTriangleB;
-
-      if(xflip)
-      {
-        if(yflip)
-        {
-          newTriangleA = new Triangle(getVertexAt(x, y), getVertexAt(x+1, y+1), getVertexAt(x, y+1)); // X
-          newTriangleB = new Triangle(getVertexAt(x, y), getVertexAt(x+1, y), getVertexAt(x+1, y+1)); // X
-        }
-        else
-        {
-          newTriangleA = new Triangle(getVertexAt(x, y), getVertexAt(x+1, y), getVertexAt(x, y+1));
-          newTriangleB = new Triangle(getVertexAt(x, y+1), getVertexAt(x+1, y), getVertexAt(x+1, y+1));
-        }
-      }
-      else
-      {
-        if(yflip)
-        {
-          newTriangleA = new Triangle(getVertexAt(x, y+1), getVertexAt(x+1, y), getVertexAt(x+1, y+1));
-          newTriangleB = new Triangle(getVertexAt(x, y), getVertexAt(x+1, y), getVertexAt(x, y+1));
-        }
-        else
-        {
-          newTriangleA = new Triangle(getVertexAt(x, y), getVertexAt(x+1, y), getVertexAt(x+1, y+1));
-          newTriangleB = new Triangle(getVertexAt(x, y), getVertexAt(x+1, y+1), getVertexAt(x, y+1));
-        }
-      }
-
-      newTriangleA->m_a->m_triangles.push_back(newTriangleA);
-      newTriangleA->m_b->m_triangles.push_back(newTriangleA);
-      newTriangleA->m_c->m_triangles.push_back(newTriangleA);
-
-      newTriangleB->m_a->m_triangles.push_back(newTriangleB);
-      newTriangleB->m_b->m_triangles.push_back(newTriangleB);
-      newTriangleB->m_c->m_triangles.push_back(newTriangleB);
-
-      m_triangles.push_back(newTriangleA);
-      m_triangles.push_back(newTriangleB);
-
-      xflip = !xflip;
-    }
-    yflip = !yflip;
-  }
+  uint32_t numVertices = m_resolution.x * m_resolution.y;
+  m_cpuNormals.assign(numVertices, glm::vec3(0.0f, 1.0f, 0.0f));
+  m_cpuTangents.assign(numVertices, glm::vec3(1.0f, 0.0f, 0.0f));
   
   // Upload data 
-  // Create indices
-  std::vector<uint32_t> indexData;
-  for(Triangle* currTriangle : m_triangles)
+  // Create indices, topology is implicit from the grid
+  std::vector<uint32_t> indexData((m_resolution.x - 1) * (m_resolution.y - 1) * 6);
+  for(uint32_t y = 0; y < m_resolution.y - 1; y++)
   {
-    indexData.push_back(currTriangle->m_c->m_id);
-    indexData.push_back(currTriangle->m_b->m_id);
-    indexData.push_back(currTriangle->m_a->m_id);
+    for(uint32_t x = 0; x < m_resolution.x - 1; x++)
+    {
+      getCellIndices(x, y, &indexData[((y * (m_resolution.x - 1)) + x) * 6]);
+    }
   }
 
-  m_indexCount = (uint32_t)m_triangles.size() * 3;
+  m_indexCount = (uint32_t)indexData.size();
 
   // Create vertices
-  std::vector<float> vertexData;
-  for(Vertex* currVertex : m_vertices)
+  std::vector<float> vertexData(numVertices * 4);
+  for(uint32_t y = 0; y < m_resolution.y; y++)
   {
-    vertexData.push_back(currVertex->m_position.x);
-    vertexData.push_back(currVertex->m_position.z);
-    vertexData.push_back(currVertex->m_uv.x);
-    vertexData.push_back(currVertex->m_uv.y);
+    for(uint32_t x = 0; x < m_resolution.x; x++)
+    {
+      float * currVertex = &vertexData[((y * m_resolution.x) + x) * 4];
+      currVertex[0] = float(x) * m_xzScale - halfSize.x;
+      currVertex[1] = float(y) * m_xzScale - halfSize.y;
+      currVertex[2] = float(x) * (1.0f/float(m_resolution.x));
+      currVertex[3] = 1.0f - (float(y) * (1.0f/float(m_resolution.y)));
+    }
   }
 
   glBindVertexArray(m_glVertexArray);
@@ -318,6 +284,24 @@ void kit::EditorTerrain::generateCache()
   // Clear heightmap
   m_heightmap->getFrontBuffer()->clearAttachment(0, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
   m_heightmap->getBackBuffer()->clearAttachment(0, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
+
+  // Initialize the CPU mirror to the same values we just cleared the GPU buffers with
+  releaseReadbacks();
+  m_maskResolution = mapResolution;
+  m_cpuHeight.assign(m_resolution.x * m_resolution.y, 0.0f);
+  m_cpuMask[0].assign(m_maskResolution.x * m_maskResolution.y * 4, 0);
+  m_cpuMask[1].assign(m_maskResolution.x * m_maskResolution.y * 4, 0);
+  for(size_t i = 0; i < m_cpuMask[0].size(); i += 4)
+  {
+    m_cpuMask[0][i] = 255;
+  }
+
+  // Nothing on disk matches the new buffers
+  m_tileCount = (m_resolution + glm::uvec2(BakeTileSize - 1)) / BakeTileSize;
+  m_dirtyTiles.assign(m_tileCount.x * m_tileCount.y, DirtyHeight | DirtyMaterial);
+  m_layerUsage.assign(m_tileCount.x * m_tileCount.y, 1);
+  m_fullBakeRequired = true;
+  m_layersDirty = true;
 }
 
 kit::EditorTerrain::EditorTerrain(const std::string&name, glm::uvec2 resolution, float xzScale, float yScale) : kit::EditorTerrain()
@@ -455,12 +439,15 @@ void kit::EditorTerrain::renderDeferred(kit::Renderer * renderer)
     return;
   }
 
+  // Pick up any finished readbacks, without stalling
+  updateCPUMirror();
+
   glm::mat4 modelViewMatrix = renderer->getActiveCamera()->getViewMatrix() * getWorldTransformMatrix();
   glm::mat4 modelViewProjectionMatrix = renderer->getActiveCamera()->getProjectionMatrix() * renderer->getActiveCamera()->getViewMatrix() * getWorldTransformMatrix();
 
-  glDisable(GL_BLEND);
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
+  kit::GLState::setBlend(false);
+  kit::GLState::setCulling(true);
+  kit::GLState::setCullFace(GL_BACK);
 
   m_program->use();
   m_program->setUniformMat4("uniform_mvMatrix", modelViewMatrix);
@@ -471,7 +458,7 @@ void kit::EditorTerrain::renderDeferred(kit::Renderer * renderer)
 
 void kit::EditorTerrain::renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
 {
-  glDisable(GL_CULL_FACE);
+  kit::GLState::setCulling(false);
   m_shadowProgram->use();
   m_shadowProgram->setUniformMat4("uniform_mvpMatrix", projectionMatrix * viewMatrix * getWorldTransformMatrix());
   renderGeometry();
@@ -491,12 +478,12 @@ void kit::EditorTerrain::renderForward(kit::Renderer * renderer)
 
   glm::mat4 modelViewProjectionMatrix = renderer->getActiveCamera()->getProjectionMatrix() * renderer->getActiveCamera()->getViewMatrix() * getWorldTransformMatrix();
 
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_ONE, GL_ONE);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
+  kit::GLState::setBlend(true);
+  kit::GLState::setBlendFunc(GL_ONE, GL_ONE);
+  kit::GLState::setDepthTest(false);
+  kit::GLState::setDepthWrite(false);
+  kit::GLState::setCulling(true);
+  kit::GLState::setCullFace(GL_BACK);
 
   m_decalProgram->use();
   m_decalProgram->setUniformMat4("uniform_mvpMatrix", modelViewProjectionMatrix);
@@ -511,7 +498,7 @@ void kit::EditorTerrain::renderForward(kit::Renderer * renderer)
   glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
   glEnable(GL_POLYGON_OFFSET_LINE);
   glPolygonOffset(-1.0f, 1.0f);
-  glEnable(GL_DEPTH_TEST);
+  kit::GLState::setDepthTest(true);
   renderGeometry();
   glPolygonOffset(0.0f, 0.0f);
   glDisable(GL_POLYGON_OFFSET_LINE);
@@ -519,9 +506,9 @@ void kit::EditorTerrain::renderForward(kit::Renderer * renderer)
 
 
   // Reset defaults!
-  glDepthMask(GL_TRUE);
-  glEnable(GL_DEPTH_TEST);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  kit::GLState::setDepthWrite(true);
+  kit::GLState::setDepthTest(true);
+  kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 }
 
 void kit::EditorTerrain::renderGeometry()
@@ -1131,93 +1118,264 @@ void kit::EditorTerrain::updateGpuProgram()
   }
 }
 
-void kit::EditorTerrain::bakeCPUNormals()
+void kit::EditorTerrain::getCellIndices(uint32_t x, uint32_t y, uint32_t * indices)
 {
-  // Calculate triangle normals and tangents
-  for(Triangle *currTriangle : m_triangles)
+  // Alternate the diagonal every cell and every row, written in reverse winding like the rest of the renderer expects
+  uint32_t i00 = (y * m_resolution.x) + x;
+  uint32_t i10 = i00 + 1;
+  uint32_t i01 = i00 + m_resolution.x;
+  uint32_t i11 = i01 + 1;
+
+  bool xflip = (x % 2) == 1;
+  bool yflip = (y % 2) == 1;
+
+  uint32_t a[6];
+  if(xflip)
+  {
+    if(yflip)
+    {
+      uint32_t cell[6] = { i00, i11, i01,  i00, i10, i11 };
+      std::memcpy(a, cell, sizeof(a));
+    }
+    else
+    {
+      uint32_t cell[6] = { i00, i10, i01,  i01, i10, i11 };
+      std::memcpy(a, cell, sizeof(a));
+    }
+  }
+  else
   {
-    // Calculate face normal
-    glm::vec3 u(currTriangle->m_b->m_position - currTriangle->m_c->m_position);
-    glm::vec3 v(currTriangle->m_a->m_position - currTriangle->m_c->m_position);
+    if(yflip)
+    {
+      uint32_t cell[6] = { i01, i10, i11,  i00, i10, i01 };
+      std::memcpy(a, cell, sizeof(a));
+    }
+    else
+    {
+      uint32_t cell[6] = { i00, i10, i11,  i00, i11, i01 };
+      std::memcpy(a, cell, sizeof(a));
+    }
+  }
+
+  indices[0] = a[2];
+  indices[1] = a[1];
+  indices[2] = a[0];
+  indices[3] = a[5];
+  indices[4] = a[4];
+  indices[5] = a[3];
+}
 
-    currTriangle->m_normal.x = (u.y * v.z) - (u.z * v.y);
-    currTriangle->m_normal.y = (u.z * v.x) - (u.x * v.z);
-    currTriangle->m_normal.z = (u.x * v.y) - (u.y * v.x);
+void kit::EditorTerrain::bakeCPUNormals()
+{
+  if(m_cpuHeight.empty())
+  {
+    return;
+  }
 
-    // Calculate face tangents and bitangents
-    glm::vec2 s(currTriangle->m_b->m_uv - currTriangle->m_c->m_uv);
-    glm::vec2 t(currTriangle->m_a->m_uv - currTriangle->m_c->m_uv);
+  // One range of rows per thread. Rows are independent and only read the heights, so no synchronization is needed
+  uint32_t numThreads = (glm::max)(1u, (glm::min)(std::thread::hardware_concurrency(), m_resolution.y));
+  uint32_t rowsPerThread = (m_resolution.y + numThreads - 1) / numThreads;
 
-    float      r = 1.0f / ((s.x * t.y) - (s.y * t.x));
-    glm::vec3  sDir((t.y * u.x - t.x * v.x) * r, (t.y * u.y - t.x * v.y) * r, (t.y * u.z - t.x * v.z) * r);
-    glm::vec3  tDir((s.x * v.x - s.y * u.x) * r, (s.x * v.y - s.y * u.y) * r, (s.x * v.z - s.y * u.z) * r);
+  std::vector<std::thread> threads;
+  for(uint32_t i = 1; i < numThreads; i++)
+  {
+    uint32_t firstRow = i * rowsPerThread;
+    uint32_t lastRow = (glm::min)(firstRow + rowsPerThread, m_resolution.y);
+    if(firstRow < lastRow)
+    {
+      threads.push_back(std::thread([this, firstRow, lastRow](){ bakeCPUNormals(glm::uvec4(0, firstRow, m_resolution.x, lastRow - firstRow)); }));
+    }
+  }
 
-    // Gram-Schmidt orthogonalize
-    glm::vec3 tangent = sDir - (currTriangle->m_normal * glm::dot(currTriangle->m_normal, sDir));
-    tangent = glm::normalize(tangent);
+  bakeCPUNormals(glm::uvec4(0, 0, m_resolution.x, (glm::min)(rowsPerThread, m_resolution.y)));
 
-    // Calculate handedness
-    float tangentDir = (glm::dot(glm::cross(currTriangle->m_normal, sDir), tDir) >= 0.0f) ? 1.0f : -1.0f;  
-    glm::vec3 bitangent = glm::cross(currTriangle->m_normal, tangent) * tangentDir;
-    
-    currTriangle->m_tangent = tangent;
-    currTriangle->m_bitangent = bitangent;
+  for(auto & currThread : threads)
+  {
+    currThread.join();
   }
-  
-  // Calculate vertex normals and tangents
-  for(Vertex *currVertex : m_vertices)
+}
+
+void kit::EditorTerrain::bakeCPUNormals(glm::uvec4 rect)
+{
+  // Central differences straight off the heightmap
+  int32_t w = int32_t(m_resolution.x);
+  int32_t h = int32_t(m_resolution.y);
+  float const * height = &m_cpuHeight[0];
+
+  for(int32_t y = int32_t(rect.y); y < int32_t(rect.y + rect.w); y++)
   {
-    for(Triangle *currTriangle : currVertex->m_triangles)
+    int32_t yUp = (glm::min)(y + 1, h - 1);
+    int32_t yDown = (glm::max)(y - 1, 0);
+    float zStep = float(yUp - yDown) * m_xzScale;
+
+    float const * rowUp = height + (yUp * w);
+    float const * rowDown = height + (yDown * w);
+    float const * row = height + (y * w);
+    glm::vec3 * normals = &m_cpuNormals[y * w];
+    glm::vec3 * tangents = &m_cpuTangents[y * w];
+
+    for(int32_t x = int32_t(rect.x); x < int32_t(rect.x + rect.z); x++)
     {
-      currVertex->m_normal += currTriangle->m_normal;
-      currVertex->m_tangent += currTriangle->m_tangent;
-      currVertex->m_bitangent += currTriangle->m_bitangent;
+      int32_t xRight = (glm::min)(x + 1, w - 1);
+      int32_t xLeft = (glm::max)(x - 1, 0);
+      float xStep = float(xRight - xLeft) * m_xzScale;
+
+      float dx = (row[xRight] - row[xLeft]) * m_yScale / xStep;
+      float dz = (rowUp[x] - rowDown[x]) * m_yScale / zStep;
+
+      glm::vec3 normal = glm::normalize(glm::vec3(-dx, 1.0f, -dz));
+
+      // Tangent follows +u, which runs along +x. Gram-Schmidt orthogonalize against the normal
+      glm::vec3 tangent(1.0f, dx, 0.0f);
+      tangent = glm::normalize(tangent - (normal * glm::dot(normal, tangent)));
+
+      normals[x] = normal;
+      tangents[x] = tangent;
     }
-    currVertex->m_normal /= float(currVertex->m_triangles.size());
-    currVertex->m_tangent /= float(currVertex->m_triangles.size());
-    currVertex->m_bitangent /= float(currVertex->m_triangles.size());
   }
 }
 
 void kit::EditorTerrain::bakeCPUHeight()
 {
-  auto pixelData = m_heightmap->getFrontBuffer()->readPixels(0);
+  // The mirror is kept up to date by readbacks, we only need to wait for the ones in flight
+  updateCPUMirror(true);
+}
+
+void kit::EditorTerrain::requestReadback(uint8_t target, glm::vec2 positionUv, glm::vec2 sizeUv)
+{
+  glm::ivec2 res = glm::ivec2(target == 0 ? m_resolution : m_maskResolution);
+
+  // Pad by a texel to be safe against rounding at the brush edges
+  glm::ivec2 lo = glm::ivec2(glm::floor(positionUv * glm::vec2(res))) - glm::ivec2(1, 1);
+  glm::ivec2 hi = glm::ivec2(glm::ceil((positionUv + sizeUv) * glm::vec2(res))) + glm::ivec2(1, 1);
+  lo = glm::clamp(lo, glm::ivec2(0, 0), res);
+  hi = glm::clamp(hi, glm::ivec2(0, 0), res);
 
-  for(uint32_t i = 0; i < m_resolution.x * m_resolution.y; i++)
+  if(hi.x <= lo.x || hi.y <= lo.y)
   {
-    m_vertices[i]->m_position.y = pixelData[i] * m_yScale;
+    return;
   }
+
+  requestReadback(target, glm::uvec4(lo.x, lo.y, hi.x - lo.x, hi.y - lo.y));
 }
 
-kit::EditorTerrain::Vertex *kit::EditorTerrain::getVertexAt(int32_t x, int32_t y)
+void kit::EditorTerrain::requestReadback(uint8_t target, glm::uvec4 rect)
 {
-
-  if((uint32_t)x >= m_resolution.x)
+  kit::PixelBuffer * source = (target == 0) ? m_heightmap->getFrontBuffer() : m_materialMask->getFrontBuffer();
+  uint32_t attachment = (target == 2) ? 1 : 0;
+  uint32_t pixelSize = (target == 0) ? sizeof(float) : 4;
+
+  PendingReadback readback;
+  readback.target = target;
+  readback.rect = rect;
+
+  glGenBuffers(1, &readback.glBuffer);
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.glBuffer);
+  glBufferData(GL_PIXEL_PACK_BUFFER, rect.z * rect.w * pixelSize, nullptr, GL_STREAM_READ);
+
+  // With a pack buffer bound this only queues the copy, it does not wait for the GPU
+  source->bind(kit::PixelBuffer::Read);
+  glReadBuffer(GL_COLOR_ATTACHMENT0 + attachment);
+  if(target == 0)
   {
-    x = m_resolution.x-1;
+    glReadPixels(rect.x, rect.y, rect.z, rect.w, GL_RED, GL_FLOAT, (void*)0);
   }
-  if(x < 0)
+  else
   {
-    x = 0;
+    glReadPixels(rect.x, rect.y, rect.z, rect.w, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
   }
-  
-  if((uint32_t)y >= m_resolution.y)  {
-    y = m_resolution.y-1;
+  readback.glFence = (void*)glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  kit::PixelBuffer::unbind(kit::PixelBuffer::Read);
+
+  m_readbacks.push_back(readback);
+}
+
+void kit::EditorTerrain::updateCPUMirror(bool wait)
+{
+  // Readbacks finish in order, so stop at the first one that is not done yet
+  while(!m_readbacks.empty())
+  {
+    PendingReadback & curr = m_readbacks.front();
+    GLsync fence = (GLsync)curr.glFence;
+
+    GLenum status = glClientWaitSync(fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+    if(status == GL_TIMEOUT_EXPIRED)
+    {
+      if(wait)
+      {
+        continue;
+      }
+      break;
+    }
+
+    if(status == GL_WAIT_FAILED)
+    {
+      KIT_ERR("Warning: terrain readback failed, CPU mirror may be stale");
+    }
+    else
+    {
+      glm::uvec2 res = (curr.target == 0) ? m_resolution : m_maskResolution;
+      uint32_t pixelSize = (curr.target == 0) ? sizeof(float) : 4;
+      uint32_t rowSize = curr.rect.z * pixelSize;
+
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, curr.glBuffer);
+      uint8_t * data = (uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, rowSize * curr.rect.w, GL_MAP_READ_BIT);
+      if(data)
+      {
+        uint8_t * destination = (curr.target == 0) ? (uint8_t*)&m_cpuHeight[0] : &m_cpuMask[curr.target - 1][0];
+
+        // GL rows go bottom to top, ours go top to bottom
+        for(uint32_t row = 0; row < curr.rect.w; row++)
+        {
+          uint32_t cpuRow = res.y - 1 - (curr.rect.y + row);
+          std::memcpy(destination + ((cpuRow * res.x) + curr.rect.x) * pixelSize, data + row * rowSize, rowSize);
+        }
+
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      }
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    glDeleteSync(fence);
+    glDeleteBuffers(1, &curr.glBuffer);
+    m_readbacks.pop_front();
   }
-  
-  if(y < 0)
+}
+
+void kit::EditorTerrain::releaseReadbacks()
+{
+  for(auto & curr : m_readbacks)
   {
-    y = 0;
+    glDeleteSync((GLsync)curr.glFence);
+    glDeleteBuffers(1, &curr.glBuffer);
   }
+  m_readbacks.clear();
+}
+
+kit::EditorTerrain::Vertex kit::EditorTerrain::getVertexAt(int32_t x, int32_t y)
+{
+  x = glm::clamp(x, 0, int32_t(m_resolution.x) - 1);
+  y = glm::clamp(y, 0, int32_t(m_resolution.y) - 1);
   
   uint32_t index = (y*m_resolution.x) + x;
   
-  if(index >= m_vertices.size())
+  if(index >= m_cpuNormals.size() || index >= m_cpuHeight.size())
   {
     KIT_THROW("Invalid vertex index");
   }
+
+  glm::vec2 halfSize = glm::vec2(m_resolution.x, m_resolution.y) * m_xzScale / 2.0f;
+
+  Vertex returner;
+  returner.m_position = glm::vec3(float(x) * m_xzScale - halfSize.x, m_cpuHeight[index] * m_yScale, float(y) * m_xzScale - halfSize.y);
+  returner.m_uv = glm::vec2(float(x) * (1.0f/float(m_resolution.x)), 1.0f - (float(y) * (1.0f/float(m_resolution.y))));
+  returner.m_normal = m_cpuNormals[index];
+  returner.m_tangent = m_cpuTangents[index];
+  returner.m_bitangent = glm::cross(returner.m_normal, returner.m_tangent);
   
-  return m_vertices[index];
+  return returner;
 }
 
 glm::vec3 kit::EditorTerrain::sampleHeightmap(int32_t x, int32_t y)
@@ -1228,10 +1386,15 @@ glm::vec3 kit::EditorTerrain::sampleHeightmap(int32_t x, int32_t y)
 
   glm::vec2 halfSize = fullSize / 2.0f;
 
+  if(m_cpuHeight.empty())
+  {
+    return glm::vec3(0.0f, 0.0f, 0.0f);
+  }
+
   x = (glm::min)(m_resolution.x-1, (unsigned int)x);
   y = (glm::min)(m_resolution.y-1, (unsigned int)y);
   
-  float ry = m_heightmap->getFrontBuffer()->readPixel(0, x, m_resolution.y - 1 - y).x * m_yScale;
+  float ry = m_cpuHeight[(y * m_resolution.x) + x] * m_yScale;
   float rx = (float(x) * m_xzScale) - halfSize.x;
   float rz = (float(y) * m_xzScale) - halfSize.y;
   
@@ -1313,6 +1476,22 @@ glm::vec3 kit::EditorTerrain::sampleBilinear(float x, float z)
   return glm::vec3(height, xAngle, zAngle);
 }
 
+glm::vec4 kit::EditorTerrain::sampleMaterialMask(uint8_t mask, glm::vec2 positionUv)
+{
+  if(mask > 1 || m_cpuMask[mask].empty())
+  {
+    return glm::vec4(0.0f, 0.0f, 0.0f, 0.0f);
+  }
+
+  // Same uv space as the paint brushes, so flip to our top to bottom rows
+  uint32_t x = (uint32_t)glm::clamp(int32_t(positionUv.x * float(m_maskResolution.x)), 0, int32_t(m_maskResolution.x) - 1);
+  uint32_t y = (uint32_t)glm::clamp(int32_t(positionUv.y * float(m_maskResolution.y)), 0, int32_t(m_maskResolution.y) - 1);
+  y = m_maskResolution.y - 1 - y;
+
+  uint8_t * texel = &m_cpuMask[mask][((y * m_maskResolution.x) + x) * 4];
+  return glm::vec4(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+}
+
 void kit::EditorTerrain::bakeARNXCache()
 {
   m_arnxCache->clearAttachment(0, glm::vec4(0.5f, 0.5f, 0.5f, 0.8f));
@@ -1321,10 +1500,136 @@ void kit::EditorTerrain::bakeARNXCache()
   m_bakeProgramArnx->use();
   m_arnxCache->bind();
   
-  glDisable(GL_BLEND);
-  glDisable(GL_CULL_FACE);
-  glDisable(GL_DEPTH_TEST);
+  kit::GLState::setBlend(false);
+  kit::GLState::setCulling(false);
+  kit::GLState::setDepthTest(false);
+  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+}
+
+void kit::EditorTerrain::bakeARNXCache(glm::uvec4 rect)
+{
+  if(rect.z == 0 || rect.w == 0)
+  {
+    return;
+  }
+
+  m_bakeProgramArnx->use();
+  m_arnxCache->bind();
+
+  // The bake pass writes every fragment it touches, so no clear is needed
+  kit::GLState::setBlend(false);
+  kit::GLState::setCulling(false);
+  kit::GLState::setDepthTest(false);
+  glEnable(GL_SCISSOR_TEST);
+  glScissor(rect.x, rect.y, rect.z, rect.w);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+  glDisable(GL_SCISSOR_TEST);
+}
+
+void kit::EditorTerrain::markDirty(uint8_t flags, glm::vec2 positionUv, glm::vec2 sizeUv)
+{
+  if(m_dirtyTiles.empty())
+  {
+    return;
+  }
+
+  // uv rows run bottom to top, tiles top to bottom. Pad by a texel since normals depend on neighbouring heights
+  glm::vec2 res = glm::vec2(m_resolution);
+  glm::ivec2 lo(int32_t(glm::floor(positionUv.x * res.x)) - 1, int32_t(glm::floor((1.0f - positionUv.y - sizeUv.y) * res.y)) - 1);
+  glm::ivec2 hi(int32_t(glm::ceil((positionUv.x + sizeUv.x) * res.x)) + 1, int32_t(glm::ceil((1.0f - positionUv.y) * res.y)) + 1);
+  lo = glm::clamp(lo, glm::ivec2(0, 0), glm::ivec2(m_resolution));
+  hi = glm::clamp(hi, glm::ivec2(0, 0), glm::ivec2(m_resolution));
+
+  if(hi.x <= lo.x || hi.y <= lo.y)
+  {
+    return;
+  }
+
+  glm::uvec2 firstTile = glm::uvec2(lo) / BakeTileSize;
+  glm::uvec2 lastTile = glm::uvec2(hi - glm::ivec2(1, 1)) / BakeTileSize;
+
+  for(uint32_t y = firstTile.y; y <= lastTile.y; y++)
+  {
+    for(uint32_t x = firstTile.x; x <= lastTile.x; x++)
+    {
+      m_dirtyTiles[(y * m_tileCount.x) + x] |= flags;
+    }
+  }
+}
+
+void kit::EditorTerrain::markAllDirty(uint8_t flags)
+{
+  for(auto & currTile : m_dirtyTiles)
+  {
+    currTile |= flags;
+  }
+}
+
+glm::uvec4 kit::EditorTerrain::getTileRect(uint32_t tile)
+{
+  glm::uvec2 origin = glm::uvec2(tile % m_tileCount.x, tile / m_tileCount.x) * BakeTileSize;
+  glm::uvec2 size = (glm::min)(origin + glm::uvec2(BakeTileSize), m_resolution) - origin;
+  return glm::uvec4(origin.x, origin.y, size.x, size.y);
+}
+
+glm::uvec4 kit::EditorTerrain::getTileMapRect(uint32_t tile)
+{
+  glm::uvec4 rect = getTileRect(tile);
+  glm::vec2 scale = glm::vec2(m_maskResolution) / glm::vec2(m_resolution);
+
+  // Flip to GL rows, then round outwards to whole map pixels
+  glm::vec2 lo = glm::vec2(float(rect.x), float(m_resolution.y - (rect.y + rect.w))) * scale;
+  glm::vec2 hi = glm::vec2(float(rect.x + rect.z), float(m_resolution.y - rect.y)) * scale;
+
+  glm::uvec2 first = glm::uvec2(glm::floor(lo));
+  glm::uvec2 last = (glm::min)(glm::uvec2(glm::ceil(hi)), m_maskResolution);
+  return glm::uvec4(first.x, first.y, last.x - first.x, last.y - first.y);
+}
+
+std::vector<uint8_t> kit::EditorTerrain::getCPUMaskRect(uint8_t mask, glm::uvec4 rect)
+{
+  // Returned in GL row order, which is also the row order of the baked images
+  std::vector<uint8_t> returner(rect.z * rect.w * 4);
+  for(uint32_t y = 0; y < rect.w; y++)
+  {
+    uint32_t cpuRow = m_maskResolution.y - 1 - (rect.y + y);
+    std::memcpy(&returner[y * rect.z * 4], &m_cpuMask[mask][((cpuRow * m_maskResolution.x) + rect.x) * 4], rect.z * 4);
+  }
+  return returner;
+}
+
+uint8_t kit::EditorTerrain::calculateLayerUsage(uint32_t tile)
+{
+  // Pad generously, the mask is sampled with mipmaps and bilinear filtering so weights bleed into neighbouring tiles
+  static const int32_t padding = 32;
+
+  glm::uvec4 rect = getTileMapRect(tile);
+  glm::ivec2 lo = glm::max(glm::ivec2(rect.x, rect.y) - glm::ivec2(padding), glm::ivec2(0));
+  glm::ivec2 hi = glm::min(glm::ivec2(rect.x + rect.z, rect.y + rect.w) + glm::ivec2(padding), glm::ivec2(m_maskResolution));
+
+  // Layer 0 is the base and always used. Any other layer only shows where its mask weight is above zero
+  uint8_t returner = 1;
+  for(uint8_t layer = 1; layer < m_numLayers; layer++)
+  {
+    std::vector<uint8_t> const & mask = m_cpuMask[layer / 4];
+    uint32_t channel = layer % 4;
+
+    for(int32_t y = lo.y; y < hi.y && !(returner & (1 << layer)); y++)
+    {
+      uint32_t cpuRow = m_maskResolution.y - 1 - y;
+      uint8_t const * row = &mask[((cpuRow * m_maskResolution.x) + lo.x) * 4];
+      for(int32_t x = 0; x < hi.x - lo.x; x++)
+      {
+        if(row[(x * 4) + channel] > 0)
+        {
+          returner |= uint8_t(1 << layer);
+          break;
+        }
+      }
+    }
+  }
+
+  return returner;
 }
 
 kit::Texture * kit::EditorTerrain::getARCache()
@@ -1348,11 +1653,11 @@ void kit::EditorTerrain::renderPickbuffer(kit::Camera * cam)
   glm::mat4 modelViewProjectionMatrix = cam->getProjectionMatrix() * cam->getViewMatrix() * getWorldTransformMatrix();
   glm::mat4 modelViewMatrix = cam->getViewMatrix() * getWorldTransformMatrix();
 
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
-  glDisable(GL_BLEND);
-  glDepthMask(GL_TRUE);
-  glEnable(GL_DEPTH_TEST);
+  kit::GLState::setCulling(true);
+  kit::GLState::setCullFace(GL_BACK);
+  kit::GLState::setBlend(false);
+  kit::GLState::setDepthWrite(true);
+  kit::GLState::setDepthTest(true);
 
   m_pickProgram->use();
   m_pickProgram->setUniformMat4("uniform_mvpMatrix", modelViewProjectionMatrix);
@@ -1393,12 +1698,16 @@ void kit::EditorTerrain::paintMaterialMask(uint8_t layerid, kit::Texture * brush
   m_materialMask->getBackBuffer()->bind();
   m_materialMask->getBackBuffer()->clearAttachment(0, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
   m_materialMask->getBackBuffer()->clearAttachment(1, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
+  kit::GLState::setBlend(false);
+  kit::GLState::setDepthTest(false);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
   m_materialMask->flip();
   m_materialMask->getFrontBuffer()->getColorAttachment(0)->generateMipmap();
   m_materialMask->getFrontBuffer()->getColorAttachment(1)->generateMipmap();
+  // The paint pass writes both masks, so both may have changed
+  requestReadback(1, positionUv, sizeUv);
+  requestReadback(2, positionUv, sizeUv);
+  markDirty(DirtyMaterial, positionUv, sizeUv);
 
 
   if (m_numLayers > 1)
@@ -1412,7 +1721,16 @@ void kit::EditorTerrain::paintMaterialMask(uint8_t layerid, kit::Texture * brush
     m_bakeProgramArnx->setUniformTexture("uniform_materialMask1", m_materialMask->getFrontBuffer()->getColorAttachment(1));
   }
 
-  bakeARNXCache();
+  // Only the brush area of the ARNX cache can have changed
+  glm::vec2 mapResolution = glm::vec2(m_maskResolution);
+  glm::ivec2 lo = glm::ivec2(glm::floor(positionUv * mapResolution)) - glm::ivec2(1, 1);
+  glm::ivec2 hi = glm::ivec2(glm::ceil((positionUv + sizeUv) * mapResolution)) + glm::ivec2(1, 1);
+  lo = glm::clamp(lo, glm::ivec2(0, 0), glm::ivec2(m_maskResolution));
+  hi = glm::clamp(hi, glm::ivec2(0, 0), glm::ivec2(m_maskResolution));
+  if(hi.x > lo.x && hi.y > lo.y)
+  {
+    bakeARNXCache(glm::uvec4(lo.x, lo.y, hi.x - lo.x, hi.y - lo.y));
+  }
 }
 
 void kit::EditorTerrain::paintHeightmap(kit::Texture * brush, glm::vec2 positionUv, glm::vec2 sizeUv, PaintOperation op, float strength)
@@ -1429,11 +1747,13 @@ void kit::EditorTerrain::paintHeightmap(kit::Texture * brush, glm::vec2 position
 
   m_heightmap->getBackBuffer()->bind();
   m_heightmap->getBackBuffer()->clearAttachment(0, glm::vec4(0.0f, 0.0f, 0.0f, 0.0f));
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
+  kit::GLState::setBlend(false);
+  kit::GLState::setDepthTest(false);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
   m_heightmap->flip();
   m_heightmap->getFrontBuffer()->getColorAttachment(0)->generateMipmap();
+  requestReadback(0, positionUv, sizeUv);
+  markDirty(DirtyHeight, positionUv, sizeUv);
   m_program->setUniformTexture("uniform_heightmap", m_heightmap->getFrontBuffer()->getColorAttachment(0));
   m_wireProgram->setUniformTexture("uniform_heightmap", m_heightmap->getFrontBuffer()->getColorAttachment(0));
   m_pickProgram->setUniformTexture("uniform_heightmap", m_heightmap->getFrontBuffer()->getColorAttachment(0));
@@ -1455,12 +1775,8 @@ glm::vec2 kit::EditorTerrain::getWorldSize()
   return glm::vec2((float)m_resolution.x, (float)m_resolution.y) * m_xzScale;
 }
 
-void kit::EditorTerrain::bake()
+void kit::EditorTerrain::bake(bool forceFull)
 {
-  bakeARNXCache();
-  bakeCPUHeight();
-  bakeCPUNormals();
-
   std::stringstream terrainPath;
   terrainPath << "./data/terrains/" << m_name;
 
@@ -1479,98 +1795,280 @@ void kit::EditorTerrain::bake()
     return;
   }
 
-  m_arnxCache->getColorAttachment(0)->saveToFile(bakedPath.str() + std::string("/arcache.tga"));
-  m_arnxCache->getColorAttachment(1)->saveToFile(bakedPath.str() + std::string("/nxcache.tga"));
+  bakeCPUHeight();
 
-  if (m_numLayers > 1)
+  // Patch the existing baked files in place if we can, otherwise write everything
+  bool incremental = !forceFull && !m_fullBakeRequired;
+  for(auto & currFile : {"/vertexdata", "/heightdata", "/arcache.tga", "/nxcache.tga"})
   {
-    m_materialMask->getFrontBuffer()->getColorAttachment(0)->saveToFile(bakedPath.str() + std::string("/materialmask0.tga"));
+    if(!std::ifstream(bakedPath.str() + currFile))
+    {
+      incremental = false;
+    }
   }
-  if (m_numLayers > 4)
+
+  if(!incremental)
   {
-    m_materialMask->getFrontBuffer()->getColorAttachment(1)->saveToFile(bakedPath.str() + std::string("/materialmask1.tga"));
+    markAllDirty(DirtyHeight | DirtyMaterial);
+    m_layersDirty = true;
   }
 
-  for(int i = 0; i < m_numLayers; i++)
+  std::vector<uint32_t> heightTiles;
+  std::vector<uint32_t> materialTiles;
+  for(uint32_t i = 0; i < m_dirtyTiles.size(); i++)
   {
-    if(m_layerInfo[i].material == nullptr)
+    if(m_dirtyTiles[i] & DirtyHeight)
     {
-      KIT_ERR("Failed to bake terrain, layer is missing material");
+      heightTiles.push_back(i);
+    }
+    if(m_dirtyTiles[i] & DirtyMaterial)
+    {
+      materialTiles.push_back(i);
+    }
+  }
+
+  // Layer usage table, so the baked terrain only samples the layers a tile actually uses
+  {
+    for(uint32_t currTile : materialTiles)
+    {
+      m_layerUsage[currTile] = calculateLayerUsage(currTile);
+    }
+
+    std::ofstream usage(bakedPath.str() + std::string("/layerusage"), std::ios_base::out | std::ios_base::binary);
+    if(!usage)
+    {
+      KIT_ERR("Failed to bake terrain, could not create layerusage-file");
       return;
     }
-    
-    m_layerInfo[i].material->getARCache()->saveToFile(bakedPath.str() + std::string("/arlayer") + std::to_string(i) + std::string(".tga"));
-    m_layerInfo[i].material->getNDCache()->saveToFile(bakedPath.str() + std::string("/ndlayer") + std::to_string(i) + std::string(".tga"));
+
+    kit::writeUint32(usage, m_tileCount.x);
+    kit::writeUint32(usage, m_tileCount.y);
+    usage.write((char*)&m_layerUsage[0], m_layerUsage.size());
   }
-  
-  std::ofstream header(bakedPath.str() + std::string("/header"));
-  if(!header)
+
+  if(m_layersDirty && !writeBakedLayers(bakedPath.str()))
   {
-    KIT_ERR("Failed to bake terrain, could not create headerfile");
     return;
   }
   
-  header << "xzscale " << m_xzScale << std::endl;
-  header << "yscale " << m_yScale << std::endl;
-  header << "numlayers " << (int)m_numLayers << std::endl;
-  header << "size " << m_resolution.x << " " << m_resolution.y << std::endl;
-  for(int i = 0; i < m_numLayers; i++)
+  if(!writeBakedHeader(bakedPath.str()))
   {
-    header << "layer " << i << " " << m_layerInfo[i].material->getUvScale() << std::endl;
+    return;
   }
-  header.close();
-  
 
-  // WRITE VERTEXDATA FOR GPU
-  std::ofstream data(bakedPath.str() + std::string("/vertexdata"), std::ios_base::binary);
-  if(!data)
+  // Material caches
+  glm::uvec4 fullMapRect(0, 0, m_maskResolution.x, m_maskResolution.y);
+  if(!incremental)
+  {
+    bakeARNXCache();
+    bool success = writeBakedImage(bakedPath.str() + "/arcache.tga", m_maskResolution, readAttachmentRect(m_arnxCache, 0, fullMapRect));
+    success &= writeBakedImage(bakedPath.str() + "/nxcache.tga", m_maskResolution, readAttachmentRect(m_arnxCache, 1, fullMapRect));
+
+    if (m_numLayers > 1)
+    {
+      success &= writeBakedImage(bakedPath.str() + "/materialmask0.tga", m_maskResolution, getCPUMaskRect(0, fullMapRect));
+    }
+    if (m_numLayers > 4)
+    {
+      success &= writeBakedImage(bakedPath.str() + "/materialmask1.tga", m_maskResolution, getCPUMaskRect(1, fullMapRect));
+    }
+
+    if(!success)
+    {
+      KIT_ERR("Failed to bake terrain, could not write material caches");
+      return;
+    }
+  }
+  else
   {
-    KIT_ERR("Failed to bake terrain, could not create vertexdata-file");
+    bool success = true;
+    for(uint32_t currTile : materialTiles)
+    {
+      glm::uvec4 rect = getTileMapRect(currTile);
+      if(rect.z == 0 || rect.w == 0)
+      {
+        continue;
+      }
+
+      success &= patchBakedImage(bakedPath.str() + "/arcache.tga", m_maskResolution, rect, readAttachmentRect(m_arnxCache, 0, rect));
+      success &= patchBakedImage(bakedPath.str() + "/nxcache.tga", m_maskResolution, rect, readAttachmentRect(m_arnxCache, 1, rect));
+
+      if (m_numLayers > 1)
+      {
+        success &= patchBakedImage(bakedPath.str() + "/materialmask0.tga", m_maskResolution, rect, getCPUMaskRect(0, rect));
+      }
+      if (m_numLayers > 4)
+      {
+        success &= patchBakedImage(bakedPath.str() + "/materialmask1.tga", m_maskResolution, rect, getCPUMaskRect(1, rect));
+      }
+    }
+
+    if(!success)
+    {
+      KIT_ERR("Failed to bake terrain, could not patch material caches");
+      m_fullBakeRequired = true;
+      return;
+    }
   }
 
-  // Write indices
-  kit::writeUint32(data, uint32_t(m_triangles.size() * 3));
-  for (Triangle * currTriangle : m_triangles)
+  // Geometry
+  if(!incremental)
+  {
+    bakeCPUNormals();
+
+    // WRITE VERTEXDATA FOR GPU
+    std::ofstream data(bakedPath.str() + std::string("/vertexdata"), std::ios_base::binary);
+    if(!data)
+    {
+      KIT_ERR("Failed to bake terrain, could not create vertexdata-file");
+      return;
+    }
+
+    // Write indices
+    kit::writeUint32(data, m_indexCount);
+    for(uint32_t y = 0; y < m_resolution.y - 1; y++)
+    {
+      for(uint32_t x = 0; x < m_resolution.x - 1; x++)
+      {
+        uint32_t indices[6];
+        getCellIndices(x, y, indices);
+        for(uint32_t i = 0; i < 6; i++)
+        {
+          kit::writeUint32(data, indices[i]);
+        }
+      }
+    }
+
+    // Write vertices
+    kit::writeUint32(data, m_resolution.x * m_resolution.y * 14);
+    for(uint32_t y = 0; y < m_resolution.y; y++)
+    {
+      for(uint32_t x = 0; x < m_resolution.x; x++)
+      {
+        Vertex currVertex = getVertexAt(x, y);
+        kit::writeVec3(data, currVertex.m_position);
+        kit::writeVec2(data, currVertex.m_uv);
+        kit::writeVec3(data, currVertex.m_normal);
+        kit::writeVec3(data, currVertex.m_tangent);
+        kit::writeVec3(data, currVertex.m_bitangent);
+      }
+    }
+    data.close();
+    
+    // WRITE HEIGHTDATA FOR CPU
+    std::ofstream hdata(bakedPath.str() + std::string("/heightdata"), std::ios_base::out | std::ios_base::binary);
+    if(!hdata)
+    {
+      KIT_ERR("Failed to bake terrain, could not create heightdata-file");
+      return;
+    }
+    
+    for (uint32_t y = 0; y < m_resolution.y; y++)
+    {
+      for (uint32_t x = 0; x < m_resolution.x; x++)
+      {
+        uint32_t index = (y * m_resolution.x) + x;
+
+        kit::writeFloat(hdata, m_cpuHeight[index]);
+        kit::writeVec3(hdata, m_cpuNormals[index]);
+      }
+    }
+
+    hdata.close();
+  }
+  else if(!heightTiles.empty())
   {
-    kit::writeUint32(data, currTriangle->m_c->m_id);
-    kit::writeUint32(data, currTriangle->m_b->m_id);
-    kit::writeUint32(data, currTriangle->m_a->m_id);
+    std::fstream data(bakedPath.str() + std::string("/vertexdata"), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    std::fstream hdata(bakedPath.str() + std::string("/heightdata"), std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+    if(!data || !hdata)
+    {
+      KIT_ERR("Failed to bake terrain, could not open vertexdata or heightdata for patching");
+      m_fullBakeRequired = true;
+      return;
+    }
+
+    // Both files are fixed-stride, so a tile is patched one row segment at a time
+    uint64_t vertexOffset = uint64_t(2 + m_indexCount) * sizeof(uint32_t);
+    uint64_t vertexStride = 14 * sizeof(float);
+    uint64_t heightStride = 4 * sizeof(float);
+
+    for(uint32_t currTile : heightTiles)
+    {
+      glm::uvec4 rect = getTileRect(currTile);
+      bakeCPUNormals(rect);
+
+      for(uint32_t y = rect.y; y < rect.y + rect.w; y++)
+      {
+        uint64_t first = (uint64_t(y) * m_resolution.x) + rect.x;
+
+        data.seekp(vertexOffset + first * vertexStride);
+        hdata.seekp(first * heightStride);
+        for(uint32_t x = rect.x; x < rect.x + rect.z; x++)
+        {
+          Vertex currVertex = getVertexAt(x, y);
+          kit::writeVec3(data, currVertex.m_position);
+          kit::writeVec2(data, currVertex.m_uv);
+          kit::writeVec3(data, currVertex.m_normal);
+          kit::writeVec3(data, currVertex.m_tangent);
+          kit::writeVec3(data, currVertex.m_bitangent);
+
+          kit::writeFloat(hdata, currVertex.m_position.y / m_yScale);
+          kit::writeVec3(hdata, currVertex.m_normal);
+        }
+      }
+    }
+
+    if(!data || !hdata)
+    {
+      KIT_ERR("Failed to bake terrain, could not patch vertexdata or heightdata");
+      m_fullBakeRequired = true;
+      return;
+    }
   }
 
-  // Write vertices
-  kit::writeUint32(data, uint32_t(m_vertices.size() * 14));
-  for (Vertex * currVertex : m_vertices)
+  std::fill(m_dirtyTiles.begin(), m_dirtyTiles.end(), 0);
+  m_fullBakeRequired = false;
+}
+
+bool kit::EditorTerrain::writeBakedHeader(std::string const & bakedPath)
+{
+  std::ofstream header(bakedPath + std::string("/header"));
+  if(!header)
   {
-    kit::writeVec3(data, currVertex->m_position);
-    kit::writeVec2(data, currVertex->m_uv);
-    kit::writeVec3(data, currVertex->m_normal);
-    kit::writeVec3(data, currVertex->m_tangent);
-    kit::writeVec3(data, currVertex->m_bitangent);
+    KIT_ERR("Failed to bake terrain, could not create headerfile");
+    return false;
   }
-  data.close();
-  
-  
   
-  // WRITE HEIGHTDATA FOR CPU
-  std::ofstream hdata(bakedPath.str() + std::string("/heightdata"), std::ios_base::out | std::ios_base::binary);
-  if(!hdata)
+  header << "xzscale " << m_xzScale << std::endl;
+  header << "yscale " << m_yScale << std::endl;
+  header << "numlayers " << (int)m_numLayers << std::endl;
+  header << "size " << m_resolution.x << " " << m_resolution.y << std::endl;
+  header << "tilesize " << BakeTileSize << std::endl;
+  for(int i = 0; i < m_numLayers; i++)
   {
-    KIT_ERR("Failed to bake terrain, could not create heightdata-file");
+    header << "layer " << i << " " << m_layerInfo[i].material->getUvScale() << std::endl;
   }
-  
-  for (uint32_t y = 0; y < m_resolution.y; y++)
+  header.close();
+
+  return true;
+}
+
+bool kit::EditorTerrain::writeBakedLayers(std::string const & bakedPath)
+{
+  for(int i = 0; i < m_numLayers; i++)
   {
-    for (uint32_t x = 0; x < m_resolution.x; x++)
+    if(m_layerInfo[i].material == nullptr)
     {
-      auto * v = getVertexAt(x, y);
-      float h = v->m_position.y / m_yScale;
-
-      kit::writeFloat(hdata, h);
-      kit::writeVec3(hdata, v->m_normal);
+      KIT_ERR("Failed to bake terrain, layer is missing material");
+      return false;
     }
+    
+    m_layerInfo[i].material->getARCache()->saveToFile(bakedPath + std::string("/arlayer") + std::to_string(i) + std::string(".tga"));
+    m_layerInfo[i].material->getNDCache()->saveToFile(bakedPath + std::string("/ndlayer") + std::to_string(i) + std::string(".tga"));
   }
 
-  hdata.close();
+  m_layersDirty = false;
+  return true;
 }
 
 void kit::EditorTerrain::save()
@@ -1616,6 +2114,7 @@ void kit::EditorTerrain::save()
 void kit::EditorTerrain::setName(const std::string&name)
 {
   m_name = name;
+  m_fullBakeRequired = true;
 }
 
 kit::EditorTerrain::LayerInfo& kit::EditorTerrain::getLayerInfo(int layer)
@@ -1635,6 +2134,10 @@ void kit::EditorTerrain::setNumLayers(uint8_t l)
     KIT_ERR("Warning: Tried to set layercount to out of bounds");
     return;
   }
+  if(l != m_numLayers)
+  {
+    m_fullBakeRequired = true;
+  }
   m_numLayers = l;
 }
 
@@ -1645,7 +2148,7 @@ uint8_t kit::EditorTerrain::getNumLayers()
 
 void kit::EditorTerrain::saveAs(const std::string&name)
 {
-  m_name = name;
+  setName(name);
   save();
 }
 
@@ -1664,7 +2167,8 @@ void kit::EditorTerrain::invalidateMaterials()
       m_bakeProgramArnx->setUniformTexture("uniform_ndLayer" + std::to_string(i), m_layerInfo[i].material->getNDCache());
     }
     bakeARNXCache();
-    
+    markAllDirty(DirtyMaterial);
+    m_layersDirty = true;
 }
 
 kit::PixelBuffer * kit::EditorTerrain::getMaterialMask()
@@ -0,0 +1,78 @@
+#include "Kit/FrameArena.hpp"
+
+#include "Kit/Exception.hpp"
+
+#include <algorithm>
+
+kit::FrameArena::FrameArena(size_t capacity)
+{
+  m_capacity = (std::max)(capacity, size_t(1));
+  m_block = new uint8_t[m_capacity];
+}
+
+kit::FrameArena::~FrameArena()
+{
+  for (auto & currOverflow : m_overflow)
+  {
+    delete[] currOverflow;
+  }
+
+  if(m_block)
+    delete[] m_block;
+}
+
+void * kit::FrameArena::allocate(size_t size, size_t alignment)
+{
+  if (alignment == 0 || (alignment & (alignment - 1)) != 0)
+  {
+    KIT_THROW("Alignment must be a power of two");
+  }
+
+  // The block itself comes from new[], which is aligned for any fundamental type
+  size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+  if (offset + size <= m_capacity)
+  {
+    m_offset = offset + size;
+    return m_block + offset;
+  }
+
+  // Out of room for this frame. Take it from the heap, and remember how much was missing for reset()
+  uint8_t * overflow = new uint8_t[size + alignment];
+  m_overflow.push_back(overflow);
+  m_overflowBytes += size + alignment;
+
+  size_t address = reinterpret_cast<size_t>(overflow);
+  return overflow + (((address + alignment - 1) & ~(alignment - 1)) - address);
+}
+
+void kit::FrameArena::reset()
+{
+  if (!m_overflow.empty())
+  {
+    for (auto & currOverflow : m_overflow)
+    {
+      delete[] currOverflow;
+    }
+    m_overflow.clear();
+
+    // Grow by at least half, so a slowly growing scene does not reallocate every frame
+    size_t needed = m_offset + m_overflowBytes;
+    m_capacity = (std::max)(needed, m_capacity + m_capacity / 2);
+
+    delete[] m_block;
+    m_block = new uint8_t[m_capacity];
+  }
+
+  m_offset = 0;
+  m_overflowBytes = 0;
+}
+
+size_t kit::FrameArena::getUsed()
+{
+  return m_offset + m_overflowBytes;
+}
+
+size_t kit::FrameArena::getCapacity()
+{
+  return m_capacity;
+}
@@ -0,0 +1,189 @@
+#include "Kit/GLState.hpp"
+
+#include "Kit/IncOpenGL.hpp"
+
+namespace
+{
+  const uint32_t unknown = 0xFFFFFFFF;
+}
+
+const uint32_t kit::GLState::TrackedTextureUnits;
+
+uint32_t kit::GLState::m_program = unknown;
+uint32_t kit::GLState::m_textures[kit::GLState::TrackedTextureUnits] = {
+  unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown,
+  unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown,
+  unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown,
+  unknown, unknown, unknown, unknown, unknown, unknown, unknown, unknown
+};
+int8_t kit::GLState::m_blend = -1;
+uint32_t kit::GLState::m_blendSource = unknown;
+uint32_t kit::GLState::m_blendDestination = unknown;
+int8_t kit::GLState::m_depthTest = -1;
+int8_t kit::GLState::m_depthWrite = -1;
+int8_t kit::GLState::m_culling = -1;
+uint32_t kit::GLState::m_cullFace = unknown;
+uint64_t kit::GLState::m_issued = 0;
+uint64_t kit::GLState::m_skipped = 0;
+
+void kit::GLState::useProgram(uint32_t handle)
+{
+  if (m_program == handle)
+  {
+    m_skipped++;
+    return;
+  }
+
+  glUseProgram(handle);
+  m_program = handle;
+  m_issued++;
+}
+
+void kit::GLState::bindTexture(uint32_t unit, uint32_t target, uint32_t handle)
+{
+#ifndef KIT_SHITTY_INTEL
+  if (unit < TrackedTextureUnits)
+  {
+    if (m_textures[unit] == handle)
+    {
+      m_skipped++;
+      return;
+    }
+    m_textures[unit] = handle;
+  }
+
+  glBindTextureUnit(unit, handle);
+#else
+  // Textures are created and uploaded through the active unit here, so its bindings can not be tracked
+  glActiveTexture(GL_TEXTURE0 + unit);
+  glBindTexture(target, handle);
+#endif
+  m_issued++;
+}
+
+void kit::GLState::forgetTexture(uint32_t handle)
+{
+  for (auto & currTexture : m_textures)
+  {
+    if (currTexture == handle)
+    {
+      currTexture = unknown;
+    }
+  }
+}
+
+void kit::GLState::forgetProgram(uint32_t handle)
+{
+  if (m_program == handle)
+  {
+    m_program = unknown;
+  }
+}
+
+void kit::GLState::setCapability(int8_t & state, uint32_t capability, bool enabled)
+{
+  if (state == (enabled ? 1 : 0))
+  {
+    m_skipped++;
+    return;
+  }
+
+  if (enabled)
+  {
+    glEnable(capability);
+  }
+  else
+  {
+    glDisable(capability);
+  }
+
+  state = enabled ? 1 : 0;
+  m_issued++;
+}
+
+void kit::GLState::setBlend(bool enabled)
+{
+  setCapability(m_blend, GL_BLEND, enabled);
+}
+
+void kit::GLState::setBlendFunc(uint32_t source, uint32_t destination)
+{
+  if (m_blendSource == source && m_blendDestination == destination)
+  {
+    m_skipped++;
+    return;
+  }
+
+  glBlendFunc(source, destination);
+  m_blendSource = source;
+  m_blendDestination = destination;
+  m_issued++;
+}
+
+void kit::GLState::setDepthTest(bool enabled)
+{
+  setCapability(m_depthTest, GL_DEPTH_TEST, enabled);
+}
+
+void kit::GLState::setDepthWrite(bool enabled)
+{
+  if (m_depthWrite == (enabled ? 1 : 0))
+  {
+    m_skipped++;
+    return;
+  }
+
+  glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+  m_depthWrite = enabled ? 1 : 0;
+  m_issued++;
+}
+
+void kit::GLState::setCulling(bool enabled)
+{
+  setCapability(m_culling, GL_CULL_FACE, enabled);
+}
+
+void kit::GLState::setCullFace(uint32_t face)
+{
+  if (m_cullFace == face)
+  {
+    m_skipped++;
+    return;
+  }
+
+  glCullFace(face);
+  m_cullFace = face;
+  m_issued++;
+}
+
+void kit::GLState::invalidate()
+{
+  m_program = unknown;
+  for (auto & currTexture : m_textures)
+  {
+    currTexture = unknown;
+  }
+  m_blend = -1;
+  m_blendSource = unknown;
+  m_blendDestination = unknown;
+  m_depthTest = -1;
+  m_depthWrite = -1;
+  m_culling = -1;
+  m_cullFace = unknown;
+}
+
+uint64_t kit::GLState::getIssuedCount()
+{
+  return m_issued;
+}
+
+uint64_t kit::GLState::getSkippedCount()
+{
+  return m_skipped;
+}
+
+void kit::GLState::resetCounters()
+{
+  m_issued = 0;
+  m_skipped = 0;
+}
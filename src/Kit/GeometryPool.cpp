@@ -0,0 +1,362 @@
+#include "Kit/GeometryPool.hpp"
+
+#include "Kit/IncOpenGL.hpp"
+
+#include <iterator>
+
+const uint32_t kit::GeometryPool::DrawTransformLocation;
+const uint32_t kit::GeometryPool::DrawTransformBinding;
+
+kit::GeometryPool::GeometryPool(uint32_t vertexSize, std::vector<kit::GeometryPool::Attribute> const & attributes, uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+  m_vertexSize = vertexSize;
+  m_vertexCapacity = glm::max(vertexCapacity, 1u);
+  m_indexCapacity = glm::max(indexCapacity, 1u);
+
+  m_glVertexBuffer = createBuffer(size_t(m_vertexCapacity) * m_vertexSize);
+  m_glIndexBuffer = createBuffer(size_t(m_indexCapacity) * sizeof(uint32_t));
+  m_freeVertices[0] = m_vertexCapacity;
+  m_freeIndices[0] = m_indexCapacity;
+
+  glGenVertexArrays(1, &m_glVertexArray);
+  glBindVertexArray(m_glVertexArray);
+
+  for (auto & currAttribute : attributes)
+  {
+    glEnableVertexAttribArray(currAttribute.location);
+    if (currAttribute.type == GL_INT)
+    {
+      glVertexAttribIFormat(currAttribute.location, currAttribute.components, currAttribute.type, currAttribute.offset);
+    }
+    else
+    {
+      glVertexAttribFormat(currAttribute.location, currAttribute.components, currAttribute.type, GL_FALSE, currAttribute.offset);
+    }
+    glVertexAttribBinding(currAttribute.location, 0);
+  }
+
+  // Draw transforms, one column per attribute. Left disabled until bindDrawTransforms
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    glVertexAttribFormat(DrawTransformLocation + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::vec4) * i);
+    glVertexAttribBinding(DrawTransformLocation + i, DrawTransformBinding);
+  }
+  glVertexBindingDivisor(DrawTransformBinding, 1);
+
+  glBindVertexArray(0);
+  attachBuffers();
+}
+
+kit::GeometryPool::~GeometryPool()
+{
+  glDeleteVertexArrays(1, &m_glVertexArray);
+  glDeleteBuffers(1, &m_glVertexBuffer);
+  glDeleteBuffers(1, &m_glIndexBuffer);
+}
+
+uint32_t kit::GeometryPool::createBuffer(size_t bytes)
+{
+  uint32_t buffer = 0;
+#ifndef KIT_SHITTY_INTEL
+  glCreateBuffers(1, &buffer);
+  glNamedBufferData(buffer, bytes, nullptr, GL_STATIC_DRAW);
+#else
+  glGenBuffers(1, &buffer);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferData(GL_COPY_WRITE_BUFFER, bytes, nullptr, GL_STATIC_DRAW);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+#endif
+  return buffer;
+}
+
+void kit::GeometryPool::copyBuffer(uint32_t source, uint32_t destination, size_t sourceOffset, size_t destinationOffset, size_t bytes)
+{
+#ifndef KIT_SHITTY_INTEL
+  glCopyNamedBufferSubData(source, destination, sourceOffset, destinationOffset, bytes);
+#else
+  glBindBuffer(GL_COPY_READ_BUFFER, source);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, destination);
+  glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, sourceOffset, destinationOffset, bytes);
+  glBindBuffer(GL_COPY_READ_BUFFER, 0);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+#endif
+}
+
+void kit::GeometryPool::uploadBuffer(uint32_t buffer, size_t offset, size_t bytes, const void * data)
+{
+#ifndef KIT_SHITTY_INTEL
+  glNamedBufferSubData(buffer, offset, bytes, data);
+#else
+  glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+#endif
+}
+
+void kit::GeometryPool::attachBuffers()
+{
+#ifndef KIT_SHITTY_INTEL
+  glVertexArrayVertexBuffer(m_glVertexArray, 0, m_glVertexBuffer, 0, m_vertexSize);
+  glVertexArrayElementBuffer(m_glVertexArray, m_glIndexBuffer);
+#else
+  glBindVertexArray(m_glVertexArray);
+  glBindVertexBuffer(0, m_glVertexBuffer, 0, m_vertexSize);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_glIndexBuffer);
+  glBindVertexArray(0);
+#endif
+}
+
+bool kit::GeometryPool::fitsRange(kit::GeometryPool::FreeList & freeList, uint32_t size)
+{
+  for (auto & currBlock : freeList)
+  {
+    if (currBlock.second >= size)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool kit::GeometryPool::allocateRange(kit::GeometryPool::FreeList & freeList, uint32_t size, uint32_t & offset)
+{
+  // First fit
+  for (auto it = freeList.begin(); it != freeList.end(); it++)
+  {
+    if (it->second < size)
+    {
+      continue;
+    }
+
+    offset = it->first;
+    uint32_t remaining = it->second - size;
+    freeList.erase(it);
+    if (remaining > 0)
+    {
+      freeList[offset + size] = remaining;
+    }
+    return true;
+  }
+  return false;
+}
+
+void kit::GeometryPool::releaseRange(kit::GeometryPool::FreeList & freeList, uint32_t offset, uint32_t size)
+{
+  // Merge with the neighbouring free blocks
+  auto next = freeList.lower_bound(offset);
+  if (next != freeList.end() && offset + size == next->first)
+  {
+    size += next->second;
+    next = freeList.erase(next);
+  }
+
+  if (next != freeList.begin())
+  {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == offset)
+    {
+      previous->second += size;
+      return;
+    }
+  }
+
+  freeList[offset] = size;
+}
+
+uint32_t kit::GeometryPool::allocate(const void * vertices, uint32_t vertexCount, const uint32_t * indices, uint32_t indexCount)
+{
+  if (!fitsRange(m_freeVertices, vertexCount) || !fitsRange(m_freeIndices, indexCount))
+  {
+    // Compacting is enough if there is room in total, otherwise grow while at it
+    uint32_t vertexCapacity = m_vertexCapacity;
+    while (vertexCapacity - m_usedVertices < vertexCount)
+    {
+      vertexCapacity *= 2;
+    }
+
+    uint32_t indexCapacity = m_indexCapacity;
+    while (indexCapacity - m_usedIndices < indexCount)
+    {
+      indexCapacity *= 2;
+    }
+
+    relocate(vertexCapacity, indexCapacity);
+  }
+
+  Allocation newAllocation;
+  newAllocation.vertexCount = vertexCount;
+  newAllocation.indexCount = indexCount;
+  newAllocation.live = true;
+  if (vertexCount > 0)
+  {
+    allocateRange(m_freeVertices, vertexCount, newAllocation.firstVertex);
+    uploadBuffer(m_glVertexBuffer, size_t(newAllocation.firstVertex) * m_vertexSize, size_t(vertexCount) * m_vertexSize, vertices);
+  }
+  if (indexCount > 0)
+  {
+    allocateRange(m_freeIndices, indexCount, newAllocation.firstIndex);
+    uploadBuffer(m_glIndexBuffer, size_t(newAllocation.firstIndex) * sizeof(uint32_t), size_t(indexCount) * sizeof(uint32_t), indices);
+  }
+  m_usedVertices += vertexCount;
+  m_usedIndices += indexCount;
+
+  uint32_t handle;
+  if (!m_freeHandles.empty())
+  {
+    handle = m_freeHandles.back();
+    m_freeHandles.pop_back();
+    m_allocations[handle] = newAllocation;
+  }
+  else
+  {
+    handle = (uint32_t)m_allocations.size();
+    m_allocations.push_back(newAllocation);
+  }
+
+  return handle;
+}
+
+void kit::GeometryPool::release(uint32_t handle)
+{
+  if (handle >= m_allocations.size() || !m_allocations[handle].live)
+  {
+    KIT_ERR("Warning: tried to release an invalid geometry pool allocation");
+    return;
+  }
+
+  Allocation & currAllocation = m_allocations[handle];
+  if (currAllocation.vertexCount > 0)
+  {
+    releaseRange(m_freeVertices, currAllocation.firstVertex, currAllocation.vertexCount);
+  }
+  if (currAllocation.indexCount > 0)
+  {
+    releaseRange(m_freeIndices, currAllocation.firstIndex, currAllocation.indexCount);
+  }
+  m_usedVertices -= currAllocation.vertexCount;
+  m_usedIndices -= currAllocation.indexCount;
+
+  currAllocation = Allocation();
+  m_freeHandles.push_back(handle);
+}
+
+void kit::GeometryPool::relocate(uint32_t vertexCapacity, uint32_t indexCapacity)
+{
+  uint32_t newVertexBuffer = createBuffer(size_t(vertexCapacity) * m_vertexSize);
+  uint32_t newIndexBuffer = createBuffer(size_t(indexCapacity) * sizeof(uint32_t));
+
+  // Indices are relative to the base vertex, so the copies need no fixing up
+  uint32_t vertexCursor = 0;
+  uint32_t indexCursor = 0;
+  for (auto & currAllocation : m_allocations)
+  {
+    if (!currAllocation.live)
+    {
+      continue;
+    }
+
+    if (currAllocation.vertexCount > 0)
+    {
+      copyBuffer(m_glVertexBuffer, newVertexBuffer, size_t(currAllocation.firstVertex) * m_vertexSize, size_t(vertexCursor) * m_vertexSize, size_t(currAllocation.vertexCount) * m_vertexSize);
+    }
+    if (currAllocation.indexCount > 0)
+    {
+      copyBuffer(m_glIndexBuffer, newIndexBuffer, size_t(currAllocation.firstIndex) * sizeof(uint32_t), size_t(indexCursor) * sizeof(uint32_t), size_t(currAllocation.indexCount) * sizeof(uint32_t));
+    }
+
+    currAllocation.firstVertex = vertexCursor;
+    currAllocation.firstIndex = indexCursor;
+    vertexCursor += currAllocation.vertexCount;
+    indexCursor += currAllocation.indexCount;
+  }
+
+  glDeleteBuffers(1, &m_glVertexBuffer);
+  glDeleteBuffers(1, &m_glIndexBuffer);
+  m_glVertexBuffer = newVertexBuffer;
+  m_glIndexBuffer = newIndexBuffer;
+  m_vertexCapacity = vertexCapacity;
+  m_indexCapacity = indexCapacity;
+
+  m_freeVertices.clear();
+  m_freeIndices.clear();
+  if (vertexCursor < m_vertexCapacity)
+  {
+    m_freeVertices[vertexCursor] = m_vertexCapacity - vertexCursor;
+  }
+  if (indexCursor < m_indexCapacity)
+  {
+    m_freeIndices[indexCursor] = m_indexCapacity - indexCursor;
+  }
+
+  attachBuffers();
+}
+
+void kit::GeometryPool::defragment()
+{
+  if (m_freeVertices.size() <= 1 && m_freeIndices.size() <= 1)
+  {
+    return;
+  }
+
+  relocate(m_vertexCapacity, m_indexCapacity);
+}
+
+uint32_t kit::GeometryPool::getFirstIndex(uint32_t handle)
+{
+  return m_allocations[handle].firstIndex;
+}
+
+int32_t kit::GeometryPool::getBaseVertex(uint32_t handle)
+{
+  return (int32_t)m_allocations[handle].firstVertex;
+}
+
+void kit::GeometryPool::bind()
+{
+  glBindVertexArray(m_glVertexArray);
+}
+
+uint32_t kit::GeometryPool::getVertexArray()
+{
+  return m_glVertexArray;
+}
+
+void kit::GeometryPool::bindDrawTransforms(uint32_t glBuffer)
+{
+  glBindVertexArray(m_glVertexArray);
+  glBindVertexBuffer(DrawTransformBinding, glBuffer, 0, sizeof(glm::mat4));
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    glEnableVertexAttribArray(DrawTransformLocation + i);
+  }
+}
+
+void kit::GeometryPool::unbindDrawTransforms()
+{
+  // Enabled attributes without a buffer are an error for regular draws
+  glBindVertexArray(m_glVertexArray);
+  for (uint32_t i = 0; i < 4; i++)
+  {
+    glDisableVertexAttribArray(DrawTransformLocation + i);
+  }
+}
+
+uint32_t kit::GeometryPool::getUsedVertices()
+{
+  return m_usedVertices;
+}
+
+uint32_t kit::GeometryPool::getVertexCapacity()
+{
+  return m_vertexCapacity;
+}
+
+uint32_t kit::GeometryPool::getUsedIndices()
+{
+  return m_usedIndices;
+}
+
+uint32_t kit::GeometryPool::getIndexCapacity()
+{
+  return m_indexCapacity;
+}
@@ -0,0 +1,349 @@
+#include "Kit/GeometrySimplifier.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <tuple>
+
+namespace
+{
+  // Symmetric 4x4 matrix, the upper triangle row by row
+  struct Quadric
+  {
+    double m[10] = { 0.0 };
+
+    void addPlane(glm::dvec3 const & n, double d, double weight)
+    {
+      m[0] += weight * n.x * n.x; m[1] += weight * n.x * n.y; m[2] += weight * n.x * n.z; m[3] += weight * n.x * d;
+      m[4] += weight * n.y * n.y; m[5] += weight * n.y * n.z; m[6] += weight * n.y * d;
+      m[7] += weight * n.z * n.z; m[8] += weight * n.z * d;
+      m[9] += weight * d * d;
+    }
+
+    void add(Quadric const & other)
+    {
+      for (uint32_t i = 0; i < 10; i++)
+      {
+        m[i] += other.m[i];
+      }
+    }
+
+    // Sum of the weighted squared distances from the planes
+    double error(glm::dvec3 const & p) const
+    {
+      return m[0] * p.x * p.x + 2.0 * m[1] * p.x * p.y + 2.0 * m[2] * p.x * p.z + 2.0 * m[3] * p.x
+           + m[4] * p.y * p.y + 2.0 * m[5] * p.y * p.z + 2.0 * m[6] * p.y
+           + m[7] * p.z * p.z + 2.0 * m[8] * p.z
+           + m[9];
+    }
+  };
+
+  struct Collapse
+  {
+    double   cost;
+    uint32_t from;
+    uint32_t to;
+    uint32_t fromVersion;
+    uint32_t toVersion;
+
+    bool operator<(Collapse const & other) const
+    {
+      // Cheapest on top of the queue
+      return cost > other.cost;
+    }
+  };
+}
+
+kit::Geometry kit::GeometrySimplifier::simplify(kit::Geometry const & source, float targetRatio, float maxError)
+{
+  uint32_t vertexCount = (uint32_t)source.m_vertices.size();
+  uint32_t triangleCount = (uint32_t)source.m_indices.size() / 3;
+  uint32_t targetCount = (uint32_t)(float(triangleCount) * glm::clamp(targetRatio, 0.0f, 1.0f));
+
+  std::vector<glm::dvec3> positions;
+  kit::AABB bounds;
+  for (auto & currVertex : source.m_vertices)
+  {
+    positions.push_back(glm::dvec3(currVertex.m_position));
+    bounds.expand(currVertex.m_position);
+  }
+  if (!bounds.isValid() || triangleCount == 0)
+  {
+    return source;
+  }
+  double errorLimit = double(maxError) * glm::distance(glm::dvec3(bounds.m_min), glm::dvec3(bounds.m_max));
+  errorLimit *= errorLimit;
+
+  std::vector<uint32_t> indices(source.m_indices.begin(), source.m_indices.begin() + triangleCount * 3);
+
+  // Weld vertices by position, so seams are not mistaken for borders
+  std::map<std::tuple<float, float, float>, uint32_t> positionIds;
+  std::vector<uint32_t> positionId(vertexCount);
+  std::vector<uint32_t> positionUsers;
+  for (uint32_t i = 0; i < vertexCount; i++)
+  {
+    glm::vec3 const & p = source.m_vertices[i].m_position;
+    auto inserted = positionIds.insert(std::make_pair(std::make_tuple(p.x, p.y, p.z), (uint32_t)positionUsers.size()));
+    if (inserted.second)
+    {
+      positionUsers.push_back(0);
+    }
+    positionId[i] = inserted.first->second;
+    positionUsers[positionId[i]]++;
+  }
+
+  // Lock seams, and borders (edges used by a single triangle)
+  std::vector<bool> locked(vertexCount, false);
+  std::map<std::pair<uint32_t, uint32_t>, uint32_t> edgeUsers;
+  for (uint32_t t = 0; t < triangleCount; t++)
+  {
+    for (uint32_t e = 0; e < 3; e++)
+    {
+      uint32_t a = positionId[indices[t * 3 + e]];
+      uint32_t b = positionId[indices[t * 3 + (e + 1) % 3]];
+      edgeUsers[std::make_pair((std::min)(a, b), (std::max)(a, b))]++;
+    }
+  }
+  std::vector<bool> borderPosition(positionUsers.size(), false);
+  for (auto & currEdge : edgeUsers)
+  {
+    if (currEdge.second == 1)
+    {
+      borderPosition[currEdge.first.first] = true;
+      borderPosition[currEdge.first.second] = true;
+    }
+  }
+  for (uint32_t i = 0; i < vertexCount; i++)
+  {
+    locked[i] = positionUsers[positionId[i]] > 1 || borderPosition[positionId[i]];
+  }
+
+  // Area weighted plane quadrics, and the triangles around each vertex
+  std::vector<Quadric> quadrics(vertexCount);
+  std::vector<std::vector<uint32_t>> vertexTriangles(vertexCount);
+  for (uint32_t t = 0; t < triangleCount; t++)
+  {
+    glm::dvec3 p0 = positions[indices[t * 3 + 0]];
+    glm::dvec3 p1 = positions[indices[t * 3 + 1]];
+    glm::dvec3 p2 = positions[indices[t * 3 + 2]];
+    glm::dvec3 normal = glm::cross(p1 - p0, p2 - p0);
+    double area = glm::length(normal);
+    if (area > 0.0)
+    {
+      normal /= area;
+      for (uint32_t v = 0; v < 3; v++)
+      {
+        quadrics[indices[t * 3 + v]].addPlane(normal, -glm::dot(normal, p0), area * 0.5);
+      }
+    }
+
+    for (uint32_t v = 0; v < 3; v++)
+    {
+      vertexTriangles[indices[t * 3 + v]].push_back(t);
+    }
+  }
+
+  std::vector<bool> removedTriangle(triangleCount, false);
+  std::vector<uint32_t> version(vertexCount, 0);
+  std::priority_queue<Collapse> queue;
+
+  auto pushCollapse = [&](uint32_t from, uint32_t to)
+  {
+    if (locked[from] || from == to)
+    {
+      return;
+    }
+
+    Quadric combined = quadrics[from];
+    combined.add(quadrics[to]);
+
+    Collapse newCollapse;
+    newCollapse.cost = combined.error(positions[to]);
+    newCollapse.from = from;
+    newCollapse.to = to;
+    newCollapse.fromVersion = version[from];
+    newCollapse.toVersion = version[to];
+    queue.push(newCollapse);
+  };
+
+  auto pushVertex = [&](uint32_t v)
+  {
+    for (auto currTriangle : vertexTriangles[v])
+    {
+      if (removedTriangle[currTriangle])
+      {
+        continue;
+      }
+      for (uint32_t e = 0; e < 3; e++)
+      {
+        uint32_t other = indices[currTriangle * 3 + e];
+        if (other != v)
+        {
+          pushCollapse(v, other);
+          pushCollapse(other, v);
+        }
+      }
+    }
+  };
+
+  for (uint32_t t = 0; t < triangleCount; t++)
+  {
+    for (uint32_t e = 0; e < 3; e++)
+    {
+      pushCollapse(indices[t * 3 + e], indices[t * 3 + (e + 1) % 3]);
+      pushCollapse(indices[t * 3 + (e + 1) % 3], indices[t * 3 + e]);
+    }
+  }
+
+  uint32_t liveTriangles = triangleCount;
+  while (liveTriangles > targetCount && !queue.empty())
+  {
+    Collapse currCollapse = queue.top();
+    queue.pop();
+
+    if (currCollapse.cost > errorLimit)
+    {
+      break;
+    }
+
+    uint32_t from = currCollapse.from;
+    uint32_t to = currCollapse.to;
+    if (currCollapse.fromVersion != version[from] || currCollapse.toVersion != version[to])
+    {
+      continue;
+    }
+
+    // Skip collapses that would flip or crush a remaining triangle
+    bool valid = true;
+    for (auto currTriangle : vertexTriangles[from])
+    {
+      if (removedTriangle[currTriangle])
+      {
+        continue;
+      }
+
+      uint32_t * tri = &indices[currTriangle * 3];
+      if (tri[0] == to || tri[1] == to || tri[2] == to)
+      {
+        continue;
+      }
+
+      glm::dvec3 before[3] = { positions[tri[0]], positions[tri[1]], positions[tri[2]] };
+      glm::dvec3 after[3] = { before[0], before[1], before[2] };
+      for (uint32_t v = 0; v < 3; v++)
+      {
+        if (tri[v] == from)
+        {
+          after[v] = positions[to];
+        }
+      }
+
+      glm::dvec3 normalBefore = glm::cross(before[1] - before[0], before[2] - before[0]);
+      glm::dvec3 normalAfter = glm::cross(after[1] - after[0], after[2] - after[0]);
+      if (glm::dot(normalBefore, normalAfter) <= 0.0 || glm::length(normalAfter) <= 1e-4 * glm::length(normalBefore))
+      {
+        valid = false;
+        break;
+      }
+    }
+    if (!valid)
+    {
+      continue;
+    }
+
+    // Move the triangles of the collapsed vertex to its target, and drop the ones that became degenerate
+    for (auto currTriangle : vertexTriangles[from])
+    {
+      if (removedTriangle[currTriangle])
+      {
+        continue;
+      }
+
+      uint32_t * tri = &indices[currTriangle * 3];
+      if (tri[0] == to || tri[1] == to || tri[2] == to)
+      {
+        removedTriangle[currTriangle] = true;
+        liveTriangles--;
+        continue;
+      }
+
+      for (uint32_t v = 0; v < 3; v++)
+      {
+        if (tri[v] == from)
+        {
+          tri[v] = to;
+        }
+      }
+      vertexTriangles[to].push_back(currTriangle);
+    }
+    vertexTriangles[from].clear();
+
+    quadrics[to].add(quadrics[from]);
+    version[from]++;
+    version[to]++;
+    pushVertex(to);
+  }
+
+  // Compact the remaining triangles and the vertices they use
+  kit::Geometry result;
+  std::vector<uint32_t> remap(vertexCount, UINT32_MAX);
+  for (uint32_t t = 0; t < triangleCount; t++)
+  {
+    if (removedTriangle[t])
+    {
+      continue;
+    }
+
+    for (uint32_t v = 0; v < 3; v++)
+    {
+      uint32_t index = indices[t * 3 + v];
+      if (remap[index] == UINT32_MAX)
+      {
+        remap[index] = (uint32_t)result.m_vertices.size();
+        result.m_vertices.push_back(source.m_vertices[index]);
+      }
+      result.m_indices.push_back(remap[index]);
+    }
+  }
+
+  return result;
+}
+
+uint32_t kit::GeometrySimplifier::buildChain(const std::string& filename, uint32_t levels, float ratio, float maxError)
+{
+  kit::Geometry current;
+  if (!current.load(filename))
+  {
+    KIT_ERR("Warning: could not load geometry to build a LOD chain from");
+    return 0;
+  }
+
+  uint32_t sourceTriangles = (uint32_t)current.m_indices.size() / 3;
+  for (uint32_t level = 1; level <= levels; level++)
+  {
+    uint32_t lastTriangles = (uint32_t)current.m_indices.size() / 3;
+    kit::Geometry simplified = kit::GeometrySimplifier::simplify(current, ratio, maxError);
+    uint32_t triangles = (uint32_t)simplified.m_indices.size() / 3;
+
+    // Stop once simplifying hardly helps, a level that costs about as much as the one before is useless
+    if (triangles == 0 || float(triangles) > float(lastTriangles) * 0.9f)
+    {
+      return level - 1;
+    }
+
+    std::stringstream levelName;
+    levelName << filename << ".lod" << level;
+    if (!simplified.save(levelName.str()))
+    {
+      KIT_ERR("Warning: could not save LOD geometry");
+      return level - 1;
+    }
+
+    std::cout << "Saved " << levelName.str() << " with " << triangles << " of " << sourceTriangles << " triangles" << std::endl;
+    current = simplified;
+  }
+
+  return levels;
+}
@@ -1,6 +1,7 @@
 #include "Kit/GridFloor.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 #include "Kit/Program.hpp"
 #include "Kit/Camera.hpp"
 #include "Kit/Texture.hpp"
@@ -226,9 +227,9 @@ void kit::GridFloor::releaseShared()
 void kit::GridFloor::renderForward(kit::Renderer * renderer)
 {
   
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-  glEnable(GL_DEPTH_TEST);
+  kit::GLState::setBlend(true);
+  kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  kit::GLState::setDepthTest(true);
   
   glm::mat4 modelViewProjectionMatrix = renderer->getActiveCamera()->getProjectionMatrix() * renderer->getActiveCamera()->getViewMatrix() * getWorldTransformMatrix();
   
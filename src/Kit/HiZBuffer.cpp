@@ -0,0 +1,121 @@
+#include "Kit/HiZBuffer.hpp"
+
+#include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
+#include "Kit/Program.hpp"
+#include "Kit/Texture.hpp"
+
+const uint32_t kit::HiZBuffer::TextureUnit;
+
+kit::HiZBuffer::HiZBuffer()
+{
+  m_program = new kit::Program({"culling/hiz-build.comp"}, kit::DataSource::Static);
+}
+
+kit::HiZBuffer::~HiZBuffer()
+{
+  if(m_program)
+    delete m_program;
+
+  if(m_glTexture != 0)
+  {
+    kit::GLState::forgetTexture(m_glTexture);
+    glDeleteTextures(1, &m_glTexture);
+  }
+}
+
+void kit::HiZBuffer::allocate(glm::uvec2 resolution)
+{
+  if(m_glTexture != 0)
+  {
+    kit::GLState::forgetTexture(m_glTexture);
+    glDeleteTextures(1, &m_glTexture);
+  }
+
+  m_resolution = glm::max(resolution, glm::uvec2(1));
+  m_levelCount = 1;
+  for (uint32_t size = glm::max(m_resolution.x, m_resolution.y); size > 1; size /= 2)
+  {
+    m_levelCount++;
+  }
+
+#ifndef KIT_SHITTY_INTEL
+  glCreateTextures(GL_TEXTURE_2D, 1, &m_glTexture);
+  glTextureStorage2D(m_glTexture, m_levelCount, GL_R32F, m_resolution.x, m_resolution.y);
+  glTextureParameteri(m_glTexture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTextureParameteri(m_glTexture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+#else
+  glGenTextures(1, &m_glTexture);
+  glBindTexture(GL_TEXTURE_2D, m_glTexture);
+  glTexStorage2D(GL_TEXTURE_2D, m_levelCount, GL_R32F, m_resolution.x, m_resolution.y);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glBindTexture(GL_TEXTURE_2D, 0);
+#endif
+
+  m_valid = false;
+}
+
+void kit::HiZBuffer::update(kit::Texture * depthTexture, glm::mat4 const & viewProjectionMatrix)
+{
+  glm::uvec2 resolution = glm::uvec2(depthTexture->getResolution());
+  if (m_glTexture == 0 || resolution != m_resolution)
+  {
+    allocate(resolution);
+  }
+
+  m_program->use();
+  m_program->setUniform1i("uniform_depth", TextureUnit);
+
+  kit::GLState::bindTexture(TextureUnit, GL_TEXTURE_2D, depthTexture->getHandle());
+
+  glm::uvec2 levelSize = m_resolution;
+  for (uint32_t level = 0; level < m_levelCount; level++)
+  {
+    // Level 0 is copied from the depth texture, the source image is not read
+    m_program->setUniform1i("uniform_copyDepth", level == 0 ? 1 : 0);
+    glBindImageTexture(0, m_glTexture, level == 0 ? 0 : level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+    glBindImageTexture(1, m_glTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((levelSize.x + 7) / 8, (levelSize.y + 7) / 8, 1);
+    glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+
+    levelSize = glm::max(levelSize / 2u, glm::uvec2(1));
+  }
+  glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+  glBindImageTexture(0, 0, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+  glBindImageTexture(1, 0, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+
+  m_viewProjectionMatrix = viewProjectionMatrix;
+  m_valid = true;
+}
+
+void kit::HiZBuffer::bind(kit::Program * program)
+{
+  program->setUniform1i("uniform_hiZ", TextureUnit);
+  program->setUniform2f("uniform_hiZResolution", glm::vec2(m_resolution));
+  program->setUniform1i("uniform_hiZLevels", (int32_t)m_levelCount);
+  program->setUniformMat4("uniform_hiZViewProjection", m_viewProjectionMatrix);
+
+  kit::GLState::bindTexture(TextureUnit, GL_TEXTURE_2D, m_glTexture);
+}
+
+bool kit::HiZBuffer::isValid()
+{
+  return m_valid;
+}
+
+glm::uvec2 kit::HiZBuffer::getResolution()
+{
+  return m_resolution;
+}
+
+uint32_t kit::HiZBuffer::getLevelCount()
+{
+  return m_levelCount;
+}
+
+glm::mat4 const & kit::HiZBuffer::getViewProjectionMatrix()
+{
+  return m_viewProjectionMatrix;
+}
@@ -4,6 +4,7 @@
 #include "Kit/PixelBuffer.hpp"
 #include "Kit/Cubemap.hpp"
 #include "Kit/Cone.hpp"
+#include "Kit/Camera.hpp"
 
 #include <glm/gtx/transform.hpp>
 
@@ -14,11 +15,17 @@ kit::Light::Light(kit::Light::Type t, glm::uvec2 shadowmapsize) : kit::Transform
   m_shadowMapped = false;
   m_shadowBuffer = nullptr;
   m_maxShadowDistance = 40.0f;
+  m_shadowmapSize = shadowmapsize;
   m_color = glm::vec3(1.0f, 1.0f, 1.0f);
   
   if (m_type == kit::Light::Point)
   {
     setRadius(1.0);
+
+    if (shadowmapsize != glm::uvec2(0, 0))
+    {
+      m_shadowMapped = true;
+    }
   }
 
   if (m_type == kit::Light::Spot)
@@ -30,7 +37,6 @@ kit::Light::Light(kit::Light::Type t, glm::uvec2 shadowmapsize) : kit::Transform
 
     if (shadowmapsize != glm::uvec2(0, 0))
     {
-      m_shadowBuffer = kit::PixelBuffer::createShadowBuffer(shadowmapsize);
       m_shadowMapped = true;
     }
   }
@@ -39,8 +45,8 @@ kit::Light::Light(kit::Light::Type t, glm::uvec2 shadowmapsize) : kit::Transform
   {
     if (shadowmapsize != glm::uvec2(0, 0))
     {
-      m_shadowBuffer = kit::PixelBuffer::createShadowBuffer(shadowmapsize);
       m_shadowMapped = true;
+      setCascadeCount(3);
     }
   }
 }
@@ -65,6 +71,34 @@ kit::PixelBuffer * kit::Light::getShadowBuffer()
   return m_shadowBuffer;
 }
 
+kit::Light::ShadowCache & kit::Light::getShadowCache()
+{
+  return m_shadowCache;
+}
+
+void kit::Light::invalidateShadowCache()
+{
+  m_shadowCache.staticCasters.clear();
+  m_shadowCache.tileCount = 0;
+  m_shadowCache.tilesStaticOnly = false;
+  m_shadowCache.frame = 0;
+}
+
+glm::uvec2 kit::Light::getShadowmapSize()
+{
+  return m_shadowmapSize;
+}
+
+void kit::Light::setShadowPriority(float priority)
+{
+  m_shadowPriority = glm::max(priority, 0.0f);
+}
+
+float kit::Light::getShadowPriority()
+{
+  return m_shadowPriority;
+}
+
 glm::vec3 kit::Light::getColor()
 {
   return m_color;
@@ -200,7 +234,7 @@ const kit::Light::Type& kit::Light::getType()
 
 glm::mat4 kit::Light::getPointProjectionMatrix()
 {
-  return glm::perspective(glm::radians(90.0f), 1.0f, 0.001f, m_radius);
+  return glm::perspective(glm::radians(90.0f), 1.0f, 0.05f, m_radius);
 }
 
 glm::mat4 kit::Light::getPointViewMatrix(kit::Cubemap::Side s)
@@ -233,6 +267,38 @@ glm::mat4 kit::Light::getPointViewMatrix(kit::Cubemap::Side s)
   return glm::mat4();
 }
 
+glm::mat4 kit::Light::getDirectionalProjectionMatrix()
+{
+  if (m_cascades.empty())
+  {
+    float boxSize = m_maxShadowDistance;
+    return glm::ortho(-boxSize, boxSize, -boxSize, boxSize, -boxSize, boxSize);
+  }
+
+  return m_cascades[0].projectionMatrix;
+}
+
+glm::mat4 kit::Light::getDirectionalViewMatrix()
+{
+  if (m_cascades.empty())
+  {
+    return glm::lookAt(-getWorldForward(), glm::vec3(0,0,0), glm::vec3(0,1,0));
+  }
+
+  return m_cascades[0].viewMatrix;
+}
+
+glm::mat4 kit::Light::getDirectionalModelMatrix(glm::vec3 cameraPosition, glm::vec3 cameraForward)
+{
+  // Cascades are fitted around the camera in world space already
+  if (m_cascades.empty())
+  {
+    return glm::translate(-cameraPosition);
+  }
+
+  return glm::mat4(1.0f);
+}
+
 glm::mat4 kit::Light::getSpotProjectionMatrix()
 {
   return glm::perspective(glm::radians(m_coneOuter), 1.0f, 0.05f, m_radius);
@@ -246,37 +312,150 @@ glm::mat4 kit::Light::getSpotViewMatrix()
 }
 
 
-glm::mat4 kit::Light::getDirectionalProjectionMatrix()
+void kit::Light::setCascadeCount(uint32_t count)
+{
+  if (m_type != kit::Light::Directional || !m_shadowMapped)
+  {
+    KIT_ERR("Refuse to set cascade count, not a shadowmapped directional light");
+    return;
+  }
+
+  count = glm::clamp(count, 1u, 4u);
+  
+  static const uint32_t defaultIntervals[4] = {1, 1, 2, 4};
+  m_cascades.resize(count);
+  for (uint32_t i = 0; i < count; i++)
+  {
+    m_cascades[i] = Cascade();
+    m_cascades[i].updateInterval = defaultIntervals[i];
+  }
+  
+  if (m_shadowBuffer)
+  {
+    delete m_shadowBuffer;
+  }
+  
+  m_shadowBuffer = kit::PixelBuffer::createShadowBuffer(glm::uvec2(m_shadowmapSize.x * count, m_shadowmapSize.y));
+}
+
+uint32_t kit::Light::getCascadeCount()
 {
-  float boxSize = m_maxShadowDistance;
-  return glm::ortho(-boxSize, boxSize, -boxSize, boxSize, -boxSize, boxSize);
+  return (uint32_t)m_cascades.size();
 }
 
-glm::mat4 kit::Light::getDirectionalViewMatrix()
+void kit::Light::setCascadeSplit(kit::Light::CascadeSplit scheme, float lambda)
 {
-  glm::mat4 depthViewMatrix = glm::lookAt(-getWorldForward(), glm::vec3(0,0,0), glm::vec3(0,1,0));
+  m_cascadeSplit = scheme;
+  m_cascadeLambda = glm::clamp(lambda, 0.0f, 1.0f);
+}
 
-  return depthViewMatrix;
+void kit::Light::setCascadeSplitDistances(std::vector<float> const & distances)
+{
+  m_cascadeSplit = CascadeSplit::Manual;
+  m_cascadeDistances = distances;
 }
 
-glm::mat4 kit::Light::getDirectionalModelMatrix(glm::vec3 cameraPosition, glm::vec3 cameraForward)
+void kit::Light::setCascadeUpdateInterval(uint32_t cascade, uint32_t frames)
 {
-  glm::mat4 depthModelMatrix = glm::translate(-cameraPosition);
+  if (cascade >= m_cascades.size())
+  {
+    KIT_ERR("Refuse to set cascade update interval, no such cascade");
+    return;
+  }
 
-  return depthModelMatrix;
+  m_cascades[cascade].updateInterval = glm::max(frames, 1u);
 }
 
-//currLight->getDirectionalProjectionMatrix() * currLight->getDirectionalViewMatrix(-c->getPosition()
+std::vector<kit::Light::Cascade> & kit::Light::getCascades()
+{
+  return m_cascades;
+}
 
+glm::uvec2 kit::Light::getCascadeResolution()
+{
+  return m_shadowmapSize;
+}
 
-/*
-Matrix viewProjectionMatrix = viewMatrix * projectionMatrix;
-Vector3 ViewTarget = ...; // A point in front of the viewpoint camera.
-Vector3 ShadowTarget = viewProjectionMatrix * ViewTarget;
+void kit::Light::updateCascades(kit::Camera * camera)
+{
+  if (m_cascades.empty())
+  {
+    return;
+  }
+
+  glm::vec2 clip = camera->getClipRange();
+  float znear = clip.x;
+  float zfar = glm::min(clip.y, m_maxShadowDistance);
+  uint32_t count = (uint32_t)m_cascades.size();
+
+  // Split distances
+  for (uint32_t i = 0; i < count; i++)
+  {
+    float t = float(i + 1) / float(count);
+    float uniformSplit = znear + (zfar - znear) * t;
+    float logSplit = znear * glm::pow(zfar / znear, t);
+    
+    switch (m_cascadeSplit)
+    {
+      case CascadeSplit::Uniform:
+        m_cascades[i].splitFar = uniformSplit;
+        break;
+      case CascadeSplit::Logarithmic:
+        m_cascades[i].splitFar = logSplit;
+        break;
+      case CascadeSplit::Practical:
+        m_cascades[i].splitFar = glm::mix(uniformSplit, logSplit, m_cascadeLambda);
+        break;
+      case CascadeSplit::Manual:
+        m_cascades[i].splitFar = (i < m_cascadeDistances.size()) ? glm::clamp(m_cascadeDistances[i], znear, zfar) : zfar;
+        break;
+    }
+  }
+  m_cascades[count - 1].splitFar = zfar;
+
+  glm::mat4 invViewMatrix = glm::inverse(camera->getViewMatrix());
+  float tanHalfFov = glm::tan(glm::radians(camera->getFov()) * 0.5f);
+  float aspect = camera->getAspectRatio();
 
-ShadowTarget.XY = Round(ShadowTarget.XY / ShadowTexture.Size) * ShadowTexture.Size;
-Matrix ShadowMatrix = BaseShadowMatrix * TranslationMatrix(ShadowTarget);
-*/
+  glm::vec3 forward = getWorldForward();
+  glm::vec3 up = glm::abs(forward.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+  glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), forward, up);
+
+  float splitNear = znear;
+  for (auto & cascade : m_cascades)
+  {
+    // Bounding sphere of the slice of the view frustum. Its radius only depends on the shape of the slice, so it does not change when the camera turns
+    glm::vec3 corners[8];
+    glm::vec3 center(0.0f);
+    for (uint32_t i = 0; i < 8; i++)
+    {
+      float depth = (i & 4) ? cascade.splitFar : splitNear;
+      float halfHeight = depth * tanHalfFov;
+      float halfWidth = halfHeight * aspect;
+      corners[i] = glm::vec3(invViewMatrix * glm::vec4((i & 1) ? halfWidth : -halfWidth, (i & 2) ? halfHeight : -halfHeight, -depth, 1.0f));
+      center += corners[i] / 8.0f;
+    }
+    
+    float radius = 0.0f;
+    for (auto & corner : corners)
+    {
+      radius = glm::max(radius, glm::distance(center, corner));
+    }
+    radius = glm::ceil(radius * 16.0f) / 16.0f;
+
+    // Snap the center to whole shadow texels, so that the shadows do not shimmer as the camera moves
+    glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+    glm::vec2 texelSize = glm::vec2(radius * 2.0f) / glm::vec2(m_shadowmapSize);
+    lightCenter.x = glm::floor(lightCenter.x / texelSize.x) * texelSize.x;
+    lightCenter.y = glm::floor(lightCenter.y / texelSize.y) * texelSize.y;
+
+    // Pull the near plane back towards the light, to catch casters outside the view
+    cascade.viewMatrix = lightView;
+    cascade.projectionMatrix = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius, -lightCenter.z - radius - m_maxShadowDistance, -lightCenter.z + radius);
+
+    splitNear = cascade.splitFar;
+  }
+}
 
 void kit::Light::setMaxShadowDistance(float f)
 {
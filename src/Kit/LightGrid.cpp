@@ -0,0 +1,283 @@
+#include "Kit/LightGrid.hpp"
+
+#include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
+#include "Kit/Camera.hpp"
+#include "Kit/Light.hpp"
+#include "Kit/Program.hpp"
+
+#include <algorithm>
+#include <glm/gtc/constants.hpp>
+
+/*
+ *  Light data layout, 4 RGBA32F texels per light, all in view space
+ *
+ *  #   r       g       b       a
+ *  0   Pos.x   Pos.y   Pos.z   Type (0 = point, 1 = spot)
+ *  1   Col.r   Col.g   Col.b   cos(outer cone angle / 2)
+ *  2   Falloff (as kit::Light::getAttenuation)
+ *  3   Dir.x   Dir.y   Dir.z   cos(inner cone angle / 2)
+ */
+
+const uint32_t kit::LightGrid::GridWidth;
+const uint32_t kit::LightGrid::GridHeight;
+const uint32_t kit::LightGrid::GridDepth;
+const uint32_t kit::LightGrid::MaxLightsPerCluster;
+const uint32_t kit::LightGrid::FirstTextureUnit;
+
+kit::LightGrid::LightGrid()
+{
+  glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &m_maxBufferTexels);
+
+#ifndef KIT_SHITTY_INTEL
+  glCreateBuffers(1, &m_glLightBuffer);
+  glCreateBuffers(1, &m_glClusterBuffer);
+  glCreateBuffers(1, &m_glIndexBuffer);
+#else
+  glGenBuffers(1, &m_glLightBuffer);
+  glGenBuffers(1, &m_glClusterBuffer);
+  glGenBuffers(1, &m_glIndexBuffer);
+#endif
+
+  // Buffer textures need a data store before they can be attached
+  m_lightData.resize(4);
+  m_clusterData.resize(GridWidth * GridHeight * GridDepth * 2, 0);
+  m_indices.resize(1, 0);
+  upload(m_glLightBuffer, m_lightData.size() * sizeof(glm::vec4), &m_lightData[0]);
+  upload(m_glClusterBuffer, m_clusterData.size() * sizeof(uint32_t), &m_clusterData[0]);
+  upload(m_glIndexBuffer, m_indices.size() * sizeof(uint32_t), &m_indices[0]);
+  m_lightData.clear();
+  m_indices.clear();
+
+#ifndef KIT_SHITTY_INTEL
+  glCreateTextures(GL_TEXTURE_BUFFER, 1, &m_glLightTexture);
+  glCreateTextures(GL_TEXTURE_BUFFER, 1, &m_glClusterTexture);
+  glCreateTextures(GL_TEXTURE_BUFFER, 1, &m_glIndexTexture);
+  glTextureBuffer(m_glLightTexture, GL_RGBA32F, m_glLightBuffer);
+  glTextureBuffer(m_glClusterTexture, GL_RG32UI, m_glClusterBuffer);
+  glTextureBuffer(m_glIndexTexture, GL_R32UI, m_glIndexBuffer);
+#else
+  glGenTextures(1, &m_glLightTexture);
+  glGenTextures(1, &m_glClusterTexture);
+  glGenTextures(1, &m_glIndexTexture);
+  glBindTexture(GL_TEXTURE_BUFFER, m_glLightTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, m_glLightBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, m_glClusterTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, m_glClusterBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, m_glIndexTexture);
+  glTexBuffer(GL_TEXTURE_BUFFER, GL_R32UI, m_glIndexBuffer);
+  glBindTexture(GL_TEXTURE_BUFFER, 0);
+#endif
+}
+
+kit::LightGrid::~LightGrid()
+{
+  kit::GLState::forgetTexture(m_glLightTexture);
+  kit::GLState::forgetTexture(m_glClusterTexture);
+  kit::GLState::forgetTexture(m_glIndexTexture);
+  glDeleteTextures(1, &m_glLightTexture);
+  glDeleteTextures(1, &m_glClusterTexture);
+  glDeleteTextures(1, &m_glIndexTexture);
+  glDeleteBuffers(1, &m_glLightBuffer);
+  glDeleteBuffers(1, &m_glClusterBuffer);
+  glDeleteBuffers(1, &m_glIndexBuffer);
+}
+
+void kit::LightGrid::upload(uint32_t buffer, size_t bytes, const void * data)
+{
+  // Respecifying the whole store orphans last frame's data instead of waiting for the GPU to finish with it
+#ifndef KIT_SHITTY_INTEL
+  glNamedBufferData(buffer, bytes, data, GL_STREAM_DRAW);
+#else
+  glBindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, bytes, data, GL_STREAM_DRAW);
+  glBindBuffer(GL_TEXTURE_BUFFER, 0);
+#endif
+}
+
+void kit::LightGrid::update(kit::Camera * camera, std::vector<kit::Light*> const & lights)
+{
+  glm::mat4 viewMatrix = camera->getViewMatrix();
+  glm::mat4 projectionMatrix = camera->getProjectionMatrix();
+  glm::vec2 clip = camera->getClipRange();
+  float znear = clip.x;
+  float zfar = clip.y;
+
+  float sliceScale = float(GridDepth) / glm::log(zfar / znear);
+  m_depthSlicing = glm::vec2(sliceScale, -glm::log(znear) * sliceScale);
+
+  m_lightData.clear();
+  m_lightClusters.clear();
+  m_indices.clear();
+  std::fill(m_clusterData.begin(), m_clusterData.end(), 0);
+
+  uint32_t maxLights = uint32_t(std::max(m_maxBufferTexels, 4) / 4);
+
+  // Cull the lights and find the clusters each of them touches
+  for(auto & currLight : lights)
+  {
+    kit::Light::Type type = currLight->getType();
+    if(type != kit::Light::Point && type != kit::Light::Spot)
+    {
+      continue;
+    }
+
+    if(m_lightClusters.size() == maxLights)
+    {
+      KIT_ERR("Warning: too many lights for the light grid, dropping the rest");
+      break;
+    }
+
+    glm::vec3 position = glm::vec3(viewMatrix * glm::vec4(currLight->getWorldPosition(), 1.0f));
+    glm::vec3 direction = glm::normalize(glm::vec3(viewMatrix * glm::vec4(currLight->getWorldForward(), 0.0f)));
+    float range = currLight->getRadius();
+
+    // Bounding sphere of the lit volume. For spot lights, the tightest sphere around the cone and its spherical cap
+    glm::vec3 center = position;
+    float radius = range;
+    glm::vec2 coneCos(1.0f, 1.0f);
+    if(type == kit::Light::Spot)
+    {
+      glm::vec2 coneAngle = glm::radians(currLight->getConeAngle()) * 0.5f;
+      coneCos = glm::vec2(glm::cos(coneAngle.x), glm::cos(coneAngle.y));
+      if(coneAngle.y > glm::quarter_pi<float>())
+      {
+        center = position + direction * (range * coneCos.y);
+        radius = range * glm::sin(coneAngle.y);
+      }
+      else
+      {
+        radius = range / (2.0f * coneCos.y);
+        center = position + direction * radius;
+      }
+    }
+
+    // Depth range, as positive distances in front of the camera
+    float minDepth = -center.z - radius;
+    float maxDepth = -center.z + radius;
+    if(maxDepth < znear || minDepth > zfar)
+    {
+      continue;
+    }
+    minDepth = std::max(minDepth, znear);
+    maxDepth = std::min(maxDepth, zfar);
+
+    // Screen bounds of the sphere's bounding box, clamped to the near plane so every corner projects
+    glm::vec2 minNDC(1.0f);
+    glm::vec2 maxNDC(-1.0f);
+    for(uint32_t i = 0; i < 8; i++)
+    {
+      glm::vec4 corner(center.x + ((i & 1) ? radius : -radius), center.y + ((i & 2) ? radius : -radius), (i & 4) ? -minDepth : -maxDepth, 1.0f);
+      glm::vec4 projected = projectionMatrix * corner;
+      glm::vec2 ndc = glm::vec2(projected) / projected.w;
+      minNDC = glm::min(minNDC, ndc);
+      maxNDC = glm::max(maxNDC, ndc);
+    }
+
+    if(minNDC.x > 1.0f || minNDC.y > 1.0f || maxNDC.x < -1.0f || maxNDC.y < -1.0f)
+    {
+      continue;
+    }
+
+    glm::vec2 gridSize(GridWidth, GridHeight);
+    glm::vec2 minTile = glm::clamp((minNDC * 0.5f + 0.5f) * gridSize, glm::vec2(0.0f), gridSize - 1.0f);
+    glm::vec2 maxTile = glm::clamp((maxNDC * 0.5f + 0.5f) * gridSize, glm::vec2(0.0f), gridSize - 1.0f);
+    float minSlice = glm::clamp(glm::log(minDepth) * m_depthSlicing.x + m_depthSlicing.y, 0.0f, float(GridDepth - 1));
+    float maxSlice = glm::clamp(glm::log(maxDepth) * m_depthSlicing.x + m_depthSlicing.y, 0.0f, float(GridDepth - 1));
+
+    ClusterRange clusters;
+    clusters.min = glm::uvec3(uint32_t(minTile.x), uint32_t(minTile.y), uint32_t(minSlice));
+    clusters.max = glm::uvec3(uint32_t(maxTile.x), uint32_t(maxTile.y), uint32_t(maxSlice));
+    m_lightClusters.push_back(clusters);
+
+    glm::vec3 color = currLight->getColor();
+    m_lightData.push_back(glm::vec4(position, type == kit::Light::Spot ? 1.0f : 0.0f));
+    m_lightData.push_back(glm::vec4(color, coneCos.y));
+    m_lightData.push_back(currLight->getAttenuation());
+    m_lightData.push_back(glm::vec4(direction, coneCos.x));
+  }
+
+  // Count the lights per cluster, then turn the counts into offsets
+  for(auto & clusters : m_lightClusters)
+  {
+    for(uint32_t z = clusters.min.z; z <= clusters.max.z; z++)
+    {
+      for(uint32_t y = clusters.min.y; y <= clusters.max.y; y++)
+      {
+        for(uint32_t x = clusters.min.x; x <= clusters.max.x; x++)
+        {
+          uint32_t & count = m_clusterData[((z * GridHeight + y) * GridWidth + x) * 2 + 1];
+          count = std::min(count + 1, MaxLightsPerCluster);
+        }
+      }
+    }
+  }
+
+  uint32_t offset = 0;
+  for(uint32_t i = 0; i < m_clusterData.size(); i += 2)
+  {
+    m_clusterData[i] = offset;
+    offset += m_clusterData[i + 1];
+    m_clusterData[i + 1] = 0;
+  }
+
+  // Fill the index lists, using the counts as write cursors
+  m_indices.resize(std::max(offset, 1u), 0);
+  for(uint32_t i = 0; i < m_lightClusters.size(); i++)
+  {
+    ClusterRange & clusters = m_lightClusters[i];
+    for(uint32_t z = clusters.min.z; z <= clusters.max.z; z++)
+    {
+      for(uint32_t y = clusters.min.y; y <= clusters.max.y; y++)
+      {
+        for(uint32_t x = clusters.min.x; x <= clusters.max.x; x++)
+        {
+          uint32_t cluster = ((z * GridHeight + y) * GridWidth + x) * 2;
+          uint32_t & count = m_clusterData[cluster + 1];
+          if(count < MaxLightsPerCluster)
+          {
+            m_indices[m_clusterData[cluster] + count] = i;
+            count++;
+          }
+        }
+      }
+    }
+  }
+
+  if(m_indices.size() > size_t(m_maxBufferTexels))
+  {
+    KIT_ERR("Warning: light grid index list exceeds the maximum buffer texture size");
+  }
+
+  if(m_lightData.empty())
+  {
+    m_lightData.push_back(glm::vec4(0.0f));
+  }
+
+  upload(m_glLightBuffer, m_lightData.size() * sizeof(glm::vec4), &m_lightData[0]);
+  upload(m_glClusterBuffer, m_clusterData.size() * sizeof(uint32_t), &m_clusterData[0]);
+  upload(m_glIndexBuffer, m_indices.size() * sizeof(uint32_t), &m_indices[0]);
+}
+
+void kit::LightGrid::bind(kit::Program * program)
+{
+  program->setUniform1i("uniform_lightData", FirstTextureUnit);
+  program->setUniform1i("uniform_clusterData", FirstTextureUnit + 1);
+  program->setUniform1i("uniform_lightIndices", FirstTextureUnit + 2);
+  program->setUniform3f("uniform_gridSize", glm::vec3(GridWidth, GridHeight, GridDepth));
+  program->setUniform2f("uniform_depthSlicing", m_depthSlicing);
+
+  kit::GLState::bindTexture(FirstTextureUnit, GL_TEXTURE_BUFFER, m_glLightTexture);
+  kit::GLState::bindTexture(FirstTextureUnit + 1, GL_TEXTURE_BUFFER, m_glClusterTexture);
+  kit::GLState::bindTexture(FirstTextureUnit + 2, GL_TEXTURE_BUFFER, m_glIndexTexture);
+}
+
+uint32_t kit::LightGrid::getLightCount()
+{
+  return uint32_t(m_lightClusters.size());
+}
+
+uint32_t kit::LightGrid::getIndexCount()
+{
+  return uint32_t(m_indices.size());
+}
@@ -1,15 +1,18 @@
 #include "Kit/Material.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 #include "Kit/Exception.hpp"
 #include "Kit/Shader.hpp"
 #include "Kit/Texture.hpp"
 #include "Kit/Program.hpp"
 #include "Kit/PixelBuffer.hpp"
+#include "Kit/MaterialCache.hpp"
 #include "Kit/Camera.hpp"
 #include "Kit/Quad.hpp"
 #include "Kit/Renderer.hpp"
 #include "Kit/Light.hpp"
+#include "Kit/UniformBuffer.hpp"
 
 #include <glm/gtx/transform.hpp>
 #include <sstream>
@@ -21,6 +24,8 @@ std::map<std::string, std::weak_ptr<kit::Material>> kit::Material::m_cache = std
 std::map<kit::Material::ProgramFlags, kit::Program*> kit::Material::m_programCache = std::map<kit::Material::ProgramFlags, kit::Program*>();
 
 kit::Program * kit::Material::m_reflectiveProgram = nullptr;
+kit::UniformRing * kit::Material::m_drawRing = nullptr;
+std::map<kit::Program*, kit::Material::ProgramUniforms> kit::Material::m_programUniforms = std::map<kit::Program*, kit::Material::ProgramUniforms>();
 
 static const char * glslVersion = "#version 430 core\n";
 
@@ -103,6 +108,7 @@ uniform float     uniform_defaultB;\n\
 \n\
 uniform int uniform_usemapA;\n\
 uniform int uniform_usemapB;\n\
+uniform int uniform_reconstructA;\n\
 \n\
 out vec4 out_color;\n\
 \n\
@@ -116,6 +122,12 @@ void main()\n\
     valA = texture(uniform_mapA, in_texCoords).rgb;\n\
   }\n\
   \n\
+  if(uniform_reconstructA == 1)\n\
+  {\n\
+    vec2 xy = valA.xy * 2.0 - 1.0;\n\
+    valA.z = sqrt(max(1.0 - dot(xy, xy), 0.0)) * 0.5 + 0.5;\n\
+  }\n\
+  \n\
   if(uniform_usemapB == 1)\n\
   {\n\
     valB = texture(uniform_mapB, in_texCoords).r;\n\
@@ -221,29 +233,13 @@ kit::Material::Material()
   {
     kit::Material::allocateShared();
   }
-  
-  m_arCache = new kit::PixelBuffer(glm::uvec2(128, 128), {kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8)});
-  m_arCache->getColorAttachment(0)->setMinFilteringMode(Texture::LinearMipmapLinear);
-  
-  m_nmCache = new kit::PixelBuffer(glm::uvec2(128, 128), {kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8)});
-  m_nmCache->getColorAttachment(0)->setMinFilteringMode(Texture::LinearMipmapLinear);
-  
-  m_ndCache = new kit::PixelBuffer(glm::uvec2(128, 128), {kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8)});
-  m_ndCache->getColorAttachment(0)->setMinFilteringMode(Texture::LinearMipmapLinear);
-  
-  m_eoCache = new kit::PixelBuffer(glm::uvec2(128, 128), {kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8)});
-  m_eoCache->getColorAttachment(0)->setMinFilteringMode(Texture::LinearMipmapLinear);
-
 }
 
 kit::Material::~Material()
 {
-  if(m_arCache) delete m_arCache;
-  if(m_nmCache) delete m_nmCache;
-  if(m_ndCache) delete m_ndCache;
-  if(m_eoCache) delete m_eoCache;
-  
   std::cout << "Removing material \"" << m_filename << "\"" << std::endl;
+
+  if(m_uniformBuffer) delete m_uniformBuffer;
   
   kit::Material::m_instanceCount--;
   if(kit::Material::m_instanceCount == 0)
@@ -289,7 +285,7 @@ kit::Material::Material(std::string const & filename) : Material()
       else if (identifier == std::string("occlusionmap"))
       {
         KIT_ASSERT(args.size() == 2 /* occlusionmap needs 1 string value (no spaces!) */);
-        m_occlusionMap = kit::Texture::load(args[1].c_str(), false);
+        m_occlusionMap = kit::Texture::load(args[1].c_str(), false, kit::Texture::Channels::One);
       }
       else if(identifier == std::string("emissivecolor"))
       {
@@ -321,7 +317,7 @@ kit::Material::Material(std::string const & filename) : Material()
       else if(identifier == std::string("roughnessmap"))
       {
         KIT_ASSERT(args.size() == 2 /* Roughnessmap needs 1 string value (no spaces!) */);
-        m_roughnessMap = kit::Texture::load(args[1].c_str(), false);
+        m_roughnessMap = kit::Texture::load(args[1].c_str(), false, kit::Texture::Channels::One);
       }
       else if(identifier == std::string("metalness"))
       {
@@ -331,7 +327,7 @@ kit::Material::Material(std::string const & filename) : Material()
       else if(identifier == std::string("metalnessmap"))
       {
         KIT_ASSERT(args.size() == 2 /* Metalnessmap needs 1 string value (no spaces!) */);
-        m_metalnessMap = kit::Texture::load(args[1].c_str(), false);
+        m_metalnessMap = kit::Texture::load(args[1].c_str(), false, kit::Texture::Channels::One);
       }
       else if (identifier == std::string("doublesided"))
       {
@@ -376,7 +372,7 @@ kit::Material::Material(std::string const & filename) : Material()
       else if (identifier == std::string("spec_depthmask"))
       {
         KIT_ASSERT(args.size() == 2 /* spec_depthmask needs 1 string value (no spaces!) */);
-        m_spec_depthMask = kit::Texture::load(args[1].c_str(), false);
+        m_spec_depthMask = kit::Texture::load(args[1].c_str(), false, kit::Texture::Channels::One);
       }
       else
       {
@@ -386,6 +382,8 @@ kit::Material::Material(std::string const & filename) : Material()
   }
   fhandle.close();
 
+  // Caches baked from the file as it is are worth keeping on disk, until a setter changes their inputs
+  m_persistCaches = true;
   assertCache();
 }
 
@@ -416,6 +414,29 @@ void kit::Material::allocateShared()
   delete pixelShader;  
   
   m_reflectiveProgram = new kit::Program({"reflective.vert"}, {"reflective.frag"}, kit::DataSource::Static);
+
+  m_drawRing = new kit::UniformRing();
+
+  // Request the fallback programs right away, so they are ready long before a material needs one
+  for(bool forward : {false, true})
+  {
+    for(uint32_t variant = 0; variant < 5; variant++)
+    {
+      kit::Material::ProgramFlags flags;
+      flags.m_skinned = (variant == 1 || variant == 3);
+      flags.m_instanced = (variant == 2 || variant == 3);
+      flags.m_batched = (variant == 4);
+      flags.m_forward = forward;
+      kit::Material::getProgram(flags);
+
+      // Fading draws keep their dither in the fallback too. Forward and batched draws never fade
+      if(!forward && !flags.m_batched)
+      {
+        flags.m_lodFade = true;
+        kit::Material::getProgram(flags);
+      }
+    }
+  }
 }
 
 void kit::Material::releaseShared()
@@ -427,198 +448,126 @@ void kit::Material::releaseShared()
     if(t.second) delete t.second;
   }
   m_programCache.clear();
+  m_programUniforms.clear();
   
   delete m_reflectiveProgram;
+  delete m_drawRing;
 }
 
-void kit::Material::renderARCache()
+void kit::Material::bakeCache(std::shared_ptr<kit::PixelBuffer> & cache, kit::MaterialCache::Key const & key)
 {
-  glm::uvec2 mapsize(2048, 2048);
-
-  
-  if(m_arCache) delete m_arCache;
-  m_arCache = new kit::PixelBuffer(mapsize, {kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8)});
-  m_arCache->getColorAttachment(0)->setMinFilteringMode(Texture::LinearMipmapLinear);
-
-  m_arCache->bind();
-  
-  kit::Material::m_cacheProgram->setUniform1f("uniform_defaultB", m_roughness);
+  // Let go of the old cache first, so it is freed before the new one is created if nothing else shares it
+  cache.reset();
 
-  if(m_roughnessMap != nullptr)
-  {
-    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapB", m_roughnessMap.get());
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapB", 1);
-  }
-  else
+  bool created = false;
+  cache = kit::MaterialCache::acquire(key, created);
+  if (!created)
   {
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapB", 0);
+    // Another material baked the same inputs already
+    return;
   }
-  
-  if(m_albedoMap != nullptr)
+
+  cache->bind();
+
+  kit::Material::m_cacheProgram->setUniform3f("uniform_defaultA", key.defaultA);
+  kit::Material::m_cacheProgram->setUniform1f("uniform_defaultB", key.defaultB);
+
+  if(key.mapA != nullptr)
   {
-    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapA", m_albedoMap.get());
+    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapA", key.mapA);
     kit::Material::m_cacheProgram->setUniform1i("uniform_usemapA", 1);
+
+    // Two-channel normal maps only store X and Y
+    kit::Material::m_cacheProgram->setUniform1i("uniform_reconstructA", key.mapA->getInternalFormat() == kit::Texture::BC5RG ? 1 : 0);
   }
   else
   {
-    kit::Material::m_cacheProgram->setUniform3f("uniform_defaultA", m_albedo);
     kit::Material::m_cacheProgram->setUniform1i("uniform_usemapA", 0);
+    kit::Material::m_cacheProgram->setUniform1i("uniform_reconstructA", 0);
   }
 
-  kit::Material::m_cacheProgram->use();
-  
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
-  
-  kit::Quad::renderGeometry();
-  
-  kit::PixelBuffer::unbind();
-  m_arCache->getColorAttachment(0)->generateMipmap();
-
-  m_arDirty = false;
-}
-
-void kit::Material::renderNMCache()
-{
-  glm::uvec2 mapsize(2048, 2048);
-  if(m_nmCache) delete m_nmCache;
-  m_nmCache = new kit::PixelBuffer(mapsize, {kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8)});
-  m_nmCache->getColorAttachment(0)->setMinFilteringMode(Texture::LinearMipmapLinear);
-
-  m_nmCache->bind();
-  
-  kit::Material::m_cacheProgram->setUniform1f("uniform_defaultB", m_metalness);
-
-  if(m_metalnessMap != nullptr)
+  if(key.mapB != nullptr)
   {
-    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapB", m_metalnessMap.get());
+    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapB", key.mapB);
     kit::Material::m_cacheProgram->setUniform1i("uniform_usemapB", 1);
   }
   else
   {
     kit::Material::m_cacheProgram->setUniform1i("uniform_usemapB", 0);
   }
-  
-  if(m_normalMap != nullptr)
-  {
-    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapA", m_normalMap.get());
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapA", 1);
-  }
-  else
-  {
-    kit::Material::m_cacheProgram->setUniform3f("uniform_defaultA", glm::vec3(0.5, 0.5, 1.0));
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapA", 0);
-  }
 
   kit::Material::m_cacheProgram->use();
   
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
-
+  kit::GLState::setBlend(false);
+  kit::GLState::setDepthTest(false);
+  kit::GLState::setDepthWrite(false);
+  
   kit::Quad::renderGeometry();
   
   kit::PixelBuffer::unbind();
-  m_nmCache->getColorAttachment(0)->generateMipmap();
+  cache->getColorAttachment(0)->generateMipmap();
 
-  m_nmDirty = false;
+  // Rebakes from setters would write a new file for every edit, so those stay in memory
+  if (m_persistCaches)
+  {
+    kit::MaterialCache::store(key, cache.get());
+  }
 }
 
-void kit::Material::renderNDCache()
+void kit::Material::renderARCache()
 {
-  glm::uvec2 mapsize(2048, 2048);
-  if(m_ndCache) delete m_ndCache;
-  m_ndCache = new kit::PixelBuffer(mapsize, {kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8)});
-  m_ndCache->getColorAttachment(0)->setMinFilteringMode(Texture::LinearMipmapLinear);
-  m_ndCache->bind();
+  kit::MaterialCache::Key key;
+  key.mapA = m_albedoMap.get();
+  key.defaultA = m_albedo;
+  key.mapB = m_roughnessMap.get();
+  key.defaultB = m_roughness;
+  bakeCache(m_arCache, key);
 
-  if (m_spec_depthMask != nullptr)
-  {
-    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapB", m_spec_depthMask.get());
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapB", 1);
-  }
-  else
-  {
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapB", 0);
-    kit::Material::m_cacheProgram->setUniform1f("uniform_defaultB", 1.0f);
-  }
+  m_arDirty = false;
+}
 
-  if (m_normalMap != nullptr)
-  {
-    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapA", m_normalMap.get());
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapA", 1);
-  }
-  else
-  {
-    kit::Material::m_cacheProgram->setUniform3f("uniform_defaultA", glm::vec3(0.5, 0.5, 1.0));
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapA", 0);
-  }
+void kit::Material::renderNMCache()
+{
+  kit::MaterialCache::Key key;
+  key.mapA = m_normalMap.get();
+  key.defaultA = glm::vec3(0.5, 0.5, 1.0);
+  key.mapB = m_metalnessMap.get();
+  key.defaultB = m_metalness;
+  bakeCache(m_nmCache, key);
 
-  kit::Material::m_cacheProgram->use();
-  
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
-  
-  kit::Quad::renderGeometry();
+  m_nmDirty = false;
+}
 
-  kit::PixelBuffer::unbind();
-  m_ndCache->getColorAttachment(0)->generateMipmap();
+void kit::Material::renderNDCache()
+{
+  kit::MaterialCache::Key key;
+  key.mapA = m_normalMap.get();
+  key.defaultA = glm::vec3(0.5, 0.5, 1.0);
+  key.mapB = m_spec_depthMask.get();
+  key.defaultB = 1.0f;
+  bakeCache(m_ndCache, key);
 
   m_ndDirty = false;
 }
 
 void kit::Material::renderEOCache()
 {
-  glm::uvec2 mapsize(2048, 2048);
-  if(m_eoCache) delete m_eoCache;
-  m_eoCache = new kit::PixelBuffer(mapsize, {kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8)});
-  m_eoCache->getColorAttachment(0)->setMinFilteringMode(Texture::LinearMipmapLinear);
-  m_eoCache->bind();
-  
-  if(m_occlusionMap != nullptr)
-  {
-    kit::Material::m_cacheProgram->setUniform1f("uniform_defaultB", 1.0f);
-    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapB", m_occlusionMap.get());
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapB", 1);
-  }
-  else
-  {
-    kit::Material::m_cacheProgram->setUniform1f("uniform_defaultB", 1.0f);
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapB", 0);
-  }
-  
-  if(m_emissiveMap != nullptr)
-  {
-    kit::Material::m_cacheProgram->setUniformTexture("uniform_mapA", m_emissiveMap.get());
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapA", 1);
-  }
-  else
-  {
-    kit::Material::m_cacheProgram->setUniform3f("uniform_defaultA", m_emissiveColor);
-    kit::Material::m_cacheProgram->setUniform1i("uniform_usemapA", 0);
-  }
-  
-  kit::Material::m_cacheProgram->use();
-
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
-
-  kit::Quad::renderGeometry();
-  
-  kit::PixelBuffer::unbind();
-  m_eoCache->getColorAttachment(0)->generateMipmap();
+  kit::MaterialCache::Key key;
+  key.mapA = m_emissiveMap.get();
+  key.defaultA = m_emissiveColor;
+  key.mapB = m_occlusionMap.get();
+  key.defaultB = 1.0f;
+  bakeCache(m_eoCache, key);
 
   m_eoDirty = false;
 }
 
-kit::Material::ProgramFlags kit::Material::getFlags(bool skinned, bool instanced)
+kit::Material::ProgramFlags kit::Material::getFlags(bool skinned, bool instanced, bool batched)
 {
   kit::Material::ProgramFlags flags;
   flags.m_skinned = skinned;
   flags.m_instanced = instanced;
+  flags.m_batched = batched;
   flags.m_albedoMap = (m_albedoMap != nullptr);
   flags.m_roughnessMap = (m_roughnessMap != nullptr);
   flags.m_dynamicAR = m_dynamicAR;
@@ -645,6 +594,8 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     << "Compiling a new material-program with flags "
     << (flags.m_skinned ? "S" : "-")
     << (flags.m_instanced ? "I" : "-")
+    << (flags.m_batched ? "B" : "-")
+    << (flags.m_lodFade ? "L" : "-")
     << (flags.m_forward ? "F" : "-")
     << (flags.m_opacityMask ? "P" : "-")
     << (flags.m_dynamicAR ? "D" : "-")
@@ -683,6 +634,11 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
       vertexsource << "layout (location = 5) in vec4  in_boneweights;" << std::endl;
     }
     
+    if(flags.m_batched)
+    {
+      vertexsource << "layout (location = 6) in mat4 in_drawTransform;" << std::endl;
+    }
+    
     vertexsource << std::endl;
     
     // Out attributes
@@ -700,9 +656,12 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     vertexsource << std::endl;
     
     // Uniforms
-    vertexsource << "uniform mat4 uniform_mvpMatrix;" << std::endl;
-    //vertexsource << "uniform mat4 uniform_mvMatrix;" << std::endl;
-    vertexsource << "uniform mat3 uniform_normalMatrix;" << std::endl;
+    vertexsource << "layout (std140) uniform DrawBlock" << std::endl;
+    vertexsource << "{" << std::endl;
+    vertexsource << "  mat4 mvpMatrix;" << std::endl;
+    vertexsource << "  mat3 normalMatrix;" << std::endl;
+    vertexsource << "  vec4 params;" << std::endl;
+    vertexsource << "} draw;" << std::endl;
     
     if(flags.m_skinned)
     {
@@ -738,13 +697,18 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     
     if(flags.m_instanced)
     {
-      vertexsource << "  gl_Position = uniform_mvpMatrix * uniform_instanceTransform[gl_InstanceID] * position;" << std::endl;
-      vertexsource << "  out_normal = uniform_normalMatrix * mat3(uniform_instanceTransform[gl_InstanceID]) * normal;" << std::endl;
+      vertexsource << "  gl_Position = draw.mvpMatrix * uniform_instanceTransform[gl_InstanceID] * position;" << std::endl;
+      vertexsource << "  out_normal = draw.normalMatrix * mat3(uniform_instanceTransform[gl_InstanceID]) * normal;" << std::endl;
+    }
+    else if(flags.m_batched)
+    {
+      vertexsource << "  gl_Position = draw.mvpMatrix * in_drawTransform * position;" << std::endl;
+      vertexsource << "  out_normal = draw.normalMatrix * mat3(in_drawTransform) * normal;" << std::endl;
     }
     else
     {
-      vertexsource << "  gl_Position = uniform_mvpMatrix * position;" << std::endl;
-      vertexsource << "  out_normal = uniform_normalMatrix * normal;" << std::endl;
+      vertexsource << "  gl_Position = draw.mvpMatrix * position;" << std::endl;
+      vertexsource << "  out_normal = draw.normalMatrix * normal;" << std::endl;
     }
     
     if(needUvs)
@@ -756,11 +720,15 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     {
       if(flags.m_skinned)
       {        
-        vertexsource << "  out_tangent = normalize(uniform_normalMatrix * (boneTransform * vec4(normalize(in_tangent), 0.0)).xyz);" << std::endl;
+        vertexsource << "  out_tangent = normalize(draw.normalMatrix * (boneTransform * vec4(normalize(in_tangent), 0.0)).xyz);" << std::endl;
+      }
+      else if(flags.m_batched)
+      {
+        vertexsource << "  out_tangent = normalize(draw.normalMatrix * mat3(in_drawTransform) * normalize(in_tangent));" << std::endl;
       }
       else
       {
-        vertexsource << "  out_tangent = normalize(uniform_normalMatrix * normalize(in_tangent));" << std::endl;
+        vertexsource << "  out_tangent = normalize(draw.normalMatrix * normalize(in_tangent));" << std::endl;
       }
       vertexsource << "  out_bitangent = cross(out_normal, out_tangent);" << std::endl;
     }
@@ -800,7 +768,13 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     }
 
     // Uniforms
-    pixelsource << "uniform vec3 uniform_albedo;" << std::endl;
+    pixelsource << "layout (std140) uniform MaterialBlock" << std::endl;
+    pixelsource << "{" << std::endl;
+    pixelsource << "  vec4 albedo;" << std::endl;
+    pixelsource << "  vec4 tint;" << std::endl;
+    pixelsource << "  vec4 emissive;" << std::endl;
+    pixelsource << "  vec4 params;" << std::endl;
+    pixelsource << "} material;" << std::endl;
 
     if(flags.m_albedoMap || flags.m_roughnessMap)
     {
@@ -815,16 +789,12 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
       }
     }
 
-    if(!flags.m_roughnessMap)
-    {
-      pixelsource << "uniform float uniform_roughness;" << std::endl;
-    }
-
     if(flags.m_normalMap || flags.m_metalnessMap)
     {
       if (flags.m_dynamicNM)
       {
         if (flags.m_normalMap) pixelsource << "uniform sampler2D uniform_normalMap;" << std::endl;
+        if (flags.m_normalMap) pixelsource << "uniform int uniform_reconstructNormal;" << std::endl;
         if (flags.m_metalnessMap) pixelsource << "uniform sampler2D uniform_metalnessMap;" << std::endl;
       }
       else
@@ -833,11 +803,6 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
       }
     }
 
-    if(!flags.m_metalnessMap)
-    {
-      pixelsource << "uniform float uniform_metalness;" << std::endl;
-    }
-
     if (flags.m_emissiveMap || flags.m_occlusionMap)
     {
       if (flags.m_dynamicEO)
@@ -850,12 +815,15 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
         pixelsource << "uniform sampler2D uniform_EOMap;" << std::endl;
       }
     }
-    pixelsource << "uniform vec3 uniform_emissiveColor;" << std::endl;
-    pixelsource << "uniform float uniform_emissiveStrength;" << std::endl;
 
-    if (flags.m_forward)
+    if (flags.m_lodFade)
     {
-      pixelsource << "uniform float uniform_opacity;" << std::endl;
+      pixelsource << "layout (std140) uniform DrawBlock" << std::endl;
+      pixelsource << "{" << std::endl;
+      pixelsource << "  mat4 mvpMatrix;" << std::endl;
+      pixelsource << "  mat3 normalMatrix;" << std::endl;
+      pixelsource << "  vec4 params;" << std::endl;
+      pixelsource << "} draw;" << std::endl;
     }
 
     if (flags.m_opacityMask)
@@ -939,8 +907,9 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     }
     else
     {
-      pixelsource << "  vec3  in_albedo = uniform_albedo;" << std::endl;
+      pixelsource << "  vec3  in_albedo = material.albedo.rgb;" << std::endl;
     }
+    pixelsource << "  in_albedo *= material.tint.rgb;" << std::endl;
 
     // Roughness
     if (flags.m_roughnessMap)
@@ -956,7 +925,7 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     }
     else
     {
-      pixelsource << "  float in_roughness  = uniform_roughness;" << std::endl;
+      pixelsource << "  float in_roughness  = material.albedo.w;" << std::endl;
     }
 
     // EO
@@ -966,7 +935,7 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     }
     
     // Emissive
-    pixelsource << "  float in_emissiveStrength = uniform_emissiveStrength;" << std::endl;
+    pixelsource << "  float in_emissiveStrength = material.emissive.w;" << std::endl;
     if (flags.m_emissiveMap)
     {
       if (flags.m_dynamicEO)
@@ -980,7 +949,7 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     }
     else
     {
-      pixelsource << "  vec3 in_emissiveColor = uniform_emissiveColor;" << std::endl;
+      pixelsource << "  vec3 in_emissiveColor = material.emissive.rgb;" << std::endl;
     }
 
     // Occlusion
@@ -1014,6 +983,12 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
       if (flags.m_dynamicNM)
       {
         pixelsource << "  vec3 normalTex     = ((texture(uniform_normalMap, in_texCoords).rgb - 0.5)*2.0);" << std::endl;
+
+        // BC5 normal maps only store X and Y
+        pixelsource << "  if(uniform_reconstructNormal == 1)" << std::endl;
+        pixelsource << "  {" << std::endl;
+        pixelsource << "    normalTex.z = sqrt(max(1.0 - dot(normalTex.xy, normalTex.xy), 0.0));" << std::endl;
+        pixelsource << "  }" << std::endl;
       }
       else
       {
@@ -1043,7 +1018,7 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     }
     else
     {
-      pixelsource << "  float in_metalness = uniform_metalness;" << std::endl;
+      pixelsource << "  float in_metalness = material.params.x;" << std::endl;
     }
 
     // Opacity
@@ -1051,11 +1026,11 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
     {
       if (flags.m_opacityMask)
       {
-        pixelsource << "  float in_opacity = uniform_opacity * texture(uniform_opacityMask, in_texCoords).a;" << std::endl;
+        pixelsource << "  float in_opacity = material.params.y * texture(uniform_opacityMask, in_texCoords).a;" << std::endl;
       }
       else
       {
-        pixelsource << "  float in_opacity = uniform_opacity;" << std::endl;
+        pixelsource << "  float in_opacity = material.params.y;" << std::endl;
       }
     }
     else
@@ -1067,6 +1042,13 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
       }
     }
 
+    // Screen-space noise, so the outgoing and incoming levels of detail cover complementary fragments
+    if (flags.m_lodFade)
+    {
+      pixelsource << "  float lodDither = fract(52.9829189 * fract(dot(gl_FragCoord.xy, vec2(0.06711056, 0.00583715))));" << std::endl;
+      pixelsource << "  if(draw.params.x >= 0.0 ? lodDither >= draw.params.x : lodDither < -draw.params.x) discard;" << std::endl;
+    }
+
     if (!flags.m_forward)
     {
       // Write albedo + roughness
@@ -1097,21 +1079,13 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
   
   auto vertexShader = new kit::Shader(Shader::Type::Vertex);
   vertexShader->sourceFromString(vertexsource.str());
-  vertexShader->compile();
   
   auto pixelShader = new kit::Shader(Shader::Type::Fragment);
   pixelShader->sourceFromString(pixelsource.str());
-  pixelShader->compile();
   
+  // Compiles in the background, bindProgram uses a fallback program until prepareProgram succeeds
   kit::Program * returner = new kit::Program();
-  returner->attachShader(vertexShader);
-  returner->attachShader(pixelShader);
-  returner->link();
-  returner->detachShader(vertexShader);
-  returner->detachShader(pixelShader);
-  
-  delete vertexShader;
-  delete pixelShader;
+  returner->linkAsync({vertexShader, pixelShader});
 
   kit::Material::m_programCache[flags] = returner;
   
@@ -1119,53 +1093,134 @@ kit::Program * kit::Material::getProgram(kit::Material::ProgramFlags flags)
 
 }
 
+kit::Material::ProgramFlags kit::Material::getFallbackFlags(kit::Material::ProgramFlags flags)
+{
+  // Keep what changes the vertex inputs and the outputs, and the LOD dither so cross-fades do not pop, and read everything else from the material block
+  kit::Material::ProgramFlags returner;
+  returner.m_skinned = flags.m_skinned;
+  returner.m_instanced = flags.m_instanced;
+  returner.m_batched = flags.m_batched;
+  returner.m_forward = flags.m_forward;
+  returner.m_lodFade = flags.m_lodFade;
+  return returner;
+}
+
+kit::Material::ProgramUniforms const * kit::Material::prepareProgram(kit::Program * program, kit::Material::ProgramFlags const & flags, bool wait)
+{
+  auto finder = kit::Material::m_programUniforms.find(program);
+  if(finder != kit::Material::m_programUniforms.end())
+  {
+    return &finder->second;
+  }
+
+  if(!program->isReady(wait) || (!wait && !program->isLinked()))
+  {
+    return nullptr;
+  }
+
+  program->setUniformBlock("MaterialBlock", kit::UniformBuffer::MaterialBinding);
+  program->setUniformBlock("DrawBlock", kit::UniformBuffer::DrawBinding);
+
+  // Resolve the uniforms bindProgram sets for every draw, only asking for the ones the generated source declares
+  auto resolve = [&](bool declared, const char * name) { return declared ? program->getUniformHandle(name) : kit::Program::InvalidUniform; };
+  ProgramUniforms uniforms;
+  uniforms.albedoMap = resolve(flags.m_dynamicAR && flags.m_albedoMap, "uniform_albedoMap");
+  uniforms.roughnessMap = resolve(flags.m_dynamicAR && flags.m_roughnessMap, "uniform_roughnessMap");
+  uniforms.ARMap = resolve(!flags.m_dynamicAR && (flags.m_albedoMap || flags.m_roughnessMap), "uniform_ARMap");
+  uniforms.normalMap = resolve(flags.m_dynamicNM && flags.m_normalMap, "uniform_normalMap");
+  uniforms.reconstructNormal = resolve(flags.m_dynamicNM && flags.m_normalMap, "uniform_reconstructNormal");
+  uniforms.metalnessMap = resolve(flags.m_dynamicNM && flags.m_metalnessMap, "uniform_metalnessMap");
+  uniforms.NMMap = resolve(!flags.m_dynamicNM && (flags.m_normalMap || flags.m_metalnessMap), "uniform_NMMap");
+  uniforms.emissiveMap = resolve(flags.m_dynamicEO && flags.m_emissiveMap, "uniform_emissiveMap");
+  uniforms.occlusionMap = resolve(flags.m_dynamicEO && flags.m_occlusionMap, "uniform_occlusionMap");
+  uniforms.EOMap = resolve(!flags.m_dynamicEO && (flags.m_emissiveMap || flags.m_occlusionMap), "uniform_EOMap");
+  uniforms.opacityMask = resolve(flags.m_opacityMask, "uniform_opacityMask");
+  uniforms.bones = resolve(flags.m_skinned, "uniform_bones");
+  uniforms.instanceTransform = resolve(flags.m_instanced, "uniform_instanceTransform");
+
+  return &(kit::Material::m_programUniforms[program] = uniforms);
+}
+
 void kit::Material::setDynamicEO(bool eo)
 {
   if (eo != m_dynamicEO)
   {
     m_dirty = true;
+    m_programRevision++;
   }
   m_dynamicEO = eo;
 }
 
 void kit::Material::assertCache()
 {
-  if(m_arDirty && !m_dynamicAR)
+  // Dynamic materials sample their maps directly, but still bake once for the reflective program
+  if((m_arDirty && !m_dynamicAR) || !m_arCache)
   {
     renderARCache();
   }
   
-  if(m_nmDirty && !m_dynamicNM)
+  if((m_nmDirty && !m_dynamicNM) || !m_nmCache)
   {
     renderNMCache();
   }
   
-  if (m_eoDirty && !m_dynamicEO)
+  if ((m_eoDirty && !m_dynamicEO) || !m_eoCache)
   {
     renderEOCache();
   }
 
-  if (m_ndDirty)
-  {
-    renderNDCache();
-  }
-
   if(m_dirty)
   {
     kit::Material::ProgramFlags flags = getFlags(false, false);
     kit::Material::ProgramFlags sflags = getFlags(true, false);
     kit::Material::ProgramFlags iflags = getFlags(false, true);
     kit::Material::ProgramFlags siflags = getFlags(true, true);
+    kit::Material::ProgramFlags bflags = getFlags(false, false, true);
   
     m_program = kit::Material::getProgram(flags);
     m_sProgram = kit::Material::getProgram(sflags);
     m_iProgram = kit::Material::getProgram(iflags);
     m_siProgram = kit::Material::getProgram(siflags);
+    m_bProgram = kit::Material::getProgram(bflags);
+
+    for(auto & currProgram : m_fadePrograms)
+    {
+      currProgram = nullptr;
+    }
     
     m_dirty = false;
   }
 }
 
+void kit::Material::prewarm()
+{
+  assertCache();
+
+  // Forward materials never fade
+  if(getFlags(false, false).m_forward)
+  {
+    return;
+  }
+
+  for(bool skinned : {false, true})
+  {
+    for(bool instanced : {false, true})
+    {
+      kit::Material::ProgramFlags flags = getFlags(skinned, instanced);
+      flags.m_lodFade = true;
+      kit::Material::getProgram(flags);
+    }
+  }
+}
+
+void kit::Material::waitForPrograms()
+{
+  for(auto & currProgram : kit::Material::m_programCache)
+  {
+    kit::Material::prepareProgram(currProgram.second, currProgram.first, true);
+  }
+}
+
 void kit::Material::useReflective(kit::Renderer * renderer, const glm::mat4& viewMatrix, const glm::mat4& projectionMatrix, const glm::mat4& modelMatrix, const std::vector<glm::mat4>& skinTransform, const std::vector<glm::mat4>& instanceTransform) 
 {
   assertCache();
@@ -1221,10 +1276,21 @@ void kit::Material::useReflective(kit::Renderer * renderer, const glm::mat4& vie
   
 }
 
-void kit::Material::use(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform)
+kit::Program * kit::Material::use(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform, float lodFade, kit::Material::DrawCache * cache)
 {
   assertCache();
-  kit::Material::ProgramFlags flags = getFlags(skinTransform.size() > 0, instanceTransform.size() > 0);
+
+  bool skinned = skinTransform.size() > 0;
+  bool instanced = instanceTransform.size() > 0;
+
+  // Fading draws are rare and short, so only steady draws go through the cache
+  bool cacheable = (cache != nullptr) && lodFade >= 1.0f;
+  if (cacheable && cache->program && cache->programRevision == m_programRevision && cache->flags.m_skinned == skinned && cache->flags.m_instanced == instanced)
+  {
+    return bindProgram(cache->program, cache->flags, cache->uniforms, viewMatrix, projectionMatrix, modelMatrix, skinTransform, instanceTransform, lodFade);
+  }
+
+  kit::Material::ProgramFlags flags = getFlags(skinned, instanced);
 
   kit::Program * currProgram = nullptr;
   
@@ -1233,46 +1299,80 @@ void kit::Material::use(glm::mat4 const & viewMatrix, glm::mat4 const & projecti
   if(!flags.m_skinned && flags.m_instanced) currProgram = m_iProgram;
   if(!flags.m_skinned && !flags.m_instanced) currProgram = m_program;
 
-  if(!flags.m_albedoMap)
+  // The discard would cost every other draw its early depth test, so fading draws get their own program, looked up only while fading
+  if (lodFade < 1.0f && !flags.m_forward)
   {
-    currProgram->setUniform3f("uniform_albedo", m_albedo);
+    flags.m_lodFade = true;
+    kit::Program *& fadeProgram = m_fadePrograms[(flags.m_skinned ? 1 : 0) + (flags.m_instanced ? 2 : 0)];
+    if(!fadeProgram)
+    {
+      fadeProgram = kit::Material::getProgram(flags);
+    }
+    currProgram = fadeProgram;
   }
+
+  // Remember the program once it has compiled, draws keep looking until then
+  ProgramUniforms const * preparedUniforms = kit::Material::prepareProgram(currProgram, flags, false);
+  if (cacheable && preparedUniforms)
+  {
+    cache->program = currProgram;
+    cache->uniforms = preparedUniforms;
+    cache->flags = flags;
+    cache->programRevision = m_programRevision;
+  }
+
+  return bindProgram(currProgram, flags, preparedUniforms, viewMatrix, projectionMatrix, modelMatrix, skinTransform, instanceTransform, lodFade);
+}
+
+void kit::Material::useBatched(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
+{
+  static const std::vector<glm::mat4> noTransforms;
   
+  assertCache();
+  kit::Material::ProgramFlags flags = getFlags(false, false, true);
+  bindProgram(m_bProgram, flags, kit::Material::prepareProgram(m_bProgram, flags, false), viewMatrix, projectionMatrix, glm::mat4(), noTransforms, noTransforms, 1.0f);
+}
+
+kit::Program * kit::Material::bindProgram(kit::Program * currProgram, kit::Material::ProgramFlags flags, kit::Material::ProgramUniforms const * preparedUniforms, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform, float lodFade)
+{
+  if(m_uniformsDirty)
+  {
+    updateUniforms();
+  }
+  m_uniformBuffer->bind(kit::UniformBuffer::MaterialBinding);
+
+  // Draw with the constants of the material until the real program has compiled. The fallbacks are tiny, and requested up front
+  if(!preparedUniforms)
+  {
+    flags = kit::Material::getFallbackFlags(flags);
+    currProgram = kit::Material::getProgram(flags);
+    preparedUniforms = kit::Material::prepareProgram(currProgram, flags, true);
+  }
+  ProgramUniforms const & uniforms = *preparedUniforms;
+
   if(flags.m_albedoMap || flags.m_roughnessMap)
   {
     if (flags.m_dynamicAR)
     {
-      if (flags.m_albedoMap) currProgram->setUniformTexture("uniform_albedoMap", m_albedoMap.get());
-      if (flags.m_roughnessMap) currProgram->setUniformTexture("uniform_roughnessMap", m_roughnessMap.get());
+      if (flags.m_albedoMap) currProgram->setUniformTexture(uniforms.albedoMap, m_albedoMap.get());
+      if (flags.m_roughnessMap) currProgram->setUniformTexture(uniforms.roughnessMap, m_roughnessMap.get());
     }
     else
     {
-      currProgram->setUniformTexture("uniform_ARMap", m_arCache->getColorAttachment(0));
+      currProgram->setUniformTexture(uniforms.ARMap, m_arCache->getColorAttachment(0));
     }
   }
 
-  if (!flags.m_roughnessMap && !flags.m_forward) // TODO: Remove forward and implement fw-lighitng
-  {
-    currProgram->setUniform1f("uniform_roughness", m_roughness);
-  }
-  
-  if(!flags.m_emissiveMap)
-  {
-    currProgram->setUniform3f("uniform_emissiveColor", m_emissiveColor);
-  }
-  
-  currProgram->setUniform1f("uniform_emissiveStrength", m_emissiveStrength);
-  
   if (flags.m_emissiveMap || flags.m_occlusionMap)
   {
     if (flags.m_dynamicEO)
     {
-      if(flags.m_occlusionMap) currProgram->setUniformTexture("uniform_occlusionMap", m_occlusionMap.get());
-      if(flags.m_emissiveMap) currProgram->setUniformTexture("uniform_emissiveMap", m_emissiveMap.get());
+      if(flags.m_occlusionMap) currProgram->setUniformTexture(uniforms.occlusionMap, m_occlusionMap.get());
+      if(flags.m_emissiveMap) currProgram->setUniformTexture(uniforms.emissiveMap, m_emissiveMap.get());
     }
     else
     {
-      currProgram->setUniformTexture("uniform_EOMap", m_eoCache->getColorAttachment(0));
+      currProgram->setUniformTexture(uniforms.EOMap, m_eoCache->getColorAttachment(0));
     }
   }
 
@@ -1280,93 +1380,125 @@ void kit::Material::use(glm::mat4 const & viewMatrix, glm::mat4 const & projecti
   {
     if (flags.m_dynamicNM)
     {
-      if (flags.m_normalMap) currProgram->setUniformTexture("uniform_normalMap", m_normalMap.get());
-      if (flags.m_metalnessMap) currProgram->setUniformTexture("uniform_metalnessMap", m_metalnessMap.get());
+      if (flags.m_normalMap)
+      {
+        currProgram->setUniformTexture(uniforms.normalMap, m_normalMap.get());
+        currProgram->setUniform1i(uniforms.reconstructNormal, m_normalMap->getInternalFormat() == kit::Texture::BC5RG ? 1 : 0);
+      }
+      if (flags.m_metalnessMap) currProgram->setUniformTexture(uniforms.metalnessMap, m_metalnessMap.get());
     }
     else
     {
-      currProgram->setUniformTexture("uniform_NMMap", m_nmCache->getColorAttachment(0));
+      currProgram->setUniformTexture(uniforms.NMMap, m_nmCache->getColorAttachment(0));
     }
 
   }
 
-  if(!flags.m_metalnessMap && !flags.m_forward)// TODO: Remove forward and implement fw-lighitng
-  {
-    currProgram->setUniform1f("uniform_metalness", m_metalness);
-  }
-  
-  if (flags.m_forward)
-  {
-    currProgram->setUniform1f("uniform_opacity", m_opacity);
-  }
-
   if (flags.m_opacityMask)
   {
-    currProgram->setUniformTexture("uniform_opacityMask", m_opacityMask.get());
+    currProgram->setUniformTexture(uniforms.opacityMask, m_opacityMask.get());
   }
 
   if(flags.m_skinned)
   {
-    currProgram->setUniformMat4v("uniform_bones", skinTransform);
+    currProgram->setUniformMat4v(uniforms.bones, skinTransform);
   }
   
   if(flags.m_instanced)
   {
-    currProgram->setUniformMat4v("uniform_instanceTransform", instanceTransform);
+    currProgram->setUniformMat4v(uniforms.instanceTransform, instanceTransform);
   }
   
   glm::mat4 modelViewMatrix = viewMatrix * modelMatrix;
   glm::mat4 modelViewProjectionMatrix = projectionMatrix * viewMatrix * modelMatrix;
   
   glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(modelViewMatrix)));
-  //glm::mat4 normalMatrix = modelViewMatrix;
 
-  //currProgram->setUniformMat4("uniform_mvMatrix", modelViewMatrix);
-  currProgram->setUniformMat4("uniform_mvpMatrix", modelViewProjectionMatrix);
-  
-  if(!flags.m_forward)// TODO: Remove forward and implement fw-lighitng
-  {
-    currProgram->setUniformMat3("uniform_normalMatrix", normalMatrix);
-  }
+  DrawBlock drawBlock;
+  drawBlock.mvpMatrix = modelViewProjectionMatrix;
+  drawBlock.normalMatrix[0] = glm::vec4(normalMatrix[0], 0.0f);
+  drawBlock.normalMatrix[1] = glm::vec4(normalMatrix[1], 0.0f);
+  drawBlock.normalMatrix[2] = glm::vec4(normalMatrix[2], 0.0f);
+  drawBlock.params = glm::vec4(lodFade, 0.0f, 0.0f, 0.0f);
+  m_drawRing->push(kit::UniformBuffer::DrawBinding, &drawBlock, sizeof(DrawBlock));
 
   currProgram->use();
   
   if (m_depthRead)
   {
-    glEnable(GL_DEPTH_TEST);
+    kit::GLState::setDepthTest(true);
   }
   else
   {
-    glDisable(GL_DEPTH_TEST);
+    kit::GLState::setDepthTest(false);
   }
-  glDepthMask( m_depthWrite ? GL_TRUE : GL_FALSE );
+  kit::GLState::setDepthWrite(m_depthWrite);
 
   if (m_doubleSided)
   {
-    glDisable(GL_CULL_FACE);
+    kit::GLState::setCulling(false);
   }
   else
   {
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_BACK);
+    kit::GLState::setCulling(true);
+    kit::GLState::setCullFace(GL_BACK);
   }
 
   if (m_blendMode == None)
   {
-    glDisable(GL_BLEND);
+    kit::GLState::setBlend(false);
   }
   else
   {
-    glEnable(GL_BLEND);
+    kit::GLState::setBlend(true);
     if (m_blendMode == Add)
     {
-      glBlendFunc(GL_ONE, GL_ONE);
+      kit::GLState::setBlendFunc(GL_ONE, GL_ONE);
     }
     else
     {
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
   }
+
+  return currProgram;
+}
+
+void kit::Material::updateUniforms()
+{
+  m_uniformBlock.albedo = glm::vec4(m_albedo, m_roughness);
+  m_uniformBlock.tint = glm::vec4(1.0f);
+  m_uniformBlock.emissive = glm::vec4(m_emissiveColor, m_emissiveStrength);
+  m_uniformBlock.params = glm::vec4(m_metalness, m_opacity, 0.0f, 0.0f);
+
+  if(!m_uniformBuffer)
+  {
+    m_uniformBuffer = new kit::UniformBuffer(sizeof(UniformBlock));
+  }
+  m_uniformBuffer->update(&m_uniformBlock, sizeof(UniformBlock));
+
+  m_uniformRevision++;
+  m_uniformsDirty = false;
+}
+
+kit::Material::UniformBlock const & kit::Material::getUniformBlock()
+{
+  if(m_uniformsDirty)
+  {
+    updateUniforms();
+  }
+
+  return m_uniformBlock;
+}
+
+uint32_t kit::Material::getProgramRevision()
+{
+  return m_programRevision;
+}
+
+uint32_t kit::Material::getUniformRevision()
+{
+  return m_uniformRevision;
 }
 
 const bool & kit::Material::getCastShadows()
@@ -1390,6 +1522,8 @@ void kit::Material::setAlbedo(glm::vec3 albedo)
   {
     m_albedo = albedo;
     m_arDirty = true;
+    m_persistCaches = false;
+    m_uniformsDirty = true;
   }
 }
 
@@ -1403,9 +1537,14 @@ void kit::Material::setAlbedoMap(std::shared_ptr<kit::Texture> albedoMap)
   if (m_albedoMap != albedoMap)
   {
     m_dirty = true;
+    m_programRevision++;
   }
   m_albedoMap = albedoMap;
   m_arDirty = true;
+  m_persistCaches = false;
+
+  // Caches are shared by the address of their maps, so a cache must not outlive the map it was baked from
+  m_arCache.reset();
 }
 
 std::shared_ptr<kit::Texture> kit::Material::getOcclusionMap()
@@ -1418,9 +1557,12 @@ void kit::Material::setOcclusionMap(std::shared_ptr<kit::Texture> c)
   if (c != m_occlusionMap)
   {
     m_dirty = true;
+    m_programRevision++;
   }
   m_occlusionMap = c;
   m_eoDirty = true;
+  m_persistCaches = false;
+  m_eoCache.reset();
 }
 
 std::shared_ptr<kit::Texture> kit::Material::getNormalMap()
@@ -1433,10 +1575,14 @@ void kit::Material::setNormalMap(std::shared_ptr<kit::Texture> normalMap)
   if (normalMap != m_normalMap)
   {
     m_dirty = true;
+    m_programRevision++;
   }
   m_normalMap = normalMap;
   m_nmDirty = true;
+  m_persistCaches = false;
   m_ndDirty = true;
+  m_nmCache.reset();
+  m_ndCache.reset();
 }
 
 const float & kit::Material::getRoughness()
@@ -1450,6 +1596,8 @@ void kit::Material::setRoughness(float roughness)
   {
     m_roughness = roughness;
     m_arDirty = true;
+    m_persistCaches = false;
+    m_uniformsDirty = true;
   }
 }
 
@@ -1463,9 +1611,12 @@ void kit::Material::setRoughnessMap(std::shared_ptr<kit::Texture> roughnessMap)
   if (roughnessMap != m_roughnessMap)
   {
     m_dirty = true;
+    m_programRevision++;
   }
   m_roughnessMap = roughnessMap;
   m_arDirty = true;
+  m_persistCaches = false;
+  m_arCache.reset();
 }
 
 const float & kit::Material::getMetalness()
@@ -1479,6 +1630,8 @@ void kit::Material::setMetalness(float metalness)
   {
     m_metalness = metalness;
     m_nmDirty = true;
+    m_persistCaches = false;
+    m_uniformsDirty = true;
   }
 }
 
@@ -1492,30 +1645,58 @@ void kit::Material::setMetalnessMap(std::shared_ptr<kit::Texture> metalnessMap)
   if (m_metalnessMap != metalnessMap)
   {
     m_dirty = true;
+    m_programRevision++;
   }
   m_metalnessMap = metalnessMap;
   m_nmDirty = true;
+  m_persistCaches = false;
+  m_nmCache.reset();
 }
 
 kit::Texture * kit::Material::getARCache()
 {
+  assertCache();
   return m_arCache->getColorAttachment(0);
 }
 
 kit::Texture * kit::Material::getNMCache()
 {
+  assertCache();
   return m_nmCache->getColorAttachment(0);
 }
 
+kit::Texture * kit::Material::getEOCache()
+{
+  assertCache();
+  return m_eoCache->getColorAttachment(0);
+}
+
 kit::Texture * kit::Material::getNDCache()
 {
+  // Only terrains use this one, so it is baked on first use
+  if (m_ndDirty || !m_ndCache)
+  {
+    renderNDCache();
+  }
   return m_ndCache->getColorAttachment(0);
 }
 
+uint64_t kit::Material::getCacheMemory()
+{
+  return kit::MaterialCache::getMemory(m_arCache.get())
+    + kit::MaterialCache::getMemory(m_nmCache.get())
+    + kit::MaterialCache::getMemory(m_ndCache.get())
+    + kit::MaterialCache::getMemory(m_eoCache.get());
+}
+
 kit::Material::ProgramFlags::ProgramFlags()
 {
   m_skinned = false;
   m_instanced = false;
+  m_batched = false;
+  m_lodFade = false;
+  m_forward = false;
+  m_opacityMask = false;
   m_dynamicAR = false;
   m_albedoMap = false;
   m_roughnessMap = false;
@@ -1538,6 +1719,8 @@ void kit::Material::setEmissiveColor(glm::vec3 c)
   {
     m_emissiveColor = c;
     m_eoDirty = true;
+    m_persistCaches = false;
+    m_uniformsDirty = true;
   }
 }
 
@@ -1552,6 +1735,8 @@ void kit::Material::setEmissiveStrength(float v)
   {
     m_emissiveStrength = v;
     m_eoDirty = true;
+    m_persistCaches = false;
+    m_uniformsDirty = true;
   }
 }
 
@@ -1565,10 +1750,13 @@ void kit::Material::setEmissiveMap(std::shared_ptr<kit::Texture> em)
   if (em != m_emissiveMap)
   {
     m_dirty = true;
+    m_programRevision++;
   }
 
   m_emissiveMap = em;
   m_eoDirty = true;
+  m_persistCaches = false;
+  m_eoCache.reset();
 }
 
 bool const & kit::Material::getDepthRead()
@@ -1602,6 +1790,8 @@ void kit::Material::setOpacity(float v)
   {
     m_opacity = v;
     m_dirty = true;
+    m_programRevision++;
+    m_uniformsDirty = true;
   }
 }
 
@@ -1631,6 +1821,8 @@ void kit::Material::setDepthMask(std::shared_ptr<kit::Texture> m)
   {
     m_spec_depthMask = m;
     m_ndDirty = true;
+    m_persistCaches = false;
+    m_ndCache.reset();
   }
 }
 
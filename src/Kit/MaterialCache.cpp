@@ -0,0 +1,315 @@
+#include "Kit/MaterialCache.hpp"
+
+#include "Kit/PixelBuffer.hpp"
+#include "Kit/Texture.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <tuple>
+
+namespace
+{
+  // Bump when the contents of a cache change for the same inputs
+  const uint32_t diskFormatVersion = 1;
+  const char diskMagic[4] = { 'K', 'M', 'C', '1' };
+
+  // 64-bit FNV-1a
+  const uint64_t hashBasis = 14695981039346656037ull;
+
+  uint64_t hashBytes(uint64_t hash, const void * data, size_t size)
+  {
+    const uint8_t * bytes = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  template <typename T>
+  uint64_t hashValue(uint64_t hash, T const & value)
+  {
+    return hashBytes(hash, &value, sizeof(T));
+  }
+}
+
+std::map<kit::MaterialCache::Key, std::weak_ptr<kit::PixelBuffer>> kit::MaterialCache::m_caches = std::map<kit::MaterialCache::Key, std::weak_ptr<kit::PixelBuffer>>();
+uint32_t kit::MaterialCache::m_maxResolution = 2048;
+std::string kit::MaterialCache::m_diskCacheDirectory = kit::getDataDirectory() + "cache/materials/";
+std::map<std::string, uint64_t> kit::MaterialCache::m_fileHashes = std::map<std::string, uint64_t>();
+
+bool kit::MaterialCache::Key::operator<(kit::MaterialCache::Key const & b) const
+{
+  return std::tie(mapA, mapB, defaultA.x, defaultA.y, defaultA.z, defaultB) < std::tie(b.mapA, b.mapB, b.defaultA.x, b.defaultA.y, b.defaultA.z, b.defaultB);
+}
+
+kit::MaterialCache::Key kit::MaterialCache::normalize(kit::MaterialCache::Key const & key)
+{
+  // Constants under a map never reach the cache, so they must not tell caches apart either
+  Key normalized = key;
+  if (normalized.mapA)
+  {
+    normalized.defaultA = glm::vec3();
+  }
+  if (normalized.mapB)
+  {
+    normalized.defaultB = 0.0f;
+  }
+  return normalized;
+}
+
+std::shared_ptr<kit::PixelBuffer> kit::MaterialCache::acquire(kit::MaterialCache::Key const & key, bool & created)
+{
+  Key normalized = normalize(key);
+
+  auto & entry = m_caches[normalized];
+  auto sharedEntry = entry.lock();
+  created = false;
+
+  if (!sharedEntry)
+  {
+    entry = sharedEntry = std::make_shared<kit::PixelBuffer>(getResolution(normalized), kit::PixelBuffer::AttachmentList{ kit::PixelBuffer::AttachmentInfo(kit::Texture::RGBA8) });
+    sharedEntry->getColorAttachment(0)->setMinFilteringMode(kit::Texture::LinearMipmapLinear);
+    created = !loadFromDisk(normalized, sharedEntry.get());
+  }
+
+  // Drop the entries of released caches while we are at it
+  for (auto it = m_caches.begin(); it != m_caches.end();)
+  {
+    if (it->second.expired())
+    {
+      it = m_caches.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
+
+  return sharedEntry;
+}
+
+glm::uvec2 kit::MaterialCache::getResolution(kit::MaterialCache::Key const & key)
+{
+  glm::uvec2 resolution(1, 1);
+  for (auto currMap : { key.mapA, key.mapB })
+  {
+    if (currMap)
+    {
+      resolution = glm::max(resolution, glm::uvec2(currMap->getResolution()));
+    }
+  }
+
+  return glm::min(resolution, glm::uvec2(m_maxResolution));
+}
+
+uint64_t kit::MaterialCache::getMemory(kit::PixelBuffer * cache)
+{
+  if (!cache)
+  {
+    return 0;
+  }
+
+  uint64_t bytes = 0;
+  glm::uvec2 level = cache->getResolution();
+  while (true)
+  {
+    bytes += uint64_t(level.x) * uint64_t(level.y) * 4;
+    if (level.x == 1 && level.y == 1)
+    {
+      break;
+    }
+    level = glm::max(level / 2u, glm::uvec2(1, 1));
+  }
+
+  return bytes;
+}
+
+uint64_t kit::MaterialCache::getTotalMemory()
+{
+  uint64_t bytes = 0;
+  for (auto & currEntry : m_caches)
+  {
+    auto sharedEntry = currEntry.second.lock();
+    bytes += getMemory(sharedEntry.get());
+  }
+
+  return bytes;
+}
+
+uint32_t kit::MaterialCache::getCacheCount()
+{
+  uint32_t count = 0;
+  for (auto & currEntry : m_caches)
+  {
+    if (!currEntry.second.expired())
+    {
+      count++;
+    }
+  }
+
+  return count;
+}
+
+void kit::MaterialCache::store(kit::MaterialCache::Key const & key, kit::PixelBuffer * cache)
+{
+  std::string path;
+  if (!cache || !getDiskPath(normalize(key), path))
+  {
+    return;
+  }
+
+  kit::Texture * texture = cache->getColorAttachment(0);
+  glm::uvec2 resolution = cache->getResolution();
+  uint32_t levels = texture->calculateMipLevels();
+
+  std::ofstream fhandle(path, std::ios::binary);
+  if (!fhandle)
+  {
+    // Most likely the directory is missing, which would fail the same way for every cache
+    static bool warned = false;
+    if (!warned)
+    {
+      KIT_ERR("Warning: could not write to the material disk cache, create the directory to enable it");
+      warned = true;
+    }
+    return;
+  }
+
+  fhandle.write(diskMagic, sizeof(diskMagic));
+  fhandle.write(reinterpret_cast<const char*>(&resolution.x), sizeof(uint32_t));
+  fhandle.write(reinterpret_cast<const char*>(&resolution.y), sizeof(uint32_t));
+  fhandle.write(reinterpret_cast<const char*>(&levels), sizeof(uint32_t));
+
+  for (uint32_t level = 0; level < levels; level++)
+  {
+    std::vector<uint8_t> data = texture->getPixelData(level);
+    fhandle.write(reinterpret_cast<const char*>(&data[0]), data.size());
+  }
+}
+
+bool kit::MaterialCache::loadFromDisk(kit::MaterialCache::Key const & key, kit::PixelBuffer * cache)
+{
+  std::string path;
+  if (!getDiskPath(key, path))
+  {
+    return false;
+  }
+
+  std::ifstream fhandle(path, std::ios::binary);
+  if (!fhandle)
+  {
+    return false;
+  }
+
+  kit::Texture * texture = cache->getColorAttachment(0);
+  char magic[4];
+  glm::uvec2 resolution;
+  uint32_t levels = 0;
+
+  fhandle.read(magic, sizeof(magic));
+  fhandle.read(reinterpret_cast<char*>(&resolution.x), sizeof(uint32_t));
+  fhandle.read(reinterpret_cast<char*>(&resolution.y), sizeof(uint32_t));
+  fhandle.read(reinterpret_cast<char*>(&levels), sizeof(uint32_t));
+
+  // The name covers the resolution, so a mismatch means a broken file
+  if (!fhandle || std::memcmp(magic, diskMagic, sizeof(magic)) != 0 || resolution != cache->getResolution() || levels != texture->calculateMipLevels())
+  {
+    KIT_ERR("Warning: ignoring invalid material disk cache file");
+    return false;
+  }
+
+  std::vector<uint8_t> data;
+  for (uint32_t level = 0; level < levels; level++)
+  {
+    glm::uvec2 size = texture->getLevelResolution(level);
+    data.resize(size_t(size.x) * size_t(size.y) * 4);
+    if (!fhandle.read(reinterpret_cast<char*>(&data[0]), data.size()))
+    {
+      KIT_ERR("Warning: ignoring truncated material disk cache file");
+      return false;
+    }
+    texture->setPixelData(&data[0], level);
+  }
+
+  return true;
+}
+
+bool kit::MaterialCache::getDiskPath(kit::MaterialCache::Key const & key, std::string & path)
+{
+  if (m_diskCacheDirectory.empty())
+  {
+    return false;
+  }
+
+  glm::uvec2 resolution = getResolution(key);
+  uint64_t hash = hashValue(hashBasis, diskFormatVersion);
+  hash = hashValue(hash, resolution.x);
+  hash = hashValue(hash, resolution.y);
+
+  for (auto currMap : { key.mapA, key.mapB })
+  {
+    // Textures made at runtime have no file to hash
+    if (currMap && currMap->getFilename().empty())
+    {
+      return false;
+    }
+
+    hash = hashValue(hash, currMap ? hashFile(currMap->getFilename()) : uint64_t(0));
+  }
+
+  hash = hashValue(hash, key.defaultA.x);
+  hash = hashValue(hash, key.defaultA.y);
+  hash = hashValue(hash, key.defaultA.z);
+  hash = hashValue(hash, key.defaultB);
+
+  std::stringstream name;
+  name << m_diskCacheDirectory << std::hex << std::setw(16) << std::setfill('0') << hash << ".kmc";
+  path = name.str();
+  return true;
+}
+
+uint64_t kit::MaterialCache::hashFile(const std::string& filename)
+{
+  auto finder = m_fileHashes.find(filename);
+  if (finder != m_fileHashes.end())
+  {
+    return finder->second;
+  }
+
+  uint64_t hash = hashBasis;
+  std::ifstream fhandle(filename, std::ios::binary);
+  char buffer[65536];
+  while (fhandle.read(buffer, sizeof(buffer)) || fhandle.gcount() > 0)
+  {
+    hash = hashBytes(hash, buffer, size_t(fhandle.gcount()));
+  }
+
+  m_fileHashes[filename] = hash;
+  return hash;
+}
+
+void kit::MaterialCache::setDiskCacheDirectory(const std::string& directory)
+{
+  m_diskCacheDirectory = directory;
+}
+
+std::string const & kit::MaterialCache::getDiskCacheDirectory()
+{
+  return m_diskCacheDirectory;
+}
+
+void kit::MaterialCache::setMaxResolution(uint32_t resolution)
+{
+  m_maxResolution = (std::max)(resolution, 1u);
+}
+
+uint32_t kit::MaterialCache::getMaxResolution()
+{
+  return m_maxResolution;
+}
@@ -0,0 +1,135 @@
+#include "Kit/MaterialInstance.hpp"
+
+#include "Kit/Material.hpp"
+#include "Kit/UniformBuffer.hpp"
+
+kit::MaterialInstance::MaterialInstance(std::shared_ptr<kit::Material> parent)
+{
+  if (!parent)
+  {
+    KIT_THROW("Material instance needs a parent material");
+  }
+
+  m_parent = parent;
+}
+
+kit::MaterialInstance::~MaterialInstance()
+{
+  if (m_uniformBuffer) delete m_uniformBuffer;
+}
+
+std::shared_ptr<kit::Material> kit::MaterialInstance::getParent()
+{
+  return m_parent;
+}
+
+void kit::MaterialInstance::use(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix, const glm::mat4 & modelMatrix, const std::vector<glm::mat4> & skinTransform, const std::vector<glm::mat4> & instanceTransform, float lodFade, kit::Material::DrawCache * cache)
+{
+  m_parent->use(viewMatrix, projectionMatrix, modelMatrix, skinTransform, instanceTransform, lodFade, cache);
+
+  if (m_uniformsDirty || m_parentRevision != m_parent->getUniformRevision())
+  {
+    updateUniforms();
+  }
+
+  m_uniformBuffer->bind(kit::UniformBuffer::MaterialBinding);
+}
+
+void kit::MaterialInstance::updateUniforms()
+{
+  kit::Material::UniformBlock block = m_parent->getUniformBlock();
+  m_parentRevision = m_parent->getUniformRevision();
+
+  block.tint = glm::vec4(m_tint, 1.0f);
+  if (m_overrides & Albedo) block.albedo = glm::vec4(m_albedo, block.albedo.w);
+  if (m_overrides & Roughness) block.albedo.w = m_roughness;
+  if (m_overrides & EmissiveColor) block.emissive = glm::vec4(m_emissiveColor, block.emissive.w);
+  if (m_overrides & EmissiveStrength) block.emissive.w = m_emissiveStrength;
+  if (m_overrides & Metalness) block.params.x = m_metalness;
+
+  if (!m_uniformBuffer)
+  {
+    m_uniformBuffer = new kit::UniformBuffer(sizeof(kit::Material::UniformBlock));
+  }
+  m_uniformBuffer->update(&block, sizeof(kit::Material::UniformBlock));
+
+  m_uniformsDirty = false;
+}
+
+void kit::MaterialInstance::setTint(glm::vec3 const & tint)
+{
+  m_tint = tint;
+  m_uniformsDirty = true;
+}
+
+glm::vec3 const & kit::MaterialInstance::getTint()
+{
+  return m_tint;
+}
+
+void kit::MaterialInstance::setAlbedo(glm::vec3 const & albedo)
+{
+  m_albedo = albedo;
+  m_overrides |= Albedo;
+  m_uniformsDirty = true;
+}
+
+glm::vec3 kit::MaterialInstance::getAlbedo()
+{
+  return (m_overrides & Albedo) ? m_albedo : m_parent->getAlbedo();
+}
+
+void kit::MaterialInstance::setRoughness(float roughness)
+{
+  m_roughness = roughness;
+  m_overrides |= Roughness;
+  m_uniformsDirty = true;
+}
+
+float kit::MaterialInstance::getRoughness()
+{
+  return (m_overrides & Roughness) ? m_roughness : m_parent->getRoughness();
+}
+
+void kit::MaterialInstance::setMetalness(float metalness)
+{
+  m_metalness = metalness;
+  m_overrides |= Metalness;
+  m_uniformsDirty = true;
+}
+
+float kit::MaterialInstance::getMetalness()
+{
+  return (m_overrides & Metalness) ? m_metalness : m_parent->getMetalness();
+}
+
+void kit::MaterialInstance::setEmissiveColor(glm::vec3 const & color)
+{
+  m_emissiveColor = color;
+  m_overrides |= EmissiveColor;
+  m_uniformsDirty = true;
+}
+
+glm::vec3 kit::MaterialInstance::getEmissiveColor()
+{
+  return (m_overrides & EmissiveColor) ? m_emissiveColor : m_parent->getEmissiveColor();
+}
+
+void kit::MaterialInstance::setEmissiveStrength(float strength)
+{
+  m_emissiveStrength = strength;
+  m_overrides |= EmissiveStrength;
+  m_uniformsDirty = true;
+}
+
+float kit::MaterialInstance::getEmissiveStrength()
+{
+  return (m_overrides & EmissiveStrength) ? m_emissiveStrength : m_parent->getEmissiveStrength();
+}
+
+void kit::MaterialInstance::clearOverrides()
+{
+  m_overrides = 0;
+  m_tint = glm::vec3(1.0f, 1.0f, 1.0f);
+  m_uniformsDirty = true;
+}
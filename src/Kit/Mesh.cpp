@@ -4,10 +4,17 @@
 #include "Kit/Submesh.hpp"
 #include "Kit/Camera.hpp"
 #include "Kit/Material.hpp"
+#include "Kit/MaterialInstance.hpp"
 #include "Kit/ConvexHull.hpp"
 #include "Kit/Renderer.hpp"
+#include "Kit/DrawBatcher.hpp"
 
+#include <algorithm>
 #include <fstream>
+#include <limits>
+#include <sstream>
+
+const std::vector<glm::mat4> kit::Mesh::NoTransforms;
 
 kit::Mesh::Mesh()
 {
@@ -42,6 +49,28 @@ kit::Mesh::Mesh(const std::string&filename)
       {
         KIT_ASSERT(currtokens.size() == 4 /* Submesh needs 3 arguments (submesh <name> <geometry-filename> <material-filename>) */);
         addSubmeshEntry(currtokens[1], kit::Submesh::load(currtokens[2]), kit::Material::load(currtokens[3]));
+        
+        // Pick up the chain saved by kit::GeometrySimplifier::buildChain
+        for (uint32_t level = 1; ; level++)
+        {
+          std::stringstream lodName;
+          lodName << currtokens[2] << ".lod" << level;
+          if (!std::ifstream(kit::getDataDirectory() + "geometry/" + lodName.str()))
+          {
+            break;
+          }
+          addSubmeshLod(currtokens[1], kit::Submesh::load(lodName.str()));
+        }
+      }
+      else if (identifier == std::string("lodsizes"))
+      {
+        // lodsizes <level 1 size> [<level 2 size> ...]
+        std::vector<float> sizes;
+        for (size_t i = 1; i < currtokens.size(); i++)
+        {
+          sizes.push_back(std::stof(currtokens[i]));
+        }
+        setLodScreenSizes(sizes);
       }
       else if (identifier == std::string("skeleton"))
       {
@@ -60,6 +89,8 @@ kit::Mesh::Mesh(const std::string&filename)
 void kit::Mesh::setSubmeshEnabled(const std::string&name, bool b)
 {
   m_submeshesEnabled.at(name) = b;
+  m_drawRecordsDirty = true;
+  m_submeshRevision++;
 }
 
 void kit::Mesh::addSubmeshEntry(const std::string&name, std::shared_ptr<kit::Submesh> geometry, std::shared_ptr<kit::Material> material)
@@ -67,6 +98,137 @@ void kit::Mesh::addSubmeshEntry(const std::string&name, std::shared_ptr<kit::Sub
   m_submeshEntries[name].m_material = material;
   m_submeshEntries[name].m_submesh = geometry;
   m_submeshesEnabled[name] = true;
+  m_drawRecordsDirty = true;
+  m_submeshRevision++;
+}
+
+void kit::Mesh::assertDrawRecords()
+{
+  if (!m_drawRecordsDirty)
+  {
+    return;
+  }
+
+  m_drawRecords.clear();
+  for (auto & currSubmesh : m_submeshEntries)
+  {
+    if (!m_submeshesEnabled.at(currSubmesh.first))
+    {
+      continue;
+    }
+
+    DrawRecord newRecord;
+    newRecord.entry = &currSubmesh.second;
+    newRecord.name = &currSubmesh.first;
+    refreshDrawRecord(newRecord);
+    m_drawRecords.push_back(newRecord);
+  }
+
+  m_drawRecordsDirty = false;
+}
+
+void kit::Mesh::refreshDrawRecord(kit::Mesh::DrawRecord & record)
+{
+  record.material = record.entry->m_material.get();
+  record.programRevision = record.material->getProgramRevision();
+  record.forward = record.material->getFlags(false, false).m_forward;
+  record.drawCache = kit::Material::DrawCache();
+}
+
+void kit::Mesh::addSubmeshLod(const std::string& name, std::shared_ptr<kit::Submesh> geometry)
+{
+  kit::Mesh::SubmeshEntry * entry = getSubmeshEntry(name);
+  entry->m_lods.push_back(geometry);
+  m_lodCount = (std::max)(m_lodCount, uint32_t(entry->m_lods.size()) + 1);
+}
+
+kit::Submesh * kit::Mesh::SubmeshEntry::getLod(uint32_t level)
+{
+  if (level == 0 || m_lods.empty())
+  {
+    return m_submesh.get();
+  }
+
+  return m_lods[(std::min)(level, uint32_t(m_lods.size())) - 1].get();
+}
+
+void kit::Mesh::setLodScreenSizes(std::vector<float> const & sizes)
+{
+  m_lodScreenSizes = sizes;
+}
+
+float kit::Mesh::getLodScreenSize(uint32_t level)
+{
+  if (level == 0)
+  {
+    return std::numeric_limits<float>::max();
+  }
+
+  if (level <= m_lodScreenSizes.size())
+  {
+    return m_lodScreenSizes[level - 1];
+  }
+
+  float size = m_lodScreenSizes.empty() ? 1.0f : m_lodScreenSizes.back();
+  for (uint32_t i = uint32_t(m_lodScreenSizes.size()); i < level; i++)
+  {
+    size *= 0.5f;
+  }
+  return size;
+}
+
+void kit::Mesh::setLodHysteresis(float hysteresis)
+{
+  m_lodHysteresis = hysteresis;
+}
+
+float kit::Mesh::getLodHysteresis()
+{
+  return m_lodHysteresis;
+}
+
+uint32_t kit::Mesh::getLodCount()
+{
+  return m_lodCount;
+}
+
+uint32_t kit::Mesh::selectLod(float screenSize, uint32_t current)
+{
+  current = (std::min)(current, m_lodCount - 1);
+
+  // Coarser while clearly below the size of the next level
+  while (current + 1 < m_lodCount && screenSize < getLodScreenSize(current + 1) * (1.0f - m_lodHysteresis))
+  {
+    current++;
+  }
+
+  // Finer while clearly above the size of the current level
+  while (current > 0 && screenSize > getLodScreenSize(current) * (1.0f + m_lodHysteresis))
+  {
+    current--;
+  }
+
+  return current;
+}
+
+float kit::Mesh::getScreenSize(kit::AABB const & bounds, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
+{
+  glm::vec3 center = (bounds.m_min + bounds.m_max) * 0.5f;
+  float radius = glm::length(bounds.m_max - bounds.m_min) * 0.5f;
+
+  // Orthographic projections do not shrink with distance
+  if (projectionMatrix[3][3] == 1.0f)
+  {
+    return radius * projectionMatrix[1][1];
+  }
+
+  float distance = glm::length(glm::vec3(viewMatrix * glm::vec4(center, 1.0f)));
+  if (distance <= radius)
+  {
+    return std::numeric_limits<float>::max();
+  }
+
+  return radius / distance * projectionMatrix[1][1];
 }
 
 kit::Mesh::SubmeshEntry* kit::Mesh::getSubmeshEntry(const std::string&name)
@@ -80,49 +242,107 @@ kit::Mesh::SubmeshEntry* kit::Mesh::getSubmeshEntry(const std::string&name)
 
 void kit::Mesh::render(kit::Mesh::RenderConfig const & conf)
 {
-  for(auto & currSubmesh : m_submeshEntries)
+  assertDrawRecords();
+
+  bool forwardPass = (conf.renderPass == RenderPass::Forward);
+  bool reflectionPass = (conf.renderPass == RenderPass::Reflection);
+  bool hasInstances = (conf.materialInstances && !conf.materialInstances->empty());
+  std::vector<glm::mat4> const & skinTransform = *conf.skinTransform;
+  std::vector<glm::mat4> const & instanceTransform = *conf.instanceTransform;
+  size_t instanceCount = instanceTransform.size();
+
+  for(auto & currRecord : m_drawRecords)
   {
-    if (m_submeshesEnabled.at(currSubmesh.first))
+    if (currRecord.material != currRecord.entry->m_material.get() || currRecord.programRevision != currRecord.material->getProgramRevision())
     {
-      bool materialForward = currSubmesh.second.m_material->getFlags(conf.skinTransform.size() > 0, conf.instanceTransform.size() > 0).m_forward;
-      if(((conf.renderPass == RenderPass::Forward) != materialForward) || (materialForward && (conf.renderPass == RenderPass::Reflection)) )
-      {
-        continue;
-      }
+      refreshDrawRecord(currRecord);
+    }
 
-      if(conf.renderPass == RenderPass::Reflection)
-      {
-        currSubmesh.second.m_material->useReflective(conf.renderer, conf.viewMatrix, conf.projectionMatrix, conf.modelMatrix, conf.skinTransform, conf.instanceTransform);
-      }
-      else
-      {
-        currSubmesh.second.m_material->use(conf.viewMatrix, conf.projectionMatrix, conf.modelMatrix, conf.skinTransform, conf.instanceTransform);
-      }
-      
-      if(conf.instanceTransform.size() > 0)
-      {
-        currSubmesh.second.m_submesh->renderGeometryInstanced(conf.instanceTransform.size());
-      }
-      else
+    if((forwardPass != currRecord.forward) || (currRecord.forward && reflectionPass))
+    {
+      continue;
+    }
+
+    kit::MaterialInstance * materialInstance = nullptr;
+    if (hasInstances)
+    {
+      auto finder = conf.materialInstances->find(*currRecord.name);
+      if (finder != conf.materialInstances->end())
       {
-        currSubmesh.second.m_submesh->renderGeometry();
+        materialInstance = finder->second.get();
       }
     }
+
+    if(reflectionPass)
+    {
+      currRecord.material->useReflective(conf.renderer, conf.viewMatrix, conf.projectionMatrix, conf.modelMatrix, skinTransform, instanceTransform);
+    }
+    else if (materialInstance)
+    {
+      materialInstance->use(conf.viewMatrix, conf.projectionMatrix, conf.modelMatrix, skinTransform, instanceTransform, conf.lodFade, &currRecord.drawCache);
+    }
+    else
+    {
+      currRecord.material->use(conf.viewMatrix, conf.projectionMatrix, conf.modelMatrix, skinTransform, instanceTransform, conf.lodFade, &currRecord.drawCache);
+    }
+    
+    if(instanceCount > 0)
+    {
+      currRecord.entry->getLod(conf.lod)->renderGeometryInstanced(instanceCount);
+    }
+    else
+    {
+      currRecord.entry->getLod(conf.lod)->renderGeometry();
+    }
   }
 }
 
-void kit::Mesh::renderGeometry()
+void kit::Mesh::renderGeometry(uint32_t lod)
 {
-  for (auto & currSubmesh : m_submeshEntries)
+  assertDrawRecords();
+
+  for (auto & currRecord : m_drawRecords)
+  {
+    currRecord.entry->getLod(lod)->renderGeometry();
+  }
+}
+
+void kit::Mesh::submitBatched(kit::DrawBatcher * batcher, glm::mat4 const & modelMatrix, uint32_t lod)
+{
+  assertDrawRecords();
+
+  for (auto & currRecord : m_drawRecords)
   {
-    if (m_submeshesEnabled.at(currSubmesh.first))
+    if (currRecord.material != currRecord.entry->m_material.get() || currRecord.programRevision != currRecord.material->getProgramRevision())
+    {
+      refreshDrawRecord(currRecord);
+    }
+
+    if (!currRecord.forward)
     {
-      currSubmesh.second.m_submesh->renderGeometry();
+      batcher->submit(currRecord.entry->getLod(lod), currRecord.material, modelMatrix);
     }
   }
 }
 
+kit::AABB kit::Mesh::getBounds()
+{
+  assertDrawRecords();
+
+  kit::AABB bounds;
+  for (auto & currRecord : m_drawRecords)
+  {
+    bounds.expand(currRecord.entry->m_submesh->getBounds());
+  }
+  return bounds;
+}
+
 std::map< std::string, kit::Mesh::SubmeshEntry > & kit::Mesh::getSubmeshEntries()
 {
   return m_submeshEntries;
 }
+
+uint32_t kit::Mesh::getSubmeshRevision()
+{
+  return m_submeshRevision;
+}
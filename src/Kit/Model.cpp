@@ -1,15 +1,18 @@
 #include "Kit/Model.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 #include "Kit/Mesh.hpp"
 #include "Kit/Camera.hpp"
 #include "Kit/Material.hpp"
+#include "Kit/MaterialInstance.hpp"
 #include "Kit/Submesh.hpp"
 #include "Kit/Program.hpp"
 #include "Kit/Texture.hpp"
 #include "Kit/Renderer.hpp"
 #include "Kit/Shader.hpp"
 #include "Kit/Skeleton.hpp"
+#include "Kit/OcclusionBuffer.hpp"
 
 #include <sstream>
 #include <glm/gtx/transform.hpp>
@@ -40,7 +43,11 @@ kit::Model::~Model()
 
 void kit::Model::allocateShared()
 {
-
+  // Request every shadow program up front, they compile in the background while the scene loads
+  for(uint32_t variant = 0; variant < 8; variant++)
+  {
+    kit::Model::getShadowProgram((variant & 1) != 0, (variant & 2) != 0, (variant & 4) != 0);
+  }
 }
 
 void kit::Model::releaseShared()
@@ -150,21 +157,10 @@ kit::Program * kit::Model::getShadowProgram(bool skinned, bool opacityMapped, bo
 
   }
   
-  // Compile and link
+  // Compile and link in the background, see renderShadows
   vertexShader->sourceFromString(vertexSource.str());
-  vertexShader->compile();
-  
   pixelShader->sourceFromString(pixelSource.str());
-  pixelShader->compile();
-
-  newProgram->attachShader(vertexShader);
-  newProgram->attachShader(pixelShader);
-  newProgram->link();
-  newProgram->detachShader(pixelShader);
-  newProgram->detachShader(vertexShader);
-  
-  delete vertexShader;
-  delete pixelShader;
+  newProgram->linkAsync({vertexShader, pixelShader});
   
   kit::Model::m_shadowPrograms[flags] = newProgram;
   return kit::Model::m_shadowPrograms.at(flags);
@@ -227,15 +223,32 @@ void kit::Model::renderDeferred(kit::Renderer* renderer)
   conf.modelMatrix = getWorldTransformMatrix();
   conf.renderPass = kit::Mesh::RenderPass::Deferred;
   conf.renderer = renderer;
+  conf.lod = selectLod(kit::Mesh::LodPass::Geometry, conf.viewMatrix, conf.projectionMatrix);
+  conf.materialInstances = &m_materialInstances;
   
   if(m_skeleton)
   {
-    conf.skinTransform = m_skeleton->getSkin();
+    conf.skinTransform = &m_skeleton->getSkin();
   }
   
   if(m_instanced)
   {
-    conf.instanceTransform = m_instanceTransform;
+    conf.instanceTransform = &m_instanceTransform;
+  }
+  
+  if (isLodFading())
+  {
+    // The incoming level takes over more of the dither pattern every frame, and the outgoing level keeps the rest
+    float fade = float(m_lodFadeFrame + 1) / float(m_lodFadeFrames + 1);
+    conf.lodFade = fade;
+    m_mesh->render(conf);
+    
+    conf.lod = m_lodFadeFrom;
+    conf.lodFade = -fade;
+    m_mesh->render(conf);
+    
+    m_lodFadeFrame++;
+    return;
   }
   
   m_mesh->render(conf);
@@ -250,15 +263,16 @@ void kit::Model::renderReflection(Renderer * renderer, const glm::mat4& viewMatr
   conf.modelMatrix = getWorldTransformMatrix();
   conf.renderPass = kit::Mesh::RenderPass::Reflection;
   conf.renderer = renderer;
+  conf.lod = selectLod(kit::Mesh::LodPass::Reflection, viewMatrix, projectionMatrix);
   
   if(m_skeleton)
   {
-    conf.skinTransform = m_skeleton->getSkin();
+    conf.skinTransform = &m_skeleton->getSkin();
   }
   
   if(m_instanced)
   {
-    conf.instanceTransform = m_instanceTransform;
+    conf.instanceTransform = &m_instanceTransform;
   }
   
   m_mesh->render(conf);
@@ -274,26 +288,50 @@ void kit::Model::renderForward(kit::Renderer* renderer)
   conf.modelMatrix = getWorldTransformMatrix();
   conf.renderPass = kit::Mesh::RenderPass::Forward;
   conf.renderer = renderer;
+  conf.lod = m_lods[uint32_t(kit::Mesh::LodPass::Geometry)];
+  conf.materialInstances = &m_materialInstances;
   
   if(m_skeleton)
   {
-    conf.skinTransform = m_skeleton->getSkin();
+    conf.skinTransform = &m_skeleton->getSkin();
   }
   
   if(m_instanced)
   {
-    conf.instanceTransform = m_instanceTransform;
+    conf.instanceTransform = &m_instanceTransform;
   }
   
   m_mesh->render(conf);
 }
 
+void kit::Model::prepareShadows(kit::Camera * camera)
+{
+  selectLod(kit::Mesh::LodPass::Shadow, camera->getViewMatrix(), camera->getProjectionMatrix());
+}
+
 void kit::Model::renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
 {
-  for (auto &currSubmeshIndex : m_mesh->getSubmeshEntries())
+  uint32_t lod = m_lods[uint32_t(kit::Mesh::LodPass::Shadow)];
+  m_shadowComplete = true;
+  
+  // Walk the submeshes and look up their programs only when the mesh changes, not for every shadow view
+  if (m_shadowDrawsMesh != m_mesh || m_shadowDrawsRevision != m_mesh->getSubmeshRevision())
   {
-    auto & currMaterial = currSubmeshIndex.second.m_material;
-    auto & currSubmesh = currSubmeshIndex.second.m_submesh;
+    m_shadowDraws.clear();
+    for (auto & currEntry : m_mesh->getSubmeshEntries())
+    {
+      ShadowDraw newDraw;
+      newDraw.entry = &currEntry.second;
+      m_shadowDraws.push_back(newDraw);
+    }
+    m_shadowDrawsMesh = m_mesh;
+    m_shadowDrawsRevision = m_mesh->getSubmeshRevision();
+  }
+  
+  for (auto & currDraw : m_shadowDraws)
+  {
+    auto & currMaterial = currDraw.entry->m_material;
+    kit::Submesh * currSubmesh = currDraw.entry->getLod(lod);
 
     if (!currMaterial->getCastShadows())
     {
@@ -302,19 +340,41 @@ void kit::Model::renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & p
 
     if (currMaterial->getDoubleSided())
     {
-      glDisable(GL_CULL_FACE);
+      kit::GLState::setCulling(false);
     }
     else
     {
-      glEnable(GL_CULL_FACE);
-      glCullFace(GL_BACK);
+      kit::GLState::setCulling(true);
+      kit::GLState::setCullFace(GL_BACK);
     }
 
     bool O = (currMaterial->getOpacityMask() != nullptr);
     bool S = (m_skeleton != nullptr);
     bool I = m_instanced;
 
-    auto currProgram = kit::Model::getShadowProgram(S, O, I);
+    if (currDraw.material != currMaterial.get() || currDraw.flags.skinned != S || currDraw.flags.opacityMapped != O || currDraw.flags.instanced != I)
+    {
+      currDraw.material = currMaterial.get();
+      currDraw.flags.skinned = S;
+      currDraw.flags.opacityMapped = O;
+      currDraw.flags.instanced = I;
+      currDraw.program = kit::Model::getShadowProgram(S, O, I);
+    }
+    auto currProgram = currDraw.program;
+
+    // While a program is still compiling, cast a shadow without the opacity mask, or none at all
+    if(!currProgram->isReady() && O)
+    {
+      O = false;
+      currProgram = kit::Model::getShadowProgram(S, O, I);
+      m_shadowComplete = false;
+    }
+
+    if(!currProgram->isReady())
+    {
+      m_shadowComplete = false;
+      continue;
+    }
 
     currProgram->setUniformMat4("uniform_mvpMatrix", projectionMatrix * viewMatrix * getWorldTransformMatrix());
 
@@ -342,9 +402,137 @@ void kit::Model::renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & p
   }
 }
 
+bool kit::Model::isShadowComplete()
+{
+  return m_shadowComplete;
+}
+
 void kit::Model::renderGeometry()
 {
-  m_mesh->renderGeometry();
+  m_mesh->renderGeometry(m_lods[uint32_t(kit::Mesh::LodPass::Geometry)]);
+}
+
+void kit::Model::setLodBias(kit::Mesh::LodPass pass, float bias)
+{
+  m_lodBias[uint32_t(pass)] = bias;
+}
+
+float kit::Model::getLodBias(kit::Mesh::LodPass pass)
+{
+  return m_lodBias[uint32_t(pass)];
+}
+
+uint32_t kit::Model::getLod(kit::Mesh::LodPass pass)
+{
+  return m_lods[uint32_t(pass)];
+}
+
+void kit::Model::setLodCrossFade(uint32_t frames)
+{
+  m_lodFadeFrames = frames;
+  m_lodFadeFrame = frames;
+}
+
+uint32_t kit::Model::getLodCrossFade()
+{
+  return m_lodFadeFrames;
+}
+
+bool kit::Model::isLodFading()
+{
+  return m_lodFadeFrame < m_lodFadeFrames;
+}
+
+uint32_t kit::Model::selectLod(kit::Mesh::LodPass pass, glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
+{
+  uint32_t & current = m_lods[uint32_t(pass)];
+  if (m_mesh->getLodCount() <= 1)
+  {
+    current = 0;
+    return current;
+  }
+
+  // Skinned models fall back to the bind pose bounds, which is close enough to pick a level by
+  kit::AABB bounds;
+  if (!getWorldBounds(bounds))
+  {
+    bounds = m_mesh->getBounds().transformed(getWorldTransformMatrix());
+  }
+
+  float screenSize = kit::Mesh::getScreenSize(bounds, viewMatrix, projectionMatrix) * m_lodBias[uint32_t(pass)];
+  uint32_t selected = m_mesh->selectLod(screenSize, current);
+
+  if (pass == kit::Mesh::LodPass::Geometry && selected != current && m_lodFadeFrames > 0)
+  {
+    m_lodFadeFrom = current;
+    m_lodFadeFrame = 0;
+  }
+
+  current = selected;
+  return current;
+}
+
+void kit::Model::setOccluder(std::shared_ptr<kit::Occluder> occluder)
+{
+  m_occluder = occluder;
+}
+
+void kit::Model::setOccluder(const std::string& geometry)
+{
+  m_occluder = kit::Occluder::load(geometry);
+}
+
+kit::MaterialInstance * kit::Model::getMaterialInstance(const std::string& submesh)
+{
+  auto & instance = m_materialInstances[submesh];
+  if (!instance)
+  {
+    instance = std::make_shared<kit::MaterialInstance>(m_mesh->getSubmeshEntry(submesh)->m_material);
+  }
+
+  return instance.get();
+}
+
+void kit::Model::setMaterialInstance(const std::string& submesh, std::shared_ptr<kit::MaterialInstance> instance)
+{
+  if (instance)
+  {
+    m_materialInstances[submesh] = instance;
+  }
+  else
+  {
+    m_materialInstances.erase(submesh);
+  }
+}
+
+kit::Occluder * kit::Model::getOccluder()
+{
+  // The occluder follows the model, not its instances
+  if (m_instanced)
+  {
+    return nullptr;
+  }
+
+  return m_occluder.get();
+}
+
+bool kit::Model::submitBatched(kit::DrawBatcher * batcher)
+{
+  // Skinned and manually instanced models need their own uniforms, and so do material instances
+  if (m_skeleton != nullptr || m_instanced || !m_materialInstances.empty())
+  {
+    return false;
+  }
+
+  // A cross-fade draws two dithered levels, which the batched program can not do
+  uint32_t lod = selectLod(kit::Mesh::LodPass::Geometry, batcher->getViewMatrix(), batcher->getProjectionMatrix());
+  if (isLodFading())
+  {
+    return false;
+  }
+
+  m_mesh->submitBatched(batcher, getWorldTransformMatrix(), lod);
+  return true;
 }
 
 bool kit::Model::isSkinned()
@@ -352,12 +540,41 @@ bool kit::Model::isSkinned()
   return (m_skeleton != nullptr);
 }
 
-std::vector<glm::mat4> kit::Model::getSkin()
+bool kit::Model::getWorldBounds(kit::AABB & bounds)
+{
+  // Animated vertices can leave the bind pose bounds
+  if (m_skeleton != nullptr)
+  {
+    return false;
+  }
+
+  kit::AABB localBounds = m_mesh->getBounds();
+  if (!localBounds.isValid())
+  {
+    return false;
+  }
+
+  glm::mat4 worldTransform = getWorldTransformMatrix();
+  if (!m_instanced)
+  {
+    bounds = localBounds.transformed(worldTransform);
+    return true;
+  }
+
+  bounds = kit::AABB();
+  for (auto & currTransform : m_instanceTransform)
+  {
+    bounds.expand(localBounds.transformed(worldTransform * currTransform));
+  }
+  return bounds.isValid();
+}
+
+std::vector<glm::mat4> const & kit::Model::getSkin()
 {
   if (m_skeleton == nullptr)
   {
     KIT_ERR("Warning: tried to get skin from non-skinned model");
-    return std::vector<glm::mat4>();
+    return kit::Mesh::NoTransforms;
   }
 
   return m_skeleton->getSkin();
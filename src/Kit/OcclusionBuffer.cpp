@@ -0,0 +1,404 @@
+#include "Kit/OcclusionBuffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KIT_OCCLUSION_SSE2
+#endif
+
+const uint32_t kit::OcclusionBuffer::TileSize;
+
+std::map<std::string, std::weak_ptr<kit::Occluder>> kit::Occluder::m_cache = std::map<std::string, std::weak_ptr<kit::Occluder>>();
+
+kit::Occluder::Occluder(std::vector<glm::vec3> const & positions, std::vector<uint32_t> const & indices)
+{
+  m_positions = positions;
+  m_indices = indices;
+}
+
+std::shared_ptr<kit::Occluder> kit::Occluder::load(const std::string& name)
+{
+  auto & entry = m_cache[name];
+  auto sharedEntry = entry.lock();
+
+  if (!sharedEntry)
+  {
+    std::string path = kit::getDataDirectory() + "geometry/" + name;
+    std::cout << "Loading occluder from file \"" << path << "\"" << std::endl;
+
+    kit::Geometry data;
+    if (!data.load(path))
+    {
+      KIT_THROW("Failed to load occluder data from file");
+    }
+
+    std::vector<glm::vec3> positions;
+    for (auto & currVertex : data.m_vertices)
+    {
+      positions.push_back(currVertex.m_position);
+    }
+
+    entry = sharedEntry = std::make_shared<kit::Occluder>(positions, data.m_indices);
+  }
+
+  return sharedEntry;
+}
+
+std::vector<glm::vec3> const & kit::Occluder::getPositions()
+{
+  return m_positions;
+}
+
+std::vector<uint32_t> const & kit::Occluder::getIndices()
+{
+  return m_indices;
+}
+
+kit::OcclusionBuffer::OcclusionBuffer(glm::uvec2 resolution, uint32_t threadCount)
+{
+  m_tiles = (glm::max(resolution, glm::uvec2(1)) + glm::uvec2(TileSize - 1)) / TileSize;
+  m_resolution = m_tiles * TileSize;
+  m_threadCount = threadCount > 0 ? threadCount : (glm::max)(1u, std::thread::hardware_concurrency());
+
+  m_depth.resize(m_resolution.x * m_resolution.y, 1.0f);
+  m_bins.resize(m_tiles.x * m_tiles.y);
+  m_nextTile = 0;
+
+  // The calling thread takes part in rasterize(), so it needs one worker less
+  uint32_t numThreads = (glm::min)(m_threadCount, m_tiles.x * m_tiles.y);
+  for (uint32_t i = 1; i < numThreads; i++)
+  {
+    m_workers.push_back(std::thread(&kit::OcclusionBuffer::workerMain, this));
+  }
+}
+
+kit::OcclusionBuffer::~OcclusionBuffer()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_condition.notify_all();
+
+  for (auto & currWorker : m_workers)
+  {
+    currWorker.join();
+  }
+}
+
+void kit::OcclusionBuffer::workerMain()
+{
+  uint64_t generation = 0;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [this, generation](){ return m_stopping || m_generation != generation; });
+      if (m_stopping)
+      {
+        return;
+      }
+      generation = m_generation;
+    }
+
+    rasterizeTiles();
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_busyWorkers--;
+    }
+    m_finished.notify_one();
+  }
+}
+
+void kit::OcclusionBuffer::clear(glm::mat4 const & viewProjectionMatrix)
+{
+  m_viewProjectionMatrix = viewProjectionMatrix;
+  std::fill(m_depth.begin(), m_depth.end(), 1.0f);
+  m_triangles.clear();
+  for (auto & currBin : m_bins)
+  {
+    currBin.clear();
+  }
+}
+
+glm::vec3 kit::OcclusionBuffer::toScreen(glm::vec4 const & clip) const
+{
+  glm::vec3 ndc = glm::vec3(clip) / clip.w;
+  return glm::vec3((glm::vec2(ndc) * 0.5f + 0.5f) * glm::vec2(m_resolution), ndc.z * 0.5f + 0.5f);
+}
+
+void kit::OcclusionBuffer::addOccluder(kit::Occluder & occluder, glm::mat4 const & modelMatrix)
+{
+  glm::mat4 modelViewProjection = m_viewProjectionMatrix * modelMatrix;
+  auto & positions = occluder.getPositions();
+  auto & indices = occluder.getIndices();
+
+  for (size_t i = 0; i + 2 < indices.size(); i += 3)
+  {
+    glm::vec4 clip[3];
+    for (uint32_t v = 0; v < 3; v++)
+    {
+      clip[v] = modelViewProjection * glm::vec4(positions[indices[i + v]], 1.0f);
+    }
+
+    // Clip against the near plane, z = -w, which leaves up to a quad
+    glm::vec4 clipped[4];
+    uint32_t clippedCount = 0;
+    for (uint32_t v = 0; v < 3; v++)
+    {
+      glm::vec4 const & curr = clip[v];
+      glm::vec4 const & next = clip[(v + 1) % 3];
+      float currDistance = curr.z + curr.w;
+      float nextDistance = next.z + next.w;
+
+      if (currDistance >= 0.0f)
+      {
+        clipped[clippedCount++] = curr;
+      }
+      if ((currDistance >= 0.0f) != (nextDistance >= 0.0f))
+      {
+        clipped[clippedCount++] = glm::mix(curr, next, currDistance / (currDistance - nextDistance));
+      }
+    }
+
+    for (uint32_t v = 2; v < clippedCount; v++)
+    {
+      addTriangle(clipped[0], clipped[v - 1], clipped[v]);
+    }
+  }
+}
+
+void kit::OcclusionBuffer::addTriangle(glm::vec4 const & c0, glm::vec4 const & c1, glm::vec4 const & c2)
+{
+  Triangle newTriangle;
+  newTriangle.v0 = toScreen(c0);
+  newTriangle.v1 = toScreen(c1);
+  newTriangle.v2 = toScreen(c2);
+
+  // Both windings are rasterized, so make them all counter-clockwise
+  float area = (newTriangle.v1.x - newTriangle.v0.x) * (newTriangle.v2.y - newTriangle.v0.y) - (newTriangle.v1.y - newTriangle.v0.y) * (newTriangle.v2.x - newTriangle.v0.x);
+  if (area == 0.0f || area != area)
+  {
+    return;
+  }
+  if (area < 0.0f)
+  {
+    std::swap(newTriangle.v1, newTriangle.v2);
+  }
+
+  glm::vec2 boundsMin = glm::min(glm::min(glm::vec2(newTriangle.v0), glm::vec2(newTriangle.v1)), glm::vec2(newTriangle.v2));
+  glm::vec2 boundsMax = glm::max(glm::max(glm::vec2(newTriangle.v0), glm::vec2(newTriangle.v1)), glm::vec2(newTriangle.v2));
+  if (boundsMax.x < 0.0f || boundsMax.y < 0.0f || boundsMin.x >= float(m_resolution.x) || boundsMin.y >= float(m_resolution.y))
+  {
+    return;
+  }
+
+  glm::uvec2 firstTile = glm::uvec2(glm::max(boundsMin, glm::vec2(0.0f))) / TileSize;
+  glm::uvec2 lastTile = glm::min(glm::uvec2(glm::min(boundsMax, glm::vec2(m_resolution - glm::uvec2(1)))) / TileSize, m_tiles - glm::uvec2(1));
+
+  uint32_t index = (uint32_t)m_triangles.size();
+  m_triangles.push_back(newTriangle);
+  for (uint32_t y = firstTile.y; y <= lastTile.y; y++)
+  {
+    for (uint32_t x = firstTile.x; x <= lastTile.x; x++)
+    {
+      m_bins[y * m_tiles.x + x].push_back(index);
+    }
+  }
+}
+
+void kit::OcclusionBuffer::rasterize()
+{
+  m_nextTile = 0;
+  if (m_workers.empty())
+  {
+    rasterizeTiles();
+    return;
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_generation++;
+    m_busyWorkers = (uint32_t)m_workers.size();
+  }
+  m_condition.notify_all();
+
+  rasterizeTiles();
+
+  std::unique_lock<std::mutex> lock(m_mutex);
+  m_finished.wait(lock, [this](){ return m_busyWorkers == 0; });
+}
+
+void kit::OcclusionBuffer::rasterizeTiles()
+{
+  // Threads take the next free tile, so occluders bunched up in one part of the screen are spread out
+  uint32_t tileCount = m_tiles.x * m_tiles.y;
+  for (uint32_t tile = m_nextTile++; tile < tileCount; tile = m_nextTile++)
+  {
+    rasterizeTile(tile);
+  }
+}
+
+void kit::OcclusionBuffer::rasterizeTile(uint32_t tile)
+{
+  int32_t tileX = int32_t(tile % m_tiles.x) * TileSize;
+  int32_t tileY = int32_t(tile / m_tiles.x) * TileSize;
+
+  for (auto currIndex : m_bins[tile])
+  {
+    Triangle const & t = m_triangles[currIndex];
+
+    int32_t minX = (glm::max)(tileX, int32_t(std::floor((glm::min)((glm::min)(t.v0.x, t.v1.x), t.v2.x))));
+    int32_t minY = (glm::max)(tileY, int32_t(std::floor((glm::min)((glm::min)(t.v0.y, t.v1.y), t.v2.y))));
+    int32_t maxX = (glm::min)(tileX + int32_t(TileSize) - 1, int32_t(std::ceil((glm::max)((glm::max)(t.v0.x, t.v1.x), t.v2.x))));
+    int32_t maxY = (glm::min)(tileY + int32_t(TileSize) - 1, int32_t(std::ceil((glm::max)((glm::max)(t.v0.y, t.v1.y), t.v2.y))));
+
+    // Edge functions, positive inside, and their steps along x and y
+    glm::vec3 stepX(t.v1.y - t.v2.y, t.v2.y - t.v0.y, t.v0.y - t.v1.y);
+    glm::vec3 stepY(t.v2.x - t.v1.x, t.v0.x - t.v2.x, t.v1.x - t.v0.x);
+    float area = (t.v1.x - t.v0.x) * (t.v2.y - t.v0.y) - (t.v1.y - t.v0.y) * (t.v2.x - t.v0.x);
+
+    // Depth is affine in screen space
+    glm::vec3 depths(t.v0.z, t.v1.z, t.v2.z);
+    float depthStepX = glm::dot(stepX, depths) / area;
+
+#ifdef KIT_OCCLUSION_SSE2
+    // Start on a multiple of 4 texels. Tiles are too, so the last group never leaves the tile, and the texels outside
+    // the bounds fail the edge tests anyway
+    minX &= ~3;
+#endif
+
+    glm::vec2 start(float(minX) + 0.5f, float(minY) + 0.5f);
+    glm::vec3 rowEdges(
+      (t.v2.x - t.v1.x) * (start.y - t.v1.y) - (t.v2.y - t.v1.y) * (start.x - t.v1.x),
+      (t.v0.x - t.v2.x) * (start.y - t.v2.y) - (t.v0.y - t.v2.y) * (start.x - t.v2.x),
+      (t.v1.x - t.v0.x) * (start.y - t.v0.y) - (t.v1.y - t.v0.y) * (start.x - t.v0.x));
+
+#ifdef KIT_OCCLUSION_SSE2
+    __m128 const lanes = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+    __m128 const zero = _mm_setzero_ps();
+    __m128 const laneEdges0 = _mm_mul_ps(_mm_set1_ps(stepX.x), lanes);
+    __m128 const laneEdges1 = _mm_mul_ps(_mm_set1_ps(stepX.y), lanes);
+    __m128 const laneEdges2 = _mm_mul_ps(_mm_set1_ps(stepX.z), lanes);
+    __m128 const laneDepths = _mm_mul_ps(_mm_set1_ps(depthStepX), lanes);
+    __m128 const groupEdges0 = _mm_set1_ps(stepX.x * 4.0f);
+    __m128 const groupEdges1 = _mm_set1_ps(stepX.y * 4.0f);
+    __m128 const groupEdges2 = _mm_set1_ps(stepX.z * 4.0f);
+    __m128 const groupDepth = _mm_set1_ps(depthStepX * 4.0f);
+
+    for (int32_t y = minY; y <= maxY; y++)
+    {
+      __m128 edges0 = _mm_add_ps(_mm_set1_ps(rowEdges.x), laneEdges0);
+      __m128 edges1 = _mm_add_ps(_mm_set1_ps(rowEdges.y), laneEdges1);
+      __m128 edges2 = _mm_add_ps(_mm_set1_ps(rowEdges.z), laneEdges2);
+      __m128 depth = _mm_add_ps(_mm_set1_ps(glm::dot(rowEdges, depths) / area), laneDepths);
+      float * row = &m_depth[y * m_resolution.x];
+
+      for (int32_t x = minX; x <= maxX; x += 4)
+      {
+        __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(edges0, zero), _mm_cmpge_ps(edges1, zero)), _mm_cmpge_ps(edges2, zero));
+        if (_mm_movemask_ps(inside) != 0)
+        {
+          __m128 current = _mm_loadu_ps(row + x);
+          __m128 nearest = _mm_min_ps(current, depth);
+          _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+        }
+        edges0 = _mm_add_ps(edges0, groupEdges0);
+        edges1 = _mm_add_ps(edges1, groupEdges1);
+        edges2 = _mm_add_ps(edges2, groupEdges2);
+        depth = _mm_add_ps(depth, groupDepth);
+      }
+
+      rowEdges += stepY;
+    }
+#else
+    for (int32_t y = minY; y <= maxY; y++)
+    {
+      glm::vec3 edges = rowEdges;
+      float depth = glm::dot(edges, depths) / area;
+      float * row = &m_depth[y * m_resolution.x];
+
+      for (int32_t x = minX; x <= maxX; x++)
+      {
+        if (edges.x >= 0.0f && edges.y >= 0.0f && edges.z >= 0.0f)
+        {
+          row[x] = (glm::min)(row[x], depth);
+        }
+        edges += stepX;
+        depth += depthStepX;
+      }
+
+      rowEdges += stepY;
+    }
+#endif
+  }
+}
+
+bool kit::OcclusionBuffer::isVisible(kit::AABB const & box) const
+{
+  if (!box.isValid())
+  {
+    return true;
+  }
+
+  glm::vec2 screenMin(std::numeric_limits<float>::max());
+  glm::vec2 screenMax(-std::numeric_limits<float>::max());
+  float nearestDepth = 1.0f;
+
+  for (uint32_t i = 0; i < 8; i++)
+  {
+    glm::vec3 corner((i & 1) ? box.m_max.x : box.m_min.x, (i & 2) ? box.m_max.y : box.m_min.y, (i & 4) ? box.m_max.z : box.m_min.z);
+    glm::vec4 clip = m_viewProjectionMatrix * glm::vec4(corner, 1.0f);
+    if (clip.z + clip.w < 0.0f)
+    {
+      return true;
+    }
+
+    glm::vec3 screen = toScreen(clip);
+    screenMin = glm::min(screenMin, glm::vec2(screen));
+    screenMax = glm::max(screenMax, glm::vec2(screen));
+    nearestDepth = (glm::min)(nearestDepth, screen.z);
+  }
+
+  // Every texel whose center the rectangle might cover
+  glm::ivec2 first = glm::max(glm::ivec2(glm::floor(screenMin)), glm::ivec2(0));
+  glm::ivec2 last = glm::min(glm::ivec2(glm::ceil(screenMax)), glm::ivec2(m_resolution) - glm::ivec2(1));
+  if (first.x > last.x || first.y > last.y)
+  {
+    return true;
+  }
+
+  for (int32_t y = first.y; y <= last.y; y++)
+  {
+    float const * row = &m_depth[y * m_resolution.x];
+    for (int32_t x = first.x; x <= last.x; x++)
+    {
+      if (row[x] >= nearestDepth)
+      {
+        return true;
+      }
+    }
+  }
+
+  return false;
+}
+
+float kit::OcclusionBuffer::getDepth(uint32_t x, uint32_t y) const
+{
+  return m_depth[y * m_resolution.x + x];
+}
+
+glm::uvec2 kit::OcclusionBuffer::getResolution() const
+{
+  return m_resolution;
+}
+
+uint32_t kit::OcclusionBuffer::getTriangleCount() const
+{
+  return (uint32_t)m_triangles.size();
+}
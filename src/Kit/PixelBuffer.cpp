@@ -1,5 +1,6 @@
 #include "Kit/PixelBuffer.hpp"
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 
 kit::PixelBuffer::AttachmentInfo::AttachmentInfo(kit::Texture * t, bool o)
 {
@@ -275,17 +276,22 @@ void kit::PixelBuffer::setDrawBuffers(std::vector< uint32_t > drawBuffers)
 }
 
 
-void kit::PixelBuffer::clear(std::vector<glm::vec4> colours, float depth)
+void kit::PixelBuffer::clear(std::vector<glm::vec4> const & colours, float depth)
+{
+  clearDepth(depth);
+  clearColors(colours.data(), colours.size());
+}
+
+void kit::PixelBuffer::clear(std::initializer_list<glm::vec4> colours, float depth)
+{
+  clearDepth(depth);
+  clearColors(colours.begin(), colours.size());
+}
+
+void kit::PixelBuffer::clearColors(glm::vec4 const * colours, size_t count)
 {
-  glDepthMask(GL_TRUE);
   bind();
-  
-  if(m_depthAttachment == nullptr)
-  {
-    KIT_THROW("Cant clear depth attachment as it does not exist, use the other clear method");
-  }
-  
-  if(colours.size() != m_colorAttachments.size())
+  if(count != m_colorAttachments.size())
   {
     KIT_THROW("Wrong number of colors passed, one color per attachment is required.");
   }
@@ -295,8 +301,6 @@ void kit::PixelBuffer::clear(std::vector<glm::vec4> colours, float depth)
     float currColor[4] = {colours[i].x, colours[i].y, colours[i].z, colours[i].w};
     glClearBufferfv(GL_COLOR, i, &currColor[0]);
   }
-
-  glClearBufferfv(GL_DEPTH, 0, &depth);
 }
 
 void kit::PixelBuffer::clearAttachment(uint32_t attachment, glm::vec4 clearcolor)
@@ -335,24 +339,19 @@ void kit::PixelBuffer::clearAttachment(uint32_t attachment, glm::ivec4 clearcolo
   glClearBufferiv(GL_COLOR, attachment, &color[0]);
 }
 
-void kit::PixelBuffer::clear(std::vector< glm::vec4 > colours)
+void kit::PixelBuffer::clear(std::vector< glm::vec4 > const & colours)
 { 
-  bind();
-  if(colours.size() != m_colorAttachments.size())
-  {
-    KIT_THROW("Wrong number of colors passed, one color per attachment is required.");
-  }
+  clearColors(colours.data(), colours.size());
+}
 
-  for(uint32_t i = 0; i < m_colorAttachments.size(); i++)
-  {
-    float currColor[4] = {colours[i].x, colours[i].y, colours[i].z, colours[i].w};
-    glClearBufferfv(GL_COLOR, i, &currColor[i]);
-  }
+void kit::PixelBuffer::clear(std::initializer_list<glm::vec4> colours)
+{ 
+  clearColors(colours.begin(), colours.size());
 }
 
 void kit::PixelBuffer::clearDepth(float d)
 {
-  glDepthMask(GL_TRUE);
+  kit::GLState::setDepthWrite(true);
   bind();
   if(m_depthAttachment == nullptr)
   {
@@ -475,7 +474,9 @@ void kit::PixelBuffer::blitFrom(kit::PixelBuffer * source, bool colorMask, std::
     clearColorMask = true;
   }
 
-  glBlitNamedFramebuffer(source->getHandle(), getHandle(), 0, 0, source->getResolution().x, source->getResolution().y, 0, 0, getResolution().x, getResolution().y, mask, GL_LINEAR);
+  // Depth and stencil can only be blitted with nearest filtering
+  GLenum filter = (depthMask || stencilMask) ? GL_NEAREST : GL_LINEAR;
+  glBlitNamedFramebuffer(source->getHandle(), getHandle(), 0, 0, source->getResolution().x, source->getResolution().y, 0, 0, getResolution().x, getResolution().y, mask, filter);
 
   if (clearColorMask)
   {
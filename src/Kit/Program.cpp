@@ -5,8 +5,11 @@
 #include "Kit/Texture.hpp"
 #include "Kit/Cubemap.hpp"
 #include "Kit/Shader.hpp"
+#include "Kit/GLState.hpp"
 
 #include <sstream>
+#include <iostream>
+#include <cstring>
 #include <glm/gtc/type_ptr.hpp>
 
 std::map <kit::Shader::Type, std::string> typeToShort { 
@@ -18,6 +21,18 @@ std::map <kit::Shader::Type, std::string> typeToShort {
   { kit::Shader::Type::Compute, "x:" }
 };
 
+const uint32_t kit::Program::InvalidUniform;
+uint32_t kit::Program::m_linkBudget = 1;
+
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace
+{
+  typedef void (*MaxShaderCompilerThreadsProc)(GLuint count);
+}
+
 
 kit::Program::Program()
 {
@@ -28,6 +43,16 @@ kit::Program::Program()
 
 kit::Program::~Program()
 {
+  for(auto & currShader : m_pendingShaders)
+  {
+    if(!m_linkDeferred)
+    {
+      detachShader(currShader);
+    }
+    delete currShader;
+  }
+
+  kit::GLState::forgetProgram(this->m_glHandle);
   glDeleteProgram(this->m_glHandle);
   glGetError();
 }
@@ -148,9 +173,141 @@ bool kit::Program::link()
   // Attempt to link the program
   glLinkProgram(this->m_glHandle);  
 
+  return checkLinkStatus();
+}
+
+void kit::Program::linkAsync(std::vector<kit::Shader*> const & shaders)
+{
+  m_pendingShaders.insert(m_pendingShaders.end(), shaders.begin(), shaders.end());
+
+  // Without compiler threads the driver compiles and links right away, so leave that to isReady() and its per-frame budget
+  if(!hasParallelCompile())
+  {
+    m_linkDeferred = true;
+    return;
+  }
+
+  for(auto & currShader : shaders)
+  {
+    currShader->compileAsync();
+    attachShader(currShader);
+  }
+
+  // Asking for the results is what blocks, so the status checks wait for isReady()
+  glLinkProgram(this->m_glHandle);
+}
+
+bool kit::Program::isReady(bool wait)
+{
+  if(m_pendingShaders.empty())
+  {
+    return true;
+  }
+
+  if(!wait)
+  {
+    if(hasParallelCompile())
+    {
+      GLint completed = GL_FALSE;
+      glGetProgramiv(this->m_glHandle, GL_COMPLETION_STATUS_KHR, &completed);
+      if(!completed)
+      {
+        return false;
+      }
+    }
+    else if(m_linkBudget == 0)
+    {
+      return false;
+    }
+    else
+    {
+      m_linkBudget--;
+    }
+  }
+
+  if(m_linkDeferred)
+  {
+    for(auto & currShader : m_pendingShaders)
+    {
+      currShader->compileAsync();
+      attachShader(currShader);
+    }
+    glLinkProgram(this->m_glHandle);
+    m_linkDeferred = false;
+  }
+
+  for(auto & currShader : m_pendingShaders)
+  {
+    currShader->checkCompileStatus();
+  }
+
+  checkLinkStatus();
+
+  for(auto & currShader : m_pendingShaders)
+  {
+    detachShader(currShader);
+    delete currShader;
+  }
+  m_pendingShaders.clear();
+
+  return true;
+}
+
+bool kit::Program::isLinked()
+{
+  return m_pendingShaders.empty() && m_linked;
+}
+
+bool kit::Program::hasParallelCompile()
+{
+  static bool checked = false;
+  static bool supported = false;
+
+  if(checked)
+  {
+    return supported;
+  }
+  checked = true;
+
+  GLint extensionCount = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &extensionCount);
+  for (GLint i = 0; i < extensionCount; i++)
+  {
+    const char * currExtension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+    MaxShaderCompilerThreadsProc maxThreads = nullptr;
+    if (currExtension && std::strcmp(currExtension, "GL_KHR_parallel_shader_compile") == 0)
+    {
+      maxThreads = (MaxShaderCompilerThreadsProc)gl3wGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    }
+    else if (currExtension && std::strcmp(currExtension, "GL_ARB_parallel_shader_compile") == 0)
+    {
+      maxThreads = (MaxShaderCompilerThreadsProc)gl3wGetProcAddress("glMaxShaderCompilerThreadsARB");
+    }
+
+    if (maxThreads && !supported)
+    {
+      // Let the driver pick the number of threads
+      maxThreads(0xFFFFFFFF);
+      supported = true;
+    }
+  }
+
+  std::cout << "Parallel shader compilation " << (supported ? "enabled" : "not supported, finishing one program per frame") << std::endl;
+
+  return supported;
+}
+
+void kit::Program::resetLinkBudget()
+{
+  m_linkBudget = 1;
+}
+
+bool kit::Program::checkLinkStatus()
+{
   // Retrieve the link status
   int32_t status;
   glGetProgramiv(this->m_glHandle, GL_LINK_STATUS, &status);
+  m_linked = (status != 0);
 
   if(!status)
   {
@@ -177,13 +334,14 @@ bool kit::Program::link()
 
 void kit::Program::use()
 {
-  glUseProgram(this->m_glHandle);
+  isReady(true);
+  kit::GLState::useProgram(this->m_glHandle);
   this->prepareTextures();
 }
 
 void kit::Program::useFixed()
 {
-  glUseProgram(0);
+  kit::GLState::useProgram(0);
 }
 
 uint32_t kit::Program::getHandle()
@@ -193,239 +351,413 @@ uint32_t kit::Program::getHandle()
 
 void kit::Program::setUniformTexture(const std::string & name, kit::Texture * texture)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  setUniformTexture(name.c_str(), texture);
+}
 
-  if(loc != (uint32_t) - 1)
-  {
-    auto it = this->m_textures.find(loc);
+void kit::Program::setUniformTexture(const char * name, kit::Texture * texture)
+{
+  setUniformTexture(getUniformHandle(name), texture);
+}
 
-    if(it != this->m_textures.end())
-    {
-      it->second = texture;
-    }
-    else
-    {
-      static const int32_t max = this->getMaxTextureUnits();
+void kit::Program::setUniformCubemap(const std::string & name, kit::Cubemap * cubemap)
+{
+  setUniformCubemap(name.c_str(), cubemap);
+}
 
-      if(this->m_textures.size() + this->m_cubemaps.size() > (uint32_t)max)
-      {
-        KIT_ERR("Could not set uniform, max texture units reached.");
-        return;
-      }
+void kit::Program::setUniformCubemap(const char * name, kit::Cubemap * cubemap)
+{
+  setUniformCubemap(getUniformHandle(name), cubemap);
+}
 
-      this->m_textures[loc] = texture;
-    }
-  }
+void kit::Program::setUniformMat3(const std::string & name, const glm::mat3 & matrix)
+{
+  setUniformMat3(name.c_str(), matrix);
 }
 
-void kit::Program::setUniformCubemap(const std::string & name, kit::Cubemap * texture )
+void kit::Program::setUniformMat3(const char * name, const glm::mat3 & matrix)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  setUniformMat3(getUniformHandle(name), matrix);
+}
 
-  if(loc != (uint32_t) - 1)
-  {
-    auto it = this->m_cubemaps.find(loc);
+void kit::Program::setUniformMat4(const std::string & name, const glm::mat4 & matrix)
+{
+  setUniformMat4(name.c_str(), matrix);
+}
 
-    if(it != this->m_cubemaps.end())
-    {
-      it->second = texture;
-    }
-    else
-    {
-      static const int32_t max = this->getMaxTextureUnits();
+void kit::Program::setUniformMat4(const char * name, const glm::mat4 & matrix)
+{
+  setUniformMat4(getUniformHandle(name), matrix);
+}
 
-      if(this->m_textures.size() + this->m_cubemaps.size() > (uint32_t)max)
-      {
-        KIT_ERR("Could not set uniform, max texture units reached.");
-        return;
-      }
+void kit::Program::setUniformMat4v(const std::string & name, const std::vector<glm::mat4> & matrices)
+{
+  setUniformMat4v(name.c_str(), matrices);
+}
 
-      this->m_cubemaps[loc] = texture;
-    }
-  }
+void kit::Program::setUniformMat4v(const char * name, const std::vector<glm::mat4> & matrices)
+{
+  setUniformMat4v(getUniformHandle(name), matrices);
 }
 
-void kit::Program::setUniformMat3(const std::string & name, const glm::mat3 & matrix)
+void kit::Program::setUniform3f(const std::string & name, const glm::vec3 & vec)
+{
+  setUniform3f(name.c_str(), vec);
+}
+
+void kit::Program::setUniform3f(const char * name, const glm::vec3 & vec)
+{
+  setUniform3f(getUniformHandle(name), vec);
+}
+
+void kit::Program::setUniform3fv(const std::string & name, const std::vector<glm::vec3> & v)
+{
+  setUniform3fv(name.c_str(), v);
+}
+
+void kit::Program::setUniform3fv(const char * name, const std::vector<glm::vec3> & v)
+{
+  setUniform3fv(getUniformHandle(name), v);
+}
+
+void kit::Program::setUniform1f(const std::string & name, float val)
+{
+  setUniform1f(name.c_str(), val);
+}
+
+void kit::Program::setUniform1f(const char * name, float val)
+{
+  setUniform1f(getUniformHandle(name), val);
+}
+
+void kit::Program::setUniform1d(const std::string & name, double val)
+{
+  setUniform1d(name.c_str(), val);
+}
+
+void kit::Program::setUniform1d(const char * name, double val)
+{
+  setUniform1f(getUniformHandle(name), float(val));
+}
+
+void kit::Program::setUniform1i(const std::string & name, int i)
+{
+  setUniform1i(name.c_str(), i);
+}
+
+void kit::Program::setUniform1i(const char * name, int i)
+{
+  setUniform1i(getUniformHandle(name), i);
+}
+
+void kit::Program::setUniform1ui(const std::string & name, uint32_t i)
+{
+  setUniform1ui(name.c_str(), i);
+}
+
+void kit::Program::setUniform1ui(const char * name, uint32_t i)
+{
+  setUniform1ui(getUniformHandle(name), i);
+}
+
+void kit::Program::setUniform4f(const std::string & name, const glm::vec4 & vec)
+{
+  setUniform4f(name.c_str(), vec);
+}
+
+void kit::Program::setUniform4f(const char * name, const glm::vec4 & vec)
+{
+  setUniform4f(getUniformHandle(name), vec);
+}
+
+void kit::Program::setUniform4fv(const std::string & name, const std::vector<glm::vec4> & v)
+{
+  setUniform4fv(name.c_str(), v);
+}
+
+void kit::Program::setUniform4fv(const char * name, const std::vector<glm::vec4> & v)
+{
+  setUniform4fv(getUniformHandle(name), v);
+}
+
+void kit::Program::setUniform4fv(const std::string & name, const glm::vec4 * values, size_t count)
+{
+  setUniform4fv(name.c_str(), values, count);
+}
+
+void kit::Program::setUniform4fv(const char * name, const glm::vec4 * values, size_t count)
+{
+  setUniform4fv(getUniformHandle(name), values, count);
+}
+
+void kit::Program::setUniform2f(const std::string & name, const glm::vec2 & vec)
+{
+  setUniform2f(name.c_str(), vec);
+}
+
+void kit::Program::setUniform2f(const char * name, const glm::vec2 & vec)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  setUniform2f(getUniformHandle(name), vec);
+}
 
-  if (loc != (uint32_t)-1)
+kit::Program::Uniform * kit::Program::updateShadow(uint32_t handle, const void * value, size_t size)
+{
+  if(handle >= this->m_uniforms.size())
   {
-    glUniformMatrix3fv(loc, 1, GL_FALSE, &matrix[0][0]);
+    return nullptr;
   }
+
+  Uniform & uniform = this->m_uniforms[handle];
+  if(uniform.shadow.size() == size && std::memcmp(uniform.shadow.data(), value, size) == 0)
+  {
+    return nullptr;
+  }
+
+  uniform.shadow.assign((const uint8_t*)value, (const uint8_t*)value + size);
+  return &uniform;
 }
 
-void kit::Program::setUniformMat4(const std::string & name, const glm::mat4 & matrix)
+bool kit::Program::assignUnit(Uniform & uniform)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  if(uniform.unit != -1)
+  {
+    return true;
+  }
+
+  static const int32_t max = this->getMaxTextureUnits();
 
-  if(loc != (uint32_t) - 1)
+  // Unit 0 is left to code that binds textures to edit them
+  int32_t unit = (int32_t)this->m_samplers.size() + 1;
+  if(unit >= max)
   {
-    glUniformMatrix4fv(loc, 1, GL_FALSE, &matrix[0][0]);
+    KIT_ERR("Could not set uniform, max texture units reached.");
+    return false;
   }
+
+  uniform.unit = unit;
+  this->m_samplers.push_back(uint32_t(&uniform - this->m_uniforms.data()));
+  glProgramUniform1i(this->m_glHandle, uniform.location, unit);
+  return true;
 }
 
-void kit::Program::setUniformMat4v(const std::string & name, const std::vector<glm::mat4> & matrices)
+void kit::Program::setUniformTexture(uint32_t handle, kit::Texture * texture)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
-
-  if(loc != (uint32_t) - 1)
+  if(handle >= this->m_uniforms.size() || !assignUnit(this->m_uniforms[handle]))
   {
-    glUniformMatrix4fv(loc, (uint32_t)matrices.size(), GL_FALSE, glm::value_ptr(matrices[0]));
+    return;
   }
+
+  Uniform & uniform = this->m_uniforms[handle];
+  uniform.target = texture ? texture->getType() : GL_TEXTURE_2D;
+  uniform.texture = texture ? texture->getHandle() : 0;
 }
 
-void kit::Program::setUniform3f(const std::string & name, const glm::vec3 & vec)
+void kit::Program::setUniformCubemap(uint32_t handle, kit::Cubemap * cubemap)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  if(handle >= this->m_uniforms.size() || !assignUnit(this->m_uniforms[handle]))
+  {
+    return;
+  }
+
+  Uniform & uniform = this->m_uniforms[handle];
+  uniform.target = GL_TEXTURE_CUBE_MAP;
+  uniform.texture = cubemap ? cubemap->getHandle() : 0;
+}
 
-  if(loc != (uint32_t) - 1)
+void kit::Program::setUniform1f(uint32_t handle, float value)
+{
+  Uniform * uniform = updateShadow(handle, &value, sizeof(value));
+  if(uniform)
   {
-    glUniform3fv(loc, 1, &vec[0]);
+    glProgramUniform1f(this->m_glHandle, uniform->location, value);
   }
 }
 
-void kit::Program::setUniform3fv(const std::string & name, const std::vector<glm::vec3> & v)
+void kit::Program::setUniform1i(uint32_t handle, int32_t value)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  Uniform * uniform = updateShadow(handle, &value, sizeof(value));
+  if(uniform)
+  {
+    glProgramUniform1i(this->m_glHandle, uniform->location, value);
+  }
+}
 
-  if (loc != (uint32_t) - 1)
+void kit::Program::setUniform1ui(uint32_t handle, uint32_t value)
+{
+  Uniform * uniform = updateShadow(handle, &value, sizeof(value));
+  if(uniform)
   {
-    glUniform3fv(loc, (uint32_t)v.size(), &v[0][0]);
+    glProgramUniform1ui(this->m_glHandle, uniform->location, value);
   }
 }
 
-void kit::Program::setUniform1f(const std::string & name, float val)
+void kit::Program::setUniform2f(uint32_t handle, const glm::vec2 & value)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  Uniform * uniform = updateShadow(handle, &value[0], sizeof(value));
+  if(uniform)
+  {
+    glProgramUniform2fv(this->m_glHandle, uniform->location, 1, &value[0]);
+  }
+}
 
-  if(loc != (uint32_t) - 1)
+void kit::Program::setUniform3f(uint32_t handle, const glm::vec3 & value)
+{
+  Uniform * uniform = updateShadow(handle, &value[0], sizeof(value));
+  if(uniform)
   {
-    glUniform1f(loc, val);
+    glProgramUniform3fv(this->m_glHandle, uniform->location, 1, &value[0]);
   }
 }
 
-void kit::Program::setUniform1d(const std::string & name, double val)
+void kit::Program::setUniform3fv(uint32_t handle, const std::vector<glm::vec3> & value)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  if(value.empty())
+  {
+    return;
+  }
 
-  if(loc != (uint32_t) - 1)
+  Uniform * uniform = updateShadow(handle, &value[0][0], value.size() * sizeof(glm::vec3));
+  if(uniform)
   {
-    glUniform1f(loc, float(val));
+    glProgramUniform3fv(this->m_glHandle, uniform->location, (int32_t)value.size(), &value[0][0]);
   }
 }
 
-void kit::Program::setUniform1i(const std::string & name, int i)
+void kit::Program::setUniform4f(uint32_t handle, const glm::vec4 & value)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  Uniform * uniform = updateShadow(handle, &value[0], sizeof(value));
+  if(uniform)
+  {
+    glProgramUniform4fv(this->m_glHandle, uniform->location, 1, &value[0]);
+  }
+}
 
-  if(loc != (uint32_t) - 1)
+void kit::Program::setUniform4fv(uint32_t handle, const std::vector<glm::vec4> & value)
+{
+  if(value.empty())
   {
-    glUniform1i(loc, i);
+    return;
   }
+
+  setUniform4fv(handle, &value[0], value.size());
 }
 
-void kit::Program::setUniform1ui(const std::string & name, uint32_t i)
+void kit::Program::setUniform4fv(uint32_t handle, const glm::vec4 * values, size_t count)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  if(count == 0)
+  {
+    return;
+  }
 
-  if (loc != (uint32_t) - 1)
+  Uniform * uniform = updateShadow(handle, &values[0][0], count * sizeof(glm::vec4));
+  if(uniform)
   {
-    glUniform1ui(loc, i);
+    glProgramUniform4fv(this->m_glHandle, uniform->location, (int32_t)count, &values[0][0]);
   }
 }
 
-void kit::Program::setUniform4f(const std::string & name, const glm::vec4 & vec)
+void kit::Program::setUniformMat3(uint32_t handle, const glm::mat3 & value)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  Uniform * uniform = updateShadow(handle, &value[0][0], sizeof(value));
+  if(uniform)
+  {
+    glProgramUniformMatrix3fv(this->m_glHandle, uniform->location, 1, GL_FALSE, &value[0][0]);
+  }
+}
 
-  if(loc != (uint32_t) - 1)
+void kit::Program::setUniformMat4(uint32_t handle, const glm::mat4 & value)
+{
+  Uniform * uniform = updateShadow(handle, &value[0][0], sizeof(value));
+  if(uniform)
   {
-    glUniform4fv(loc, 1, &vec[0]);
+    glProgramUniformMatrix4fv(this->m_glHandle, uniform->location, 1, GL_FALSE, &value[0][0]);
   }
 }
 
-void kit::Program::setUniform2f(const std::string & name, const glm::vec2 & vec)
+void kit::Program::setUniformMat4v(uint32_t handle, const std::vector<glm::mat4> & value)
 {
-  glUseProgram(this->m_glHandle);
-  uint32_t loc = this->getUniformLocation(name);
+  if(value.empty())
+  {
+    return;
+  }
 
-  if(loc != (uint32_t) - 1)
+  Uniform * uniform = updateShadow(handle, glm::value_ptr(value[0]), value.size() * sizeof(glm::mat4));
+  if(uniform)
   {
-    glm::vec2 v(vec.x, vec.y);
-    glUniform2fv(loc, 1, &v[0]);
+    glProgramUniformMatrix4fv(this->m_glHandle, uniform->location, (int32_t)value.size(), GL_FALSE, glm::value_ptr(value[0]));
   }
 }
 
-uint32_t kit::Program::getUniformLocation(const std::string & name)
+bool kit::Program::setUniformBlock(const std::string & name, uint32_t binding)
 {
-  auto it = this->m_locationCache.find(name.c_str());
+  isReady(true);
+  uint32_t index = glGetUniformBlockIndex(this->m_glHandle, name.c_str());
+  if(index == GL_INVALID_INDEX)
+  {
+    return false;
+  }
+
+  glUniformBlockBinding(this->m_glHandle, index, binding);
+  return true;
+}
 
-  if(it != this->m_locationCache.end())
+uint32_t kit::Program::getUniformHandle(const std::string & name)
+{
+  return getUniformHandle(name.c_str());
+}
+
+uint32_t kit::Program::getUniformHandle(const char * name)
+{
+  // The map compares against the pointer directly, so looking up a known uniform builds no string
+  auto it = this->m_handles.find(name);
+
+  if(it != this->m_handles.end())
   {
     return it->second;
   }
-  else
-  {
-    glUseProgram(this->m_glHandle);
-    int loc = glGetUniformLocation(this->m_glHandle, name.c_str());
 
-    if(loc == -1)
-    {
-      std::stringstream e;
-      e << "No such uniform \"" << name.c_str() << "\" in shader (file identifer string: (\"" << this->m_fileIdentifier << "\")";
-      KIT_ERR(e.str());
-      return -1;
-    }
+  // Locations only exist once linked, and a missing one would be remembered for good
+  isReady(true);
 
-    this->m_locationCache.insert(std::make_pair(name, loc));
-    return loc;
+  int loc = glGetUniformLocation(this->m_glHandle, name);
+
+  if(loc == -1)
+  {
+    // Remembered as well, so the error is only printed once
+    std::stringstream e;
+    e << "No such uniform \"" << name << "\" in shader (file identifer string: (\"" << this->m_fileIdentifier << "\")";
+    KIT_ERR(e.str());
+    this->m_handles.insert(std::make_pair(std::string(name), InvalidUniform));
+    return InvalidUniform;
   }
+
+  Uniform newUniform;
+  newUniform.location = loc;
+  this->m_uniforms.push_back(newUniform);
+
+  uint32_t handle = (uint32_t)this->m_uniforms.size() - 1;
+  this->m_handles.insert(std::make_pair(std::string(name), handle));
+  return handle;
 }
 
- void kit::Program::prepareTextures()
+uint32_t kit::Program::getUniformLocation(const std::string & name)
 {
-  uint32_t i = 1;
-
-  for(auto & it : this->m_textures)
+  uint32_t handle = getUniformHandle(name);
+  if(handle == InvalidUniform)
   {
-    if(it.second)
-    {
-      glUniform1i(it.first, i);
-#ifndef KIT_SHITTY_INTEL
-      glBindTextureUnit(i, it.second->getHandle());
-#else
-      glActiveTexture(GL_TEXTURE0 + i);
-      it.second->bind();
-#endif 
-      i++;
-    }
+    return -1;
   }
-  
-  for(auto & it : this->m_cubemaps)
+
+  return this->m_uniforms[handle].location;
+}
+
+ void kit::Program::prepareTextures()
+{
+  for(auto handle : this->m_samplers)
   {
-    if(it.second)
+    Uniform & uniform = this->m_uniforms[handle];
+    if(uniform.texture)
     {
-      glUniform1i(it.first, i);
-#ifndef KIT_SHITTY_INTEL
-      glBindTextureUnit(i, it.second->getHandle());
-#else 
-      glActiveTexture(GL_TEXTURE0 + i);
-      it.second->bind();
-#endif
-      i++;
+      kit::GLState::bindTexture(uniform.unit, uniform.target, uniform.texture);
     }
   }
 }
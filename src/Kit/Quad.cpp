@@ -1,6 +1,7 @@
 #include "Kit/Quad.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 #include "Kit/Shader.hpp"
 #include "Kit/Program.hpp"
 
@@ -101,8 +102,8 @@ kit::Quad::~Quad()
 
 void kit::Quad::prepareProgram(kit::Program * customprogram)
 {
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_BACK);
+  kit::GLState::setCulling(true);
+  kit::GLState::setCullFace(GL_BACK);
   if(customprogram != nullptr)
   {
     customprogram->setUniform2f("uniform_size", m_size);
@@ -115,15 +116,15 @@ void kit::Quad::prepareProgram(kit::Program * customprogram)
   {
       if (m_blending)
       {
-        glEnable(GL_BLEND);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        kit::GLState::setBlend(true);
+        kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
       }
       else
       {
-        glDisable(GL_BLEND);
+        kit::GLState::setBlend(false);
       }
-      glDisable(GL_DEPTH_TEST);
-      glDepthMask(GL_FALSE);
+      kit::GLState::setDepthTest(false);
+      kit::GLState::setDepthWrite(false);
 
       kit::Quad::m_program->setUniform4f("uniform_color", kit::srgbDec(m_color));
       kit::Quad::m_program->setUniform2f("uniform_size", m_size);
@@ -134,15 +135,15 @@ void kit::Quad::prepareProgram(kit::Program * customprogram)
   {
     if (m_blending)
     {
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      kit::GLState::setBlend(true);
+      kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     }
     else
     {
-      glDisable(GL_BLEND);
+      kit::GLState::setBlend(false);
     }
-    glDisable(GL_DEPTH_TEST);
-    glDepthMask(GL_FALSE);
+    kit::GLState::setDepthTest(false);
+    kit::GLState::setDepthWrite(false);
     kit::Quad::m_programTextured->setUniformTexture("uniform_texture", m_texture);
     kit::Quad::m_programTextured->setUniform2f("uniform_texSubOffset", m_texSubOffset);
     kit::Quad::m_programTextured->setUniform2f("uniform_texSubSize", m_texSubSize);
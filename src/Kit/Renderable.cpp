@@ -14,6 +14,16 @@ void kit::Renderable::renderForward(kit::Renderer * renderer)
 
 void kit::Renderable::renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
 {
+  
+}
+
+bool kit::Renderable::isShadowComplete()
+{
+  return true;
+}
+
+void kit::Renderable::prepareShadows(kit::Camera * camera)
+{
 
 }
 
@@ -37,9 +47,35 @@ void kit::Renderable::setShadowCaster(bool s)
   m_shadowCaster = s;
 }
 
+bool kit::Renderable::isStatic()
+{
+  return m_static;
+}
+
+void kit::Renderable::setStatic(bool s)
+{
+  m_static = s;
+}
+
+bool kit::Renderable::getWorldBounds(kit::AABB & bounds)
+{
+  return false;
+}
+
+bool kit::Renderable::submitBatched(kit::DrawBatcher * batcher)
+{
+  return false;
+}
+
+kit::Occluder * kit::Renderable::getOccluder()
+{
+  return nullptr;
+}
+
 kit::Renderable::Renderable()
 {
   m_shadowCaster = true;
+  m_static = false;
 }
 
 kit::Renderable::~Renderable()
@@ -52,9 +88,10 @@ bool kit::Renderable::isSkinned()
   return false;
 }
 
-std::vector<glm::mat4> kit::Renderable::getSkin()
+std::vector<glm::mat4> const & kit::Renderable::getSkin()
 {
-  return std::vector<glm::mat4>();
+  static const std::vector<glm::mat4> noSkin;
+  return noSkin;
 }
 
 int32_t kit::Renderable::getRenderPriority()
@@ -1,6 +1,7 @@
 #include "Kit/Renderer.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 #include "Kit/Light.hpp"
 #include "Kit/Cubemap.hpp"
 #include "Kit/Texture.hpp"
@@ -11,11 +12,19 @@
 #include "Kit/PixelBuffer.hpp"
 #include "Kit/DoubleBuffer.hpp"
 #include "Kit/Program.hpp"
-#include "Kit/Sphere.hpp"
 #include "Kit/Font.hpp"
 #include "Kit/GLTimer.hpp"
 #include "Kit/Quad.hpp"
 #include "Kit/Cone.hpp"
+#include "Kit/Sphere.hpp"
+#include "Kit/LightGrid.hpp"
+#include "Kit/ShadowAtlas.hpp"
+#include "Kit/DrawBatcher.hpp"
+#include "Kit/OcclusionBuffer.hpp"
+#include "Kit/MaterialCache.hpp"
+#include "Kit/UniformBuffer.hpp"
+#include "Kit/FrameArena.hpp"
+#include "Kit/AllocationCounter.hpp"
 
 #include <algorithm>
 #include <queue>
@@ -25,6 +34,31 @@
 
 uint32_t kit::Renderer::m_instanceCount = 0;
 
+namespace
+{
+  // A renderable with its sort keys, computed once rather than in every comparison
+  struct SortedRenderable
+  {
+    kit::Renderable * renderable;
+    int32_t           priority;
+    float             distance;
+  };
+
+  typedef kit::FrameVector<SortedRenderable> SortedRenderables;
+
+  // Sorts by render priority, then by distance to the camera
+  void sortRenderables(SortedRenderables & renderables, bool backToFront)
+  {
+    std::sort(renderables.begin(), renderables.end(), [backToFront](SortedRenderable const & lhs, SortedRenderable const & rhs)
+    {
+      if (lhs.priority != rhs.priority)
+        return lhs.priority < rhs.priority;
+      else
+        return backToFront ? lhs.distance > rhs.distance : lhs.distance < rhs.distance;
+    });
+  }
+}
+
 std::vector<kit::Light *> & kit::RenderPayload::getLights()
 {
   return m_lights;
@@ -127,11 +161,23 @@ kit::Renderer::Renderer(glm::uvec2 const & resolution)
   m_programDirectionalNS = new kit::Program({"lighting/directional-light.vert"}, {"lighting/cooktorrance.glsl", "normals.glsl", "lighting/directional-light-ns.frag"}, kit::DataSource::Static);
   
   m_programSpot = new kit::Program({"lighting/spot-light.vert"}, {"lighting/attenuation.glsl", "lighting/spotattenuation.glsl", "normals.glsl", "lighting/cooktorrance.glsl", "lighting/spot-light.frag"}, kit::DataSource::Static);
-  m_programSpotNS = new kit::Program({"lighting/spot-light.vert"}, {"lighting/attenuation.glsl", "lighting/spotattenuation.glsl", "normals.glsl", "lighting/cooktorrance.glsl", "lighting/spot-light-ns.frag"}, kit::DataSource::Static);
-  
-  m_programPoint = new kit::Program({"lighting/point-light.vert"}, {"lighting/attenuation.glsl", "lighting/spotattenuation.glsl",  "normals.glsl", "lighting/cooktorrance.glsl", "lighting/point-light.frag"}, kit::DataSource::Static);
-  m_programPointNS = new kit::Program({"lighting/point-light.vert"}, {"lighting/attenuation.glsl", "lighting/spotattenuation.glsl",  "normals.glsl", "lighting/cooktorrance.glsl", "lighting/point-light-ns.frag"}, kit::DataSource::Static);
+  m_programPoint = new kit::Program({"lighting/spot-light.vert"}, {"lighting/attenuation.glsl", "normals.glsl", "lighting/cooktorrance.glsl", "lighting/point-light.frag"}, kit::DataSource::Static);
   m_pointGeometry = new kit::Sphere(32, 24);
+  
+  // Unshadowed point and spot lights are binned into clusters and shaded together in one full-screen pass
+  m_programClustered = new kit::Program({"lighting/directional-light.vert"}, {"lighting/attenuation.glsl", "lighting/spotattenuation.glsl", "normals.glsl", "lighting/cooktorrance.glsl", "lighting/clustered-light.frag"}, kit::DataSource::Static);
+  m_lightGrid = new kit::LightGrid();
+
+  // Camera data is shared by every light program through the frame uniform block
+  m_frameBuffer = new kit::UniformBuffer(sizeof(FrameBlock));
+  for (auto currProgram : { m_programIBL, m_programDirectional, m_programDirectionalNS, m_programSpot, m_programPoint, m_programClustered })
+  {
+    currProgram->setUniformBlock("FrameBlock", kit::UniformBuffer::FrameBinding);
+  }
+  
+  m_drawBatcher = new kit::DrawBatcher();
+  m_frameArena = new kit::FrameArena();
+  m_occlusionBuffer = new kit::OcclusionBuffer();
  
   m_programIBL->setUniformTexture("uniform_brdf", m_integratedBRDF);
   
@@ -197,6 +243,7 @@ kit::Renderer::Renderer(glm::uvec2 const & resolution)
 
   // --- Setup shadows
   m_shadowsEnabled = true;
+  m_shadowAtlas = new kit::ShadowAtlas();
 
   // --- Setup scene fringe
   m_fringeEnabled = false;
@@ -231,10 +278,15 @@ kit::Renderer::~Renderer()
     if(m_programDirectional) delete m_programDirectional;
     if(m_programDirectionalNS) delete m_programDirectionalNS;
     if(m_programSpot) delete m_programSpot;
-    if(m_programSpotNS) delete m_programSpotNS;
     if(m_programPoint) delete m_programPoint;
-    if(m_programPointNS) delete m_programPointNS;
     if(m_pointGeometry) delete m_pointGeometry;
+    if(m_programClustered) delete m_programClustered;
+    if(m_lightGrid) delete m_lightGrid;
+    if(m_frameBuffer) delete m_frameBuffer;
+    if(m_shadowAtlas) delete m_shadowAtlas;
+    if(m_drawBatcher) delete m_drawBatcher;
+    if(m_occlusionBuffer) delete m_occlusionBuffer;
+    if(m_frameArena) delete m_frameArena;
     if(m_bloomBrightProgram) delete m_bloomBrightProgram;
     if(m_bloomBlurProgram) delete m_bloomBlurProgram;
     if(m_bloomBrightBuffer) delete m_bloomBrightBuffer;
@@ -281,13 +333,6 @@ void kit::Renderer::renderLight(kit::Light * currLight)
   glm::mat4 p = c->getProjectionMatrix();
   glm::mat4 mv = v * m;
   glm::mat4 mvp = p * v * m;
-
-  //D
-  glm::vec2 clip = c->getClipRange();
-  float znear = clip.x;
-  float zfar = clip.y;
-  float px = (-zfar * znear ) / ( zfar - znear );//D
-  float py = zfar / ( zfar - znear ) ;//D
   
   if(currLight->getType() == kit::Light::Directional)
   {
@@ -296,7 +341,14 @@ void kit::Renderer::renderLight(kit::Light * currLight)
     {
       currProgram = m_programDirectional;
       currProgram->setUniformTexture("uniform_shadowmap", currLight->getShadowBuffer()->getDepthAttachment());
-      currProgram->setUniformMat4("uniform_lightViewProjMatrix", currLight->getDirectionalProjectionMatrix() * currLight->getDirectionalViewMatrix() * currLight->getDirectionalModelMatrix(c->getWorldPosition(), c->getWorldForward()));
+      
+      m_shadowMatrices.clear();
+      for (auto & cascade : currLight->getCascades())
+      {
+        m_shadowMatrices.push_back(cascade.shadowViewProjection);
+      }
+      currProgram->setUniformMat4v("uniform_cascadeMatrices", m_shadowMatrices);
+      currProgram->setUniform1i("uniform_cascadeCount", (int32_t)m_shadowMatrices.size());
     }
     else
     {
@@ -305,10 +357,6 @@ void kit::Renderer::renderLight(kit::Light * currLight)
     
     currProgram->setUniform3f("uniform_lightColor", currLight->getColor());
     currProgram->setUniform3f("uniform_lightDir", glm::normalize(glm::vec3(v * glm::vec4(currLight->getWorldForward(), 0.0f))));
-
-    currProgram->setUniform2f("uniform_projConst", glm::vec2(px, py));
-    
-    currProgram->setUniformMat4("uniform_invProjMatrix", glm::inverse(p));
     
     currProgram->use(); 
     
@@ -317,17 +365,11 @@ void kit::Renderer::renderLight(kit::Light * currLight)
   }
   else if (currLight->getType() == kit::Light::Spot)
   {
-    kit::Program * currProgram;
-    if(currLight->isShadowMapped() && m_shadowsEnabled)
-    {
-      currProgram = m_programSpot;
-      currProgram->setUniformTexture("uniform_shadowmap", currLight->getShadowBuffer()->getDepthAttachment());
-      currProgram->setUniformMat4("uniform_lightViewProjMatrix", currLight->getSpotProjectionMatrix() * currLight->getSpotViewMatrix());
-    }
-    else
-    {
-      currProgram = m_programSpotNS;
-    }
+    // Only spotlights with a tile in the shadow atlas get here, the rest go through the light grid
+    kit::Program * currProgram = m_programSpot;
+    currProgram->setUniformTexture("uniform_shadowmap", m_shadowAtlas->getBuffer()->getDepthAttachment());
+    currProgram->setUniformMat4("uniform_lightViewProjMatrix", currLight->getShadowCache().viewProjection);
+    currProgram->setUniform4f("uniform_shadowRect", m_shadowAtlas->getTileRect(currLight->getShadowCache().tiles[0]));
     
     currProgram->setUniform3f("uniform_lightColor", currLight->getColor());
     currProgram->setUniform3f("uniform_lightPosition", glm::vec3(v * glm::vec4(currLight->getWorldPosition(), 1.0f)));
@@ -336,44 +378,47 @@ void kit::Renderer::renderLight(kit::Light * currLight)
     currProgram->setUniform2f("uniform_coneAngle", glm::vec2(glm::cos(glm::radians(currLight->getConeAngle().x) * 0.5f), glm::cos(glm::radians(currLight->getConeAngle().y) * 0.5f)));
     currProgram->setUniformMat4("uniform_MVPMatrix", mvp);
     currProgram->setUniformMat4("uniform_MVMatrix", mv);
-    currProgram->setUniform2f("uniform_projConst", glm::vec2(px, py));
     
     currProgram->use();
     
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
+    kit::GLState::setCulling(true);
+    kit::GLState::setCullFace(GL_FRONT);
     currLight->getSpotGeometry()->renderGeometry();
-    glDisable(GL_CULL_FACE);
+    kit::GLState::setCulling(false);
   }
-  else if(currLight->getType() == kit::Light::Point)
+  else if (currLight->getType() == kit::Light::Point)
   {
-    kit::Program * currProgram;
-    //if(currLight->m_shadowMapped)TODO
-    //{
-    //  currProgram = m_programPoint;
-    //  currProgram->setUniformCubemap("uniform_shadowmap", currLight->getShadowBuffer()->getCubemap());
-    //  currProgram->setUniformMat4("uniform_invViewMatrix", glm::inverse(kit::Light::m_cameraCache->getTransformMatrix()));
-    //}
-    //else
-    //{
-      currProgram = m_programPointNS;
-    //}
+    // Only pointlights with tiles in the shadow atlas get here, the rest go through the light grid
+    kit::Light::ShadowCache & cache = currLight->getShadowCache();
+    glm::mat4 projection = currLight->getPointProjectionMatrix();
+    
+    m_shadowMatrices.clear();
+    m_shadowRects.clear();
+    for (uint32_t i = 0; i < cache.tileCount; i++)
+    {
+      m_shadowMatrices.push_back(projection * currLight->getPointViewMatrix(kit::Cubemap::Side(i)));
+      m_shadowRects.push_back(m_shadowAtlas->getTileRect(cache.tiles[i]));
+    }
+    
+    kit::Program * currProgram = m_programPoint;
+    currProgram->setUniformTexture("uniform_shadowmap", m_shadowAtlas->getBuffer()->getDepthAttachment());
+    currProgram->setUniformMat4v("uniform_faceMatrices", m_shadowMatrices);
+    currProgram->setUniform4fv("uniform_faceRects", m_shadowRects);
+    currProgram->setUniform3f("uniform_lightPositionWorld", currLight->getWorldPosition());
     
     currProgram->setUniform3f("uniform_lightColor", currLight->getColor());
-    currProgram->setUniformMat4("uniform_MVPMatrix", mvp);
-    //currProgram->setUniform1f("uniform_lightRadius", currLight->getRadius());
-    currProgram->setUniform3f("uniform_lightPosition", glm::vec3(v * glm::vec4(currLight->getWorldPosition(), 1.0f)));    
+    currProgram->setUniform3f("uniform_lightPosition", glm::vec3(v * glm::vec4(currLight->getWorldPosition(), 1.0f)));
     currProgram->setUniform4f("uniform_lightFalloff", currLight->getAttenuation());
-    
+    currProgram->setUniformMat4("uniform_MVPMatrix", mvp);
     currProgram->setUniformMat4("uniform_MVMatrix", mv);
-    currProgram->setUniform2f("uniform_projConst", glm::vec2(px, py));
-
+    
     currProgram->use();
     
-    glEnable(GL_CULL_FACE);
-    glCullFace(GL_FRONT);
+    // Only shade the pixels inside the light sphere, which is scaled to the light radius
+    kit::GLState::setCulling(true);
+    kit::GLState::setCullFace(GL_FRONT);
     m_pointGeometry->renderGeometry();
-    glDisable(GL_CULL_FACE);
+    kit::GLState::setCulling(false);
   }
   else if(currLight->getType() == kit::Light::IBL)
   {
@@ -382,9 +427,6 @@ void kit::Renderer::renderLight(kit::Light * currLight)
     m_programIBL->setUniformCubemap("uniform_lightIrradiance", currLight->getIrradianceMap());
     m_programIBL->setUniformCubemap("uniform_lightRadiance", currLight->getRadianceMap());
     //m_programIBL->setUniformCubemap("uniform_lightReflection", currLight->getReflectionMap());
-    m_programIBL->setUniform2f("uniform_projConst", glm::vec2(px, py));
-    
-    m_programIBL->setUniformMat4("uniform_invProjMatrix", glm::inverse(p));
     
     m_programIBL->use();
     
@@ -459,6 +501,18 @@ void kit::Renderer::onResize()
 
 void kit::Renderer::renderFrame()
 {
+  m_frameIndex++;
+
+  // Application code may have changed GL state behind the tracker since the last frame
+  kit::GLState::invalidate();
+
+  // Without parallel shader compilation, finish at most one program that is compiling in the background per frame
+  kit::Program::resetLinkBudget();
+
+  // Containers of the last frame are gone by now
+  m_frameArena->reset();
+  kit::AllocationCounter::reset();
+  
   if (m_metricsEnabled)
   {
     renderFrameWithMetrics();
@@ -506,14 +560,6 @@ void kit::Renderer::renderFrameWithoutMetrics()
     m_metricsFPS = (uint32_t)fps;
     m_metricsFPSCalibrated = (uint32_t)fpsCalibrated;
     m_framesCount = 0;
-    
-    std::wstringstream s;
-    s << std::setprecision(3) << std::fixed << std::right;
-    s << L"Timed FPS:     " << std::setw(7) << m_metricsFPS << " fps" << std::endl;
-    s << L"Calibrated FPS:    " << std::setw(7) << m_metricsFPSCalibrated << " fps" << std::endl;
-    
-    m_metrics->setText(s.str());
-    
     m_metricsFPSTimer.restart();
   }
 
@@ -529,6 +575,7 @@ void kit::Renderer::renderFrameWithMetrics()
   }
   
   uint64_t geometryPassTime, shadowPassTime, lightPassTime, forwardPassTime, hdrPassTime, postFxPassTime;
+  kit::GLState::resetCounters();
   
   // render geometry pass
   m_metricsTimer->start();
@@ -561,7 +608,7 @@ void kit::Renderer::renderFrameWithMetrics()
   postFxPassTime = m_metricsTimer->end();
 
   uint64_t totalTime = geometryPassTime + lightPassTime + forwardPassTime + shadowPassTime + hdrPassTime + postFxPassTime;
-  
+
   m_framesCount++;
   double milli = (double)m_metricsFPSTimer.timeSinceStart().asMilliseconds();
   if (milli >= 1000.0)
@@ -588,145 +635,432 @@ void kit::Renderer::renderFrameWithMetrics()
   s << L"--Forward:     " << std::setw(7) << (((double)forwardPassTime  /1000.0)/1000.0) << " ms" << std::endl;
   s << L"--HDR:         " << std::setw(7) << (((double)hdrPassTime      /1000.0)/1000.0) << " ms" << std::endl;
   s << L"--Composition: " << std::setw(7) << (((double)postFxPassTime   /1000.0)/1000.0) << " ms" << std::endl;
+  s << std::endl;
+  s << L"Batched draws: " << std::setw(7) << m_drawBatcher->getDrawCount() << " in " << m_drawBatcher->getCallCount() << " calls" << std::endl;
+  s << L"GL state:      " << std::setw(7) << kit::GLState::getIssuedCount() << " calls, " << kit::GLState::getSkippedCount() << " skipped" << std::endl;
+  s << L"Mat. caches:   " << std::setw(7) << (double(kit::MaterialCache::getTotalMemory()) / (1024.0 * 1024.0)) << " MB in " << kit::MaterialCache::getCacheCount() << " caches" << std::endl;
+  s << L"Frame arena:   " << std::setw(7) << (double(m_frameArena->getUsed()) / 1024.0) << " KB of " << (double(m_frameArena->getCapacity()) / 1024.0) << " KB" << std::endl;
+  if (kit::AllocationCounter::isEnabled())
+  {
+    s << L"Heap allocs:   " << std::setw(7) << m_metricsAllocations << " last frame" << std::endl;
+  }
+  if (m_softwareOcclusionEnabled)
+  {
+    s << L"Occluded:      " << std::setw(7) << m_occludedCount << " by " << m_occlusionBuffer->getTriangleCount() << " triangles" << std::endl;
+  }
   
   m_metrics->setText(s.str());
  
   kit::PixelBuffer::unbind();
   kit::Program::useFixed();
+
+  // Read once the metrics text is built, so its own allocations are counted too
+  m_metricsAllocations = kit::AllocationCounter::getCount();
 }
 
-void kit::Renderer::geometryPass()
+void kit::Renderer::occlusionPass()
 {
-  // Sorts by renderpriority, then front to back to cull as many fragments as possible
-  // Inverted because its pushed to a queue
-  auto sorter = [&](kit::Renderable* & lhs, kit::Renderable* & rhs)
+  m_occludedCount = 0;
+  if (!m_softwareOcclusionEnabled) return;
+
+  m_occlusionBuffer->clear(m_activeCamera->getProjectionMatrix() * m_activeCamera->getViewMatrix());
+  for (auto & currPayload : m_payload)
   {
-    glm::vec3 cwp = glm::vec3(m_activeCamera->getWorldTransformMatrix() * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-    glm::vec3 lwp = glm::vec3(lhs->getWorldTransformMatrix() * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-    glm::vec3 rwp = glm::vec3(rhs->getWorldTransformMatrix() * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f));
-    
-    float ld = glm::distance(cwp, lwp);
-    float rd = glm::distance(cwp, rwp);
-    
-    float lp = lhs->getRenderPriority();
-    float rp = rhs->getRenderPriority();
-    
-    if(lp != rp)
-      return lp > rp;
-    else
-      return ld > rd;
-  };
+    for (auto & currRenderable : currPayload->getRenderables())
+    {
+      kit::Occluder * currOccluder = currRenderable->getOccluder();
+      if (currOccluder)
+      {
+        m_occlusionBuffer->addOccluder(*currOccluder, currRenderable->getWorldTransformMatrix());
+      }
+    }
+  }
+  m_occlusionBuffer->rasterize();
+}
+
+void kit::Renderer::updateFrameBlock()
+{
+  glm::vec2 clip = m_activeCamera->getClipRange();
+  float znear = clip.x;
+  float zfar = clip.y;
+
+  FrameBlock frame;
+  frame.viewMatrix = m_activeCamera->getViewMatrix();
+  frame.projectionMatrix = m_activeCamera->getProjectionMatrix();
+  frame.invViewMatrix = glm::inverse(frame.viewMatrix);
+  frame.invProjectionMatrix = glm::inverse(frame.projectionMatrix);
+  frame.projConst = glm::vec4((-zfar * znear) / (zfar - znear), zfar / (zfar - znear), 0.0f, 0.0f);
+  frame.cameraPosition = glm::vec4(m_activeCamera->getWorldPosition(), 1.0f);
+
+  m_frameBuffer->update(&frame, sizeof(FrameBlock));
+  m_frameBuffer->bind(kit::UniformBuffer::FrameBinding);
+}
+
+void kit::Renderer::geometryPass()
+{
+  updateFrameBlock();
+
+  // The shadow pass tests against the occluders as well
+  occlusionPass();
+
+  // Sorted by renderpriority, then front to back to cull as many fragments as possible
+  SortedRenderables workPayload(m_frameArena);
+  glm::vec3 cameraPosition = m_activeCamera->getWorldPosition();
   
-  std::priority_queue<kit::Renderable*, std::vector<kit::Renderable*>, decltype(sorter)> workPayload(sorter);
+  glm::mat4 viewMatrix = m_activeCamera->getViewMatrix();
+  glm::mat4 projectionMatrix = m_activeCamera->getProjectionMatrix();
+  kit::CullVolume cameraVolume(projectionMatrix * viewMatrix);
+  kit::AABB bounds;
+  m_drawBatcher->setViewProjection(viewMatrix, projectionMatrix);
   
   for (auto & currPayload : m_payload)
   {
     for (auto & currRenderable : currPayload->getRenderables())
     {
-      workPayload.push(currRenderable);
+      // Batched renderables are culled per submesh by the batcher
+      if (m_batchingEnabled && m_gpuCullingEnabled && currRenderable->submitBatched(m_drawBatcher))
+      {
+        continue;
+      }
+
+      // Skip renderables outside the view
+      bool bounded = currRenderable->getWorldBounds(bounds);
+      if (bounded && !cameraVolume.intersects(bounds))
+      {
+        continue;
+      }
+      
+      // Skip renderables hidden behind occluders. An occluder is inside its own bounds, so it never hides itself
+      if (bounded && m_softwareOcclusionEnabled && !m_occlusionBuffer->isVisible(bounds))
+      {
+        m_occludedCount++;
+        continue;
+      }
+      
+      workPayload.push_back({ currRenderable, currRenderable->getRenderPriority(), glm::distance(cameraPosition, currRenderable->getWorldPosition()) });
     }
   }
+
+  sortRenderables(workPayload, false);
   
-  glDisable(GL_BLEND);
+  kit::GLState::setBlend(false);
 
-  glDepthMask(GL_TRUE);
-  glEnable(GL_DEPTH_TEST);
+  kit::GLState::setDepthWrite(true);
+  kit::GLState::setDepthTest(true);
 
   // Clear and bind the geometry buffer
   m_geometryBuffer->clear({ glm::vec4(0.0, 0.0, 0.0, 0.0), glm::vec4(0.0, 0.0, 0.0, 0.0), glm::vec4(0.0, 0.0, 0.0, 0.0) }, 1.0f);
 
-  while(!workPayload.empty())
+  // Batchable renderables are collected, and drawn together after the rest
+  for (auto & currEntry : workPayload)
   {
-    workPayload.top()->renderDeferred(this);
-    workPayload.pop();
+    kit::Renderable * currRenderable = currEntry.renderable;
+    if (!m_batchingEnabled || !currRenderable->submitBatched(m_drawBatcher))
+    {
+      currRenderable->renderDeferred(this);
+    }
   }
+  
+  m_drawBatcher->flush(viewMatrix, projectionMatrix, m_geometryBuffer->getDepthAttachment());
 }
 
 void kit::Renderer::shadowPass()
 {
   if (!m_shadowsEnabled) return;
 
-  std::vector<kit::Renderable*> renderables;
-  std::queue<kit::Light*> lights;
+  // Gather the shadow casters once, with their bounds
+  m_shadowCasters.clear();
   for (auto currPayload : m_payload)
   {
     for (auto currRenderable : currPayload->getRenderables())
     {
-      renderables.push_back(currRenderable);
+      if (!currRenderable->isShadowCaster())
+      {
+        continue;
+      }
+      
+      currRenderable->prepareShadows(m_activeCamera);
+
+      ShadowCaster caster;
+      caster.renderable = currRenderable;
+      caster.bounded = currRenderable->getWorldBounds(caster.bounds);
+      m_shadowCasters.push_back(caster);
     }
-    
-    for(auto currLight : currPayload->getLights())
+  }
+  
+  kit::GLState::setDepthWrite(true);
+  kit::GLState::setDepthTest(true);
+  kit::GLState::setBlend(false);
+
+  // Render the directional cascades, and let the spot and point lights compete for room in the atlas
+  glm::mat4 cameraProjection = m_activeCamera->getProjectionMatrix();
+  kit::CullVolume cameraVolume(cameraProjection * m_activeCamera->getViewMatrix());
+  glm::vec3 cameraPosition = m_activeCamera->getWorldPosition();
+  
+  m_shadowAtlas->clearRequests();
+  m_atlasRequests.clear();
+  for (auto currPayload : m_payload)
+  {
+    for (auto currLight : currPayload->getLights())
+    {
+      // Ignore light if its not shadowmapped
+      if (!currLight->isShadowMapped())
+      {
+        continue;
+      }
+
+      if (currLight->getType() == Light::Directional)
+      {
+        renderShadowCascades(currLight);
+        continue;
+      }
+      
+      // Lights that can not light anything in view get no tiles
+      float radius = currLight->getRadius();
+      glm::vec3 position = currLight->getWorldPosition();
+      kit::AABB lightBounds(position - glm::vec3(radius), position + glm::vec3(radius));
+      if (!cameraVolume.intersects(lightBounds))
+      {
+        currLight->getShadowCache().tileCount = 0;
+        continue;
+      }
+      
+      // Neither do lights whose whole range is hidden behind occluders, as every visible surface is in front of it
+      if (m_softwareOcclusionEnabled && !m_occlusionBuffer->isVisible(lightBounds))
+      {
+        currLight->getShadowCache().tileCount = 0;
+        continue;
+      }
+      
+      // Size the tiles after how much of the screen the light covers
+      float distance = glm::distance(cameraPosition, position);
+      float coverage = 1.0f;
+      if (distance > radius)
+      {
+        coverage = glm::min(1.0f, radius / glm::sqrt(distance * distance - radius * radius) * cameraProjection[1][1]);
+      }
+      
+      AtlasRequest atlasRequest;
+      atlasRequest.light = currLight;
+      atlasRequest.request = m_shadowAtlas->request(currLight->getType() == Light::Point ? 6 : 1, uint32_t(coverage * float(currLight->getShadowmapSize().x)), coverage * currLight->getShadowPriority());
+      m_atlasRequests.push_back(atlasRequest);
+    }
+  }
+  
+  if (m_atlasRequests.empty())
+  {
+    return;
+  }
+  
+  m_shadowAtlas->allocate();
+  m_shadowAtlas->getBuffer()->bind();
+  glEnable(GL_SCISSOR_TEST);
+  
+  for (auto & currRequest : m_atlasRequests)
+  {
+    kit::Light::ShadowCache & cache = currRequest.light->getShadowCache();
+    if (!m_shadowAtlas->isAllocated(currRequest.request))
     {
-      lights.push(currLight);
+      cache.tileCount = 0;
+      continue;
     }
+    
+    renderShadowTiles(currRequest.light, currRequest.request);
   }
   
-  glDepthMask(GL_TRUE);
-  glEnable(GL_DEPTH_TEST);
-  glDisable(GL_BLEND);
+  glDisable(GL_SCISSOR_TEST);
+}
 
-  // For each light in current payload ...
-  while(!lights.empty())
+void kit::Renderer::renderShadowCascades(kit::Light * light)
+{
+  light->updateCascades(m_activeCamera);
+  
+  kit::PixelBuffer * shadowBuffer = light->getShadowBuffer();
+  glm::uvec2 resolution = light->getCascadeResolution();
+  glm::vec3 direction = light->getWorldForward();
+  auto & cascades = light->getCascades();
+  
+  shadowBuffer->bind();
+  glEnable(GL_SCISSOR_TEST);
+  
+  for (uint32_t i = 0; i < cascades.size(); i++)
   {
-    auto currLight = lights.front();
-    lights.pop();
+    kit::Light::Cascade & cascade = cascades[i];
     
-    // Ignore light if its not shadowmapped
-    if (!currLight->isShadowMapped())
+    // Distant cascades are updated less often, offset by their index so that they do not all update in the same frame
+    bool due = ((m_frameIndex + i) % cascade.updateInterval) == 0;
+    if (cascade.rendered && cascade.shadowDirection == direction && !due)
     {
       continue;
     }
-
-    // Ignore light if its not inside camera frustum
-    // If spotcone || pointsphere !inside camerafrustum continue
     
-    currLight->getShadowBuffer()->clearDepth(1.0f);
+    cascade.shadowViewProjection = cascade.projectionMatrix * cascade.viewMatrix;
+    cascade.shadowDirection = direction;
+    
+    glScissor(i * resolution.x, 0, resolution.x, resolution.y);
+    shadowBuffer->clearDepth(1.0f);
+    glViewport(i * resolution.x, 0, resolution.x, resolution.y);
     
-    for(auto currRenderable : renderables)
+    kit::CullVolume volume(cascade.shadowViewProjection);
+    bool complete = true;
+    for (auto & caster : m_shadowCasters)
     {
-      // Ignore renderable if its not a shadowcaster
-      if (!currRenderable->isShadowCaster())
+      if (caster.bounded && !volume.intersects(caster.bounds))
       {
         continue;
       }
+      
+      caster.renderable->renderShadows(cascade.viewMatrix, cascade.projectionMatrix);
+      complete = caster.renderable->isShadowComplete() && complete;
+    }
+    
+    // Render it again next frame if anything was missing, instead of waiting for its interval
+    cascade.rendered = complete;
+  }
+  
+  glDisable(GL_SCISSOR_TEST);
+}
 
-      // If light is a spotlight..
-      if (currLight->getType() == Light::Spot)
-      {
-        // If currRenderable !inside spotfrustum continue
-        // Render the renderable to the shadowmap
-        currRenderable->renderShadows(currLight->getSpotViewMatrix(), currLight->getSpotProjectionMatrix());
-      }
+void kit::Renderer::renderShadowTiles(kit::Light * light, uint32_t request)
+{
+  kit::Light::ShadowCache & cache = light->getShadowCache();
+  bool point = (light->getType() == kit::Light::Point);
+  uint32_t faces = point ? 6 : 1;
+  glm::mat4 projectionMatrix = point ? light->getPointProjectionMatrix() : light->getSpotProjectionMatrix();
+  glm::vec3 position = light->getWorldPosition();
+  
+  // Pointlights are culled against their sphere here and against each face when drawing
+  glm::mat4 viewProjection = point ? projectionMatrix * glm::translate(-position) : projectionMatrix * light->getSpotViewMatrix();
+  kit::CullVolume volume(viewProjection);
+  kit::AABB sphereBounds(position - glm::vec3(light->getRadius()), position + glm::vec3(light->getRadius()));
 
-      // If light is directional
-      if (currLight->getType() == Light::Directional)
-      {
-        // Render the renderable to the shadowmap
-        currRenderable->renderShadows(currLight->getDirectionalViewMatrix() * currLight->getDirectionalModelMatrix(m_activeCamera->getWorldPosition(), m_activeCamera->getWorldForward()), currLight->getDirectionalProjectionMatrix());
-      }
+  // Split the casters inside the light volume into static and dynamic ones
+  m_staticCasters.clear();
+  m_dynamicCasters.clear();
+  for (auto & caster : m_shadowCasters)
+  {
+    if (caster.bounded && !(point ? sphereBounds.intersects(caster.bounds) : volume.intersects(caster.bounds)))
+    {
+      continue;
+    }
+    
+    if (caster.renderable->isStatic())
+    {
+      m_staticCasters.push_back(&caster);
+    }
+    else
+    {
+      m_dynamicCasters.push_back(&caster);
+    }
+  }
+
+  // The tiles are stale if the light skipped a frame, since other lights may have drawn over them, if they moved in the atlas,
+  // if the light has moved, or if a static caster inside its volume has been added, removed or moved
+  bool changed = (cache.frame + 1 != m_frameIndex) || (cache.tileCount != faces) || (cache.viewProjection != viewProjection) || (cache.staticCasters.size() != m_staticCasters.size());
+  for (uint32_t i = 0; i < faces && !changed; i++)
+  {
+    changed = (cache.tiles[i] != m_shadowAtlas->getTile(request, i));
+  }
+  for (size_t i = 0; i < m_staticCasters.size() && !changed; i++)
+  {
+    changed = (cache.staticCasters[i].first != m_staticCasters[i]->renderable) || (cache.staticCasters[i].second != m_staticCasters[i]->renderable->getWorldTransformMatrix());
+  }
+  
+  // Tiles holding only static casters stay valid until they or the light change
+  if (!changed && cache.tilesStaticOnly && m_dynamicCasters.empty())
+  {
+    cache.frame = m_frameIndex;
+    return;
+  }
+  
+  // Redraw the static casters into the static buffer only when they changed
+  if (changed)
+  {
+    cache.viewProjection = viewProjection;
+    cache.tileCount = faces;
+    cache.staticCasters.clear();
+    for (auto currCaster : m_staticCasters)
+    {
+      cache.staticCasters.push_back(std::make_pair(currCaster->renderable, currCaster->renderable->getWorldTransformMatrix()));
+    }
+    
+    bool complete = true;
+    for (uint32_t i = 0; i < faces; i++)
+    {
+      cache.tiles[i] = m_shadowAtlas->getTile(request, i);
+      complete = renderShadowTile(light, m_shadowAtlas->getStaticBuffer(), request, i, m_staticCasters, true) && complete;
+    }
+    
+    // Keep the static tiles stale while a caster is missing from them, such as when its program is still compiling
+    if (!complete)
+    {
+      cache.viewProjection = glm::mat4(0.0f);
+    }
+  }
+  
+  // Then restore them in the atlas, and composite the dynamic casters on top
+  for (uint32_t i = 0; i < faces; i++)
+  {
+    kit::ShadowAtlas::Tile const & tile = cache.tiles[i];
+    glScissor(tile.offset.x, tile.offset.y, tile.size, tile.size);
+    m_shadowAtlas->restoreStaticTile(tile);
+    
+    if (!m_dynamicCasters.empty())
+    {
+      renderShadowTile(light, m_shadowAtlas->getBuffer(), request, i, m_dynamicCasters, false);
     }
   }
+  
+  cache.tilesStaticOnly = m_dynamicCasters.empty() && cache.viewProjection == viewProjection;
+  cache.frame = m_frameIndex;
+}
 
+bool kit::Renderer::renderShadowTile(kit::Light * light, kit::PixelBuffer * buffer, uint32_t request, uint32_t face, std::vector<ShadowCaster*> const & casters, bool clear)
+{
+  kit::ShadowAtlas::Tile const & tile = m_shadowAtlas->getTile(request, face);
+  bool point = (light->getType() == kit::Light::Point);
+  glm::mat4 projectionMatrix = point ? light->getPointProjectionMatrix() : light->getSpotProjectionMatrix();
+  glm::mat4 viewMatrix = point ? light->getPointViewMatrix(kit::Cubemap::Side(face)) : light->getSpotViewMatrix();
+  kit::CullVolume faceVolume(projectionMatrix * viewMatrix);
+  
+  buffer->bind();
+  glScissor(tile.offset.x, tile.offset.y, tile.size, tile.size);
+  if (clear)
+  {
+    buffer->clearDepth(1.0f);
+  }
+  glViewport(tile.offset.x, tile.offset.y, tile.size, tile.size);
+  
+  bool complete = true;
+  for (auto currCaster : casters)
+  {
+    if (point && currCaster->bounded && !faceVolume.intersects(currCaster->bounds))
+    {
+      continue;
+    }
+    
+    currCaster->renderable->renderShadows(viewMatrix, projectionMatrix);
+    complete = currCaster->renderable->isShadowComplete() && complete;
+  }
+  
+  return complete;
 }
 
 void kit::Renderer::lightPass()
 {
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_ONE, GL_ONE);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
+  kit::GLState::setBlend(true);
+  kit::GLState::setBlendFunc(GL_ONE, GL_ONE);
+  kit::GLState::setDepthTest(false);
+  kit::GLState::setDepthWrite(false);
   //glDisable(GL_CULL_FACE);
   
   // Clear and bind the light accumulation buffer
-  glm::mat4 invViewMatrix;
-
   m_accumulationBuffer->clear({ glm::vec4(0.0, 0.0, 0.0, 1.0) });
-  invViewMatrix = glm::inverse(m_activeCamera->getViewMatrix());
 
-  // Update our light programs
-  m_programIBL->setUniformMat4("uniform_invViewMatrix", invViewMatrix);
-  m_programSpot->setUniformMat4("uniform_invViewMatrix", invViewMatrix);
-  m_programDirectional->setUniformMat4("uniform_invViewMatrix", invViewMatrix);
+  // Other passes may have used the frame binding point since the geometry pass
+  m_frameBuffer->bind(kit::UniformBuffer::FrameBinding);
+
+  m_clusteredLights.clear();
 
   // For each payload ...
   for (auto & currPayload : m_payload)
@@ -734,51 +1068,54 @@ void kit::Renderer::lightPass()
     // For each light in current payload ...
     for (auto & currLight : currPayload->getLights())
     {
+      kit::Light::Type type = currLight->getType();
+      bool shadowed = currLight->isShadowMapped() && m_shadowsEnabled;
+      
+      // Point and spot lights without tiles in the shadow atlas this frame are shaded together below
+      kit::Light::ShadowCache const & cache = currLight->getShadowCache();
+      if((type == kit::Light::Point || type == kit::Light::Spot) && (!shadowed || cache.tileCount == 0 || cache.frame != m_frameIndex))
+      {
+        m_clusteredLights.push_back(currLight);
+        continue;
+      }
+      
       // Render the light
       renderLight(currLight);
     }
   }
 
+  // Bin the clustered lights and shade them all in a single full-screen pass
+  m_lightGrid->update(m_activeCamera, m_clusteredLights);
+  if(m_lightGrid->getLightCount() > 0)
+  {
+    m_lightGrid->bind(m_programClustered);
+    m_screenQuad->render(m_programClustered);
+  }
+
   // Render emissive light
   m_screenQuad->render(m_programEmissive);
 }
 
 void kit::Renderer::forwardPass()
 {
-  // Sorts by renderpriority, then back to front to render forward stuff as correctly as possible
-  // Inverted because its pushed to a queue
-  auto sorter = [&](kit::Renderable* & lhs, kit::Renderable* & rhs)
-  {
-    glm::vec3 cwp = m_activeCamera->getWorldPosition();
-    glm::vec3 lwp = lhs->getWorldPosition();
-    glm::vec3 rwp = rhs->getWorldPosition();
-    
-    float ld = glm::distance(cwp, lwp);
-    float rd = glm::distance(cwp, rwp);
-    
-    float lp = lhs->getRenderPriority();
-    float rp = rhs->getRenderPriority();
-    
-    if(lp != rp)
-      return lp > rp;
-    else
-      return ld < rd;
-  };
-  
-  std::priority_queue<kit::Renderable*, std::vector<kit::Renderable*>, decltype(sorter)> workPayload(sorter);
+  // Sorted by renderpriority, then back to front to render forward stuff as correctly as possible
+  SortedRenderables workPayload(m_frameArena);
+  glm::vec3 cameraPosition = m_activeCamera->getWorldPosition();
   
   for (auto & currPayload : m_payload)
   {
     for (auto & currRenderable : currPayload->getRenderables())
     {
-      workPayload.push(currRenderable);
+      workPayload.push_back({ currRenderable, currRenderable->getRenderPriority(), glm::distance(cameraPosition, currRenderable->getWorldPosition()) });
     }
   }
+
+  sortRenderables(workPayload, true);
   
-  glDepthMask(GL_TRUE);
-  glEnable(GL_DEPTH_TEST);
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  kit::GLState::setDepthWrite(true);
+  kit::GLState::setDepthTest(true);
+  kit::GLState::setBlend(true);
+  kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
   // Bind the accumulation buffer
   m_accumulationBuffer->bind();
@@ -786,34 +1123,34 @@ void kit::Renderer::forwardPass()
   // If we have a skybox
   if (m_skybox)
   {
-    glDisable(GL_CULL_FACE);
+    kit::GLState::setCulling(false);
     // Render the skybox
     m_skybox->render(this);
   }
 
-  while(!workPayload.empty())
+  for (auto & currEntry : workPayload)
   {
-    if(workPayload.top()->requestAccumulationCopy())
+    kit::Renderable * currRenderable = currEntry.renderable;
+    if(currRenderable->requestAccumulationCopy())
     {
       updateAccumulationCopy();
     }
     
-    if(workPayload.top()->requestPositionBuffer())
+    if(currRenderable->requestPositionBuffer())
     {
       updatePositionBuffer();
       
-      glDepthMask(GL_TRUE);
-      glEnable(GL_DEPTH_TEST);
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      kit::GLState::setDepthWrite(true);
+      kit::GLState::setDepthTest(true);
+      kit::GLState::setBlend(true);
+      kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
       // Bind the accumulation buffer
       m_accumulationBuffer->bind();
     }
     
     
-    workPayload.top()->renderForward(this);
-    workPayload.pop();
+    currRenderable->renderForward(this);
   }
   
 }
@@ -821,10 +1158,10 @@ void kit::Renderer::forwardPass()
 void kit::Renderer::hdrPass()
 {
   
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
-  glDisable(GL_CULL_FACE);
+  kit::GLState::setBlend(false);
+  kit::GLState::setDepthTest(false);
+  kit::GLState::setDepthWrite(false);
+  kit::GLState::setCulling(false);
 
 
   // If we have bloom enabled
@@ -1010,10 +1347,10 @@ void kit::Renderer::hdrPass()
 void kit::Renderer::postFXPass()
 {
   
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
-  glDisable(GL_CULL_FACE);
+  kit::GLState::setBlend(false);
+  kit::GLState::setDepthTest(false);
+  kit::GLState::setDepthWrite(false);
+  kit::GLState::setCulling(false);
 
   if (m_fringeEnabled)
   {
@@ -1196,6 +1533,82 @@ bool const & kit::Renderer::getShadows()
   return m_shadowsEnabled;
 }
 
+void kit::Renderer::setBatching(bool const & enabled)
+{
+  m_batchingEnabled = enabled;
+}
+
+bool const & kit::Renderer::getBatching()
+{
+  return m_batchingEnabled;
+}
+
+void kit::Renderer::setGpuCulling(bool const & enabled)
+{
+  m_drawBatcher->setGpuCulling(enabled);
+  m_gpuCullingEnabled = enabled;
+}
+
+bool const & kit::Renderer::getGpuCulling()
+{
+  return m_gpuCullingEnabled;
+}
+
+void kit::Renderer::setSoftwareOcclusion(bool const & enabled)
+{
+  m_softwareOcclusionEnabled = enabled;
+}
+
+bool const & kit::Renderer::getSoftwareOcclusion()
+{
+  return m_softwareOcclusionEnabled;
+}
+
+kit::FrameArena * kit::Renderer::getFrameArena()
+{
+  return m_frameArena;
+}
+
+kit::OcclusionBuffer * kit::Renderer::getOcclusionBuffer()
+{
+  return m_occlusionBuffer;
+}
+
+void kit::Renderer::setOcclusionCulling(bool const & enabled)
+{
+  m_drawBatcher->setOcclusionCulling(enabled);
+  m_occlusionCullingEnabled = enabled;
+}
+
+bool const & kit::Renderer::getOcclusionCulling()
+{
+  return m_occlusionCullingEnabled;
+}
+
+void kit::Renderer::setShadowAtlasResolution(uint32_t const & resolution)
+{
+  if (m_shadowAtlas)
+  {
+    delete m_shadowAtlas;
+  }
+  
+  m_shadowAtlas = new kit::ShadowAtlas(resolution);
+  
+  // The tiles of the old atlas are gone
+  for (auto & currPayload : m_payload)
+  {
+    for (auto & currLight : currPayload->getLights())
+    {
+      currLight->invalidateShadowCache();
+    }
+  }
+}
+
+kit::ShadowAtlas * kit::Renderer::getShadowAtlas()
+{
+  return m_shadowAtlas;
+}
+
 void kit::Renderer::setSceneFringe(bool const & enabled)
 {
   m_fringeEnabled = enabled;
@@ -1474,18 +1887,10 @@ void kit::Renderer::updateBuffers()
   m_programSpot->setUniformTexture("uniform_textureB", m_geometryBuffer->getColorAttachment(1));
   m_programSpot->setUniformTexture("uniform_textureC", m_geometryBuffer->getColorAttachment(2));
   m_programSpot->setUniformTexture("uniform_textureDepth", m_geometryBuffer->getDepthAttachment());
-  m_programSpotNS->setUniformTexture("uniform_textureA", m_geometryBuffer->getColorAttachment(0));
-  m_programSpotNS->setUniformTexture("uniform_textureB", m_geometryBuffer->getColorAttachment(1));
-  m_programSpotNS->setUniformTexture("uniform_textureC", m_geometryBuffer->getColorAttachment(2));
-  m_programSpotNS->setUniformTexture("uniform_textureDepth", m_geometryBuffer->getDepthAttachment());
-  m_programPoint->setUniformTexture("uniform_textureA", m_geometryBuffer->getColorAttachment(0));
-  m_programPoint->setUniformTexture("uniform_textureB", m_geometryBuffer->getColorAttachment(1));
-  m_programPoint->setUniformTexture("uniform_textureC", m_geometryBuffer->getColorAttachment(2));
-  m_programPoint->setUniformTexture("uniform_textureDepth", m_geometryBuffer->getDepthAttachment());
-  m_programPointNS->setUniformTexture("uniform_textureA", m_geometryBuffer->getColorAttachment(0));
-  m_programPointNS->setUniformTexture("uniform_textureB", m_geometryBuffer->getColorAttachment(1));
-  m_programPointNS->setUniformTexture("uniform_textureC", m_geometryBuffer->getColorAttachment(2));
-  m_programPointNS->setUniformTexture("uniform_textureDepth", m_geometryBuffer->getDepthAttachment());
+  m_programClustered->setUniformTexture("uniform_textureA", m_geometryBuffer->getColorAttachment(0));
+  m_programClustered->setUniformTexture("uniform_textureB", m_geometryBuffer->getColorAttachment(1));
+  m_programClustered->setUniformTexture("uniform_textureC", m_geometryBuffer->getColorAttachment(2));
+  m_programClustered->setUniformTexture("uniform_textureDepth", m_geometryBuffer->getDepthAttachment());
   m_programIBL->setUniformTexture("uniform_textureA", m_geometryBuffer->getColorAttachment(0));
   m_programIBL->setUniformTexture("uniform_textureB", m_geometryBuffer->getColorAttachment(1));
   m_programIBL->setUniformTexture("uniform_textureC", m_geometryBuffer->getColorAttachment(2));
@@ -1534,9 +1939,9 @@ void kit::Renderer::updateAccumulationCopy()
 
 void kit::Renderer::updatePositionBuffer()
 {
-  glDisable(GL_BLEND);
-  glDisable(GL_DEPTH_TEST);
-  glDepthMask(GL_FALSE);
+  kit::GLState::setBlend(false);
+  kit::GLState::setDepthTest(false);
+  kit::GLState::setDepthWrite(false);
   
   kit::Camera * c = m_activeCamera;
   glm::mat4 p = c->getProjectionMatrix();
@@ -1579,41 +1984,25 @@ void kit::Renderer::renderReflections(float const & planarHeight)
     return;
   }
   
-  // Sorts by renderpriority, then front to back to cull as many fragments as possible
-  // Inverted because its pushed to a queue
-  auto sorter = [&](kit::Renderable* & lhs, kit::Renderable* & rhs)
-  {
-    glm::vec3 cwp = m_activeCamera->getWorldPosition();
-    glm::vec3 lwp = lhs->getWorldPosition();
-    glm::vec3 rwp = rhs->getWorldPosition();
-    
-    float ld = glm::distance(cwp, lwp);
-    float rd = glm::distance(cwp, rwp);
-    
-    float lp = lhs->getRenderPriority();
-    float rp = rhs->getRenderPriority();
-    
-    if(lp != rp)
-      return lp > rp;
-    else
-      return ld > rd;
-  };
-  
-  std::priority_queue<kit::Renderable*, std::vector<kit::Renderable*>, decltype(sorter)> workPayload(sorter);
+  // Sorted by renderpriority, then front to back to cull as many fragments as possible
+  SortedRenderables workPayload(m_frameArena);
+  glm::vec3 cameraPosition = m_activeCamera->getWorldPosition();
   
   for (auto & currPayload : m_payload)
   {
     for (auto & currRenderable : currPayload->getRenderables())
     {
-      workPayload.push(currRenderable);
+      workPayload.push_back({ currRenderable, currRenderable->getRenderPriority(), glm::distance(cameraPosition, currRenderable->getWorldPosition()) });
     }
   }
+
+  sortRenderables(workPayload, false);
   
-  glDisable(GL_BLEND);
-  glDepthMask(GL_TRUE);
-  glEnable(GL_DEPTH_TEST);
+  kit::GLState::setBlend(false);
+  kit::GLState::setDepthWrite(true);
+  kit::GLState::setDepthTest(true);
   
-  glDisable(GL_CULL_FACE);
+  kit::GLState::setCulling(false);
   //glCullFace(GL_FRONT);
 
   glm::mat4 viewMatrix = m_activeCamera->getViewMatrix();
@@ -1636,26 +2025,35 @@ void kit::Renderer::renderReflections(float const & planarHeight)
     //glEnable(GL_CULL_FACE);
   }
   
-  while(!workPayload.empty())
+  for (auto & currEntry : workPayload)
   {
-    workPayload.top()->renderReflection(this, viewMatrix, projectionMatrix);
-    workPayload.pop();
+    currEntry.renderable->renderReflection(this, viewMatrix, projectionMatrix);
   }
 }
 
 kit::Light * kit::Renderer::findIBLLight()
 {
- for(auto & currPayload : m_payload)
- {
-   for(auto & light : currPayload->getLights())
-   {
-     if(light->getType() == kit::Light::Type::IBL)
-     {
-       return light;
-     }
-   }
- }
- 
+  // Reflective materials ask for every submesh they draw, so the search is done once per frame
+  if(m_iblLightFrame == m_frameIndex && m_frameIndex != 0)
+  {
+    return m_iblLight;
+  }
+
+  m_iblLight = nullptr;
+  m_iblLightFrame = m_frameIndex;
+
+  for(auto & currPayload : m_payload)
+  {
+    for(auto & light : currPayload->getLights())
+    {
+      if(light->getType() == kit::Light::Type::IBL)
+      {
+        m_iblLight = light;
+        return m_iblLight;
+      }
+    }
+  }
+
   return nullptr;
 }
 
@@ -76,10 +76,19 @@ void kit::Shader::clearSource()
 }
 
 bool kit::Shader::compile()
+{
+  compileAsync();
+  return checkCompileStatus();
+}
+
+void kit::Shader::compileAsync()
 {
   // Attempt to compile the shader
   glCompileShader(this->m_glHandle);
+}
 
+bool kit::Shader::checkCompileStatus()
+{
   // Retrieve the compilation status
   int32_t status;
   glGetShaderiv(this->m_glHandle, GL_COMPILE_STATUS, &status);
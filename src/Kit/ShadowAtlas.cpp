@@ -0,0 +1,211 @@
+#include "Kit/ShadowAtlas.hpp"
+
+#include "Kit/PixelBuffer.hpp"
+#include "Kit/IncOpenGL.hpp"
+
+#include <algorithm>
+
+namespace
+{
+  uint32_t floorPow2(uint32_t v)
+  {
+    uint32_t r = 1;
+    while (r * 2 <= v && r < 0x80000000u)
+    {
+      r *= 2;
+    }
+    return r;
+  }
+
+  uint32_t ceilPow2(uint32_t v)
+  {
+    uint32_t r = 1;
+    while (r < v && r < 0x80000000u)
+    {
+      r *= 2;
+    }
+    return r;
+  }
+
+  // Every other bit of a Z-order index
+  uint32_t compactBits(uint64_t v)
+  {
+    uint32_t r = 0;
+    for (uint32_t i = 0; i < 32; i++)
+    {
+      r |= uint32_t((v >> (i * 2)) & 1) << i;
+    }
+    return r;
+  }
+}
+
+bool kit::ShadowAtlas::Tile::operator==(kit::ShadowAtlas::Tile const & other) const
+{
+  return offset == other.offset && size == other.size;
+}
+
+bool kit::ShadowAtlas::Tile::operator!=(kit::ShadowAtlas::Tile const & other) const
+{
+  return !(*this == other);
+}
+
+kit::ShadowAtlas::ShadowAtlas(uint32_t resolution, uint32_t minTileSize, uint32_t maxTileSize)
+{
+  m_resolution = floorPow2(glm::max(resolution, 1u));
+  m_minTileSize = glm::min(floorPow2(glm::max(minTileSize, 1u)), m_resolution);
+  m_maxTileSize = glm::clamp(floorPow2(glm::max(maxTileSize, 1u)), m_minTileSize, m_resolution);
+  m_buffer = kit::PixelBuffer::createShadowBuffer(glm::uvec2(m_resolution, m_resolution));
+  m_staticBuffer = kit::PixelBuffer::createShadowBuffer(glm::uvec2(m_resolution, m_resolution));
+}
+
+kit::ShadowAtlas::~ShadowAtlas()
+{
+  if(m_buffer)
+    delete m_buffer;
+
+  if(m_staticBuffer)
+    delete m_staticBuffer;
+}
+
+void kit::ShadowAtlas::clearRequests()
+{
+  m_requests.clear();
+  m_tiles.clear();
+}
+
+uint32_t kit::ShadowAtlas::request(uint32_t faces, uint32_t size, float importance)
+{
+  Request newRequest;
+  newRequest.faces = faces;
+  newRequest.size = glm::clamp(ceilPow2(size), m_minTileSize, m_maxTileSize);
+  newRequest.importance = glm::max(importance, 0.0001f);
+  newRequest.firstTile = (uint32_t)m_tiles.size();
+  m_requests.push_back(newRequest);
+  m_tiles.resize(m_tiles.size() + faces);
+
+  return (uint32_t)m_requests.size() - 1;
+}
+
+void kit::ShadowAtlas::allocate()
+{
+  auto area = [](Request const & r) { return uint64_t(r.faces) * uint64_t(r.size) * uint64_t(r.size); };
+
+  uint64_t capacity = uint64_t(m_resolution) * uint64_t(m_resolution);
+  uint64_t total = 0;
+  for (auto & currRequest : m_requests)
+  {
+    total += area(currRequest);
+  }
+
+  while (total > capacity)
+  {
+    // Halve the tiles with the most texels per importance
+    Request * shrink = nullptr;
+    for (auto & currRequest : m_requests)
+    {
+      if (currRequest.size > m_minTileSize && (!shrink || float(currRequest.size) / currRequest.importance > float(shrink->size) / shrink->importance))
+      {
+        shrink = &currRequest;
+      }
+    }
+
+    if (shrink)
+    {
+      total -= area(*shrink);
+      shrink->size /= 2;
+      total += area(*shrink);
+      continue;
+    }
+
+    // Every tile is as small as it gets, so drop the least important light
+    Request * drop = nullptr;
+    for (auto & currRequest : m_requests)
+    {
+      if (currRequest.size > 0 && (!drop || currRequest.importance < drop->importance))
+      {
+        drop = &currRequest;
+      }
+    }
+
+    total -= area(*drop);
+    drop->size = 0;
+  }
+
+  // Place the tiles largest first. Every tile then starts at a multiple of its own area along the curve, which keeps it square and aligned
+  m_order.clear();
+  for (uint32_t i = 0; i < m_requests.size(); i++)
+  {
+    m_order.push_back(i);
+  }
+  std::stable_sort(m_order.begin(), m_order.end(), [&](uint32_t lhs, uint32_t rhs) { return m_requests[lhs].size > m_requests[rhs].size; });
+
+  uint64_t cursor = 0;
+  for (auto currIndex : m_order)
+  {
+    Request & currRequest = m_requests[currIndex];
+    uint32_t cells = currRequest.size / m_minTileSize;
+
+    for (uint32_t face = 0; face < currRequest.faces; face++)
+    {
+      Tile & currTile = m_tiles[currRequest.firstTile + face];
+      currTile.size = currRequest.size;
+      currTile.offset = glm::uvec2(compactBits(cursor), compactBits(cursor >> 1)) * m_minTileSize;
+      cursor += uint64_t(cells) * uint64_t(cells);
+    }
+  }
+}
+
+bool kit::ShadowAtlas::isAllocated(uint32_t request)
+{
+  if (request >= m_requests.size())
+  {
+    KIT_THROW("Index out of range");
+  }
+
+  return m_requests[request].size > 0;
+}
+
+kit::ShadowAtlas::Tile const & kit::ShadowAtlas::getTile(uint32_t request, uint32_t face)
+{
+  if (request >= m_requests.size() || face >= m_requests[request].faces)
+  {
+    KIT_THROW("Index out of range");
+  }
+
+  return m_tiles[m_requests[request].firstTile + face];
+}
+
+glm::vec4 kit::ShadowAtlas::getTileRect(kit::ShadowAtlas::Tile const & tile)
+{
+  float texel = 1.0f / float(m_resolution);
+  return glm::vec4(glm::vec2(tile.offset) * texel, glm::vec2(float(tile.size) * texel));
+}
+
+void kit::ShadowAtlas::restoreStaticTile(kit::ShadowAtlas::Tile const & tile)
+{
+  glm::uvec2 end = tile.offset + glm::uvec2(tile.size, tile.size);
+
+  // Depth can only be blitted with nearest filtering
+#ifndef KIT_SHITTY_INTEL
+  glBlitNamedFramebuffer(m_staticBuffer->getHandle(), m_buffer->getHandle(), tile.offset.x, tile.offset.y, end.x, end.y, tile.offset.x, tile.offset.y, end.x, end.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+#else
+  m_staticBuffer->bind(kit::PixelBuffer::Read);
+  m_buffer->bind(kit::PixelBuffer::Draw);
+  glBlitFramebuffer(tile.offset.x, tile.offset.y, end.x, end.y, tile.offset.x, tile.offset.y, end.x, end.y, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+#endif
+}
+
+kit::PixelBuffer * kit::ShadowAtlas::getBuffer()
+{
+  return m_buffer;
+}
+
+kit::PixelBuffer * kit::ShadowAtlas::getStaticBuffer()
+{
+  return m_staticBuffer;
+}
+
+uint32_t kit::ShadowAtlas::getResolution()
+{
+  return m_resolution;
+}
@@ -270,7 +270,7 @@ void kit::Skeleton::stop()
   m_currentTime = 0.0;
 }
 
-std::vector< glm::mat4 > kit::Skeleton::getSkin()
+std::vector< glm::mat4 > const & kit::Skeleton::getSkin()
 {
   return m_skin;
 }
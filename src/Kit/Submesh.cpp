@@ -1,12 +1,20 @@
 #include "Kit/Submesh.hpp"
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GeometryPool.hpp"
 
 std::map<std::string, std::weak_ptr<kit::Submesh>> kit::Submesh::m_cache = std::map<std::string, std::weak_ptr<kit::Submesh>>();
 
+kit::GeometryPool * kit::Submesh::m_geometryPool = nullptr;
+uint32_t kit::Submesh::m_instanceCount = 0;
+
 kit::Submesh::Submesh(const std::string&filename)
 {
   std::cout << "Loading submesh from file \"" << filename << "\"" << std::endl;
-  allocateBuffers();
+  kit::Submesh::m_instanceCount++;
+  if (kit::Submesh::m_instanceCount == 1)
+  {
+    kit::Submesh::allocateShared();
+  }
   m_indexCount = 0;
 
   loadGeometry(filename);
@@ -15,19 +23,90 @@ kit::Submesh::Submesh(const std::string&filename)
 kit::Submesh::~Submesh()
 {
   std::cout << "Removing submesh" << std::endl;
-  releaseBuffers();
+  if (m_allocated)
+  {
+    m_geometryPool->release(m_allocation);
+  }
+  
+  kit::Submesh::m_instanceCount--;
+  if (kit::Submesh::m_instanceCount == 0)
+  {
+    kit::Submesh::releaseShared();
+  }
+}
+
+void kit::Submesh::allocateShared()
+{
+  // Matches kit::Geometry's vertex layout
+  uint32_t vertexSize = (sizeof(float) * 15) + (sizeof(int32_t) * 4);
+  m_geometryPool = new kit::GeometryPool(vertexSize, {
+    { 0, 3, GL_FLOAT, 0 },                                                // Positions
+    { 1, 2, GL_FLOAT, sizeof(float) * 3 },                                // Texture coordinates
+    { 2, 3, GL_FLOAT, sizeof(float) * 5 },                                // Normals
+    { 3, 3, GL_FLOAT, sizeof(float) * 8 },                                // Tangents
+    { 4, 4, GL_INT, sizeof(float) * 11 },                                 // Bone ID's
+    { 5, 4, GL_FLOAT, (sizeof(float) * 11) + (sizeof(int32_t) * 4) }      // Bone weights
+  });
+}
+
+void kit::Submesh::releaseShared()
+{
+  if(m_geometryPool)
+    delete m_geometryPool;
+  
+  m_geometryPool = nullptr;
+}
+
+kit::GeometryPool * kit::Submesh::getGeometryPool()
+{
+  return m_geometryPool;
 }
 
 void kit::Submesh::renderGeometry()
 {
-  glBindVertexArray(m_glVertexArray);
-  glDrawElements( GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, (void*)0);
+  m_geometryPool->bind();
+  glDrawElementsBaseVertex( GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, (void*)(sizeof(uint32_t) * getFirstIndex()), getBaseVertex());
 }
 
 void kit::Submesh::renderGeometryInstanced(uint32_t numInstances)
 {
-  glBindVertexArray(m_glVertexArray);
-  glDrawElementsInstanced( GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, (void*)0, numInstances);
+  m_geometryPool->bind();
+  glDrawElementsInstancedBaseVertex( GL_TRIANGLES, m_indexCount, GL_UNSIGNED_INT, (void*)(sizeof(uint32_t) * getFirstIndex()), numInstances, getBaseVertex());
+}
+
+kit::AABB const & kit::Submesh::getBounds()
+{
+  return m_bounds;
+}
+
+void kit::Submesh::bindDrawTransforms(uint32_t glBuffer)
+{
+  m_geometryPool->bindDrawTransforms(glBuffer);
+}
+
+void kit::Submesh::unbindDrawTransforms()
+{
+  m_geometryPool->unbindDrawTransforms();
+}
+
+uint32_t kit::Submesh::getVertexArray()
+{
+  return m_geometryPool->getVertexArray();
+}
+
+uint32_t kit::Submesh::getIndexCount()
+{
+  return m_indexCount;
+}
+
+uint32_t kit::Submesh::getFirstIndex()
+{
+  return m_allocated ? m_geometryPool->getFirstIndex(m_allocation) : 0;
+}
+
+int32_t kit::Submesh::getBaseVertex()
+{
+  return m_allocated ? m_geometryPool->getBaseVertex(m_allocation) : 0;
 }
 
 std::shared_ptr<kit::Submesh> kit::Submesh::load(const std::string& name)
@@ -45,21 +124,6 @@ std::shared_ptr<kit::Submesh> kit::Submesh::load(const std::string& name)
   return sharedEntry;
 }
 
-void kit::Submesh::allocateBuffers()
-{
-  glGenVertexArrays(1, &m_glVertexArray);
-  glGenBuffers(1, &m_glVertexIndices);
-  glGenBuffers(1, &m_glVertexBuffer);
-}
-
-void kit::Submesh::releaseBuffers()
-{
-  
-  glDeleteBuffers(1, &m_glVertexIndices);
-  glDeleteBuffers(1, &m_glVertexBuffer);
-  glDeleteVertexArrays(1, &m_glVertexArray);
-}
-
 void kit::Submesh::loadGeometry(const std::string&filename)
 {
   
@@ -71,40 +135,13 @@ void kit::Submesh::loadGeometry(const std::string&filename)
   
   m_indexCount = (uint32_t)data.m_indices.size();
   
-  glBindVertexArray(m_glVertexArray);
-  
-  // Upload indices
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_glVertexIndices);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, data.m_indices.size() * sizeof(uint32_t), &data.m_indices[0], GL_STATIC_DRAW);
-  
-  // Upload vertices 
-  glBindBuffer(GL_ARRAY_BUFFER, m_glVertexBuffer);
-  glBufferData(GL_ARRAY_BUFFER, data.m_vertices.size() * 19 * sizeof(float) , &data.m_vertices[0], GL_STATIC_DRAW);
-  
-  // Total size
-  uint32_t attributeSize = (sizeof(float) * 15) + (sizeof(int32_t) * 4);
-  
-  // Positions
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, attributeSize, (void*)0);
-  
-  // Texture coordinates
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, attributeSize, (void*) (sizeof(float) * 3) );
-
-  // Normals
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, attributeSize, (void*) (sizeof(float) * 5) );
-  
-  // Tangents
-  glEnableVertexAttribArray(3);
-  glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, attributeSize, (void*) (sizeof(float) * 8) );
-  
-  // Bone ID's
-  glEnableVertexAttribArray(4);
-  glVertexAttribIPointer(4, 4, GL_INT, attributeSize, (void*) (sizeof(float) * 11)  );
+  m_bounds = kit::AABB();
+  for(auto & currVertex : data.m_vertices)
+  {
+    m_bounds.expand(currVertex.m_position);
+  }
   
-  // Bone weights
-  glEnableVertexAttribArray(5);
-  glVertexAttribPointer(5, 4, GL_FLOAT, GL_FALSE, attributeSize, (void*)((sizeof(float) * 11) + (sizeof(int32_t) * 4)) );
+  // Upload vertices and indices into the shared pool
+  m_allocation = m_geometryPool->allocate(data.m_vertices.empty() ? nullptr : &data.m_vertices[0], (uint32_t)data.m_vertices.size(), data.m_indices.empty() ? nullptr : &data.m_indices[0], m_indexCount);
+  m_allocated = true;
 }
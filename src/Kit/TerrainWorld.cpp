@@ -0,0 +1,536 @@
+#include "Kit/TerrainWorld.hpp"
+
+#include "Kit/Exception.hpp"
+
+#include <string>
+#include <fstream>
+#include <cstdlib>
+#include <algorithm>
+#include <exception>
+
+kit::TerrainWorld::TerrainWorld(const std::string& name, uint32_t numWorkers)
+{
+  m_name = name;
+  m_tileCount = glm::uvec2(0, 0);
+
+  std::ifstream f("./data/terrains/" + name + "/world");
+  if(!f)
+  {
+    KIT_THROW("Failed to load terrain world \"" + name + "\": could not open world file");
+  }
+
+  std::string currLine;
+  while(std::getline(f, currLine))
+  {
+    if(kit::trim(currLine) == "")
+    {
+      continue;
+    }
+
+    auto args = kit::splitString(currLine);
+
+    if(args[0] == "tiles" && args.size() == 3)
+    {
+      m_tileCount.x = std::atoi(args[1].c_str());
+      m_tileCount.y = std::atoi(args[2].c_str());
+    }
+
+    if(args[0] == "tilesize" && args.size() == 2)
+    {
+      m_tileResolution = std::atoi(args[1].c_str());
+    }
+
+    if(args[0] == "xzscale" && args.size() == 2)
+    {
+      m_xzScale = (float)std::atof(args[1].c_str());
+    }
+  }
+
+  if(m_tileCount.x == 0 || m_tileCount.y == 0 || m_tileResolution < 2)
+  {
+    KIT_THROW("Failed to load terrain world \"" + name + "\": missing or invalid tiles/tilesize");
+  }
+
+  m_tiles.resize(m_tileCount.x * m_tileCount.y);
+  m_wanted.reserve(m_tiles.size());
+  m_isWanted.resize(m_tiles.size(), false);
+
+  numWorkers = (glm::max)(numWorkers, 1u);
+  m_maxResults = numWorkers * 2;
+  for(uint32_t i = 0; i < numWorkers; i++)
+  {
+    m_workers.push_back(std::thread(&kit::TerrainWorld::workerMain, this));
+  }
+}
+
+kit::TerrainWorld::~TerrainWorld()
+{
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopping = true;
+  }
+  m_condition.notify_all();
+
+  for(auto & currWorker : m_workers)
+  {
+    currWorker.join();
+  }
+
+  for(auto & currResult : m_results)
+  {
+    if(currResult.second)
+      delete currResult.second;
+  }
+
+  for(auto & currTile : m_tiles)
+  {
+    if(currTile.terrain)
+      delete currTile.terrain;
+  }
+}
+
+void kit::TerrainWorld::workerMain()
+{
+  while(true)
+  {
+    uint32_t tile = 0;
+    {
+      std::unique_lock<std::mutex> lock(m_mutex);
+      m_condition.wait(lock, [this](){ return m_stopping || (!m_requests.empty() && m_results.size() < m_maxResults); });
+      if(m_stopping)
+      {
+        return;
+      }
+
+      tile = m_requests.front();
+      m_requests.pop_front();
+    }
+
+    // The expensive part, disk IO and decoding, happens without the lock
+    kit::BakedTerrain::Data * data = nullptr;
+    try
+    {
+      data = kit::BakedTerrain::loadData(getTileName(tile));
+    }
+    catch(kit::Exception & e)
+    {
+      KIT_ERR("Warning: Failed to load terrain tile \"" << getTileName(tile) << "\": " << e.what());
+    }
+    catch(std::exception & e)
+    {
+      // Corrupt files can make sizes or numbers fail to parse, which must not take down the thread
+      KIT_ERR("Warning: Failed to load terrain tile \"" << getTileName(tile) << "\": " << e.what());
+    }
+    catch(...)
+    {
+      KIT_ERR("Warning: Failed to load terrain tile \"" << getTileName(tile) << "\"");
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_results.push_back(std::make_pair(tile, data));
+    }
+  }
+}
+
+void kit::TerrainWorld::update(glm::vec3 const & cameraPosition)
+{
+  m_updateCount++;
+  glm::vec3 camera = cameraPosition - getWorldPosition();
+
+  // Find the tiles within load distance, nearest first
+  m_wanted.clear();
+  for(uint32_t i = 0; i < m_tiles.size(); i++)
+  {
+    if(m_tiles[i].state == TileState::Failed)
+    {
+      if(m_updateCount < m_tiles[i].retryAt)
+      {
+        continue;
+      }
+      m_tiles[i].state = TileState::Unloaded;
+    }
+
+    glm::vec3 center = getTileCenter(i);
+    float distance = glm::length(glm::vec2(center.x - camera.x, center.z - camera.z));
+    if(distance <= m_loadDistance)
+    {
+      m_wanted.push_back(std::make_pair(distance, i));
+    }
+  }
+  std::sort(m_wanted.begin(), m_wanted.end());
+
+  // Only keep as many as fit in the budgets, estimated by the largest tile seen so far
+  std::fill(m_isWanted.begin(), m_isWanted.end(), false);
+  size_t cpuUsage = 0;
+  size_t gpuUsage = 0;
+  for(auto & currWanted : m_wanted)
+  {
+    if(cpuUsage + m_tileCpuEstimate > m_cpuBudget || gpuUsage + m_tileGpuEstimate > m_gpuBudget)
+    {
+      break;
+    }
+    cpuUsage += m_tileCpuEstimate;
+    gpuUsage += m_tileGpuEstimate;
+
+    m_isWanted[currWanted.second] = true;
+    m_tiles[currWanted.second].lastUsed = m_updateCount;
+  }
+
+  // Replace the request queue. Tiles already picked up by a worker stay queued until their result arrives
+  {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for(uint32_t currRequest : m_requests)
+    {
+      m_tiles[currRequest].state = TileState::Unloaded;
+    }
+    m_requests.clear();
+
+    for(auto & currWanted : m_wanted)
+    {
+      Tile & currTile = m_tiles[currWanted.second];
+      if(m_isWanted[currWanted.second] && currTile.state == TileState::Unloaded)
+      {
+        currTile.state = TileState::Queued;
+        m_requests.push_back(currWanted.second);
+      }
+    }
+  }
+  m_condition.notify_all();
+
+  // Upload finished loads, a few per update
+  uint32_t uploads = 0;
+  while(uploads < m_uploadsPerUpdate)
+  {
+    std::pair<uint32_t, kit::BakedTerrain::Data*> result;
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      if(m_results.empty())
+      {
+        break;
+      }
+      result = m_results.front();
+      m_results.pop_front();
+    }
+    m_condition.notify_all();
+
+    if(result.second == nullptr)
+    {
+      fail(result.first);
+      continue;
+    }
+
+    // The camera may have moved on while it was loading
+    if(!m_isWanted[result.first])
+    {
+      delete result.second;
+      m_tiles[result.first].state = TileState::Unloaded;
+      continue;
+    }
+
+    makeResident(result.first, result.second);
+    uploads++;
+  }
+
+  // Evict least recently used tiles until we are within budget. Tiles within load distance are never evicted
+  while(m_cpuUsage > m_cpuBudget || m_gpuUsage > m_gpuBudget)
+  {
+    int64_t oldest = -1;
+    for(uint32_t i = 0; i < m_tiles.size(); i++)
+    {
+      if(m_tiles[i].state == TileState::Resident && (oldest < 0 || m_tiles[i].lastUsed < m_tiles[oldest].lastUsed))
+      {
+        oldest = i;
+      }
+    }
+
+    if(oldest < 0 || m_tiles[oldest].lastUsed == m_updateCount)
+    {
+      break;
+    }
+
+    evict((uint32_t)oldest);
+  }
+}
+
+void kit::TerrainWorld::makeResident(uint32_t tile, kit::BakedTerrain::Data * data)
+{
+  Tile & currTile = m_tiles[tile];
+
+  if(data->size != glm::uvec2(m_tileResolution, m_tileResolution))
+  {
+    KIT_ERR("Warning: Terrain tile \"" << getTileName(tile) << "\" does not match the world tile size");
+    delete data;
+    fail(tile);
+    return;
+  }
+
+  try
+  {
+    currTile.terrain = new kit::BakedTerrain(data);
+  }
+  catch(kit::Exception & e)
+  {
+    KIT_ERR("Warning: Failed to create terrain tile \"" << getTileName(tile) << "\": " << e.what());
+    fail(tile);
+    return;
+  }
+
+  currTile.terrain->attachTo(this);
+  currTile.terrain->setPosition(getTileCenter(tile));
+  currTile.terrain->setDetailDistance(m_detailDistance);
+
+  // Stitch the shared edges with resident neighbours
+  glm::ivec2 position(tile % m_tileCount.x, tile / m_tileCount.x);
+  for(auto & direction : {glm::ivec2(1, 0), glm::ivec2(-1, 0), glm::ivec2(0, 1), glm::ivec2(0, -1)})
+  {
+    glm::ivec2 neighbour = position + direction;
+    if(neighbour.x < 0 || neighbour.y < 0 || neighbour.x >= int32_t(m_tileCount.x) || neighbour.y >= int32_t(m_tileCount.y))
+    {
+      continue;
+    }
+
+    Tile & neighbourTile = m_tiles[(neighbour.y * m_tileCount.x) + neighbour.x];
+    if(neighbourTile.state == TileState::Resident)
+    {
+      currTile.terrain->stitchEdge(neighbourTile.terrain, direction);
+    }
+  }
+
+  currTile.cpuBytes = currTile.terrain->getCpuMemoryUsage();
+  currTile.gpuBytes = currTile.terrain->getGpuMemoryUsage();
+  currTile.lastUsed = m_updateCount;
+  currTile.state = TileState::Resident;
+  currTile.failures = 0;
+
+  m_cpuUsage += currTile.cpuBytes;
+  m_gpuUsage += currTile.gpuBytes;
+  m_tileCpuEstimate = (glm::max)(m_tileCpuEstimate, currTile.cpuBytes);
+  m_tileGpuEstimate = (glm::max)(m_tileGpuEstimate, currTile.gpuBytes);
+}
+
+void kit::TerrainWorld::evict(uint32_t tile)
+{
+  Tile & currTile = m_tiles[tile];
+
+  if(currTile.terrain)
+    delete currTile.terrain;
+
+  currTile.terrain = nullptr;
+  currTile.state = TileState::Unloaded;
+
+  m_cpuUsage -= currTile.cpuBytes;
+  m_gpuUsage -= currTile.gpuBytes;
+  currTile.cpuBytes = 0;
+  currTile.gpuBytes = 0;
+}
+
+void kit::TerrainWorld::fail(uint32_t tile)
+{
+  Tile & currTile = m_tiles[tile];
+
+  // Back off exponentially, so a tile that is missing for good does not keep a worker busy
+  uint64_t delay = uint64_t(m_retryDelay) << (glm::min)(currTile.failures, 6u);
+  currTile.failures++;
+  currTile.retryAt = m_updateCount + delay;
+  currTile.state = TileState::Failed;
+
+  KIT_ERR("Warning: Terrain tile \"" << getTileName(tile) << "\" failed to load " << currTile.failures << " time(s), retrying in " << delay << " updates");
+}
+
+std::string kit::TerrainWorld::getTileName(uint32_t tile)
+{
+  return m_name + "/" + std::to_string(tile % m_tileCount.x) + "_" + std::to_string(tile / m_tileCount.x);
+}
+
+glm::vec3 kit::TerrainWorld::getTileCenter(uint32_t tile)
+{
+  float spacing = getTileSpacing();
+  return glm::vec3(float(tile % m_tileCount.x) * spacing, 0.0f, float(tile / m_tileCount.x) * spacing);
+}
+
+bool kit::TerrainWorld::findTile(float x, float z, kit::BakedTerrain *& terrain, glm::vec2 & local)
+{
+  glm::vec3 worldPosition = getWorldPosition();
+  glm::vec2 position(x - worldPosition.x, z - worldPosition.z);
+
+  // Tiles extend half their full size to the negative side of their center, and one vertex less to the positive side
+  float spacing = getTileSpacing();
+  float halfSize = float(m_tileResolution) * m_xzScale * 0.5f;
+
+  int32_t tx = (int32_t)glm::floor((position.x + halfSize) / spacing);
+  int32_t tz = (int32_t)glm::floor((position.y + halfSize) / spacing);
+  if(tx < 0 || tz < 0 || tx >= int32_t(m_tileCount.x) || tz >= int32_t(m_tileCount.y))
+  {
+    return false;
+  }
+
+  uint32_t tile = (tz * m_tileCount.x) + tx;
+  if(m_tiles[tile].state != TileState::Resident)
+  {
+    return false;
+  }
+
+  terrain = m_tiles[tile].terrain;
+  glm::vec3 center = getTileCenter(tile);
+  local = position - glm::vec2(center.x, center.z);
+  return true;
+}
+
+bool kit::TerrainWorld::sampleHeight(float x, float z, float & height)
+{
+  kit::BakedTerrain * terrain = nullptr;
+  glm::vec2 local;
+  if(!findTile(x, z, terrain, local))
+  {
+    return false;
+  }
+
+  height = terrain->sampleHeight(local.x, local.y) + getWorldPosition().y;
+  return true;
+}
+
+bool kit::TerrainWorld::sampleNormal(float x, float z, glm::vec3 & normal)
+{
+  kit::BakedTerrain * terrain = nullptr;
+  glm::vec2 local;
+  if(!findTile(x, z, terrain, local))
+  {
+    return false;
+  }
+
+  normal = terrain->sampleNormal(local.x, local.y);
+  return true;
+}
+
+void kit::TerrainWorld::renderDeferred(kit::Renderer * renderer)
+{
+  for(auto & currTile : m_tiles)
+  {
+    if(currTile.state == TileState::Resident)
+    {
+      currTile.terrain->renderDeferred(renderer);
+    }
+  }
+}
+
+void kit::TerrainWorld::renderGeometry()
+{
+  for(auto & currTile : m_tiles)
+  {
+    if(currTile.state == TileState::Resident)
+    {
+      currTile.terrain->renderGeometry();
+    }
+  }
+}
+
+void kit::TerrainWorld::renderShadows(glm::mat4 const & viewMatrix, glm::mat4 const & projectionMatrix)
+{
+  // Tiles still loading will cast shadows once they arrive, so cached shadow maps have to wait for them
+  m_shadowComplete = true;
+  for(auto & currTile : m_tiles)
+  {
+    if(currTile.state == TileState::Resident)
+    {
+      currTile.terrain->renderShadows(viewMatrix, projectionMatrix);
+      m_shadowComplete = currTile.terrain->isShadowComplete() && m_shadowComplete;
+    }
+    else if(currTile.state == TileState::Queued)
+    {
+      m_shadowComplete = false;
+    }
+  }
+}
+
+bool kit::TerrainWorld::isShadowComplete()
+{
+  return m_shadowComplete;
+}
+
+int32_t kit::TerrainWorld::getRenderPriority()
+{
+  // Same as a single baked terrain
+  return 990;
+}
+
+void kit::TerrainWorld::setLoadDistance(float meters)
+{
+  m_loadDistance = meters;
+}
+
+void kit::TerrainWorld::setCpuBudget(size_t bytes)
+{
+  m_cpuBudget = bytes;
+}
+
+void kit::TerrainWorld::setGpuBudget(size_t bytes)
+{
+  m_gpuBudget = bytes;
+}
+
+void kit::TerrainWorld::setUploadsPerUpdate(uint32_t uploads)
+{
+  m_uploadsPerUpdate = (glm::max)(uploads, 1u);
+}
+
+void kit::TerrainWorld::setDetailDistance(float meters)
+{
+  m_detailDistance = meters;
+  for(auto & currTile : m_tiles)
+  {
+    if(currTile.state == TileState::Resident)
+    {
+      currTile.terrain->setDetailDistance(meters);
+    }
+  }
+}
+
+void kit::TerrainWorld::setRetryDelay(uint32_t updates)
+{
+  m_retryDelay = updates;
+}
+
+void kit::TerrainWorld::retryFailedTiles()
+{
+  for(auto & currTile : m_tiles)
+  {
+    if(currTile.state == TileState::Failed)
+    {
+      currTile.state = TileState::Unloaded;
+      currTile.failures = 0;
+      currTile.retryAt = 0;
+    }
+  }
+}
+
+glm::uvec2 kit::TerrainWorld::getTileCount()
+{
+  return m_tileCount;
+}
+
+float kit::TerrainWorld::getTileSpacing()
+{
+  return float(m_tileResolution - 1) * m_xzScale;
+}
+
+kit::BakedTerrain * kit::TerrainWorld::getTile(uint32_t x, uint32_t y)
+{
+  if(x >= m_tileCount.x || y >= m_tileCount.y)
+  {
+    return nullptr;
+  }
+
+  Tile & currTile = m_tiles[(y * m_tileCount.x) + x];
+  return (currTile.state == TileState::Resident) ? currTile.terrain : nullptr;
+}
+
+size_t kit::TerrainWorld::getCpuMemoryUsage()
+{
+  return m_cpuUsage;
+}
+
+size_t kit::TerrainWorld::getGpuMemoryUsage()
+{
+  return m_gpuUsage;
+}
@@ -1,6 +1,7 @@
 #include "Kit/Text.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 #include "Kit/Texture.hpp"
 #include "Kit/Font.hpp"
 #include "Kit/Program.hpp"
@@ -54,11 +55,11 @@ void kit::Text::renderShadowed(glm::ivec2 resolution, glm::vec2 shadowOffset, gl
 
 void kit::Text::render(glm::ivec2 resolution)
 {
-  glDisable(GL_DEPTH_TEST);
-  glDisable(GL_CULL_FACE);
-  glDepthMask(GL_FALSE);
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  kit::GLState::setDepthTest(false);
+  kit::GLState::setCulling(false);
+  kit::GLState::setDepthWrite(false);
+  kit::GLState::setBlend(true);
+  kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   kit::Text::m_renderProgram->use();
   kit::Text::m_renderProgram->setUniform2f("uniform_resolution", glm::vec2(float(resolution.x), float(resolution.y)));
   
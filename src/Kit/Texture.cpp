@@ -3,6 +3,8 @@
 #include "Kit/IncOpenGL.hpp"
 #include "Kit/Exception.hpp"
 #include "Kit/Types.hpp"
+#include "Kit/GLState.hpp"
+#include "Kit/TextureCompressor.hpp"
 
 #include "Kit/stb/stb_image.h"
 #include "Kit/stb/stb_image_write.h"
@@ -30,6 +32,7 @@ kit::Texture::Texture(Type t)
 kit::Texture::~Texture()
 {
   std::cout << "Removing texture \"" << m_filename << "\"" << std::endl;
+  kit::GLState::forgetTexture(m_glHandle);
   glDeleteTextures(1, &m_glHandle);
   glGetError();
 }
@@ -55,7 +58,7 @@ kit::Texture::Texture(glm::uvec2 resolution, kit::Texture::InternalFormat format
   setAnisotropicLevel(1.0f);
 }
 
-kit::Texture::Texture(const std::string & filename, kit::Texture::InternalFormat format, uint8_t levels, Type t) : kit::Texture(t)
+kit::Texture::Texture(const std::string & filename, kit::Texture::InternalFormat format, uint8_t levels, Type t, Channels channels) : kit::Texture(t)
 {
   std::cout << "Loading texture from file \"" << filename.c_str() << "\"" << std::endl;
   m_filename = filename;
@@ -63,17 +66,67 @@ kit::Texture::Texture(const std::string & filename, kit::Texture::InternalFormat
   {
     m_internalFormat    = format;
 
-    // Try to load data from file
-    unsigned char* bufferdata;
+    if (filename.size() > 4 && filename.compare(filename.size() - 4, 4, ".dds") == 0)
+    {
+      loadCompressed(filename, format == SRGB8 || format == SRGB8Alpha8);
+      return;
+    }
+
     int x, y, n;
+    if (!stbi_info(filename.c_str(), &x, &y, &n))
+    {
+      KIT_THROW(stbi_failure_reason());
+    }
+
+    // Keep only the channels the texture needs
+    int keep = 4;
+    if (format == RGBA8)
+    {
+      if (channels == Channels::One || (channels == Channels::Detect && n == 1))
+      {
+        keep = 1;
+      }
+      else if (channels == Channels::Two || (channels == Channels::Detect && n == 2))
+      {
+        keep = 2;
+      }
+    }
+
+    // Try to load data from file. stb turns color into luminance, but shaders read red, so that is picked out by hand
+    unsigned char* bufferdata;
+    bool pickRed = (keep < 4 && n >= 3);
 
     stbi_set_flip_vertically_on_load(1);
-    bufferdata = stbi_load(filename.c_str(), &x, &y, &n, 4);
+    bufferdata = stbi_load(filename.c_str(), &x, &y, &n, pickRed ? 4 : keep);
     if (bufferdata == nullptr)
     {
       KIT_THROW(stbi_failure_reason());
     }
 
+    if (pickRed)
+    {
+      for (size_t i = 0; i < size_t(x) * size_t(y); i++)
+      {
+        bufferdata[i * keep] = bufferdata[i * 4];
+        if (keep == 2)
+        {
+          bufferdata[i * keep + 1] = bufferdata[i * 4 + 3];
+        }
+      }
+    }
+
+    Format dataFormat = RGBA;
+    if (keep == 1)
+    {
+      m_internalFormat = R8;
+      dataFormat = Red;
+    }
+    else if (keep == 2)
+    {
+      m_internalFormat = RG8;
+      dataFormat = RG;
+    }
+
     // Set resolution
     m_resolution        = glm::uvec3(x, y, 0);
 
@@ -82,16 +135,25 @@ kit::Texture::Texture(const std::string & filename, kit::Texture::InternalFormat
     // Specify storage and upload data to GPU
   #ifndef KIT_SHITTY_INTEL
     glTextureStorage2D(m_glHandle, mipLevels, m_internalFormat, m_resolution.x, m_resolution.y);
-    glTextureSubImage2D(m_glHandle, 0, 0, 0, x, y, GL_RGBA, GL_UNSIGNED_BYTE, bufferdata);
   #else
     bind();
     glTexStorage2D(m_type, mipLevels, m_internalFormat, m_resolution.x, m_resolution.y);
-    glTexSubImage2D(m_type, 0, 0, 0, x, y, GL_RGBA, GL_UNSIGNED_BYTE, bufferdata);
   #endif
+    setPixelData(bufferdata, 0, dataFormat);
 
     // Free loaded data
     stbi_image_free(bufferdata);
 
+    // Read back as the RGBA8 texture would have been
+    if (keep == 1)
+    {
+      setSwizzle(GL_RED, GL_RED, GL_RED, GL_ONE);
+    }
+    else if (keep == 2)
+    {
+      setSwizzle(GL_RED, GL_RED, GL_RED, GL_GREEN);
+    }
+
     // Set parameters
     setEdgeSamplingMode(EdgeSamplingMode::Repeat);
     setMinFilteringMode(m_minFilteringMode);
@@ -141,6 +203,74 @@ kit::Texture::Texture(const std::string & filename, kit::Texture::InternalFormat
   }
 }
 
+void kit::Texture::loadCompressed(const std::string & filename, bool srgb)
+{
+  kit::TextureCompressor::Format format;
+  bool fileSrgb = false;
+  std::vector<kit::TextureCompressor::Level> levels;
+  kit::TextureCompressor::readDDS(filename, format, fileSrgb, levels);
+
+  // DDS files are stored top row first, while kit keeps textures bottom row first
+  for (auto & currLevel : levels)
+  {
+    if (!kit::TextureCompressor::flipVertically(format, currLevel))
+    {
+      KIT_THROW("\"" + filename + "\" can not be flipped exactly, use BC1, BC3, BC4 or BC5 and heights that stay a multiple of 4 down to the 4 texel levels");
+    }
+  }
+
+  // Whether the texels are colors is up to the caller, the same as for uncompressed files
+  switch (format)
+  {
+    case kit::TextureCompressor::BC1: m_internalFormat = srgb ? BC1SRGBAlpha : BC1RGBA; break;
+    case kit::TextureCompressor::BC3: m_internalFormat = srgb ? BC3SRGBAlpha : BC3RGBA; break;
+    case kit::TextureCompressor::BC4: m_internalFormat = BC4Red; break;
+    case kit::TextureCompressor::BC5: m_internalFormat = BC5RG; break;
+    case kit::TextureCompressor::BC7: m_internalFormat = srgb ? BC7SRGBAlpha : BC7RGBA; break;
+  }
+
+  m_resolution = glm::uvec3(levels[0].resolution, 0);
+
+  // Upload every level as it is, compressed textures can not generate their own mipmaps
+#ifndef KIT_SHITTY_INTEL
+  glTextureStorage2D(m_glHandle, (GLsizei)levels.size(), m_internalFormat, m_resolution.x, m_resolution.y);
+  for (uint32_t i = 0; i < levels.size(); i++)
+  {
+    glCompressedTextureSubImage2D(m_glHandle, i, 0, 0, levels[i].resolution.x, levels[i].resolution.y, m_internalFormat, (GLsizei)levels[i].data.size(), &levels[i].data[0]);
+  }
+#else
+  bind();
+  glTexStorage2D(m_type, (GLsizei)levels.size(), m_internalFormat, m_resolution.x, m_resolution.y);
+  for (uint32_t i = 0; i < levels.size(); i++)
+  {
+    glCompressedTexSubImage2D(m_type, i, 0, 0, levels[i].resolution.x, levels[i].resolution.y, m_internalFormat, (GLsizei)levels[i].data.size(), &levels[i].data[0]);
+  }
+#endif
+
+  // Masks read as gray, like the uncompressed files they replace
+  if (m_internalFormat == BC4Red)
+  {
+    setSwizzle(GL_RED, GL_RED, GL_RED, GL_ONE);
+  }
+
+  setEdgeSamplingMode(EdgeSamplingMode::Repeat);
+  setMinFilteringMode(m_minFilteringMode);
+  setMagFilteringMode(m_magFilteringMode);
+
+  setAnisotropicLevel(1.0f);
+}
+
+void kit::Texture::setSwizzle(uint32_t r, uint32_t g, uint32_t b, uint32_t a)
+{
+  GLint swizzle[4] = { GLint(r), GLint(g), GLint(b), GLint(a) };
+#ifndef KIT_SHITTY_INTEL
+  glTextureParameteriv(m_glHandle, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+#else
+  bind();
+  glTexParameteriv(m_type, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+#endif
+}
+
 kit::Texture * kit::Texture::createShadowmap(glm::uvec2 resolution)
 {
   kit::Texture * returner = new kit::Texture(resolution, kit::Texture::DepthComponent24, 1);
@@ -153,9 +283,9 @@ kit::Texture * kit::Texture::createShadowmap(glm::uvec2 resolution)
   return returner;
 }
 
-std::shared_ptr<kit::Texture> kit::Texture::load(const std::string & name, bool sRGB)
+std::shared_ptr<kit::Texture> kit::Texture::load(const std::string & name, bool sRGB, Channels channels)
 {
-  std::string key = name + (sRGB ? ".sRGB" : ".linear");
+  std::string key = name + (sRGB ? ".sRGB" : ".linear") + "." + std::to_string(uint32_t(channels));
   InternalFormat format = sRGB ? SRGB8Alpha8 : RGBA8;
   std::string path = kit::getDataDirectory() + "textures/" + name;
   
@@ -164,7 +294,13 @@ std::shared_ptr<kit::Texture> kit::Texture::load(const std::string & name, bool
   
   if(!sharedEntry)
   {
-    entry = sharedEntry = std::make_shared<kit::Texture>(path, format);
+    // Prefer the compressed version, if one was made
+    if (std::ifstream(path + ".dds"))
+    {
+      path += ".dds";
+    }
+
+    entry = sharedEntry = std::make_shared<kit::Texture>(path, format, 0, Type::Texture2D, channels);
     sharedEntry->setMinFilteringMode(FilteringMode::LinearMipmapLinear);
     sharedEntry->setMagFilteringMode(FilteringMode::Linear);
     sharedEntry->setAnisotropicLevel(4.0f);
@@ -192,8 +328,47 @@ uint32_t kit::Texture::calculateMipLevels()
   return (miplevels > 6 ? 6 : miplevels);
 }
 
+void kit::Texture::setPixelData(const uint8_t * data, uint32_t level, Format format)
+{
+  glm::uvec2 size = getLevelResolution(level);
+
+  // Rows of one or two channels are not padded to four bytes
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+#ifndef KIT_SHITTY_INTEL
+  glTextureSubImage2D(m_glHandle, level, 0, 0, size.x, size.y, format, GL_UNSIGNED_BYTE, data);
+#else
+  bind();
+  glTexSubImage2D(m_type, level, 0, 0, size.x, size.y, format, GL_UNSIGNED_BYTE, data);
+#endif
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+std::vector<uint8_t> kit::Texture::getPixelData(uint32_t level)
+{
+  glm::uvec2 size = getLevelResolution(level);
+  std::vector<uint8_t> data(size_t(size.x) * size_t(size.y) * 4);
+#ifndef KIT_SHITTY_INTEL
+  glGetTextureImage(m_glHandle, level, GL_RGBA, GL_UNSIGNED_BYTE, (GLsizei)data.size(), &data[0]);
+#else
+  bind();
+  glGetTexImage(m_type, level, GL_RGBA, GL_UNSIGNED_BYTE, &data[0]);
+#endif
+  return data;
+}
+
+glm::uvec2 kit::Texture::getLevelResolution(uint32_t level)
+{
+  return glm::max(glm::uvec2(m_resolution.x >> level, m_resolution.y >> level), glm::uvec2(1, 1));
+}
+
 void kit::Texture::generateMipmap()
 {
+  // Compressed textures bring their own mipmaps
+  if (isCompressed())
+  {
+    return;
+  }
+
 #ifndef KIT_SHITTY_INTEL
   glGenerateTextureMipmap(m_glHandle);
 #else
@@ -204,12 +379,13 @@ void kit::Texture::generateMipmap()
 
 void kit::Texture::bind()
 {
-  glBindTexture(m_type, m_glHandle);
+  // Through the tracker, so the texture it thinks is bound to the first unit stays right
+  kit::GLState::bindTexture(0, m_type, m_glHandle);
 }
 
 void kit::Texture::unbind(kit::Texture::Type t)
 {
-  glBindTexture(t, 0);
+  kit::GLState::bindTexture(0, t, 0);
 }
 
 glm::vec4 kit::Texture::getPixelFloat(glm::vec3 position)
@@ -441,11 +617,35 @@ uint32_t kit::Texture::getHandle()
   return m_glHandle;
 }
 
+kit::Texture::Type kit::Texture::getType()
+{
+  return m_type;
+}
+
 kit::Texture::InternalFormat kit::Texture::getInternalFormat()
 {
   return m_internalFormat;
 }
 
+bool kit::Texture::isCompressed()
+{
+  switch (m_internalFormat)
+  {
+    case BC1RGBA:
+    case BC1SRGBAlpha:
+    case BC3RGBA:
+    case BC3SRGBAlpha:
+    case BC4Red:
+    case BC5RG:
+    case BC7RGBA:
+    case BC7SRGBAlpha:
+      return true;
+
+    default:
+      return false;
+  }
+}
+
 bool kit::Texture::saveToFile(const std::string&filename)
 {
   // Fetch data from GPU
@@ -0,0 +1,702 @@
+#include "Kit/TextureCompressor.hpp"
+
+#include "Kit/Exception.hpp"
+
+#include "Kit/stb/stb_image.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+  uint32_t const ddsMagic = 0x20534444; // "DDS "
+
+  uint32_t const ddsCaps = 0x1;
+  uint32_t const ddsHeight = 0x2;
+  uint32_t const ddsWidth = 0x4;
+  uint32_t const ddsPixelFormat = 0x1000;
+  uint32_t const ddsMipmapCount = 0x20000;
+  uint32_t const ddsLinearSize = 0x80000;
+  uint32_t const ddsFourCC = 0x4;
+  uint32_t const ddsCapsComplex = 0x8;
+  uint32_t const ddsCapsTexture = 0x1000;
+  uint32_t const ddsCapsMipmap = 0x400000;
+  uint32_t const ddsCaps2Cubemap = 0x200;
+  uint32_t const ddsCaps2Volume = 0x200000;
+  uint32_t const ddsDimensionTexture2D = 3;
+
+  // DXGI_FORMAT values of the formats kit knows
+  uint32_t const dxgiBC1 = 71;
+  uint32_t const dxgiBC1SRGB = 72;
+  uint32_t const dxgiBC3 = 77;
+  uint32_t const dxgiBC3SRGB = 78;
+  uint32_t const dxgiBC4 = 80;
+  uint32_t const dxgiBC5 = 83;
+  uint32_t const dxgiBC7 = 98;
+  uint32_t const dxgiBC7SRGB = 99;
+
+  constexpr uint32_t fourCC(char a, char b, char c, char d)
+  {
+    return uint32_t(uint8_t(a)) | (uint32_t(uint8_t(b)) << 8) | (uint32_t(uint8_t(c)) << 16) | (uint32_t(uint8_t(d)) << 24);
+  }
+
+  // The fixed part of a DDS file after the magic, without the optional DX10 extension
+  struct DDSHeader
+  {
+    uint32_t size = 124;
+    uint32_t flags = 0;
+    uint32_t height = 0;
+    uint32_t width = 0;
+    uint32_t pitchOrLinearSize = 0;
+    uint32_t depth = 0;
+    uint32_t mipmapCount = 0;
+    uint32_t reserved1[11] = { 0 };
+    uint32_t formatSize = 32;
+    uint32_t formatFlags = 0;
+    uint32_t formatFourCC = 0;
+    uint32_t formatBitCount = 0;
+    uint32_t formatMasks[4] = { 0 };
+    uint32_t caps = 0;
+    uint32_t caps2 = 0;
+    uint32_t caps3 = 0;
+    uint32_t caps4 = 0;
+    uint32_t reserved2 = 0;
+  };
+
+  struct DDSHeaderDX10
+  {
+    uint32_t dxgiFormat = 0;
+    uint32_t resourceDimension = ddsDimensionTexture2D;
+    uint32_t miscFlag = 0;
+    uint32_t arraySize = 1;
+    uint32_t miscFlags2 = 0;
+  };
+
+  static_assert(sizeof(DDSHeader) == 124, "DDS header must be packed");
+  static_assert(sizeof(DDSHeaderDX10) == 20, "DDS DX10 header must be packed");
+
+  uint32_t toDXGI(kit::TextureCompressor::Format format, bool srgb)
+  {
+    switch (format)
+    {
+      case kit::TextureCompressor::BC1: return srgb ? dxgiBC1SRGB : dxgiBC1;
+      case kit::TextureCompressor::BC3: return srgb ? dxgiBC3SRGB : dxgiBC3;
+      case kit::TextureCompressor::BC4: return dxgiBC4;
+      case kit::TextureCompressor::BC5: return dxgiBC5;
+      case kit::TextureCompressor::BC7: return srgb ? dxgiBC7SRGB : dxgiBC7;
+    }
+
+    return dxgiBC1;
+  }
+
+  bool fromDXGI(uint32_t dxgi, kit::TextureCompressor::Format & format, bool & srgb)
+  {
+    srgb = (dxgi == dxgiBC1SRGB || dxgi == dxgiBC3SRGB || dxgi == dxgiBC7SRGB);
+    switch (dxgi)
+    {
+      case dxgiBC1: case dxgiBC1SRGB: format = kit::TextureCompressor::BC1; return true;
+      case dxgiBC3: case dxgiBC3SRGB: format = kit::TextureCompressor::BC3; return true;
+      case dxgiBC4: format = kit::TextureCompressor::BC4; return true;
+      case dxgiBC5: format = kit::TextureCompressor::BC5; return true;
+      case dxgiBC7: case dxgiBC7SRGB: format = kit::TextureCompressor::BC7; return true;
+    }
+
+    return false;
+  }
+
+  // ---- Block encoders
+
+  uint16_t packColor(glm::vec3 const & color)
+  {
+    glm::vec3 c = glm::clamp(color, glm::vec3(0.0f), glm::vec3(255.0f));
+    uint32_t r = uint32_t(c.r * 31.0f / 255.0f + 0.5f);
+    uint32_t g = uint32_t(c.g * 63.0f / 255.0f + 0.5f);
+    uint32_t b = uint32_t(c.b * 31.0f / 255.0f + 0.5f);
+    return uint16_t((r << 11) | (g << 5) | b);
+  }
+
+  glm::vec3 unpackColor(uint16_t color)
+  {
+    uint32_t r = (color >> 11) & 31;
+    uint32_t g = (color >> 5) & 63;
+    uint32_t b = color & 31;
+    return glm::vec3(float((r << 3) | (r >> 2)), float((g << 2) | (g >> 4)), float((b << 3) | (b >> 2)));
+  }
+
+  // Endpoints along the principal axis of the colors, each index picks the closest of the four palette entries
+  void encodeColorBlock(glm::vec3 const (&texels)[16], uint8_t * out)
+  {
+    glm::vec3 mean(0.0f);
+    glm::vec3 minColor(255.0f);
+    glm::vec3 maxColor(0.0f);
+    for (auto & currTexel : texels)
+    {
+      mean += currTexel;
+      minColor = glm::min(minColor, currTexel);
+      maxColor = glm::max(maxColor, currTexel);
+    }
+    mean /= 16.0f;
+
+    // Covariance, as the upper triangle
+    float cov[6] = { 0.0f };
+    for (auto & currTexel : texels)
+    {
+      glm::vec3 d = currTexel - mean;
+      cov[0] += d.r * d.r; cov[1] += d.r * d.g; cov[2] += d.r * d.b;
+      cov[3] += d.g * d.g; cov[4] += d.g * d.b;
+      cov[5] += d.b * d.b;
+    }
+
+    // A few rounds of power iteration, starting from the bounding box diagonal
+    glm::vec3 axis = maxColor - minColor;
+    for (uint32_t i = 0; i < 8; i++)
+    {
+      glm::vec3 next(
+        cov[0] * axis.r + cov[1] * axis.g + cov[2] * axis.b,
+        cov[1] * axis.r + cov[3] * axis.g + cov[4] * axis.b,
+        cov[2] * axis.r + cov[4] * axis.g + cov[5] * axis.b);
+      float length = glm::length(next);
+      if (length < 0.0001f)
+      {
+        break;
+      }
+      axis = next / length;
+    }
+
+    float axisLength = glm::length(axis);
+    if (axisLength > 0.0001f)
+    {
+      axis /= axisLength;
+    }
+
+    float minT = 0.0f;
+    float maxT = 0.0f;
+    for (auto & currTexel : texels)
+    {
+      float t = glm::dot(currTexel - mean, axis);
+      minT = (std::min)(minT, t);
+      maxT = (std::max)(maxT, t);
+    }
+
+    // Pull the endpoints in a little, the extremes are rarely worth an exact palette entry
+    float inset = (maxT - minT) / 16.0f;
+    uint16_t color0 = packColor(mean + axis * (maxT - inset));
+    uint16_t color1 = packColor(mean + axis * (minT + inset));
+
+    // color0 must be the larger one for the four-color mode
+    if (color0 < color1)
+    {
+      std::swap(color0, color1);
+    }
+
+    out[0] = uint8_t(color0 & 0xFF);
+    out[1] = uint8_t(color0 >> 8);
+    out[2] = uint8_t(color1 & 0xFF);
+    out[3] = uint8_t(color1 >> 8);
+
+    uint32_t indices = 0;
+    if (color0 != color1)
+    {
+      glm::vec3 palette[4];
+      palette[0] = unpackColor(color0);
+      palette[1] = unpackColor(color1);
+      palette[2] = (palette[0] * 2.0f + palette[1]) / 3.0f;
+      palette[3] = (palette[0] + palette[1] * 2.0f) / 3.0f;
+
+      for (uint32_t i = 0; i < 16; i++)
+      {
+        uint32_t best = 0;
+        float bestDistance = 1e30f;
+        for (uint32_t p = 0; p < 4; p++)
+        {
+          glm::vec3 d = texels[i] - palette[p];
+          float distance = glm::dot(d, d);
+          if (distance < bestDistance)
+          {
+            best = p;
+            bestDistance = distance;
+          }
+        }
+        indices |= best << (i * 2);
+      }
+    }
+
+    out[4] = uint8_t(indices);
+    out[5] = uint8_t(indices >> 8);
+    out[6] = uint8_t(indices >> 16);
+    out[7] = uint8_t(indices >> 24);
+  }
+
+  // Endpoints at the range of the values, in the eight-value mode
+  void encodeChannelBlock(uint8_t const (&texels)[16], uint8_t * out)
+  {
+    uint8_t minValue = 255;
+    uint8_t maxValue = 0;
+    for (auto currTexel : texels)
+    {
+      minValue = (std::min)(minValue, currTexel);
+      maxValue = (std::max)(maxValue, currTexel);
+    }
+
+    out[0] = maxValue;
+    out[1] = minValue;
+
+    uint64_t indices = 0;
+    if (maxValue != minValue)
+    {
+      // Index 0 and 1 are the endpoints, 2 to 7 step from the first towards the second
+      float palette[8];
+      palette[0] = float(maxValue);
+      palette[1] = float(minValue);
+      for (uint32_t i = 1; i < 7; i++)
+      {
+        palette[i + 1] = (float(7 - i) * float(maxValue) + float(i) * float(minValue)) / 7.0f;
+      }
+
+      for (uint32_t i = 0; i < 16; i++)
+      {
+        uint64_t best = 0;
+        float bestDistance = 1e30f;
+        for (uint32_t p = 0; p < 8; p++)
+        {
+          float distance = std::abs(float(texels[i]) - palette[p]);
+          if (distance < bestDistance)
+          {
+            best = p;
+            bestDistance = distance;
+          }
+        }
+        indices |= best << (i * 3);
+      }
+    }
+
+    for (uint32_t i = 0; i < 6; i++)
+    {
+      out[2 + i] = uint8_t(indices >> (i * 8));
+    }
+  }
+
+  // ---- Vertical flipping
+
+  // Reorders the 2-bit index rows of a BC1 color block, one byte each. rows[i] is the row that ends up in row i
+  void flipColorBlock(uint8_t * block, uint32_t const rows[4])
+  {
+    uint8_t indices[4] = { block[4], block[5], block[6], block[7] };
+    for (uint32_t i = 0; i < 4; i++)
+    {
+      block[4 + i] = indices[rows[i]];
+    }
+  }
+
+  // Reorders the 3-bit index rows of a BC4 block, 12 bits each after the two endpoints
+  void flipAlphaBlock(uint8_t * block, uint32_t const rows[4])
+  {
+    uint64_t indices = 0;
+    for (uint32_t i = 0; i < 6; i++)
+    {
+      indices |= uint64_t(block[2 + i]) << (i * 8);
+    }
+
+    uint64_t flipped = 0;
+    for (uint32_t i = 0; i < 4; i++)
+    {
+      flipped |= ((indices >> (rows[i] * 12)) & 0xFFF) << (i * 12);
+    }
+
+    for (uint32_t i = 0; i < 6; i++)
+    {
+      block[2 + i] = uint8_t(flipped >> (i * 8));
+    }
+  }
+
+  // ---- Mipmap filtering
+
+  float srgbToLinear(float v)
+  {
+    return v <= 0.04045f ? v / 12.92f : std::pow((v + 0.055f) / 1.055f, 2.4f);
+  }
+
+  float linearToSrgb(float v)
+  {
+    return v <= 0.0031308f ? v * 12.92f : 1.055f * std::pow(v, 1.0f / 2.4f) - 0.055f;
+  }
+
+  uint8_t toByte(float v)
+  {
+    return uint8_t(glm::clamp(v, 0.0f, 1.0f) * 255.0f + 0.5f);
+  }
+}
+
+kit::TextureCompressor::Format kit::TextureCompressor::getFormat(kit::TextureCompressor::Usage usage)
+{
+  switch (usage)
+  {
+    case Color: return BC1;
+    case ColorAlpha: return BC3;
+    case NormalMap: return BC5;
+    case Mask: return BC4;
+  }
+
+  return BC1;
+}
+
+uint32_t kit::TextureCompressor::getBlockSize(kit::TextureCompressor::Format format)
+{
+  return (format == BC1 || format == BC4) ? 8 : 16;
+}
+
+size_t kit::TextureCompressor::getLevelSize(kit::TextureCompressor::Format format, glm::uvec2 resolution)
+{
+  return size_t((resolution.x + 3) / 4) * size_t((resolution.y + 3) / 4) * getBlockSize(format);
+}
+
+std::vector<uint8_t> kit::TextureCompressor::encode(const uint8_t * rgba, glm::uvec2 resolution, kit::TextureCompressor::Format format)
+{
+  if (format == BC7)
+  {
+    KIT_THROW("BC7 encoding is not supported, use BC1 or BC3");
+  }
+
+  std::vector<uint8_t> returner(getLevelSize(format, resolution));
+  uint32_t blockSize = getBlockSize(format);
+  glm::uvec2 blocks((resolution.x + 3) / 4, (resolution.y + 3) / 4);
+
+  for (uint32_t by = 0; by < blocks.y; by++)
+  {
+    for (uint32_t bx = 0; bx < blocks.x; bx++)
+    {
+      // Gather the block, repeating the last row and column where it hangs over the edge
+      uint8_t texels[16][4];
+      for (uint32_t y = 0; y < 4; y++)
+      {
+        for (uint32_t x = 0; x < 4; x++)
+        {
+          uint32_t sx = (std::min)(bx * 4 + x, resolution.x - 1);
+          uint32_t sy = (std::min)(by * 4 + y, resolution.y - 1);
+          const uint8_t * texel = rgba + (size_t(sy) * resolution.x + sx) * 4;
+          std::copy(texel, texel + 4, texels[y * 4 + x]);
+        }
+      }
+
+      uint8_t * out = &returner[(size_t(by) * blocks.x + bx) * blockSize];
+
+      glm::vec3 colors[16];
+      uint8_t channel[16];
+      switch (format)
+      {
+        case BC1:
+          for (uint32_t i = 0; i < 16; i++) colors[i] = glm::vec3(texels[i][0], texels[i][1], texels[i][2]);
+          encodeColorBlock(colors, out);
+          break;
+
+        case BC3:
+          for (uint32_t i = 0; i < 16; i++) channel[i] = texels[i][3];
+          encodeChannelBlock(channel, out);
+          for (uint32_t i = 0; i < 16; i++) colors[i] = glm::vec3(texels[i][0], texels[i][1], texels[i][2]);
+          encodeColorBlock(colors, out + 8);
+          break;
+
+        case BC4:
+          for (uint32_t i = 0; i < 16; i++) channel[i] = texels[i][0];
+          encodeChannelBlock(channel, out);
+          break;
+
+        case BC5:
+          for (uint32_t i = 0; i < 16; i++) channel[i] = texels[i][0];
+          encodeChannelBlock(channel, out);
+          for (uint32_t i = 0; i < 16; i++) channel[i] = texels[i][1];
+          encodeChannelBlock(channel, out + 8);
+          break;
+
+        case BC7:
+          break;
+      }
+    }
+  }
+
+  return returner;
+}
+
+std::vector<uint8_t> kit::TextureCompressor::downsample(const uint8_t * rgba, glm::uvec2 resolution, bool srgb, bool normalMap)
+{
+  glm::uvec2 target = glm::max(resolution / 2u, glm::uvec2(1, 1));
+  std::vector<uint8_t> returner(size_t(target.x) * size_t(target.y) * 4);
+
+  for (uint32_t y = 0; y < target.y; y++)
+  {
+    for (uint32_t x = 0; x < target.x; x++)
+    {
+      glm::vec4 sum(0.0f);
+      for (uint32_t i = 0; i < 4; i++)
+      {
+        uint32_t sx = (std::min)(x * 2 + (i & 1), resolution.x - 1);
+        uint32_t sy = (std::min)(y * 2 + (i >> 1), resolution.y - 1);
+        const uint8_t * texel = rgba + (size_t(sy) * resolution.x + sx) * 4;
+        glm::vec4 value = glm::vec4(texel[0], texel[1], texel[2], texel[3]) / 255.0f;
+
+        if (srgb)
+        {
+          value = glm::vec4(srgbToLinear(value.r), srgbToLinear(value.g), srgbToLinear(value.b), value.a);
+        }
+        else if (normalMap)
+        {
+          value = glm::vec4(glm::vec3(value) * 2.0f - 1.0f, value.a);
+        }
+
+        sum += value;
+      }
+      sum /= 4.0f;
+
+      if (srgb)
+      {
+        sum = glm::vec4(linearToSrgb(sum.r), linearToSrgb(sum.g), linearToSrgb(sum.b), sum.a);
+      }
+      else if (normalMap)
+      {
+        glm::vec3 normal = glm::vec3(sum);
+        float length = glm::length(normal);
+        normal = length > 0.0001f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+        sum = glm::vec4(normal * 0.5f + 0.5f, sum.a);
+      }
+
+      uint8_t * out = &returner[(size_t(y) * target.x + x) * 4];
+      out[0] = toByte(sum.r);
+      out[1] = toByte(sum.g);
+      out[2] = toByte(sum.b);
+      out[3] = toByte(sum.a);
+    }
+  }
+
+  return returner;
+}
+
+bool kit::TextureCompressor::flipVertically(kit::TextureCompressor::Format format, kit::TextureCompressor::Level & level)
+{
+  // Its blocks would have to be decoded and encoded again, since where the index rows are depends on the block mode
+  if (format == BC7)
+  {
+    return false;
+  }
+
+  uint32_t blockSize = getBlockSize(format);
+  glm::uvec2 blocks((level.resolution.x + 3) / 4, (level.resolution.y + 3) / 4);
+  size_t rowSize = size_t(blocks.x) * blockSize;
+
+  // Swap whole rows of blocks
+  for (uint32_t y = 0; y < blocks.y / 2; y++)
+  {
+    auto top = level.data.begin() + y * rowSize;
+    auto bottom = level.data.begin() + (blocks.y - 1 - y) * rowSize;
+    std::swap_ranges(top, top + rowSize, bottom);
+  }
+
+  // Then the texel rows inside each block. Levels less than 4 texels high only fill the first rows of their blocks
+  uint32_t height = (std::min)(level.resolution.y, 4u);
+  uint32_t rows[4] = { 0, 1, 2, 3 };
+  for (uint32_t i = 0; i < height; i++)
+  {
+    rows[i] = height - 1 - i;
+  }
+
+  for (size_t offset = 0; offset + blockSize <= level.data.size(); offset += blockSize)
+  {
+    uint8_t * block = &level.data[offset];
+    switch (format)
+    {
+      case BC1: flipColorBlock(block, rows); break;
+      case BC3: flipAlphaBlock(block, rows); flipColorBlock(block + 8, rows); break;
+      case BC4: flipAlphaBlock(block, rows); break;
+      case BC5: flipAlphaBlock(block, rows); flipAlphaBlock(block + 8, rows); break;
+      default: break;
+    }
+  }
+
+  // Only whole blocks can move, so other heights end up shifted by the rows padding their last block
+  return level.resolution.y < 4 || level.resolution.y % 4 == 0;
+}
+
+bool kit::TextureCompressor::compressFile(const std::string& source, const std::string& destination, kit::TextureCompressor::Usage usage, bool srgb)
+{
+  // Top row first, like every other DDS file
+  int x, y, n;
+  stbi_set_flip_vertically_on_load(0);
+  unsigned char * bufferdata = stbi_load(source.c_str(), &x, &y, &n, 4);
+  if (bufferdata == nullptr)
+  {
+    KIT_ERR(stbi_failure_reason());
+    return false;
+  }
+
+  // kit::Texture refuses files it can not flip exactly
+  for (int height = y; height >= 4; height /= 2)
+  {
+    if (height % 4 != 0)
+    {
+      KIT_ERR("Warning: \"" << source << "\" is " << y << " texels high, which does not stay a multiple of 4 down to the 4 texel levels");
+      stbi_image_free(bufferdata);
+      return false;
+    }
+  }
+
+  Format format = getFormat(usage);
+  bool filterSrgb = srgb && (usage == Color || usage == ColorAlpha);
+
+  std::vector<uint8_t> current(bufferdata, bufferdata + size_t(x) * size_t(y) * 4);
+  stbi_image_free(bufferdata);
+
+  std::vector<Level> levels;
+  glm::uvec2 resolution(x, y);
+  while (true)
+  {
+    Level newLevel;
+    newLevel.resolution = resolution;
+    newLevel.data = encode(&current[0], resolution, format);
+    levels.push_back(newLevel);
+
+    if (resolution.x == 1 && resolution.y == 1)
+    {
+      break;
+    }
+
+    current = downsample(&current[0], resolution, filterSrgb, usage == NormalMap);
+    resolution = glm::max(resolution / 2u, glm::uvec2(1, 1));
+  }
+
+  if (!writeDDS(destination, format, filterSrgb, levels))
+  {
+    return false;
+  }
+
+  size_t compressedSize = 0;
+  for (auto & currLevel : levels)
+  {
+    compressedSize += currLevel.data.size();
+  }
+
+  std::cout << "Saved " << destination << " (" << compressedSize / 1024 << " KiB, " << levels.size() << " levels)" << std::endl;
+  return true;
+}
+
+bool kit::TextureCompressor::writeDDS(const std::string& filename, kit::TextureCompressor::Format format, bool srgb, std::vector<kit::TextureCompressor::Level> const & levels)
+{
+  if (levels.empty())
+  {
+    KIT_ERR("Warning: no levels to write");
+    return false;
+  }
+
+  std::ofstream fhandle(filename, std::ios::binary);
+  if (!fhandle)
+  {
+    KIT_ERR("Warning: could not open file for writing");
+    return false;
+  }
+
+  DDSHeader header;
+  header.flags = ddsCaps | ddsHeight | ddsWidth | ddsPixelFormat | ddsMipmapCount | ddsLinearSize;
+  header.height = levels[0].resolution.y;
+  header.width = levels[0].resolution.x;
+  header.pitchOrLinearSize = (uint32_t)levels[0].data.size();
+  header.mipmapCount = (uint32_t)levels.size();
+  header.formatFlags = ddsFourCC;
+  header.formatFourCC = fourCC('D', 'X', '1', '0');
+  header.caps = ddsCapsTexture | (levels.size() > 1 ? ddsCapsComplex | ddsCapsMipmap : 0);
+
+  DDSHeaderDX10 headerDX10;
+  headerDX10.dxgiFormat = toDXGI(format, srgb);
+
+  fhandle.write(reinterpret_cast<const char*>(&ddsMagic), sizeof(ddsMagic));
+  fhandle.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  fhandle.write(reinterpret_cast<const char*>(&headerDX10), sizeof(headerDX10));
+  for (auto & currLevel : levels)
+  {
+    fhandle.write(reinterpret_cast<const char*>(&currLevel.data[0]), currLevel.data.size());
+  }
+
+  if (!fhandle)
+  {
+    KIT_ERR("Warning: failed to write DDS file");
+    return false;
+  }
+
+  return true;
+}
+
+void kit::TextureCompressor::readDDS(const std::string& filename, kit::TextureCompressor::Format & format, bool & srgb, std::vector<kit::TextureCompressor::Level> & levels)
+{
+  std::ifstream fhandle(filename, std::ios::binary);
+  if (!fhandle)
+  {
+    KIT_THROW("Could not open DDS file");
+  }
+
+  uint32_t magic = 0;
+  DDSHeader header;
+  fhandle.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  fhandle.read(reinterpret_cast<char*>(&header), sizeof(header));
+  if (!fhandle || magic != ddsMagic || header.size != sizeof(DDSHeader) || (header.formatFlags & ddsFourCC) == 0)
+  {
+    KIT_THROW("Not a compressed DDS file");
+  }
+
+  if ((header.caps2 & (ddsCaps2Cubemap | ddsCaps2Volume)) != 0)
+  {
+    KIT_THROW("Only 2D DDS textures are supported");
+  }
+
+  srgb = false;
+  switch (header.formatFourCC)
+  {
+    case fourCC('D', 'X', 'T', '1'): format = BC1; break;
+    case fourCC('D', 'X', 'T', '5'): format = BC3; break;
+    case fourCC('A', 'T', 'I', '1'): case fourCC('B', 'C', '4', 'U'): format = BC4; break;
+    case fourCC('A', 'T', 'I', '2'): case fourCC('B', 'C', '5', 'U'): format = BC5; break;
+
+    case fourCC('D', 'X', '1', '0'):
+    {
+      DDSHeaderDX10 headerDX10;
+      fhandle.read(reinterpret_cast<char*>(&headerDX10), sizeof(headerDX10));
+      if (!fhandle || headerDX10.resourceDimension != ddsDimensionTexture2D || headerDX10.arraySize > 1)
+      {
+        KIT_THROW("Only 2D DDS textures are supported");
+      }
+
+      if (!fromDXGI(headerDX10.dxgiFormat, format, srgb))
+      {
+        KIT_THROW("Unsupported DDS format, use BC1, BC3, BC4, BC5 or BC7");
+      }
+      break;
+    }
+
+    default:
+      KIT_THROW("Unsupported DDS format, use BC1, BC3, BC4, BC5 or BC7");
+  }
+
+  uint32_t levelCount = (header.flags & ddsMipmapCount) && header.mipmapCount > 0 ? header.mipmapCount : 1;
+  glm::uvec2 resolution(header.width, header.height);
+  if (resolution.x == 0 || resolution.y == 0)
+  {
+    KIT_THROW("DDS file has no texels");
+  }
+
+  levels.clear();
+  for (uint32_t i = 0; i < levelCount; i++)
+  {
+    Level newLevel;
+    newLevel.resolution = resolution;
+    newLevel.data.resize(getLevelSize(format, resolution));
+    if (!fhandle.read(reinterpret_cast<char*>(&newLevel.data[0]), newLevel.data.size()))
+    {
+      KIT_THROW("DDS file is truncated");
+    }
+    levels.push_back(newLevel);
+
+    if (resolution.x == 1 && resolution.y == 1)
+    {
+      break;
+    }
+    resolution = glm::max(resolution / 2u, glm::uvec2(1, 1));
+  }
+}
@@ -20,6 +20,7 @@
 #include <fstream>
 #include <algorithm>
 #include <random>
+#include <limits>
 #include <glm/gtc/quaternion.hpp>
 
 std::string kit::getDataDirectory(kit::DataSource source)
@@ -792,6 +793,109 @@ kit::Vertex::Vertex()
   this->m_texCoords = glm::vec2(0.0f, 0.0f);
 }
 
+kit::AABB::AABB()
+{
+  m_min = glm::vec3(std::numeric_limits<float>::max());
+  m_max = glm::vec3(-std::numeric_limits<float>::max());
+}
+
+kit::AABB::AABB(glm::vec3 const & min, glm::vec3 const & max)
+{
+  m_min = min;
+  m_max = max;
+}
+
+bool kit::AABB::isValid() const
+{
+  return m_min.x <= m_max.x && m_min.y <= m_max.y && m_min.z <= m_max.z;
+}
+
+void kit::AABB::expand(glm::vec3 const & point)
+{
+  m_min = glm::min(m_min, point);
+  m_max = glm::max(m_max, point);
+}
+
+void kit::AABB::expand(kit::AABB const & box)
+{
+  if(!box.isValid())
+  {
+    return;
+  }
+
+  m_min = glm::min(m_min, box.m_min);
+  m_max = glm::max(m_max, box.m_max);
+}
+
+bool kit::AABB::intersects(kit::AABB const & box) const
+{
+  return glm::all(glm::lessThanEqual(m_min, box.m_max)) && glm::all(glm::greaterThanEqual(m_max, box.m_min));
+}
+
+kit::AABB kit::AABB::transformed(glm::mat4 const & matrix) const
+{
+  if(!isValid())
+  {
+    return kit::AABB();
+  }
+
+  // Transform the center, and project the extents onto the new axes
+  glm::vec3 center = glm::vec3(matrix * glm::vec4((m_min + m_max) * 0.5f, 1.0f));
+  glm::vec3 extents = (m_max - m_min) * 0.5f;
+  glm::mat3 absolute = glm::mat3(matrix);
+  for(int i = 0; i < 3; i++)
+  {
+    absolute[i] = glm::abs(absolute[i]);
+  }
+
+  glm::vec3 newExtents = absolute * extents;
+  return kit::AABB(center - newExtents, center + newExtents);
+}
+
+kit::CullVolume::CullVolume()
+{
+  for(auto & plane : m_planes)
+  {
+    plane = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+  }
+}
+
+kit::CullVolume::CullVolume(glm::mat4 const & m)
+{
+  // Gribb/Hartmann plane extraction, from the rows of the matrix
+  glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+  glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+  glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+  glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+  m_planes[0] = row3 + row0; // Left
+  m_planes[1] = row3 - row0; // Right
+  m_planes[2] = row3 + row1; // Bottom
+  m_planes[3] = row3 - row1; // Top
+  m_planes[4] = row3 + row2; // Near
+  m_planes[5] = row3 - row2; // Far
+}
+
+bool kit::CullVolume::intersects(kit::AABB const & box) const
+{
+  if(!box.isValid())
+  {
+    return false;
+  }
+
+  for(auto & plane : m_planes)
+  {
+    // The corner furthest along the plane normal
+    glm::vec3 positive(plane.x >= 0.0f ? box.m_max.x : box.m_min.x, plane.y >= 0.0f ? box.m_max.y : box.m_min.y, plane.z >= 0.0f ? box.m_max.z : box.m_min.z);
+    if(glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+    {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 glm::vec4 kit::srgbEnc(glm::vec4 color)
 {
   glm::vec3 invec = glm::vec3(color.x, color.y, color.z);
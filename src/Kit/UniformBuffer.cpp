@@ -0,0 +1,128 @@
+#include "Kit/UniformBuffer.hpp"
+
+#include "Kit/IncOpenGL.hpp"
+#include "Kit/Exception.hpp"
+
+const uint32_t kit::UniformBuffer::FrameBinding;
+const uint32_t kit::UniformBuffer::MaterialBinding;
+const uint32_t kit::UniformBuffer::DrawBinding;
+
+kit::UniformBuffer::UniformBuffer(size_t size)
+{
+  m_size = size;
+
+#ifndef KIT_SHITTY_INTEL
+  glCreateBuffers(1, &m_glHandle);
+  glNamedBufferData(m_glHandle, m_size, nullptr, GL_DYNAMIC_DRAW);
+#else
+  glGenBuffers(1, &m_glHandle);
+  glBindBuffer(GL_UNIFORM_BUFFER, m_glHandle);
+  glBufferData(GL_UNIFORM_BUFFER, m_size, nullptr, GL_DYNAMIC_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
+}
+
+kit::UniformBuffer::~UniformBuffer()
+{
+  glDeleteBuffers(1, &m_glHandle);
+}
+
+void kit::UniformBuffer::update(const void * data, size_t size, size_t offset)
+{
+  if (offset + size > m_size)
+  {
+    KIT_THROW("Uniform buffer update out of range");
+  }
+
+#ifndef KIT_SHITTY_INTEL
+  glNamedBufferSubData(m_glHandle, offset, size, data);
+#else
+  glBindBuffer(GL_UNIFORM_BUFFER, m_glHandle);
+  glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
+}
+
+void kit::UniformBuffer::bind(uint32_t binding)
+{
+  glBindBufferBase(GL_UNIFORM_BUFFER, binding, m_glHandle);
+}
+
+uint32_t kit::UniformBuffer::getHandle()
+{
+  return m_glHandle;
+}
+
+size_t kit::UniformBuffer::getSize()
+{
+  return m_size;
+}
+
+uint32_t kit::UniformBuffer::getOffsetAlignment()
+{
+  static GLint alignment = 0;
+  if (alignment == 0)
+  {
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    if (alignment <= 0)
+    {
+      alignment = 256;
+    }
+  }
+
+  return uint32_t(alignment);
+}
+
+kit::UniformRing::UniformRing(size_t size)
+{
+  m_size = size;
+  m_alignment = kit::UniformBuffer::getOffsetAlignment();
+
+#ifndef KIT_SHITTY_INTEL
+  glCreateBuffers(1, &m_glHandle);
+  glNamedBufferData(m_glHandle, m_size, nullptr, GL_STREAM_DRAW);
+#else
+  glGenBuffers(1, &m_glHandle);
+  glBindBuffer(GL_UNIFORM_BUFFER, m_glHandle);
+  glBufferData(GL_UNIFORM_BUFFER, m_size, nullptr, GL_STREAM_DRAW);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
+}
+
+kit::UniformRing::~UniformRing()
+{
+  glDeleteBuffers(1, &m_glHandle);
+}
+
+void kit::UniformRing::push(uint32_t binding, const void * data, size_t size)
+{
+  if (size > m_size)
+  {
+    KIT_THROW("Uniform block larger than the ring");
+  }
+
+  if (m_offset + size > m_size)
+  {
+    // Respecifying the store orphans the old one, which the GPU keeps until it is done with it
+#ifndef KIT_SHITTY_INTEL
+    glNamedBufferData(m_glHandle, m_size, nullptr, GL_STREAM_DRAW);
+#else
+    glBindBuffer(GL_UNIFORM_BUFFER, m_glHandle);
+    glBufferData(GL_UNIFORM_BUFFER, m_size, nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
+    m_offset = 0;
+  }
+
+#ifndef KIT_SHITTY_INTEL
+  glNamedBufferSubData(m_glHandle, m_offset, size, data);
+#else
+  glBindBuffer(GL_UNIFORM_BUFFER, m_glHandle);
+  glBufferSubData(GL_UNIFORM_BUFFER, m_offset, size, data);
+  glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
+
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, m_glHandle, m_offset, size);
+
+  m_offset += ((size + m_alignment - 1) / m_alignment) * m_alignment;
+}
@@ -1,6 +1,7 @@
 #include "Kit/Water.hpp"
 
 #include "Kit/IncOpenGL.hpp"
+#include "Kit/GLState.hpp"
 #include "Kit/Camera.hpp"
 #include "Kit/Renderer.hpp"
 #include "Kit/Program.hpp"
@@ -56,9 +57,9 @@ kit::Water::Water()
   // Lets also create a shader program  and load some textures we need
   m_program = new kit::Program({ "water.vert" }, {"water.frag" });
   m_belowProgram = new kit::Program({ "waterbelow.vert" }, {"waterbelow.frag" });
-  m_heightmapA = kit::Texture::load("waterheight.tga", false);
+  m_heightmapA = kit::Texture::load("waterheight.tga", false, kit::Texture::Channels::One);
   m_normalmapA = kit::Texture::load("waternormal.tga", false);
-  m_heightmapB = kit::Texture::load("waterheight2.tga", false);
+  m_heightmapB = kit::Texture::load("waterheight2.tga", false, kit::Texture::Channels::One);
   m_normalmapB = kit::Texture::load("waternormal2.tga", false);
   
   m_underwaterProgram =new kit::Program({ "underwater.vert" }, {"underwater.frag" });
@@ -82,13 +83,13 @@ void kit::Water::renderForward(kit::Renderer* renderer)
 {
 
   // Set OpenGL states
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+  kit::GLState::setBlend(true);
+  kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
   //glBlendFunc(GL_ONE, GL_ONE);
-  glEnable(GL_CULL_FACE);
-  glCullFace(GL_FRONT);
-  glEnable(GL_DEPTH_TEST);
-  glDepthMask(GL_TRUE);
+  kit::GLState::setCulling(true);
+  kit::GLState::setCullFace(GL_FRONT);
+  kit::GLState::setDepthTest(true);
+  kit::GLState::setDepthWrite(true);
 
 
   
@@ -115,12 +116,12 @@ void kit::Water::renderForward(kit::Renderer* renderer)
     // Render surface from below
     {
       // Set OpenGL states
-      glCullFace(GL_BACK);
-      glEnable(GL_BLEND);
-      glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-      glEnable(GL_CULL_FACE);
-      glEnable(GL_DEPTH_TEST);
-      glDepthMask(GL_TRUE);
+      kit::GLState::setCullFace(GL_BACK);
+      kit::GLState::setBlend(true);
+      kit::GLState::setBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+      kit::GLState::setCulling(true);
+      kit::GLState::setDepthTest(true);
+      kit::GLState::setDepthWrite(true);
 
       //glStencilFunc(GL_ALWAYS, 1, 0xFF); // Set any stencil to 1
       //glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
@@ -136,6 +137,8 @@ void kit::Water::renderForward(kit::Renderer* renderer)
 
       m_belowProgram->setUniformTexture("uniform_normalmapA", m_normalmapA.get());
       m_belowProgram->setUniformTexture("uniform_normalmapB", m_normalmapB.get());
+      m_belowProgram->setUniform1i("uniform_reconstructA", m_normalmapA->getInternalFormat() == kit::Texture::BC5RG ? 1 : 0);
+      m_belowProgram->setUniform1i("uniform_reconstructB", m_normalmapB->getInternalFormat() == kit::Texture::BC5RG ? 1 : 0);
       //m_belowProgram->setUniformTexture("uniform_heightmapA", m_heightmapA.get());
       //m_belowProgram->setUniformTexture("uniform_heightmapB", m_heightmapB.get());
 
@@ -153,16 +156,18 @@ void kit::Water::renderForward(kit::Renderer* renderer)
       renderer->updateAccumulationCopy();
       renderer->updatePositionBuffer();
       
-      glDisable(GL_BLEND);
-      glEnable(GL_CULL_FACE);
-      glCullFace(GL_BACK);
-      glDisable(GL_DEPTH_TEST);
-      glDepthMask(GL_FALSE);
+      kit::GLState::setBlend(false);
+      kit::GLState::setCulling(true);
+      kit::GLState::setCullFace(GL_BACK);
+      kit::GLState::setDepthTest(false);
+      kit::GLState::setDepthWrite(false);
       //glStencilFunc(GL_EQUAL, 1, 0xFF); // Pass test if stencil value is 1
       //glStencilMask(0x00); // Don't write anything to stencil buffer
       
       m_underwaterProgram->setUniformTexture("uniform_normalmapA", m_normalmapA.get());
       m_underwaterProgram->setUniformTexture("uniform_normalmapB", m_normalmapB.get());
+      m_underwaterProgram->setUniform1i("uniform_reconstructA", m_normalmapA->getInternalFormat() == kit::Texture::BC5RG ? 1 : 0);
+      m_underwaterProgram->setUniform1i("uniform_reconstructB", m_normalmapB->getInternalFormat() == kit::Texture::BC5RG ? 1 : 0);
       m_underwaterProgram->setUniformTexture("uniform_colormap", renderer->getAccumulationCopy()->getColorAttachment(0));
       m_underwaterProgram->setUniformTexture("uniform_positionmap", renderer->getPositionBuffer()->getColorAttachment(0));
       m_underwaterProgram->setUniformMat4("uniform_invViewMatrix", invViewMatrix);
@@ -190,6 +195,8 @@ void kit::Water::renderForward(kit::Renderer* renderer)
     
     m_program->setUniformTexture("uniform_normalmapA", m_normalmapA.get());
     m_program->setUniformTexture("uniform_normalmapB", m_normalmapB.get());
+    m_program->setUniform1i("uniform_reconstructA", m_normalmapA->getInternalFormat() == kit::Texture::BC5RG ? 1 : 0);
+    m_program->setUniform1i("uniform_reconstructB", m_normalmapB->getInternalFormat() == kit::Texture::BC5RG ? 1 : 0);
     m_program->setUniformTexture("uniform_reflection", renderer->getReflectionMap());
     //m_program->setUniformTexture("uniform_heightmapA", m_heightmapA.get());
     //m_program->setUniformTexture("uniform_heightmapB", m_heightmapB.get());
@@ -29,6 +29,7 @@ kit::Window::Args::Args()
   fullscreenMonitor = nullptr;
   resolution = glm::uvec2(0, 0);
   resizable = false;
+  visible = true;
   title = "New window";
 }
 
@@ -94,6 +95,11 @@ kit::Window::Window(kit::Window::Args const & windowArgs)
 #endif 
   kit::Window::prepareGLFWHints(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
 
+  if(!windowArgs.visible)
+  {
+    kit::Window::prepareGLFWHints(GLFW_VISIBLE, GL_FALSE);
+  }
+
   // Set window-specific hints and create window according to our window-arguments
   switch(windowArgs.mode)
   {